@@ -0,0 +1,409 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   dgr-bench measures how well DGR keeps slaves up to date as the
+   number of slaves and the amount of data grows. It starts one master
+   process and N slave processes on the loopback interface. If there
+   is more than one slave, dgr-relay (which must be in the same
+   directory as dgr-bench) is started to forward packets to each slave
+   just like in the IVS.
+
+   The master sends a configurable number of records of a configurable
+   size at a fixed rate. Each slave measures the end-to-end latency of
+   every frame it applies and how many frames it never saw. When the
+   run is finished, the latency percentiles, frame loss, and CPU time
+   of each process are printed. No display or OpenGL context is
+   needed.
+
+   The -l option makes each slave ignore a percentage of the packets
+   it receives (DGR_DROP_PERCENT) to simulate a lossy network. Use it
+   with -k (DGR_FEC) and/or -d (DGR_DUPLICATE) to see how many frames
+   are recovered and how much extra data the master sends.
+
+   @author Scott Kuhl
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "kuhl-nodep.h"
+#include "dgr.h"
+#include "msg.h"
+
+/** Information that the master sends to slaves each frame in addition
+ * to the payload. */
+typedef struct {
+	int seq;      /**< Frame number, starting at 0 */
+	int done;     /**< Set to 1 when the master is finished */
+	long sent_us; /**< Time the master sent this frame (kuhl_microseconds()) */
+} bench_stamp;
+
+/** Results that each slave sends back to the parent process. */
+typedef struct {
+	int applied;   /**< Number of frames the slave saw */
+	int maxSeq;    /**< Highest frame number the slave saw */
+	int corrupt;   /**< Number of frames where the payload didn't match the frame number */
+	long lat[6];   /**< min, p50, p95, p99, p99.9, max latency in microseconds */
+	dgr_stats stats; /**< Statistics from DGR */
+} bench_result;
+
+static int numSlaves = 1;
+static int numRecords = 10;
+static int recordSize = 64;
+static int rate = 60;
+static int seconds = 10;
+static int port = 5800;
+static int useSetget = 0;
+static char *dropPercent = NULL;
+static char *fecGroup = NULL;
+static char *duplicate = NULL;
+
+static bench_stamp stamp;
+static char *payload = NULL;
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n", prog);
+	printf("  -s slaves    Number of slave processes (default %d)\n", numSlaves);
+	printf("  -n records   Number of records sent each frame (default %d)\n", numRecords);
+	printf("  -b bytes     Size of each record in bytes (default %d)\n", recordSize);
+	printf("  -f rate      Frames sent per second (default %d)\n", rate);
+	printf("  -t seconds   Length of the test (default %d)\n", seconds);
+	printf("  -p port      First UDP port to use (default %d)\n", port);
+	printf("  -m mode      'register' to use dgr_register() or 'setget' to use dgr_setget() (default register)\n");
+	printf("  -l percent   Percent of packets each slave ignores to simulate loss (default 0)\n");
+	printf("  -k group     Send a parity fragment every 'group' fragments (default 0, off)\n");
+	printf("  -d copies    Send small frames this many extra times (default 0)\n");
+}
+
+static int compare_long(const void *a, const void *b)
+{
+	long x = *(const long*)a;
+	long y = *(const long*)b;
+	return (x > y) - (x < y);
+}
+
+/** Registers the stamp and all of the payload records with DGR. Both
+ * the master and the slaves must do this in the same order. */
+static void bench_register()
+{
+	if(useSetget)
+		return;
+	dgr_register("!!bench", &stamp, sizeof(bench_stamp));
+	char name[64];
+	for(int i=0; i<numRecords; i++)
+	{
+		snprintf(name, 64, "rec%d", i);
+		dgr_register(name, payload+i*recordSize, recordSize);
+	}
+}
+
+/** Calls dgr_setget() on the stamp and all of the payload records when
+ * we are not using dgr_register(). */
+static void bench_setget()
+{
+	if(!useSetget)
+		return;
+	dgr_setget("!!bench", &stamp, sizeof(bench_stamp));
+	char name[64];
+	for(int i=0; i<numRecords; i++)
+	{
+		snprintf(name, 64, "rec%d", i);
+		dgr_setget(name, payload+i*recordSize, recordSize);
+	}
+}
+
+static void run_master(int totalFrames)
+{
+	char portStr[32];
+	snprintf(portStr, 32, "%d", port);
+	setenv("DGR_MODE", "master", 1);
+	setenv("DGR_MASTER_DEST_IP", "127.0.0.1", 1);
+	setenv("DGR_MASTER_DEST_PORT", portStr, 1);
+	if(fecGroup)
+		setenv("DGR_FEC", fecGroup, 1);
+	if(duplicate)
+		setenv("DGR_DUPLICATE", duplicate, 1);
+	dgr_init();
+	bench_register();
+
+	/* Give the slaves (and relay) a chance to bind their sockets. */
+	usleep(500000);
+
+	for(int i=0; i<totalFrames; i++)
+	{
+		/* Change the payload a little bit each frame */
+		for(int j=0; j<numRecords; j++)
+			payload[j*recordSize] = (char) i;
+		stamp.seq = i;
+		stamp.done = 0;
+		stamp.sent_us = kuhl_microseconds();
+		bench_setget();
+		dgr_update();
+		kuhl_limitfps(rate);
+	}
+	/* Tell the slaves we are done. Send it several times in case
+	 * some of the packets are lost. */
+	for(int i=0; i<10; i++)
+	{
+		stamp.done = 1;
+		stamp.sent_us = kuhl_microseconds();
+		bench_setget();
+		dgr_update();
+		usleep(10000);
+	}
+}
+
+static void run_slave(int slaveNum, int writefd, int totalFrames)
+{
+	char portStr[32];
+	snprintf(portStr, 32, "%d", numSlaves > 1 ? port+1+slaveNum : port);
+	setenv("DGR_MODE", "slave", 1);
+	setenv("DGR_SLAVE_LISTEN_PORT", portStr, 1);
+	if(dropPercent)
+		setenv("DGR_DROP_PERCENT", dropPercent, 1);
+	dgr_init();
+	bench_register();
+
+	long *latency = malloc(sizeof(long)*(totalFrames+1));
+	int applied = 0;
+	int corrupt = 0;
+	int lastSeq = -1;
+	long giveUp = kuhl_microseconds() + (seconds+5)*1000000L;
+	while(kuhl_microseconds() < giveUp)
+	{
+		dgr_update();
+		bench_setget();
+		if(stamp.done)
+			break;
+		if(stamp.seq != lastSeq && stamp.sent_us != 0)
+		{
+			if(applied <= totalFrames)
+				latency[applied++] = kuhl_microseconds() - stamp.sent_us;
+			lastSeq = stamp.seq;
+			for(int j=0; j<numRecords; j++)
+				if(payload[j*recordSize] != (char) stamp.seq)
+				{
+					corrupt++;
+					break;
+				}
+		}
+		/* A real slave would be rendering here. Sleep briefly so we
+		 * measure DGR instead of a busy loop. */
+		usleep(100);
+	}
+
+	bench_result result;
+	memset(&result, 0, sizeof(result));
+	result.applied = applied;
+	result.maxSeq = lastSeq;
+	result.corrupt = corrupt;
+	if(applied > 0)
+	{
+		qsort(latency, applied, sizeof(long), compare_long);
+		double pct[6] = { 0, .5, .95, .99, .999, 1 };
+		for(int i=0; i<6; i++)
+			result.lat[i] = latency[(int)(pct[i]*(applied-1))];
+	}
+	free(latency);
+	dgr_get_stats(&result.stats);
+	if(write(writefd, &result, sizeof(result)) != sizeof(result))
+		msg(ERROR, "Slave %d: Unable to send results to the parent process.\n", slaveNum);
+	close(writefd);
+}
+
+static double cpu_seconds(const struct rusage *r)
+{
+	return r->ru_utime.tv_sec + r->ru_utime.tv_usec/1000000.0 +
+		r->ru_stime.tv_sec + r->ru_stime.tv_usec/1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while((opt = getopt(argc, argv, "s:n:b:f:t:p:m:l:k:d:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 's': numSlaves = atoi(optarg); break;
+			case 'n': numRecords = atoi(optarg); break;
+			case 'b': recordSize = atoi(optarg); break;
+			case 'f': rate = atoi(optarg); break;
+			case 't': seconds = atoi(optarg); break;
+			case 'p': port = atoi(optarg); break;
+			case 'l': dropPercent = optarg; break;
+			case 'k': fecGroup = optarg; break;
+			case 'd': duplicate = optarg; break;
+			case 'm':
+				if(strcmp(optarg, "setget") == 0)
+					useSetget = 1;
+				else if(strcmp(optarg, "register") == 0)
+					useSetget = 0;
+				else
+				{
+					usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if(numSlaves < 1 || numRecords < 1 || recordSize < 1 || rate < 1 || seconds < 1)
+	{
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Estimate the size of each packet. Names are "recN" for
+	 * dgr_setget() records. */
+	int packetSize = numRecords*recordSize + sizeof(bench_stamp) + 12;
+	if(useSetget)
+		packetSize += numRecords*(sizeof(int)+10) + 8+sizeof(int);
+	if(packetSize > 65000 && (fecGroup == NULL || atoi(fecGroup) == 0))
+	{
+		msg(FATAL, "Each packet would be about %d bytes which is more than can fit in a single UDP packet.\n", packetSize);
+		exit(EXIT_FAILURE);
+	}
+
+	int totalFrames = rate*seconds;
+	payload = calloc(numRecords, recordSize);
+	printf("dgr-bench: %d slave(s), %d records x %d bytes (~%d byte packets), %d frames/sec for %d sec using %s\n",
+	       numSlaves, numRecords, recordSize, packetSize, rate, seconds, useSetget ? "dgr_setget()" : "dgr_register()");
+	fflush(stdout);
+
+	/* Start the relay if there is more than one slave. */
+	pid_t relay = -1;
+	if(numSlaves > 1)
+	{
+		char relayPath[1024];
+		char *progCopy = strdup(argv[0]);
+		snprintf(relayPath, 1024, "%s/dgr-relay", dirname(progCopy));
+		free(progCopy);
+		/* Check for the relay before starting it since the relay's
+		 * output is discarded. Otherwise, every slave would quietly
+		 * lose every frame. */
+		if(access(relayPath, X_OK) != 0)
+		{
+			msg(FATAL, "Unable to run %s. dgr-relay is needed when there is more than one slave.\n", relayPath);
+			exit(EXIT_FAILURE);
+		}
+
+		relay = fork();
+		if(relay == 0)
+		{
+			char **relayArgs = malloc(sizeof(char*)*(numSlaves+5));
+			char portStr[32];
+			snprintf(portStr, 32, "%d", port);
+			relayArgs[0] = relayPath;
+			relayArgs[1] = portStr;
+			relayArgs[2] = "127.0.0.1";
+			for(int i=0; i<numSlaves; i++)
+			{
+				relayArgs[3+i] = malloc(32);
+				snprintf(relayArgs[3+i], 32, "%d", port+1+i);
+			}
+			relayArgs[3+numSlaves] = NULL;
+			/* Keep the relay quiet so it doesn't clutter our results. */
+			if(freopen("/dev/null", "w", stdout) == NULL)
+				msg(WARNING, "Unable to silence dgr-relay.\n");
+			execv(relayPath, relayArgs);
+			/* stdout was discarded, so report the error on stderr. */
+			fprintf(stderr, "dgr-bench: Unable to run %s. dgr-relay is needed when there is more than one slave.\n", relayPath);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Start the slaves */
+	pid_t *slaves = malloc(sizeof(pid_t)*numSlaves);
+	int *pipes = malloc(sizeof(int)*numSlaves);
+	for(int i=0; i<numSlaves; i++)
+	{
+		int fd[2];
+		if(pipe(fd) != 0)
+		{
+			msg(FATAL, "pipe() failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		slaves[i] = fork();
+		if(slaves[i] == 0)
+		{
+			close(fd[0]);
+			run_slave(i, fd[1], totalFrames);
+			exit(EXIT_SUCCESS);
+		}
+		close(fd[1]);
+		pipes[i] = fd[0];
+	}
+
+	long startTime = kuhl_microseconds();
+	run_master(totalFrames);
+	double wall = (kuhl_microseconds() - startTime)/1000000.0;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	dgr_stats masterStats;
+	dgr_get_stats(&masterStats);
+
+	printf("\n%-8s %8s %7s %8s %8s %8s %8s %8s %8s %6s %8s %8s\n", "process", "frames", "loss%",
+	       "min_us", "p50_us", "p95_us", "p99_us", "p999_us", "max_us", "cpu%", "dropped", "rebuilt");
+	printf("%-8s %8d %7s %8s %8s %8s %8s %8s %8s %6.1f %8s %8s\n", "master", totalFrames, "-",
+	       "-", "-", "-", "-", "-", "-", 100*cpu_seconds(&usage)/wall, "-", "-");
+
+	for(int i=0; i<numSlaves; i++)
+	{
+		bench_result result;
+		memset(&result, 0, sizeof(result));
+		if(read(pipes[i], &result, sizeof(result)) != sizeof(result))
+			msg(ERROR, "Didn't receive results from slave %d.\n", i);
+		close(pipes[i]);
+		struct rusage slaveUsage;
+		memset(&slaveUsage, 0, sizeof(slaveUsage));
+		wait4(slaves[i], NULL, 0, &slaveUsage);
+
+		char name[32];
+		snprintf(name, 32, "slave%d", i);
+		printf("%-8s %8d %7.2f %8ld %8ld %8ld %8ld %8ld %8ld %6.1f %8ld %8ld\n", name, result.applied,
+		       100.0*(totalFrames-result.applied)/totalFrames,
+		       result.lat[0], result.lat[1], result.lat[2], result.lat[3], result.lat[4], result.lat[5],
+		       100*cpu_seconds(&slaveUsage)/wall,
+		       result.stats.packetsDropped, result.stats.fragmentsRecovered);
+		if(result.corrupt > 0)
+			msg(ERROR, "%s received %d frames with payloads that didn't match the frame number.\n", name, result.corrupt);
+	}
+
+	if(relay > 0)
+	{
+		kill(relay, SIGTERM);
+		struct rusage relayUsage;
+		memset(&relayUsage, 0, sizeof(relayUsage));
+		wait4(relay, NULL, 0, &relayUsage);
+		printf("%-8s %8s %7s %8s %8s %8s %8s %8s %8s %6.1f %8s %8s\n", "relay", "-", "-",
+		       "-", "-", "-", "-", "-", "-", 100*cpu_seconds(&relayUsage)/wall, "-", "-");
+	}
+
+	if(masterStats.frameBytes > 0)
+		printf("\nMaster sent %ld packets, %ld bytes for %ld bytes of frame data (%.1f%% overhead from headers, duplicates and parity).\n",
+		       masterStats.packetsSent, masterStats.bytesSent, masterStats.frameBytes,
+		       100.0*(masterStats.bytesSent-masterStats.frameBytes)/masterStats.frameBytes);
+
+	printf("loss%% counts frames a slave never applied, either because the packet was lost or because a newer packet arrived first.\n");
+	printf("dropped counts packets ignored because of -l; rebuilt counts fragments rebuilt from parity.\n");
+	free(slaves);
+	free(pipes);
+	free(payload);
+	return 0;
+}
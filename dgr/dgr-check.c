@@ -0,0 +1,240 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   dgr-check makes sure that a DGR slave handles fragmented frames
+   (see DGR_FEC) whose headers change from one frame to the next, such
+   as when a master is restarted with a different DGR_FEC setting. It
+   runs a slave and sends it hand-made fragments over the loopback
+   interface:
+
+   - A frame split into 8 fragments with one parity fragment for every
+     4 fragments.
+
+   - A frame that goes into the same slot on the slave with one parity
+     fragment for every fragment. One data fragment is left out so the
+     slave has to rebuild it from the last parity fragment, which only
+     fits if the slave made its parity buffer bigger.
+
+   - A frame whose group size is larger than the number of fragments.
+     The slave must ignore it.
+
+   The program exits with EXIT_SUCCESS if the slave applied the right
+   frames. Building it with -fsanitize=address also catches writes
+   past the end of the slave's buffers. No display or OpenGL context
+   is needed.
+
+   @author Scott Kuhl
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "dgr.h"
+#include "msg.h"
+
+/* The packet formats below must match the ones in dgr.c. */
+#define CHECK_MAGIC 0x44475231      /**< DGR_MAGIC in dgr.c */
+#define CHECK_FRAG_MAGIC 0x44475246 /**< DGR_FRAG_MAGIC in dgr.c */
+#define CHECK_SCHEMA 2166136261u    /**< Schema of a slave that hasn't called dgr_register() */
+
+/** dgr_header in dgr.c */
+typedef struct {
+	unsigned int magic;
+	unsigned int schema;
+	int blockSize;
+} check_header;
+
+/** dgr_fragment_header in dgr.c */
+typedef struct {
+	unsigned int magic;
+	unsigned int frame;
+	unsigned short index;
+	unsigned short count;
+	unsigned short group;
+	unsigned short parity;
+	int fragSize;
+	int frameSize;
+} check_fragment_header;
+
+/** Fragment size used for every frame. 8 fragments hold a frame. */
+#define CHECK_FRAG_SIZE 64
+/** Size of the record that is sent in each frame */
+#define CHECK_RECORD_SIZE (CHECK_FRAG_SIZE*8 - (int)sizeof(check_header) - 6 - (int)sizeof(int))
+
+static int port = 5900;
+static int sock = -1;
+static struct sockaddr_in dest;
+
+/** Creates a frame containing a single record named "check" where
+ * every byte is 'value'.
+ *
+ * @return The size of the frame.
+ */
+static int check_frame(char *buf, char value)
+{
+	check_header header;
+	header.magic = CHECK_MAGIC;
+	header.schema = CHECK_SCHEMA;
+	header.blockSize = 0;
+	memcpy(buf, &header, sizeof(header));
+	char *ptr = buf + sizeof(header);
+	strcpy(ptr, "check");
+	ptr += 6;
+	int size = CHECK_RECORD_SIZE;
+	memcpy(ptr, &size, sizeof(int));
+	ptr += sizeof(int);
+	memset(ptr, value, size);
+	ptr += size;
+	return (int) (ptr - buf);
+}
+
+static void check_send(const check_fragment_header *header, const char *data, int len)
+{
+	char packet[sizeof(check_fragment_header) + CHECK_FRAG_SIZE];
+	memcpy(packet, header, sizeof(check_fragment_header));
+	memcpy(packet + sizeof(check_fragment_header), data, len);
+	if(sendto(sock, packet, sizeof(check_fragment_header)+len, 0,
+	          (struct sockaddr*) &dest, sizeof(dest)) == -1)
+	{
+		perror("sendto");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Sends a frame in fragments with a parity fragment after every
+ * 'group' fragments, the same way a master does.
+ *
+ * @param skip A data fragment to leave out, or -1 to send all of them.
+ */
+static void check_send_frame(unsigned int frame, char value, int group, int skip)
+{
+	char buf[CHECK_FRAG_SIZE*8];
+	int size = check_frame(buf, value);
+	int count = (size + CHECK_FRAG_SIZE - 1) / CHECK_FRAG_SIZE;
+
+	check_fragment_header header;
+	header.magic = CHECK_FRAG_MAGIC;
+	header.frame = frame;
+	header.count = count;
+	header.group = group;
+	header.fragSize = CHECK_FRAG_SIZE;
+	header.frameSize = size;
+
+	char parity[CHECK_FRAG_SIZE];
+	for(int i=0; i<count; i++)
+	{
+		int len = i == count-1 ? size - i*CHECK_FRAG_SIZE : CHECK_FRAG_SIZE;
+		const char *data = buf + i*CHECK_FRAG_SIZE;
+		header.index = i;
+		header.parity = 0;
+		if(i != skip)
+			check_send(&header, data, len);
+
+		if(group == 0)
+			continue;
+		if(i % group == 0)
+			memset(parity, 0, CHECK_FRAG_SIZE);
+		for(int j=0; j<len; j++)
+			parity[j] ^= data[j];
+		if(i % group == group-1 || i == count-1)
+		{
+			header.index = i / group;
+			header.parity = 1;
+			check_send(&header, parity, CHECK_FRAG_SIZE);
+		}
+	}
+}
+
+/** Receives whatever was sent to the slave and makes sure that the
+ * record is filled with 'value'.
+ *
+ * @return 1 if the record is correct, 0 otherwise.
+ */
+static int check_receive(const char *what, char value)
+{
+	/* Give the packets time to arrive. */
+	usleep(100000);
+	dgr_update();
+	char record[CHECK_RECORD_SIZE];
+	memset(record, 0, CHECK_RECORD_SIZE);
+	dgr_setget("check", record, CHECK_RECORD_SIZE);
+	for(int i=0; i<CHECK_RECORD_SIZE; i++)
+		if(record[i] != value)
+		{
+			printf("dgr-check: FAILED: %s\n", what);
+			return 0;
+		}
+	printf("dgr-check: ok: %s\n", what);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while((opt = getopt(argc, argv, "p:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'p': port = atoi(optarg); break;
+			default:
+				printf("Usage: %s [-p port]\n", argv[0]);
+				printf("  -p port      UDP port that the slave listens on (default %d)\n", port);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	char portStr[32];
+	snprintf(portStr, 32, "%d", port);
+	setenv("DGR_MODE", "slave", 1);
+	setenv("DGR_SLAVE_LISTEN_PORT", portStr, 1);
+	dgr_init();
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sock == -1)
+	{
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	memset(&dest, 0, sizeof(dest));
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons(port);
+	dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int passed = 1;
+	check_send_frame(1, 1, 4, -1);
+	passed &= check_receive("frame with one parity fragment for every 4 fragments", 1);
+
+	check_send_frame(2, 2, 1, 7);
+	passed &= check_receive("frame with one parity fragment for every fragment", 2);
+	dgr_stats stats;
+	dgr_get_stats(&stats);
+	if(stats.fragmentsRecovered != 1)
+	{
+		printf("dgr-check: FAILED: rebuilt %ld fragments from parity fragments instead of 1\n", stats.fragmentsRecovered);
+		passed = 0;
+	}
+
+	printf("dgr-check: The slave should print an error about an invalid header next.\n");
+	fflush(stdout);
+	check_send_frame(3, 3, 9, -1);
+	passed &= check_receive("frame with more fragments per group than fragments is ignored", 2);
+
+	close(sock);
+	if(!passed)
+	{
+		msg(ERROR, "dgr-check failed.\n");
+		return EXIT_FAILURE;
+	}
+	printf("dgr-check: passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,714 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bvh.h"
+#include "vecmat.h"
+#include "msg.h"
+
+/** Number of bins that the centers of the items are sorted into along each axis. */
+#define BVH_BINS 16
+/** Leaves with more items than this are split whenever the items can be split. */
+#define BVH_MAX_LEAF_ITEMS 4
+/** The deepest a leaf can be. Queries keep a stack of nodes this deep. */
+#define BVH_MAX_DEPTH 64
+/** Subtrees with at least this many items may be built on a thread of their own. */
+#define BVH_PARALLEL_ITEMS 16384
+
+/** Threads used to build a tree, 0 for one per processor. See bvh_build_threads(). */
+static int bvh_threads = 0;
+
+/** State shared by the threads that build one tree. */
+typedef struct {
+	bvh *tree;
+	const float *itemBounds; /**< Bounding box of each item, 6 floats per item */
+	const float *centers;    /**< Center of each bounding box, 3 floats per item */
+	unsigned int nodeCount;  /**< The next unused node, changed atomically */
+	int threadsLeft;         /**< Threads that may still be started, changed atomically */
+} bvh_builder;
+
+/** A subtree for a thread to build. */
+typedef struct {
+	bvh_builder *builder;
+	unsigned int node, first, count, depth;
+	float bounds[6], centerBounds[6];
+} bvh_task;
+
+/** Allocates memory or exits. */
+static void* bvh_malloc(size_t size)
+{
+	void *ptr = malloc(size > 0 ? size : 1);
+	if(ptr == NULL)
+	{
+		msg(FATAL, "Unable to allocate %zu bytes for a bounding volume hierarchy.\n", size);
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+/** Makes a box that contains nothing, so that growing it by any
+ * other box results in that box. */
+static void bvh_box_empty(float box[6])
+{
+	for(int i=0; i<3; i++)
+	{
+		box[i*2]   = FLT_MAX;
+		box[i*2+1] = -FLT_MAX;
+	}
+}
+
+/** Grows a box to contain another box. Comparisons are used instead
+ * of fminf() and fmaxf(), which the compiler may not inline. */
+static void bvh_box_grow(float box[6], const float other[6])
+{
+	for(int i=0; i<3; i++)
+	{
+		box[i*2]   = other[i*2]   < box[i*2]   ? other[i*2]   : box[i*2];
+		box[i*2+1] = other[i*2+1] > box[i*2+1] ? other[i*2+1] : box[i*2+1];
+	}
+}
+
+/** Returns half of the surface area of a box. */
+static float bvh_box_area(const float box[6])
+{
+	if(box[0] > box[1])
+		return 0;
+	float dx = box[1]-box[0], dy = box[3]-box[2], dz = box[5]-box[4];
+	return dx*dy + dy*dz + dz*dx;
+}
+
+/** Returns the vertex number of one of the corners of a triangle. */
+static unsigned int bvh_vertex(const bvh *tree, unsigned int triangle, unsigned int corner)
+{
+	return tree->indices ? tree->indices[triangle*3+corner] : triangle*3+corner;
+}
+
+/** Calculates the bounding box of an item in a tree. */
+static void bvh_item_bounds(const bvh *tree, unsigned int item, float box[6])
+{
+	if(tree->boxes)
+	{
+		memcpy(box, tree->boxes+item*6, sizeof(float)*6);
+		return;
+	}
+	bvh_box_empty(box);
+	for(unsigned int corner=0; corner<3; corner++)
+	{
+		const float *p = tree->positions + bvh_vertex(tree, item, corner)*3;
+		for(int i=0; i<3; i++)
+		{
+			box[i*2]   = p[i] < box[i*2]   ? p[i] : box[i*2];
+			box[i*2+1] = p[i] > box[i*2+1] ? p[i] : box[i*2+1];
+		}
+	}
+}
+
+/** Returns the bin that a center is sorted into. The same
+ * calculation must be used when counting the items in each bin and
+ * when the items are split. */
+static int bvh_bin(float center, float low, float scale)
+{
+	int bin = (int) ((center - low) * scale);
+	return bin < BVH_BINS ? bin : BVH_BINS-1;
+}
+
+/** Claims one of the threads that a builder may start. Returns 0 if
+ * they are all in use. */
+static int bvh_claim_thread(bvh_builder *b)
+{
+	if(__atomic_sub_fetch(&(b->threadsLeft), 1, __ATOMIC_RELAXED) >= 0)
+		return 1;
+	__atomic_add_fetch(&(b->threadsLeft), 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void bvh_build_node(bvh_builder *b, unsigned int nodeIndex, unsigned int first, unsigned int count,
+                           unsigned int depth, const float bounds[6], const float centerBounds[6]);
+
+static void* bvh_build_thread(void *data)
+{
+	bvh_task *task = (bvh_task*) data;
+	bvh_build_node(task->builder, task->node, task->first, task->count, task->depth,
+	               task->bounds, task->centerBounds);
+	return NULL;
+}
+
+/** Builds the subtree for items tree->items[first] through
+ * tree->items[first+count-1], whose root is nodes[nodeIndex].
+ * bounds is the bounding box of the items and centerBounds is the
+ * bounding box of their centers. */
+static void bvh_build_node(bvh_builder *b, unsigned int nodeIndex, unsigned int first, unsigned int count,
+                           unsigned int depth, const float bounds[6], const float centerBounds[6])
+{
+	bvh *tree = b->tree;
+	bvh_node *node = &(tree->nodes[nodeIndex]);
+	unsigned int *items = tree->items + first;
+
+	memcpy(node->bounds, bounds, sizeof(float)*6);
+	node->first = first;
+	node->count = count;
+	if(count <= 1 || depth >= BVH_MAX_DEPTH-1)
+		return;
+
+	/* Sort the items into bins along all three axes at once. */
+	float low[3], scale[3];
+	for(int axis=0; axis<3; axis++)
+	{
+		low[axis] = centerBounds[axis*2];
+		float extent = centerBounds[axis*2+1] - low[axis];
+		scale[axis] = extent > 0 ? BVH_BINS / extent : 0;
+	}
+	unsigned int binCount[3][BVH_BINS];
+	float binBounds[3][BVH_BINS][6];
+	for(int axis=0; axis<3; axis++)
+	{
+		for(int k=0; k<BVH_BINS; k++)
+		{
+			binCount[axis][k] = 0;
+			bvh_box_empty(binBounds[axis][k]);
+		}
+	}
+	for(unsigned int i=0; i<count; i++)
+	{
+		const float *box = b->itemBounds + items[i]*6;
+		const float *center = b->centers + items[i]*3;
+		for(int axis=0; axis<3; axis++)
+		{
+			int k = bvh_bin(center[axis], low[axis], scale[axis]);
+			binCount[axis][k]++;
+			bvh_box_grow(binBounds[axis][k], box);
+		}
+	}
+
+	/* Try splitting between each pair of bins along each axis. The
+	 * cost of a split is the number of items on each side times the
+	 * surface area of that side, which is proportional to the chance
+	 * that a random ray that hits the node also hits that side. */
+	float bestCost = FLT_MAX;
+	int bestAxis = -1, bestSplit = 0;
+	for(int axis=0; axis<3; axis++)
+	{
+		if(scale[axis] == 0)
+			continue;
+
+		/* Sweep from the right to get the right side of every split,
+		 * then from the left to finish each one. */
+		float rightArea[BVH_BINS], box[6];
+		unsigned int rightCount[BVH_BINS], n = 0;
+		bvh_box_empty(box);
+		for(int k=BVH_BINS-1; k>0; k--)
+		{
+			bvh_box_grow(box, binBounds[axis][k]);
+			n += binCount[axis][k];
+			rightArea[k] = bvh_box_area(box);
+			rightCount[k] = n;
+		}
+		bvh_box_empty(box);
+		n = 0;
+		for(int k=0; k<BVH_BINS-1; k++) // split between bin k and k+1
+		{
+			bvh_box_grow(box, binBounds[axis][k]);
+			n += binCount[axis][k];
+			if(n == 0 || rightCount[k+1] == 0)
+				continue;
+			float cost = bvh_box_area(box)*n + rightArea[k+1]*rightCount[k+1];
+			if(cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = k+1;
+			}
+		}
+	}
+	if(bestAxis < 0) // every center is at the same place
+		return;
+
+	/* Small nodes stay leaves if testing all of their items is
+	 * cheaper than visiting two more nodes. */
+	float area = bvh_box_area(bounds);
+	if(count <= BVH_MAX_LEAF_ITEMS && (area <= 0 || 1 + bestCost/area >= count))
+		return;
+
+	/* Move the items on the left side of the split to the start and
+	 * find the bounds of the centers on each side. */
+	float leftCenters[6], rightCenters[6];
+	bvh_box_empty(leftCenters);
+	bvh_box_empty(rightCenters);
+	unsigned int leftCount = 0, end = count;
+	while(leftCount < end)
+	{
+		const float *c = b->centers + items[leftCount]*3;
+		float point[6] = { c[0], c[0], c[1], c[1], c[2], c[2] };
+		if(bvh_bin(c[bestAxis], low[bestAxis], scale[bestAxis]) < bestSplit)
+		{
+			bvh_box_grow(leftCenters, point);
+			leftCount++;
+		}
+		else
+		{
+			bvh_box_grow(rightCenters, point);
+			end--;
+			unsigned int tmp = items[leftCount];
+			items[leftCount] = items[end];
+			items[end] = tmp;
+		}
+	}
+	float leftBounds[6], rightBounds[6];
+	bvh_box_empty(leftBounds);
+	bvh_box_empty(rightBounds);
+	for(int k=0; k<BVH_BINS; k++)
+		bvh_box_grow(k < bestSplit ? leftBounds : rightBounds, binBounds[bestAxis][k]);
+
+	unsigned int left = __atomic_fetch_add(&(b->nodeCount), 2, __ATOMIC_RELAXED);
+	node->first = left;
+	node->count = 0;
+
+	/* Build large subtrees on the left on another thread while
+	 * this thread builds the right. */
+	if(count >= BVH_PARALLEL_ITEMS && bvh_claim_thread(b))
+	{
+		bvh_task task = { .builder = b, .node = left, .first = first, .count = leftCount, .depth = depth+1 };
+		memcpy(task.bounds, leftBounds, sizeof(float)*6);
+		memcpy(task.centerBounds, leftCenters, sizeof(float)*6);
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, bvh_build_thread, &task) == 0)
+		{
+			bvh_build_node(b, left+1, first+leftCount, count-leftCount, depth+1, rightBounds, rightCenters);
+			pthread_join(thread, NULL);
+			__atomic_add_fetch(&(b->threadsLeft), 1, __ATOMIC_RELAXED);
+			return;
+		}
+		__atomic_add_fetch(&(b->threadsLeft), 1, __ATOMIC_RELAXED);
+	}
+	bvh_build_node(b, left, first, leftCount, depth+1, leftBounds, leftCenters);
+	bvh_build_node(b, left+1, first+leftCount, count-leftCount, depth+1, rightBounds, rightCenters);
+}
+
+/** Builds a tree over the items that tree->indices, tree->positions
+ * or tree->boxes describe. */
+static void bvh_build(bvh *tree, unsigned int count)
+{
+	tree->item_count = count;
+	tree->node_count = 0;
+	tree->nodes = NULL;
+	tree->items = NULL;
+	if(count == 0)
+		return;
+
+	/* A tree with n leaves has n-1 inner nodes and each leaf has at
+	 * least one item. */
+	tree->nodes = bvh_malloc(sizeof(bvh_node)*(2*(size_t)count-1));
+	tree->items = bvh_malloc(sizeof(unsigned int)*count);
+	float *itemBounds = bvh_malloc(sizeof(float)*6*(size_t)count);
+	float *centers = bvh_malloc(sizeof(float)*3*(size_t)count);
+	float bounds[6], centerBounds[6];
+	bvh_box_empty(bounds);
+	bvh_box_empty(centerBounds);
+	for(unsigned int i=0; i<count; i++)
+	{
+		bvh_item_bounds(tree, i, itemBounds+i*6);
+		float point[6];
+		for(int j=0; j<3; j++)
+			centers[i*3+j] = point[j*2] = point[j*2+1] = (itemBounds[i*6+j*2] + itemBounds[i*6+j*2+1])/2;
+		bvh_box_grow(bounds, itemBounds+i*6);
+		bvh_box_grow(centerBounds, point);
+		tree->items[i] = i;
+	}
+
+	int threads = bvh_threads;
+	if(threads <= 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int) cpus : 1;
+	}
+	bvh_builder builder = { tree, itemBounds, centers, 1, threads-1 };
+	bvh_build_node(&builder, 0, 0, count, 0, bounds, centerBounds);
+	tree->node_count = builder.nodeCount;
+
+	free(itemBounds);
+	free(centers);
+}
+
+/** Builds a tree over the triangles of a mesh.
+
+    @param tree The tree to fill in. Free it with bvh_free().
+
+    @param indices 3 vertex numbers per triangle. If NULL, triangle t
+    uses vertices 3t, 3t+1 and 3t+2.
+
+    @param triangleCount The number of triangles.
+
+    @param positions 3 floats per vertex.
+*/
+void bvh_build_triangles(bvh *tree, const unsigned int *indices, unsigned int triangleCount, const float *positions)
+{
+	tree->indices = indices;
+	tree->positions = positions;
+	tree->boxes = NULL;
+	bvh_build(tree, triangleCount);
+}
+
+/** Builds a tree over a list of axis-aligned bounding boxes, such as
+    the world space bounding box of each copy of a model in a scene
+    (see kuhl_geometry_bbox()).
+
+    @param tree The tree to fill in. Free it with bvh_free().
+
+    @param boxes 6 floats per box (xmin,xmax,ymin,ymax,zmin,zmax).
+
+    @param count The number of boxes.
+*/
+void bvh_build_boxes(bvh *tree, const float *boxes, unsigned int count)
+{
+	tree->indices = NULL;
+	tree->positions = NULL;
+	tree->boxes = boxes;
+	bvh_build(tree, count);
+}
+
+/** Sets the number of threads that build each tree.
+
+    @param threads The number of threads, including the thread that
+    calls bvh_build_triangles() or bvh_build_boxes(). If 0 or less,
+    one thread per processor is used (the default).
+*/
+void bvh_build_threads(int threads)
+{
+	bvh_threads = threads;
+}
+
+/** Updates the boxes in a tree after the items that it was built
+    over move. The tree keeps its structure, so it gets slower to
+    search as the items move far from where they were when it was
+    built. The vertices or boxes are read from the same arrays that
+    the tree was built with.
+
+    @param tree The tree to update.
+*/
+void bvh_refit(bvh *tree)
+{
+	/* Children are always after their parents, so the nodes can be
+	 * updated from the last to the first. */
+	for(unsigned int n = tree->node_count; n-- > 0; )
+	{
+		bvh_node *node = &(tree->nodes[n]);
+		bvh_box_empty(node->bounds);
+		if(node->count > 0)
+		{
+			for(unsigned int i=0; i<node->count; i++)
+			{
+				float box[6];
+				bvh_item_bounds(tree, tree->items[node->first+i], box);
+				bvh_box_grow(node->bounds, box);
+			}
+		}
+		else
+		{
+			bvh_box_grow(node->bounds, tree->nodes[node->first].bounds);
+			bvh_box_grow(node->bounds, tree->nodes[node->first+1].bounds);
+		}
+	}
+}
+
+/** Frees the memory that a tree uses. The vertices, indices or boxes
+    that it was built from are not freed.
+
+    @param tree The tree to free.
+*/
+void bvh_free(bvh *tree)
+{
+	free(tree->nodes);
+	free(tree->items);
+	tree->nodes = NULL;
+	tree->items = NULL;
+	tree->node_count = 0;
+	tree->item_count = 0;
+}
+
+/** Returns how far along a ray it enters a box (0 if the ray starts
+ * in the box) or -1 if it misses the box or enters it after
+ * maxDistance. */
+static float bvh_ray_box(const float box[6], const float origin[3], const float invDir[3], float maxDistance)
+{
+	float tmin = 0, tmax = maxDistance;
+	for(int i=0; i<3; i++)
+	{
+		float t1 = (box[i*2]   - origin[i]) * invDir[i];
+		float t2 = (box[i*2+1] - origin[i]) * invDir[i];
+		tmin = fmaxf(tmin, fminf(t1, t2));
+		tmax = fminf(tmax, fmaxf(t1, t2));
+	}
+	return tmin <= tmax ? tmin : -1;
+}
+
+/** Intersects a ray with a triangle with the Moller-Trumbore
+ * algorithm. Both sides of the triangle can be hit. Returns 1 and
+ * fills in hit->distance, hit->u and hit->v if the ray hits the
+ * triangle before maxDistance. */
+static int bvh_ray_triangle(const float p0[3], const float p1[3], const float p2[3],
+                            const float origin[3], const float direction[3], float maxDistance, bvh_hit *hit)
+{
+	float edge1[3], edge2[3], pvec[3], tvec[3], qvec[3];
+	vec3f_sub_new(edge1, p1, p0);
+	vec3f_sub_new(edge2, p2, p0);
+	vec3f_cross_new(pvec, direction, edge2);
+	float det = vec3f_dot(edge1, pvec);
+	if(det == 0) // the ray is parallel to the triangle
+		return 0;
+	float invDet = 1/det;
+
+	vec3f_sub_new(tvec, origin, p0);
+	float u = vec3f_dot(tvec, pvec) * invDet;
+	if(u < 0 || u > 1)
+		return 0;
+	vec3f_cross_new(qvec, tvec, edge1);
+	float v = vec3f_dot(direction, qvec) * invDet;
+	if(v < 0 || u+v > 1)
+		return 0;
+	float t = vec3f_dot(edge2, qvec) * invDet;
+	if(t < 0 || t >= maxDistance)
+		return 0;
+
+	hit->distance = t;
+	hit->u = u;
+	hit->v = v;
+	return 1;
+}
+
+/** Finds the closest item in a tree that a ray hits. In a tree of
+    triangles, the triangles can be hit from either side. In a tree of
+    boxes, the distance is where the ray enters the box (0 if it
+    starts inside of it); to find the triangle that the ray hits in a
+    scene, cast the ray against a triangle tree for each copy of a
+    model whose box it hits.
+
+    @param tree The tree.
+    @param origin Where the ray starts.
+    @param direction The direction of the ray. It doesn't need to be normalized.
+    @param maxDistance Items farther than this (in multiples of the
+    length of direction) are ignored. Use FLT_MAX for no limit.
+    @param hit Filled in with the closest item if the ray hits one.
+
+    @return 1 if the ray hit an item, 0 otherwise.
+*/
+int bvh_raycast(const bvh *tree, const float origin[3], const float direction[3], float maxDistance, bvh_hit *hit)
+{
+	if(tree->node_count == 0)
+		return 0;
+	float invDir[3] = { 1/direction[0], 1/direction[1], 1/direction[2] };
+
+	unsigned int stack[BVH_MAX_DEPTH*2];
+	float stackDistance[BVH_MAX_DEPTH*2];
+	int top = 0;
+	float best = maxDistance;
+	int found = 0;
+
+	float rootDistance = bvh_ray_box(tree->nodes[0].bounds, origin, invDir, best);
+	if(rootDistance < 0)
+		return 0;
+	stack[top] = 0;
+	stackDistance[top++] = rootDistance;
+	while(top > 0)
+	{
+		top--;
+		if(stackDistance[top] > best) // a closer item was found after the node was pushed
+			continue;
+		const bvh_node *node = &(tree->nodes[stack[top]]);
+		if(node->count > 0)
+		{
+			for(unsigned int i=0; i<node->count; i++)
+			{
+				unsigned int item = tree->items[node->first+i];
+				if(tree->boxes)
+				{
+					float distance = bvh_ray_box(tree->boxes+item*6, origin, invDir, best);
+					if(distance >= 0 && (!found || distance < best))
+					{
+						best = distance;
+						hit->item = item;
+						hit->distance = distance;
+						hit->u = hit->v = 0;
+						found = 1;
+					}
+				}
+				else if(bvh_ray_triangle(tree->positions + bvh_vertex(tree, item, 0)*3,
+				                         tree->positions + bvh_vertex(tree, item, 1)*3,
+				                         tree->positions + bvh_vertex(tree, item, 2)*3,
+				                         origin, direction, best, hit))
+				{
+					best = hit->distance;
+					hit->item = item;
+					found = 1;
+				}
+			}
+			continue;
+		}
+
+		/* Visit the closer child first by pushing it last. */
+		unsigned int left = node->first;
+		float dl = bvh_ray_box(tree->nodes[left].bounds,   origin, invDir, best);
+		float dr = bvh_ray_box(tree->nodes[left+1].bounds, origin, invDir, best);
+		if(dl >= 0 && dr >= 0 && dl < dr)
+		{
+			stack[top] = left+1; stackDistance[top++] = dr;
+			stack[top] = left;   stackDistance[top++] = dl;
+		}
+		else
+		{
+			if(dl >= 0) { stack[top] = left;   stackDistance[top++] = dl; }
+			if(dr >= 0) { stack[top] = left+1; stackDistance[top++] = dr; }
+		}
+	}
+	return found;
+}
+
+/** Compares a box with a query. Returns 0 if the box is outside of
+ * it, 1 if the box may be partly inside of it and 2 if the box is
+ * entirely inside of it. */
+typedef int (*bvh_classify_func)(const float box[6], const float *query);
+
+/** Compares a box with the planes of a frustum (see bvh_classify_func). */
+static int bvh_classify_frustum(const float box[6], const float *planes)
+{
+	int result = 2;
+	for(int p=0; p<6; p++)
+	{
+		const float *pl = planes + p*4;
+		/* The signed distances to the corners of the box that are
+		 * farthest along and against the normal of the plane. */
+		float farthest = pl[3], nearest = pl[3];
+		for(int i=0; i<3; i++)
+		{
+			float a = pl[i]*box[i*2], b = pl[i]*box[i*2+1];
+			farthest += fmaxf(a, b);
+			nearest  += fminf(a, b);
+		}
+		if(farthest < 0)
+			return 0;
+		if(nearest < 0)
+			result = 1;
+	}
+	return result;
+}
+
+/** Compares a box with another box (see bvh_classify_func). */
+static int bvh_classify_box(const float box[6], const float *query)
+{
+	int result = 2;
+	for(int i=0; i<3; i++)
+	{
+		if(box[i*2] > query[i*2+1] || box[i*2+1] < query[i*2])
+			return 0;
+		if(box[i*2] < query[i*2] || box[i*2+1] > query[i*2+1])
+			result = 1;
+	}
+	return result;
+}
+
+/** Finds the items whose bounding boxes the classify function
+ * doesn't reject. The items in nodes that are entirely inside of the
+ * query are added without testing them. */
+static unsigned int bvh_query(const bvh *tree, bvh_classify_func classify, const float *query,
+                              unsigned int *results, unsigned int maxResults)
+{
+	if(tree->node_count == 0)
+		return 0;
+
+	unsigned int stack[BVH_MAX_DEPTH*2];
+	char stackInside[BVH_MAX_DEPTH*2];
+	int top = 0;
+	unsigned int found = 0;
+	stack[top] = 0;
+	stackInside[top++] = 0;
+	while(top > 0)
+	{
+		top--;
+		const bvh_node *node = &(tree->nodes[stack[top]]);
+		int inside = stackInside[top];
+		if(!inside)
+		{
+			int c = classify(node->bounds, query);
+			if(c == 0)
+				continue;
+			inside = (c == 2);
+		}
+
+		if(node->count > 0)
+		{
+			for(unsigned int i=0; i<node->count; i++)
+			{
+				unsigned int item = tree->items[node->first+i];
+				if(!inside)
+				{
+					float box[6];
+					bvh_item_bounds(tree, item, box);
+					if(classify(box, query) == 0)
+						continue;
+				}
+				if(found < maxResults)
+					results[found] = item;
+				found++;
+			}
+			continue;
+		}
+		stack[top] = node->first;   stackInside[top++] = (char) inside;
+		stack[top] = node->first+1; stackInside[top++] = (char) inside;
+	}
+	return found;
+}
+
+/** Finds the items in a tree whose bounding boxes may be inside of a
+    view frustum. Like frustum_cull_spheres(), an item near a corner
+    of the frustum may be found even though it is outside of it.
+
+    @param tree The tree.
+
+    @param planes The planes from mat4f_frustum_planes(), in the same
+    coordinates as the tree. For a tree of world space boxes, use the
+    projection * view matrix.
+
+    @param results Filled in with the item numbers. May be NULL if
+    maxResults is 0.
+
+    @param maxResults The number of item numbers that fit in results.
+
+    @return The number of items found, which may be larger than
+    maxResults.
+*/
+unsigned int bvh_query_frustum(const bvh *tree, const float planes[24], unsigned int *results, unsigned int maxResults)
+{
+	return bvh_query(tree, bvh_classify_frustum, planes, results, maxResults);
+}
+
+/** Finds the items in a tree whose bounding boxes overlap a box, for
+    example to find what a moving object might collide with.
+
+    @param tree The tree.
+
+    @param box The box (xmin,xmax,ymin,ymax,zmin,zmax) in the same
+    coordinates as the tree.
+
+    @param results Filled in with the item numbers. May be NULL if
+    maxResults is 0.
+
+    @param maxResults The number of item numbers that fit in results.
+
+    @return The number of items found, which may be larger than
+    maxResults.
+*/
+unsigned int bvh_query_box(const bvh *tree, const float box[6], unsigned int *results, unsigned int maxResults)
+{
+	return bvh_query(tree, bvh_classify_box, box, results, maxResults);
+}
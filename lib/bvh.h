@@ -0,0 +1,91 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    A bounding volume hierarchy (BVH) finds the triangles of a mesh,
+    or the copies of models in a scene, that a ray hits or that are
+    inside of a view frustum or a box without testing every one of
+    them.
+
+    The tree is a binary tree of axis-aligned bounding boxes. Each
+    leaf holds a few items (triangles or boxes). A tree can be built
+    over the triangles of an indexed mesh or over a list of bounding
+    boxes, such as the world space box of each copy of a model from
+    kuhl_geometry_bbox(). The items are split with the surface area
+    heuristic (SAH): the centers of the items are sorted into bins
+    along each axis and the split between two bins that minimizes the
+    surface area of each side times its number of items is used.
+    Subtrees with many items are built on several threads at once.
+
+    When the items move but stay near each other (an animated mesh,
+    copies of a model that move a little each frame), bvh_refit()
+    updates the boxes of the existing tree, which is much faster than
+    building a new tree. The tree gets slower to search as the items
+    drift away from where they were when it was built.
+
+    The tree doesn't copy the vertices, indices or boxes; they must
+    stay in memory while the tree is used.
+
+    Typical use:
+
+    bvh tree;
+    bvh_build_triangles(&tree, indices, triangleCount, positions);
+    bvh_hit hit;
+    if(bvh_raycast(&tree, origin, direction, FLT_MAX, &hit))
+        the ray hit triangle hit.item at origin + hit.distance * direction
+    After the vertices in positions move:
+    bvh_refit(&tree);
+    bvh_free(&tree);
+
+    @author Scott Kuhl
+ */
+
+#ifndef __BVH_H__
+#define __BVH_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** One node of a bvh. */
+typedef struct {
+	float bounds[6];    /**< Bounding box of the node (xmin,xmax,ymin,ymax,zmin,zmax) */
+	unsigned int first; /**< Leaf: position in bvh.items of the first item. Inner node: index of the left child; the right child follows it. */
+	unsigned int count; /**< Number of items in a leaf, 0 for inner nodes */
+} bvh_node;
+
+/** A bounding volume hierarchy over triangles or boxes. */
+typedef struct {
+	bvh_node *nodes;         /**< The nodes, nodes[0] is the root */
+	unsigned int node_count;
+	unsigned int *items;     /**< The item numbers (triangle or box) grouped by leaf */
+	unsigned int item_count;
+
+	const unsigned int *indices; /**< Triangles: 3 indices per triangle, NULL if the vertices are drawn in order */
+	const float *positions;      /**< Triangles: 3 floats per vertex, NULL for a tree of boxes */
+	const float *boxes;          /**< Boxes: 6 floats per box, NULL for a tree of triangles */
+} bvh;
+
+/** Where a ray hit an item in a bvh. */
+typedef struct {
+	unsigned int item; /**< The triangle or box that was hit */
+	float distance;    /**< How far along the ray the hit is, in multiples of the length of the direction */
+	float u, v;        /**< Barycentric coordinates of the hit on a triangle (the weights of its second and third vertices) */
+} bvh_hit;
+
+void bvh_build_triangles(bvh *tree, const unsigned int *indices, unsigned int triangleCount, const float *positions);
+void bvh_build_boxes(bvh *tree, const float *boxes, unsigned int count);
+void bvh_build_threads(int threads);
+void bvh_refit(bvh *tree);
+void bvh_free(bvh *tree);
+
+int bvh_raycast(const bvh *tree, const float origin[3], const float direction[3], float maxDistance, bvh_hit *hit);
+unsigned int bvh_query_frustum(const bvh *tree, const float planes[24], unsigned int *results, unsigned int maxResults);
+unsigned int bvh_query_box(const bvh *tree, const float box[6], unsigned int *results, unsigned int maxResults);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __BVH_H__
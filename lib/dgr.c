@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <time.h>
 #include "msg.h"
+#include "dgr.h"
 
 
 
@@ -39,9 +40,72 @@
 typedef struct {
 	char name[1024]; /**< The name of the variable */
 	int size;        /**< Number of bytes of data in this variable */
-	void *buffer;    /**< The bytes of data in this variable */
+	void *buffer;    /**< The bytes of data in this variable. For records created with dgr_register(), this points at the application's memory. */
+	int registered;  /**< 1 if this record was created by dgr_register(), 0 if it was created by dgr_setget() */
 } dgr_record;
 
+/** A dgr_span is a piece of application memory that is copied
+ * directly into (on a master) or out of (on a slave) the block of
+ * registered data in each packet. Records that are registered
+ * back-to-back in memory (for example, the fields of a struct) are
+ * merged into a single span so they are copied with one memcpy(). */
+typedef struct {
+	char *app;  /**< Location of the data in the application's memory */
+	int offset; /**< Offset of the data in the registered block */
+	int size;   /**< Number of bytes in this span */
+} dgr_span;
+
+/** Every DGR packet starts with this header. It is followed by
+ * 'blockSize' bytes of registered data and then any records created
+ * with dgr_setget() in the format described in dgr_serialize(). */
+typedef struct {
+	unsigned int magic;  /**< Always DGR_MAGIC */
+	unsigned int schema; /**< Hash of the names and sizes of the registered records */
+	int blockSize;       /**< Number of bytes of registered data following the header */
+} dgr_header;
+
+#define DGR_MAGIC 0x44475231 /**< "DGR1" */
+
+/** When forward error correction is enabled (see DGR_FEC), each frame
+ * is split into fragments that are sent in separate UDP packets. Each
+ * of those packets starts with this header. After every 'group' data
+ * fragments, a parity fragment is sent which is the XOR of the data
+ * fragments in the group. A slave can rebuild any one lost data
+ * fragment in a group from the parity fragment. */
+typedef struct {
+	unsigned int magic;    /**< Always DGR_FRAG_MAGIC */
+	unsigned int frame;    /**< Frame number that this fragment belongs to */
+	unsigned short index;  /**< Index of this data fragment, or the group number for a parity fragment */
+	unsigned short count;  /**< Number of data fragments in the frame */
+	unsigned short group;  /**< Number of data fragments covered by each parity fragment */
+	unsigned short parity; /**< 1 if this is a parity fragment, 0 otherwise */
+	int fragSize;          /**< Maximum number of bytes of data in a fragment */
+	int frameSize;         /**< Number of bytes in the whole frame */
+} dgr_fragment_header;
+
+#define DGR_FRAG_MAGIC 0x44475246 /**< "DGRF" */
+
+/** Frames that a slave is in the process of reassembling from
+ * fragments. */
+typedef struct {
+	int inUse;          /**< 1 if this slot holds a frame */
+	unsigned int frame; /**< Frame number */
+	int count;          /**< Number of data fragments in the frame */
+	int group;          /**< Number of data fragments per parity fragment */
+	int fragSize;       /**< Maximum number of bytes of data in a fragment */
+	int frameSize;      /**< Number of bytes in the frame */
+	int received;       /**< Number of data fragments we have */
+	char *data;         /**< count*fragSize bytes, padded with zeros */
+	char *parity;       /**< One fragSize buffer per group */
+	char *have;         /**< 1 for each data fragment that we have */
+	char *haveParity;   /**< 1 for each parity fragment that we have */
+	int capacity;       /**< Number of data fragments that 'data' and 'have' can hold */
+	int parityCapacity; /**< Number of groups that 'parity' and 'haveParity' can hold */
+} dgr_frame_slot;
+
+/** Number of frames that a slave can reassemble at the same time */
+#define DGR_FRAME_SLOTS 4
+
 
 
 
@@ -52,6 +116,37 @@ static dgr_record dgr_list[DGR_MAX_LIST_SIZE];
 /** Size of the DGR record list */
 static int dgr_list_size = 0;
 
+/** Spans of application memory registered with dgr_register() */
+static dgr_span dgr_spans[DGR_MAX_LIST_SIZE];
+/** Number of spans in dgr_spans */
+static int dgr_spans_size = 0;
+/** Total size of all records created with dgr_register() */
+static int dgr_block_size = 0;
+/** Hash of the names and sizes of all records created with dgr_register() */
+static unsigned int dgr_schema = 2166136261u;
+
+/** Buffer that packets are assembled in before they are sent. It is
+ * reused each frame and grows as needed. */
+static char *dgr_sendbuf = NULL;
+static int dgr_sendbuf_size = 0;
+
+/** Largest DGR_FRAGMENT_SIZE that a master sends and that a slave accepts. */
+#define DGR_MAX_FRAG_SIZE 65000
+
+/* Options for unreliable networks, see dgr_init(). */
+static int dgr_fec_group = 0;       /**< Data fragments per parity fragment, 0 if FEC is off */
+static int dgr_frag_size = 1400;    /**< Maximum bytes of frame data in a fragment */
+static int dgr_duplicate = 0;       /**< Number of extra times to send frames that fit in one fragment */
+static float dgr_drop_percent = 0;  /**< Percent of packets that a slave will intentionally ignore */
+static unsigned int dgr_drop_seed = 1;
+
+static unsigned int dgr_frame_num = 0; /**< Number of the next fragmented frame a master will send */
+static int dgr_frame_applied = 0;      /**< 1 if a slave has applied a fragmented frame */
+static unsigned int dgr_frame_last;    /**< Number of the last fragmented frame a slave applied */
+static dgr_frame_slot dgr_slots[DGR_FRAME_SLOTS];
+
+static dgr_stats dgr_statistics;
+
 /* The socket that we are sending/receiving from */
 static int dgr_socket;
 static struct addrinfo *dgr_addrinfo;
@@ -66,8 +161,12 @@ static int dgr_disabled = 0; /**< Set to 1 if we are running in a DGR environmen
 static void dgr_free()
 {
 	for(int i=0; i<dgr_list_size; i++)
-		free(dgr_list[i].buffer);
+		if(dgr_list[i].registered == 0)
+			free(dgr_list[i].buffer);
 	dgr_list_size = 0;
+	dgr_spans_size = 0;
+	dgr_block_size = 0;
+	dgr_schema = 2166136261u;
 }
 
 /** Initializes a master DGR process that will send packets out on the network. */
@@ -195,9 +294,65 @@ int dgr_is_enabled()
 }
 
 
+/** Reads the DGR options for unreliable networks from environment
+ * variables. */
+static void dgr_init_options()
+{
+	memset(&dgr_statistics, 0, sizeof(dgr_stats));
+
+	const char *fec = getenv("DGR_FEC");
+	if(fec != NULL)
+		dgr_fec_group = atoi(fec);
+	const char *fragSize = getenv("DGR_FRAGMENT_SIZE");
+	if(fragSize != NULL)
+		dgr_frag_size = atoi(fragSize);
+	const char *duplicate = getenv("DGR_DUPLICATE");
+	if(duplicate != NULL)
+		dgr_duplicate = atoi(duplicate);
+	const char *drop = getenv("DGR_DROP_PERCENT");
+	if(drop != NULL)
+		dgr_drop_percent = atof(drop);
+
+	if(dgr_fec_group < 0 || dgr_fec_group > 255)
+	{
+		msg(ERROR, "DGR_FEC must be between 0 and 255; you set it to %d. Disabling FEC.\n", dgr_fec_group);
+		dgr_fec_group = 0;
+	}
+	if(dgr_frag_size < 64 || dgr_frag_size > DGR_MAX_FRAG_SIZE)
+	{
+		msg(ERROR, "DGR_FRAGMENT_SIZE must be between 64 and %d; you set it to %d. Using 1400.\n", DGR_MAX_FRAG_SIZE, dgr_frag_size);
+		dgr_frag_size = 1400;
+	}
+	if(dgr_duplicate < 0)
+		dgr_duplicate = 0;
+
+	if(dgr_mode && dgr_fec_group > 0)
+		msg(INFO, "DGR Master: Sending frames in %d byte fragments with one parity fragment for every %d fragments.\n", dgr_frag_size, dgr_fec_group);
+	if(dgr_mode && dgr_duplicate > 0)
+		msg(INFO, "DGR Master: Sending frames smaller than %d bytes %d extra time(s).\n", dgr_frag_size, dgr_duplicate);
+	if(!dgr_mode && dgr_drop_percent > 0)
+	{
+		msg(WARNING, "DGR Slave: Intentionally ignoring %.1f%% of the packets we receive (DGR_DROP_PERCENT).\n", dgr_drop_percent);
+		dgr_drop_seed = (unsigned int) getpid();
+	}
+}
+
 /** Initialize DGR. DGR options are specified via environment
  * variables. This function should typically be called once near the
- * beginning of a DGR program. */
+ * beginning of a DGR program.
+ *
+ * On networks that lose packets, the master can be configured to send
+ * extra data so that slaves can recover from lost packets without
+ * asking for them again:
+ *
+ * DGR_FEC=k splits each frame into fragments and sends an XOR parity
+ * fragment after every k fragments (0 disables, the default).
+ * DGR_FRAGMENT_SIZE sets the largest fragment in bytes (default 1400).
+ * DGR_DUPLICATE=n sends frames that fit in one fragment n extra times.
+ *
+ * DGR_DROP_PERCENT can be set on a slave to ignore a percentage of the
+ * packets it receives to test how well these options work.
+ */
 void dgr_init()
 {
 	const char* mode = getenv("DGR_MODE");
@@ -225,6 +380,8 @@ void dgr_init()
 	
 	if(dgr_disabled)
 		msg(INFO, "DGR is disabled; not a valid DGR environment.\n");
+	else
+		dgr_init_options();
 
 	// if there already is a list, free it.
 	if(dgr_list_size > 0)
@@ -264,7 +421,8 @@ static int dgr_get(const char *name, void* buffer, int bufferSize)
 	/* Copy the data if there is enough room */
 	if(bufferSize >= rec->size)
 	{
-		memcpy(buffer, rec->buffer, rec->size);
+		if(buffer != rec->buffer)
+			memcpy(buffer, rec->buffer, rec->size);
 		return rec->size;
 	}
 	else /* 'buffer' wasn't large enough to store data. */
@@ -287,14 +445,15 @@ static void dgr_set(const char *name, void *buffer, int size)
 	{
 		// printf("DGR Master: The name '%s' is new to dgr, storing it at location %d\n", name, dgr_list_size);
 
-		if(dgr_list_size > DGR_MAX_LIST_SIZE)
+		if(dgr_list_size >= DGR_MAX_LIST_SIZE)
 		{
 			msg(FATAL, "DGR Master: You have exceeded the maximum list size for DGR.");
 			exit(EXIT_FAILURE);
 		}
 
 		dgr_record *record = &(dgr_list[dgr_list_size]);
-		sprintf(record->name, "%s",  name);
+		snprintf(record->name, 1024, "%s",  name);
+		record->registered = 0;
 		record->size = size;
 		record->buffer = malloc(size);
 		memcpy(record->buffer, buffer, size);
@@ -306,6 +465,11 @@ static void dgr_set(const char *name, void *buffer, int size)
 		dgr_record *record = &(dgr_list[index]);
 		// printf("DGR Master: The name '%s' is already known to dgr (at index %d)\n", name, index);
 
+		if(record->registered && record->size != size)
+		{
+			msg(ERROR, "DGR: '%s' was registered with %d bytes; you tried to set it with %d bytes.\n", name, record->size, size);
+			return;
+		}
 		if(record->size != size)
 		{
 //			printf("DGR Master: The name %s used to have size %d but now has size %d.", name, record->size, size);
@@ -313,7 +477,8 @@ static void dgr_set(const char *name, void *buffer, int size)
 			record->buffer = malloc(size);
 			record->size = size;
 		}
-		memcpy(record->buffer, buffer, size);
+		if(record->buffer != buffer)
+			memcpy(record->buffer, buffer, size);
 	}
 }
 
@@ -332,6 +497,11 @@ static void dgr_set(const char *name, void *buffer, int size)
  * new value. If you set a variable once and never set it again, DGR
  * will keep sending that variable.
  *
+ * For variables that are updated every frame, dgr_register() avoids
+ * looking up the name and copying the data into a separate buffer
+ * each time. dgr_setget() can still be used on a registered variable
+ * as long as 'bufferSize' matches the registered size.
+ *
  * @param name A string representing the name of the variable. Both the DGR master and DGR slaves must use the same string for the same variable.
  * @param buffer A pointer to the data (an int, float, array, struct, etc.)
  * @param bufferSize The size of the data in the buffer in bytes.
@@ -357,8 +527,94 @@ void dgr_setget(const char *name, void* buffer, int bufferSize)
 }
 
 
+/** Registers a piece of the application's memory with DGR. Unlike
+ * dgr_setget(), which looks up the variable by name and copies it
+ * into (or out of) a DGR-owned buffer every frame, a registered
+ * variable is bound once. After that, dgr_update() copies the data
+ * directly from 'buffer' into the outgoing packet on the master and
+ * directly from the incoming packet into 'buffer' on a slave.
+ *
+ * All registered variables are sent as a single contiguous block
+ * near the start of each packet. Variables that are registered
+ * back-to-back in memory (for example, each field of a struct in
+ * order) are copied with a single memcpy(). The master and the slaves
+ * must register the same names with the same sizes in the same
+ * order; a slave will print an error and ignore the registered data
+ * in any packet that does not match.
+ *
+ * A registered variable can also be accessed with dgr_setget() using
+ * the same name and size.
+ *
+ * dgr_register() should be called after dgr_init() and 'buffer' must
+ * remain valid until the program exits (for example, a global or
+ * static variable).
+ *
+ * @param name A string representing the name of the variable. Both the DGR master and DGR slaves must use the same string for the same variable.
+ * @param buffer A pointer to the data (an int, float, array, struct, etc.)
+ * @param bufferSize The size of the data in the buffer in bytes.
+ * @return A handle for the variable, or -1 if DGR is disabled or if the variable could not be registered.
+ */
+int dgr_register(const char *name, void *buffer, int bufferSize)
+{
+	if(dgr_disabled)
+		return -1;
+
+	if(buffer == NULL || bufferSize <= 0)
+	{
+		msg(ERROR, "DGR: Can't register '%s' with a NULL buffer or a size of %d.\n", name, bufferSize);
+		return -1;
+	}
+	if(dgr_findIndex(name) != -1)
+	{
+		msg(ERROR, "DGR: '%s' is already known to DGR and can't be registered again.\n", name);
+		return -1;
+	}
+	if(dgr_list_size >= DGR_MAX_LIST_SIZE)
+	{
+		msg(FATAL, "DGR: You have exceeded the maximum list size for DGR.");
+		exit(EXIT_FAILURE);
+	}
+
+	int index = dgr_list_size;
+	dgr_record *record = &(dgr_list[index]);
+	snprintf(record->name, 1024, "%s", name);
+	record->registered = 1;
+	record->size = bufferSize;
+	record->buffer = buffer;
+	dgr_list_size++;
+
+	/* Extend the previous span if this variable immediately follows
+	 * it in memory. Otherwise, start a new one. */
+	dgr_span *prev = NULL;
+	if(dgr_spans_size > 0)
+		prev = &(dgr_spans[dgr_spans_size-1]);
+	if(prev != NULL && prev->app + prev->size == (char*) buffer)
+		prev->size += bufferSize;
+	else
+	{
+		dgr_span *span = &(dgr_spans[dgr_spans_size++]);
+		span->app = buffer;
+		span->offset = dgr_block_size;
+		span->size = bufferSize;
+	}
+	dgr_block_size += bufferSize;
+
+	/* Update the schema (FNV-1a hash of each name and size) so that
+	 * slaves can detect if the master registered different data. */
+	for(const char *c = name; *c != '\0'; c++)
+		dgr_schema = (dgr_schema ^ (unsigned char) *c) * 16777619u;
+	for(int i=0; i<(int)sizeof(int); i++)
+		dgr_schema = (dgr_schema ^ ((bufferSize >> (i*8)) & 0xff)) * 16777619u;
+
+	return index;
+}
+
+
 /** Takes the list of DGR records and puts them into a compact byte
- * stream. The format is:
+ * stream. The stream starts with a dgr_header, followed by the data
+ * of every registered variable in the order they were registered.
+ * Then, for each variable that was created with dgr_setget(), the
+ * stream contains:
  *   
  * label character string<br>
  * Null terminator at end of string<br>
@@ -366,22 +622,42 @@ void dgr_setget(const char *name, void* buffer, int bufferSize)
  * A buffer of the data.<br>
  *
  * @param size The size of the data being serialized.
- * @return A serialized array of bytes (to be free()'d by the caller)
+ * @return A serialized array of bytes. The array is reused by the next call to dgr_serialize() and should not be free()'d by the caller.
 */
-char* dgr_serialize(int *size)
+static char* dgr_serialize(int *size)
 {
-	int spaceNeeded = 0;
+	int spaceNeeded = sizeof(dgr_header) + dgr_block_size;
 	for(int i=0; i<dgr_list_size; i++)
-		spaceNeeded += strlen(dgr_list[i].name)+1+sizeof(int)+dgr_list[i].size;
+		if(dgr_list[i].registered == 0)
+			spaceNeeded += strlen(dgr_list[i].name)+1+sizeof(int)+dgr_list[i].size;
 	*size = spaceNeeded;
 
-	if(spaceNeeded == 0)
-		return NULL;
-	
-	char *serialized = malloc(spaceNeeded);
-	char *ptr = serialized;
+	if(spaceNeeded > dgr_sendbuf_size)
+	{
+		dgr_sendbuf = realloc(dgr_sendbuf, spaceNeeded);
+		if(dgr_sendbuf == NULL)
+		{
+			msg(FATAL, "DGR Master: Unable to allocate %d bytes.", spaceNeeded);
+			exit(EXIT_FAILURE);
+		}
+		dgr_sendbuf_size = spaceNeeded;
+	}
+
+	dgr_header header;
+	header.magic = DGR_MAGIC;
+	header.schema = dgr_schema;
+	header.blockSize = dgr_block_size;
+	memcpy(dgr_sendbuf, &header, sizeof(dgr_header));
+
+	char *block = dgr_sendbuf + sizeof(dgr_header);
+	for(int i=0; i<dgr_spans_size; i++)
+		memcpy(block + dgr_spans[i].offset, dgr_spans[i].app, dgr_spans[i].size);
+
+	char *ptr = block + dgr_block_size;
 	for(int i=0; i<dgr_list_size; i++)
 	{
+		if(dgr_list[i].registered)
+			continue;
 		int bytesPrinted = sprintf(ptr, "%s", dgr_list[i].name);
 		ptr += bytesPrinted+1; // extra byte for null terminated string.
 		memcpy(ptr, &(dgr_list[i].size), sizeof(int));
@@ -390,21 +666,50 @@ char* dgr_serialize(int *size)
 		ptr += dgr_list[i].size;
 	}
 
-	return serialized;
+	return dgr_sendbuf;
 }
 
 
 /** Unserializes serialized data and stores it in our global dgr_list
  * variable. We do not blow away the list, instead we just update the
- * data that is already in the list.
+ * data that is already in the list. Registered variables are copied
+ * directly into the application's memory.
  *
  * @param size Length of the serialized data.
  * @param serialized The serialized data as an array of bytes.
  **/
 static void dgr_unserialize(int size, char *serialized)
 {
-	char *ptr = serialized;
+	if(size < (int) sizeof(dgr_header))
+	{
+		msg(ERROR, "DGR Slave: Received a packet that is too small (%d bytes).\n", size);
+		return;
+	}
+	dgr_header header;
+	memcpy(&header, serialized, sizeof(dgr_header));
+	if(header.magic != DGR_MAGIC || header.blockSize < 0 ||
+	   header.blockSize > size - (int) sizeof(dgr_header))
+	{
+		msg(ERROR, "DGR Slave: Received a packet that wasn't sent by a compatible DGR master.\n");
+		return;
+	}
 
+	char *block = serialized + sizeof(dgr_header);
+	if(header.schema == dgr_schema && header.blockSize == dgr_block_size)
+	{
+		for(int i=0; i<dgr_spans_size; i++)
+			memcpy(dgr_spans[i].app, block + dgr_spans[i].offset, dgr_spans[i].size);
+	}
+	else
+	{
+		/* Only complain once so we don't print a message every frame. */
+		static int warned = 0;
+		if(!warned)
+			msg(ERROR, "DGR Slave: The variables registered with dgr_register() on the master (%d bytes) don't match the ones registered on this slave (%d bytes). Ignoring registered variables.\n", header.blockSize, dgr_block_size);
+		warned = 1;
+	}
+	
+	char *ptr = block + header.blockSize;
 	while(ptr < serialized + size)
 	{
 		int c = 0;
@@ -422,11 +727,8 @@ static void dgr_unserialize(int size, char *serialized)
 		memcpy(&size, ptr, sizeof(int));
 		ptr += sizeof(int);
 
-		char data[size];
-		memcpy(data, ptr, size);
+		dgr_set(name, ptr, size);
 		ptr += size;
-
-		dgr_set(name, data, size);
 	}
 
 }
@@ -444,25 +746,16 @@ void dgr_print_list()
 	for(int i=0; i<dgr_list_size; i++)
 	{
 		dgr_record *r = &(dgr_list[i]);
-		msg(DEBUG, "%3d %5d %p %s\n", i, r->size, r->buffer, r->name);
+		msg(DEBUG, "%3d %5d %p %s%s\n", i, r->size, r->buffer, r->name, r->registered ? " (registered)" : "");
 	}
 	if(dgr_list_size == 0)
 		msg(DEBUG, "[ the list is empty ]\n");
 }
 
-/** Serializes and sends DGR data out across a network. */
-static void dgr_send()
-{
 #ifndef __MINGW32__
-	if(dgr_disabled)
-		return;
-	int  bufSize = 0;
-	char *buf = dgr_serialize(&bufSize);
-
-	// no need to send an empty packet.
-	if(bufSize == 0 || dgr_list_size == 0)
-		return;
-	
+/** Sends a single UDP packet to the destination. */
+static void dgr_sendto(const char *buf, int bufSize)
+{
 	/* If the message is too large to send, sendto() will not send the
 	 * message, and will set errno to EMSGSIZE. The MTU may limit the
 	 * amount of data that we can send. With an MTU of 1500, we can
@@ -475,15 +768,325 @@ static void dgr_send()
 		msg(FATAL, "DGR Master: sendto: %s", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	free(buf);
 	if(numbytes != bufSize) // double check that everything got sent
 	{
 		msg(FATAL, "DGR Master: Error sending all of the bytes in the message.");
 		exit(EXIT_FAILURE);
 	}
+	dgr_statistics.packetsSent++;
+	dgr_statistics.bytesSent += bufSize;
+}
+
+/** Splits a serialized frame into fragments and sends them along with
+ * a parity fragment for every dgr_fec_group data fragments. */
+static void dgr_send_fragments(const char *buf, int bufSize)
+{
+	static char *packet = NULL;
+	static char *parity = NULL;
+	static int packetSize = 0;
+	int fragSize = dgr_frag_size;
+	if(packetSize < (int) sizeof(dgr_fragment_header) + fragSize)
+	{
+		packetSize = sizeof(dgr_fragment_header) + fragSize;
+		packet = realloc(packet, packetSize);
+		parity = realloc(parity, packetSize);
+	}
+
+	int count = (bufSize + fragSize - 1) / fragSize;
+	if(count > 65535)
+	{
+		msg(FATAL, "DGR Master: A %d byte frame needs too many %d byte fragments.", bufSize, fragSize);
+		exit(EXIT_FAILURE);
+	}
+
+	/* A group can't be larger than the frame. Slaves reject headers
+	 * where it is. */
+	int group = dgr_fec_group < count ? dgr_fec_group : count;
+
+	dgr_fragment_header header;
+	header.magic = DGR_FRAG_MAGIC;
+	header.frame = dgr_frame_num++;
+	header.count = count;
+	header.group = group;
+	header.fragSize = fragSize;
+	header.frameSize = bufSize;
+
+	char *parityData = parity + sizeof(dgr_fragment_header);
+	int parityLen = 0;
+	for(int i=0; i<count; i++)
+	{
+		int len = fragSize;
+		if(i == count-1)
+			len = bufSize - i*fragSize;
+		const char *data = buf + i*fragSize;
+
+		header.index = i;
+		header.parity = 0;
+		memcpy(packet, &header, sizeof(dgr_fragment_header));
+		memcpy(packet + sizeof(dgr_fragment_header), data, len);
+		dgr_sendto(packet, sizeof(dgr_fragment_header)+len);
+
+		if(group == 0)
+			continue;
+
+		/* Accumulate the parity for this group. The last fragment
+		 * is treated as if it were padded with zeros. */
+		if(i % group == 0)
+		{
+			memset(parityData, 0, fragSize);
+			parityLen = 0;
+		}
+		for(int j=0; j<len; j++)
+			parityData[j] ^= data[j];
+		if(len > parityLen)
+			parityLen = len;
+
+		if(i % group == group-1 || i == count-1)
+		{
+			header.index = i / group;
+			header.parity = 1;
+			memcpy(parity, &header, sizeof(dgr_fragment_header));
+			dgr_sendto(parity, sizeof(dgr_fragment_header)+parityLen);
+		}
+	}
+}
 #endif // __MINGW32__
+
+/** Serializes and sends DGR data out across a network. */
+static void dgr_send()
+{
+#ifndef __MINGW32__
+	if(dgr_disabled)
+		return;
+
+	// no need to send an empty packet.
+	if(dgr_list_size == 0)
+		return;
+
+	int  bufSize = 0;
+	char *buf = dgr_serialize(&bufSize);
+	dgr_statistics.framesSent++;
+	dgr_statistics.frameBytes += bufSize;
+
+	/* Send small frames multiple times if requested. */
+	int copies = 1;
+	if(bufSize <= dgr_frag_size)
+		copies += dgr_duplicate;
+
+	for(int i=0; i<copies; i++)
+	{
+		if(dgr_fec_group > 0)
+			dgr_send_fragments(buf, bufSize);
+		else
+			dgr_sendto(buf, bufSize);
+	}
+#endif // __MINGW32__
+}
+
+#ifndef __MINGW32__
+/** Returns 1 if frame number a is newer than frame number b. */
+static int dgr_frame_newer(unsigned int a, unsigned int b)
+{
+	return (int)(a - b) > 0;
 }
 
+/** Makes sure that a slot can hold the number of fragments in
+ * 'header' and clears it. */
+static void dgr_slot_reset(dgr_frame_slot *slot, const dgr_fragment_header *header)
+{
+	/* The number of groups depends on the group size in the header,
+	 * not just the number of fragments, so the parity buffers are
+	 * sized separately from the data buffers. */
+	int groups = header->group > 0 ? (header->count + header->group - 1) / header->group : 0;
+	if(header->count > slot->capacity || header->fragSize != slot->fragSize)
+	{
+		slot->data = realloc(slot->data, (size_t)header->count * header->fragSize);
+		slot->have = realloc(slot->have, header->count);
+		slot->capacity = header->count;
+	}
+	if(groups > slot->parityCapacity || header->fragSize != slot->fragSize || slot->parity == NULL)
+	{
+		int parityGroups = groups > 0 ? groups : 1;
+		slot->parity = realloc(slot->parity, (size_t)parityGroups * header->fragSize);
+		slot->haveParity = realloc(slot->haveParity, parityGroups);
+		slot->parityCapacity = parityGroups;
+	}
+	if(slot->data == NULL || slot->parity == NULL || slot->have == NULL || slot->haveParity == NULL)
+	{
+		msg(FATAL, "DGR Slave: Unable to allocate memory for a %d byte frame.", header->frameSize);
+		exit(EXIT_FAILURE);
+	}
+	slot->inUse = 1;
+	slot->frame = header->frame;
+	slot->count = header->count;
+	slot->group = header->group;
+	slot->fragSize = header->fragSize;
+	slot->frameSize = header->frameSize;
+	slot->received = 0;
+	memset(slot->data, 0, (size_t)header->count * header->fragSize);
+	memset(slot->have, 0, header->count);
+	memset(slot->haveParity, 0, groups);
+}
+
+/** Stores a fragment that a slave received in the appropriate slot. */
+static void dgr_fragment_receive(const char *packet, int size)
+{
+	dgr_fragment_header header;
+	memcpy(&header, packet, sizeof(dgr_fragment_header));
+	const char *data = packet + sizeof(dgr_fragment_header);
+	int len = size - sizeof(dgr_fragment_header);
+
+	/* The header comes from the network, so check that the sizes
+	 * agree with each other before they are used to allocate or copy
+	 * memory. */
+	if(header.fragSize <= 0 || header.fragSize > DGR_MAX_FRAG_SIZE || len > header.fragSize ||
+	   header.frameSize <= 0 || header.frameSize > 1024*1024*64 ||
+	   header.count != (header.frameSize + header.fragSize - 1) / header.fragSize ||
+	   (size_t)header.frameSize > (size_t)header.count * (size_t)header.fragSize ||
+	   header.group > header.count)
+	{
+		msg(ERROR, "DGR Slave: Received a fragment with an invalid header.\n");
+		return;
+	}
+
+	/* Ignore fragments from frames that are older than the one we
+	 * last used. */
+	if(dgr_frame_applied && !dgr_frame_newer(header.frame, dgr_frame_last))
+		return;
+
+	/* Find the slot for this frame, or the slot with the oldest frame
+	 * if we don't have one yet. */
+	dgr_frame_slot *slot = NULL;
+	dgr_frame_slot *oldest = NULL;
+	for(int i=0; i<DGR_FRAME_SLOTS; i++)
+	{
+		dgr_frame_slot *s = &(dgr_slots[i]);
+		if(s->inUse && s->frame == header.frame)
+		{
+			slot = s;
+			break;
+		}
+		if(oldest == NULL || !s->inUse ||
+		   (oldest->inUse && dgr_frame_newer(oldest->frame, s->frame)))
+			oldest = s;
+	}
+	if(slot == NULL)
+	{
+		slot = oldest;
+		if(slot->inUse)
+			dgr_statistics.framesLost++;
+		dgr_slot_reset(slot, &header);
+	}
+	else if(slot->count != header.count || slot->fragSize != header.fragSize ||
+	        slot->group != header.group || slot->frameSize != header.frameSize)
+	{
+		msg(ERROR, "DGR Slave: Fragments for frame %u don't agree on the size of the frame.\n", header.frame);
+		return;
+	}
+
+	if(header.parity)
+	{
+		int groups = header.group > 0 ? (header.count + header.group - 1) / header.group : 0;
+		if(header.index >= groups || slot->haveParity[header.index])
+			return;
+		char *dest = slot->parity + header.index * header.fragSize;
+		memset(dest, 0, header.fragSize);
+		memcpy(dest, data, len);
+		slot->haveParity[header.index] = 1;
+	}
+	else
+	{
+		if(header.index >= header.count || slot->have[header.index])
+			return;
+		memcpy(slot->data + header.index * header.fragSize, data, len);
+		slot->have[header.index] = 1;
+		slot->received++;
+	}
+}
+
+/** Rebuilds missing data fragments using parity fragments when only
+ * one data fragment in a group is missing. */
+static void dgr_slot_recover(dgr_frame_slot *slot)
+{
+	if(slot->group == 0 || slot->received == slot->count)
+		return;
+	int groups = (slot->count + slot->group - 1) / slot->group;
+	for(int g=0; g<groups; g++)
+	{
+		if(!slot->haveParity[g])
+			continue;
+		int first = g*slot->group;
+		int last = first + slot->group;
+		if(last > slot->count)
+			last = slot->count;
+
+		int missing = -1;
+		int numMissing = 0;
+		for(int i=first; i<last; i++)
+			if(!slot->have[i])
+			{
+				missing = i;
+				numMissing++;
+			}
+		if(numMissing != 1)
+			continue;
+
+		/* XOR the parity with all of the other fragments in the group. */
+		char *dest = slot->data + missing*slot->fragSize;
+		memcpy(dest, slot->parity + g*slot->fragSize, slot->fragSize);
+		for(int i=first; i<last; i++)
+		{
+			if(i == missing)
+				continue;
+			const char *src = slot->data + i*slot->fragSize;
+			for(int j=0; j<slot->fragSize; j++)
+				dest[j] ^= src[j];
+		}
+		/* The data past the end of the frame must remain zero. */
+		if(missing == slot->count-1)
+			memset(slot->data + slot->frameSize, 0, slot->count*slot->fragSize - slot->frameSize);
+		slot->have[missing] = 1;
+		slot->received++;
+		dgr_statistics.fragmentsRecovered++;
+	}
+}
+
+/** Applies the newest complete fragmented frame (if there is one) and
+ * frees the slots of any older frames. */
+static void dgr_fragment_apply()
+{
+	dgr_frame_slot *newest = NULL;
+	for(int i=0; i<DGR_FRAME_SLOTS; i++)
+	{
+		dgr_frame_slot *s = &(dgr_slots[i]);
+		if(!s->inUse)
+			continue;
+		dgr_slot_recover(s);
+		if(s->received == s->count &&
+		   (newest == NULL || dgr_frame_newer(s->frame, newest->frame)))
+			newest = s;
+	}
+	if(newest == NULL)
+		return;
+
+	dgr_unserialize(newest->frameSize, newest->data);
+	dgr_statistics.framesReceived++;
+	dgr_frame_applied = 1;
+	dgr_frame_last = newest->frame;
+
+	for(int i=0; i<DGR_FRAME_SLOTS; i++)
+	{
+		dgr_frame_slot *s = &(dgr_slots[i]);
+		if(s->inUse && !dgr_frame_newer(s->frame, dgr_frame_last))
+		{
+			if(s != newest && s->received != s->count)
+				dgr_statistics.framesLost++;
+			s->inUse = 0;
+		}
+	}
+}
+#endif // __MINGW32__
+
 /** Receives DGR data from the network.
  *
  * @param timeout If timeout > 0, dgr_receive() will block for at most
@@ -533,19 +1136,59 @@ static void dgr_receive(int timeout)
 	struct sockaddr_storage their_addr;
 	socklen_t addr_len = sizeof their_addr;
 
-	char serialized[1024*1024];
+	/* Packets are read into 'packet'. When a packet contains a whole
+	 * frame, it is swapped into 'serialized' so that it isn't
+	 * overwritten by any fragments or dropped packets that follow. */
+	static char buffers[2][1024*1024];
+	char *packet = buffers[0];
+	char *serialized = buffers[1];
 	int numbytes;
+	int wholeFrameBytes = -1; // size of newest packet containing a whole frame
+	int gotFragment = 0;
 	/* Read packets until there are no more to read. This ensures that
 	 * we are always using the newest packet. For example, 5 packets
 	 * might arrive while the slave is rendering a scene. We want to
 	 * make sure that we use the newest packet. */
 	while(1)
 	{
-		if ((numbytes = recvfrom(dgr_socket, serialized, 1024*1024, 0,
+		if ((numbytes = recvfrom(dgr_socket, packet, 1024*1024, 0,
 		                         (struct sockaddr *)&their_addr, &addr_len)) == -1) {
 			msg(FATAL, "recvfrom: %s", strerror(errno));
 			exit(EXIT_FAILURE);
 		}
+		dgr_time_lastreceive = time(NULL);
+
+		/* Pretend that some packets were lost if DGR_DROP_PERCENT is set. */
+		int drop = 0;
+		if(dgr_drop_percent > 0)
+		{
+			dgr_drop_seed = dgr_drop_seed * 1103515245u + 12345u;
+			if((dgr_drop_seed >> 8) % 100000 < dgr_drop_percent * 1000)
+				drop = 1;
+		}
+
+		if(drop)
+			dgr_statistics.packetsDropped++;
+		else
+		{
+			dgr_statistics.packetsReceived++;
+			unsigned int magic = 0;
+			if(numbytes >= (int) sizeof(unsigned int))
+				memcpy(&magic, packet, sizeof(unsigned int));
+			if(magic == DGR_FRAG_MAGIC && numbytes >= (int) sizeof(dgr_fragment_header))
+			{
+				dgr_fragment_receive(packet, numbytes);
+				gotFragment = 1;
+				wholeFrameBytes = -1;
+			}
+			else
+			{
+				char *tmp = serialized;
+				serialized = packet;
+				packet = tmp;
+				wholeFrameBytes = numbytes;
+			}
+		}
 
 		// if there is nothing to read anymore from the socket, break out of loop.
 		struct pollfd fds;
@@ -555,12 +1198,27 @@ static void dgr_receive(int timeout)
 		if(retval == 0)
 			break;
 	}
-	dgr_time_lastreceive = time(NULL);
-	
-	dgr_unserialize(numbytes, serialized);
+
+	if(wholeFrameBytes >= 0)
+	{
+		dgr_unserialize(wholeFrameBytes, serialized);
+		dgr_statistics.framesReceived++;
+	}
+	else if(gotFragment)
+		dgr_fragment_apply();
 #endif // __MINGW32__
 }
 
+/** Gets statistics about the packets that DGR has sent or received
+ * since dgr_init() was called.
+ *
+ * @param stats A struct to store the statistics in.
+ */
+void dgr_get_stats(dgr_stats *stats)
+{
+	*stats = dgr_statistics;
+}
+
 /** Send or receive data depending on DGR configuration. If we are a
  * DGR master, dgr_update() will send data to the network. if we are
  * DGR slave, dgr_update() will receive data from the network. In an
@@ -571,11 +1229,18 @@ void dgr_update()
 	if(dgr_mode)
 		dgr_send();
 	else
-		// if it is our first time receiving, allow for a delay.
-		if(dgr_time_lastreceive == 0)
-			dgr_receive(10000);
+	{
+		/* If we haven't received a whole frame yet, allow for a
+		 * delay. When frames are split into fragments, we may need
+		 * to receive several packets before we have a whole frame. */
+		if(dgr_statistics.framesReceived == 0)
+		{
+			while(dgr_statistics.framesReceived == 0 && !dgr_disabled)
+				dgr_receive(10000);
+		}
 		else
 			dgr_receive(0);
+	}
 }
 
 
@@ -17,12 +17,28 @@
 extern "C" {
 #endif
 
+/** Statistics about the packets DGR has sent or received. See
+ * dgr_get_stats(). */
+typedef struct {
+	long framesSent;         /**< Master: Number of frames sent */
+	long frameBytes;         /**< Master: Bytes of frame data sent, not counting duplicates or FEC */
+	long packetsSent;        /**< Master: Number of UDP packets sent */
+	long bytesSent;          /**< Master: Number of bytes sent in UDP packets */
+	long framesReceived;     /**< Slave: Number of frames applied */
+	long framesLost;         /**< Slave: Number of fragmented frames that were never completed */
+	long packetsReceived;    /**< Slave: Number of UDP packets received */
+	long packetsDropped;     /**< Slave: Number of UDP packets ignored because of DGR_DROP_PERCENT */
+	long fragmentsRecovered; /**< Slave: Number of lost fragments rebuilt from parity fragments */
+} dgr_stats;
+
 void dgr_init();
 void dgr_update();
 void dgr_setget(const char *name, void* buffer, int bufferSize);
+int dgr_register(const char *name, void *buffer, int bufferSize);
 void dgr_print_list();
 int dgr_is_master();
 int dgr_is_enabled();
+void dgr_get_stats(dgr_stats *stats);
 
 #ifdef __cplusplus
 } // end extern "C"
@@ -0,0 +1,98 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "frustum-cull.h"
+
+/** Tests one sphere against the planes of a view frustum.
+
+    @param planes The planes from mat4f_frustum_planes().
+    @param center The center of the sphere, in the same coordinates as the planes.
+    @param radius The radius of the sphere.
+
+    @return 0 if the sphere is entirely outside of the frustum, 1 otherwise.
+*/
+int frustum_cull_sphere(const float planes[24], const float center[3], float radius)
+{
+	for(int p=0; p<6; p++)
+	{
+		const float *pl = planes + p*4;
+		if(pl[0]*center[0] + pl[1]*center[1] + pl[2]*center[2] + pl[3] < -radius)
+			return 0;
+	}
+	return 1;
+}
+
+/** Tests many spheres against the planes of a view frustum.
+
+    @param planes The planes from mat4f_frustum_planes().
+
+    @param x The x coordinates of the centers of the spheres.
+    @param y The y coordinates of the centers of the spheres.
+    @param z The z coordinates of the centers of the spheres.
+    @param radius The radius of each sphere.
+
+    @param count The number of spheres.
+
+    @param visible count values, each set to 1 if the sphere may be
+    visible and 0 if it is entirely outside of the frustum.
+
+    @return The number of spheres that may be visible.
+*/
+unsigned int frustum_cull_spheres(const float planes[24],
+                                  const float *x, const float *y, const float *z, const float *radius,
+                                  unsigned int count, unsigned char *visible)
+{
+	unsigned int visibleCount = 0;
+	unsigned int i = 0;
+#ifdef __SSE__
+	__m128 a[6], b[6], c[6], d[6];
+	for(int p=0; p<6; p++)
+	{
+		a[p] = _mm_set1_ps(planes[p*4+0]);
+		b[p] = _mm_set1_ps(planes[p*4+1]);
+		c[p] = _mm_set1_ps(planes[p*4+2]);
+		d[p] = _mm_set1_ps(planes[p*4+3]);
+	}
+
+	/* Four spheres at a time. A lane of 'outside' becomes all ones
+	 * when its sphere is entirely outside of a plane. */
+	for(; i+4 <= count; i+=4)
+	{
+		__m128 cx = _mm_loadu_ps(x+i), cy = _mm_loadu_ps(y+i), cz = _mm_loadu_ps(z+i);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius+i));
+		__m128 outside = _mm_setzero_ps();
+		for(int p=0; p<6; p++)
+		{
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[p], cx), _mm_mul_ps(b[p], cy)),
+			                         _mm_add_ps(_mm_mul_ps(c[p], cz), d[p]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, negRadius));
+		}
+		int mask = _mm_movemask_ps(outside);
+		for(int k=0; k<4; k++)
+		{
+			visible[i+k] = !((mask >> k) & 1);
+			visibleCount += visible[i+k];
+		}
+	}
+#endif
+
+	/* The remaining spheres (or all of them without SSE). */
+	for(; i<count; i++)
+	{
+		float center[3] = { x[i], y[i], z[i] };
+		visible[i] = (unsigned char) frustum_cull_sphere(planes, center, radius[i]);
+		visibleCount += visible[i];
+	}
+	return visibleCount;
+}
@@ -0,0 +1,44 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Tests many bounding spheres against the planes of a view frustum
+    at once so that programs that draw thousands of copies of a model
+    (such as flock.c) can skip the copies that can't be seen.
+
+    The spheres are stored as a structure of arrays (all of the x
+    values, then all of the y values, etc.) so that four spheres are
+    tested at once with SSE instructions. A sphere is culled if it is
+    entirely outside of any of the planes. Spheres near a corner of
+    the frustum may be kept even though they are outside of it, which
+    only costs a draw call that draws nothing.
+
+    Typical use, once per viewport:
+
+    float projview[16], planes[24];
+    mat4f_mult_mat4f_new(projview, projection, view);
+    mat4f_frustum_planes(planes, projview);
+    frustum_cull_spheres(planes, x, y, z, radius, count, visible);
+    for each i where visible[i] is 1, draw copy i
+
+    @author Scott Kuhl
+ */
+
+#ifndef __FRUSTUM_CULL_H__
+#define __FRUSTUM_CULL_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+unsigned int frustum_cull_spheres(const float planes[24],
+                                  const float *x, const float *y, const float *z, const float *radius,
+                                  unsigned int count, unsigned char *visible);
+int frustum_cull_sphere(const float planes[24], const float center[3], float radius);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __FRUSTUM_CULL_H__
@@ -8,6 +8,13 @@
  * This file provides a way to interact with the YEI orientation
  * sensor that use used by the Sensics dSight HMD.
  *
+ * The sensor only sends an orientation after it is asked for one and
+ * the reply can take a few milliseconds to arrive. So that rendering
+ * doesn't wait for the sensor, a reader thread continuously asks for
+ * and reads orientations. It publishes the newest one with a
+ * sequence lock (the same approach as vrpn-help.cpp) so that
+ * updateHmdControl() only copies four floats.
+ *
  * @author Evan Hauck
  */
 
@@ -17,7 +24,23 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+/** The reader thread won't ask the sensor for orientations more often
+ * than this (microseconds). */
+#define HMD_DSIGHT_POLL_MICROSECONDS 1000
+
+struct HmdControlReader
+{
+	int fd;              /**< The serial device */
+	pthread_t thread;    /**< Thread that reads from the device */
+	int stop;            /**< Set to 1 to ask the thread to stop */
+	unsigned int seq;    /**< Odd while 'quaternion' is being written */
+	int hasData;         /**< 1 once 'quaternion' has been filled in */
+	float quaternion[4]; /**< The newest orientation from the sensor */
+};
 
 /**
    Reliably write bytes to a file descriptor. Exits on failure.
@@ -91,13 +114,78 @@ static void swapEndianessFloat(float* data, const int n)
 	}
 }
 
-/** Opens a connection to the orientation sensor in the dSight HMD.
+// http://stackoverflow.com/questions/2100331
+#define IS_BIG_ENDIAN (!*(unsigned char *)&(unsigned short){1})
+
+/** Asks the sensor for its orientation and waits for the reply.
+
+    @param fd The serial device.
+    @param quaternion The resulting quaternion.
+*/
+static void requestOrientation(int fd, float quaternion[4])
+{
+	const unsigned char writeData[3] = { 0xf7, 0x00, 0x00 };
+	writeSafe(fd, writeData, 3);
+
+	readSafe(fd, (unsigned char*)quaternion, 4 * sizeof(float));
+	if (!IS_BIG_ENDIAN)
+	{
+		// HMD returns float in big-endian order
+		swapEndianessFloat(quaternion, 4);
+	}
+	// TODO: Not sure if quaternion itself is in right order, either.
+}
+
+/** Continuously reads orientations from the sensor and publishes the
+ * newest one. */
+static void* readerThread(void *data)
+{
+	HmdControlReader *reader = (HmdControlReader*) data;
+	while(__atomic_load_n(&(reader->stop), __ATOMIC_RELAXED) == 0)
+	{
+		long start = kuhl_microseconds();
+		float quaternion[4];
+		requestOrientation(reader->fd, quaternion);
+
+		/* Readers will retry if they see an odd sequence number or if
+		 * the sequence number changes while they are copying. */
+		unsigned int seq = reader->seq;
+		__atomic_store_n(&(reader->seq), seq+1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memcpy(reader->quaternion, quaternion, sizeof(float)*4);
+		reader->hasData = 1;
+		__atomic_store_n(&(reader->seq), seq+2, __ATOMIC_RELEASE);
+
+		long elapsed = kuhl_microseconds() - start;
+		if(elapsed < HMD_DSIGHT_POLL_MICROSECONDS)
+			usleep(HMD_DSIGHT_POLL_MICROSECONDS - elapsed);
+	}
+	return NULL;
+}
+
+/** Opens a connection to the orientation sensor in the dSight HMD and
+ * starts a thread that reads from it.
 
     @param deviceFile The serial device to communicate with. For example, /dev/ttyACM0
 */
 HmdControlState initHmdControl(const char* deviceFile)
+{
+	return initHmdControlThreaded(deviceFile, 1);
+}
+
+/** Opens a connection to the orientation sensor in the dSight HMD.
+
+    @param deviceFile The serial device to communicate with. For example, /dev/ttyACM0
+
+    @param useThread If 1, a thread reads from the sensor and
+    updateHmdControl() returns the newest orientation immediately. If
+    0 (or if the thread can't be started), updateHmdControl() asks the
+    sensor for the orientation and waits for the reply.
+*/
+HmdControlState initHmdControlThreaded(const char* deviceFile, int useThread)
 {
 	HmdControlState result;
+	result.reader = NULL;
 #ifndef __MINGW32__
 	result.fd = open(deviceFile, O_RDWR | O_NOCTTY);
 #else
@@ -108,29 +196,79 @@ HmdControlState initHmdControl(const char* deviceFile)
 		msg(FATAL, "Could not open %s for HMD rotation sensor driver\n", deviceFile);
 		exit(EXIT_FAILURE);
 	}
+
+	if(useThread)
+	{
+		HmdControlReader *reader = malloc(sizeof(HmdControlReader));
+		if(reader == NULL)
+		{
+			msg(FATAL, "Unable to allocate memory for HMD rotation sensor driver\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(reader, 0, sizeof(HmdControlReader));
+		reader->fd = result.fd;
+		if(pthread_create(&(reader->thread), NULL, readerThread, reader) == 0)
+			result.reader = reader;
+		else
+		{
+			msg(WARNING, "Unable to start HMD rotation sensor thread; reading sensor while rendering instead.\n");
+			free(reader);
+		}
+	}
 	return result;
 }
 
 
-// http://stackoverflow.com/questions/2100331
-#define IS_BIG_ENDIAN (!*(unsigned char *)&(unsigned short){1})
-
-
-/** Retrieve the latest orientation from the dSight HMD.
+/** Retrieve the latest orientation from the dSight HMD. If the reader
+ * thread is running, this never waits for the sensor. Until the
+ * first orientation arrives, the identity quaternion is returned.
 
     @param state A HmdControlState struct created by initHmdControl()
-    @param The resulting quaternion.
+    @param quaternion The resulting quaternion.
 */
 void updateHmdControl(HmdControlState *state, float quaternion[4])
 {
-	const unsigned char writeData[3] = { 0xf7, 0x00, 0x00 };
-	writeSafe(state->fd, writeData, 3);
+	HmdControlReader *reader = state->reader;
+	if(reader == NULL)
+	{
+		requestOrientation(state->fd, quaternion);
+		return;
+	}
 
-	readSafe(state->fd, (unsigned char*)quaternion, 4 * sizeof(float));
-	if (!IS_BIG_ENDIAN)
+	unsigned int before, after;
+	int hasData;
+	do
 	{
-		// HMD returns float in big-endian order
-		swapEndianessFloat(quaternion, 4);
+		before = __atomic_load_n(&(reader->seq), __ATOMIC_ACQUIRE);
+		hasData = reader->hasData;
+		memcpy(quaternion, reader->quaternion, sizeof(float)*4);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&(reader->seq), __ATOMIC_RELAXED);
+	} while(before != after || (before & 1));
+
+	if(!hasData)
+	{
+		quaternion[0] = quaternion[1] = quaternion[2] = 0;
+		quaternion[3] = 1;
 	}
-	// TODO: Not sure if quaternion itself is in right order, either.
+}
+
+/** Stops the reader thread (if there is one) and closes the
+ * device. The state can't be used again after this is called.
+
+    @param state A HmdControlState struct created by initHmdControl()
+*/
+void closeHmdControl(HmdControlState *state)
+{
+	if(state->reader)
+	{
+		/* The thread might be waiting for a reply from the sensor; it
+		 * checks 'stop' after the reply arrives. */
+		__atomic_store_n(&(state->reader->stop), 1, __ATOMIC_RELAXED);
+		pthread_join(state->reader->thread, NULL);
+		free(state->reader);
+		state->reader = NULL;
+	}
+	close(state->fd);
+	state->fd = -1;
 }
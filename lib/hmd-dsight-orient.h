@@ -13,13 +13,20 @@
 extern "C" {
 #endif
 
+/** Shared between the reader thread and the rendering thread. See
+ * hmd-dsight-orient.c. */
+typedef struct HmdControlReader HmdControlReader;
+
 typedef struct
 {
 	int fd;
+	HmdControlReader *reader; /**< NULL if the sensor is read on the calling thread */
 } HmdControlState;
 
 HmdControlState initHmdControl(const char* deviceFile);
+HmdControlState initHmdControlThreaded(const char* deviceFile, int useThread);
 void updateHmdControl(HmdControlState *state, float quaternion[4]);
+void closeHmdControl(HmdControlState *state);
 
 #ifdef __cplusplus
 } // end extern "C"
@@ -6,12 +6,14 @@
 /** @file
  * @author Scott Kuhl
  */
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
 #include "kuhl-nodep.h"
 #include "kalman.h"
 #include "vecmat.h"
+#include "msg.h"
 
 
 
@@ -24,6 +26,11 @@
  * call this function three different times with three different
  * kalman_state variables to filter X, Y, and Z.
  *
+ * This function assumes that the measurement was taken right
+ * now. If the time of the measurement is known (for example, VRPN
+ * provides the time each record was created), use
+ * kalman_estimate_time() instead.
+ *
  * @param state An kalman_state struct initialized by kalman_initialize()
  *
  * @param measured The newest, unfiltered measurement.
@@ -33,11 +40,35 @@
  */
 float kalman_estimate(kalman_state * state, float measured)
 {
-	if(state->isEnabled == 0)
-		return measured;
+	return kalman_estimate_time(state, measured, kuhl_microseconds());
+}
 
-	long now = kuhl_milliseconds();
-	double dt = (now - state->time_prev)/1000.0;
+/** Given a fully initialized kalman_state object, a new measurement,
+ * and the time the measurement was taken, get a filtered data
+ * point. See kalman_estimate() for more information.
+ *
+ * If 'time' isn't newer than the time of the previous measurement
+ * (for example, the first measurement from a recording that is being
+ * replayed), the filter is restarted at the measured value.
+ *
+ * @param state An kalman_state struct initialized by kalman_initialize()
+ *
+ * @param measured The newest, unfiltered measurement.
+ *
+ * @param time The time the measurement was taken in microseconds.
+ *
+ * @return The filtered data.
+ */
+float kalman_estimate_time(kalman_state * state, float measured, long time)
+{
+	long now = time;
+	double dt = (now - state->time_prev)/1000000.0;
+	if(state->isEnabled == 0 || dt <= 0)
+	{
+		vec3d_set(state->xk_prev, measured, 0, 0);
+		state->time_prev = now;
+		return measured;
+	}
 	
 	/* A is the transition matrix which will move our state ahead by
 	 * one timestep. */
@@ -63,9 +94,11 @@ float kalman_estimate(kalman_state * state, float measured)
 	*/
 	double q[9];
 	{
-		double row1[3] = { pow(dt,5)/20, pow(dt,4)/8, pow(dt,3)/6 };
-		double row2[3] = { pow(dt,4)/8, pow(dt,3)/3, pow(dt,2)/2 };
-		double row3[3] = { pow(dt,3)/6, pow(dt,2)/2, dt };
+		double dt2 = dt*dt;
+		double dt3 = dt2*dt;
+		double row1[3] = { dt3*dt2/20, dt3*dt/8, dt3/6 };
+		double row2[3] = { dt3*dt/8,   dt3/3,    dt2/2 };
+		double row3[3] = { dt3/6,      dt2/2,    dt };
 		mat3d_setRow(q, row1, 0);
 		mat3d_setRow(q, row2, 1);
 		mat3d_setRow(q, row3, 2);
@@ -154,7 +187,7 @@ void kalman_initialize(kalman_state * state, float sigma_meas, float qScale)
 	memset(state, 0, sizeof(kalman_state));
 
 	state->isEnabled = 1;
-	state->time_prev = kuhl_milliseconds();
+	state->time_prev = kuhl_microseconds();
 
 	float sigma_model = 100; // confidence in current state (smaller=more confident)
 
@@ -189,3 +222,286 @@ void kalman_initialize(kalman_state * state, float sigma_meas, float qScale)
 	// Converts our state into the set of variables we are measuring.
 	vec3d_set(state->h, 1,0,0);
 }
+
+/** Uses the current state of the filter to predict the value at some
+ * time in the future (or past). The state of the filter is not
+ * changed.
+
+   @param state A kalman_state struct that has been updated with
+   kalman_estimate() or kalman_estimate_time().
+
+   @param time The time in microseconds that we want to predict the
+   value at. This is typically after the time of the most recent
+   measurement.
+
+   @return The predicted value.
+*/
+float kalman_predict(const kalman_state * state, long time)
+{
+	double dt = (time - state->time_prev)/1000000.0;
+	return state->xk_prev[0] + state->xk_prev[1]*dt + .5*state->xk_prev[2]*dt*dt;
+}
+
+
+/** Initializes a kalman_bank that filters 'count' channels. Every
+ * channel starts with the same noise parameters (see
+ * kalman_initialize()); kalman_bank_set_noise() can change them for
+ * an individual channel. Free the bank with kalman_bank_free().
+
+   @param bank The bank to initialize.
+
+   @param count The number of channels to filter.
+
+   @param sigma_meas Standard deviation of the measurement noise.
+
+   @param qScale Scaling factor for the system noise. See kalman_initialize().
+*/
+void kalman_bank_init(kalman_bank *bank, int count, float sigma_meas, float qScale)
+{
+	memset(bank, 0, sizeof(kalman_bank));
+	if(count < 0)
+		count = 0;
+	bank->count = count;
+	bank->numBlocks = (count + KALMAN_BANK_WIDTH-1) / KALMAN_BANK_WIDTH;
+
+	/* Align the blocks so that each array inside of them can be
+	 * loaded into a SIMD register directly. */
+	size_t align = KALMAN_BANK_WIDTH*sizeof(float);
+	size_t size = sizeof(kalman_bank_block)*bank->numBlocks + align;
+	bank->memory = malloc(size);
+	if(bank->memory == NULL)
+	{
+		msg(FATAL, "Unable to allocate %lu bytes for %d kalman filters\n", (unsigned long) size, count);
+		exit(EXIT_FAILURE);
+	}
+	bank->blocks = (kalman_bank_block*) (((size_t)bank->memory + align-1) / align * align);
+	memset(bank->blocks, 0, sizeof(kalman_bank_block)*bank->numBlocks);
+
+	/* Initialize the unused channels in the last block too so that
+	 * they don't compute anything strange. */
+	for(int i=0; i<bank->numBlocks*KALMAN_BANK_WIDTH; i++)
+	{
+		kalman_bank_set_noise(bank, i, sigma_meas, qScale);
+		kalman_bank_reset(bank, i);
+	}
+}
+
+/** Frees the memory used by a kalman_bank.
+
+   @param bank A bank initialized with kalman_bank_init().
+*/
+void kalman_bank_free(kalman_bank *bank)
+{
+	free(bank->memory);
+	memset(bank, 0, sizeof(kalman_bank));
+}
+
+/** Changes the noise parameters for one channel in a bank. See
+ * kalman_initialize() for information about the parameters. */
+void kalman_bank_set_noise(kalman_bank *bank, int channel, float sigma_meas, float qScale)
+{
+	kalman_bank_block *b = &(bank->blocks[channel / KALMAN_BANK_WIDTH]);
+	int i = channel % KALMAN_BANK_WIDTH;
+	b->r[i] = sigma_meas * sigma_meas;
+	b->qScale[i] = qScale;
+}
+
+/** Restarts one channel of a bank. The next measurement for the
+ * channel will be used as-is and the filtering will start from
+ * there. */
+void kalman_bank_reset(kalman_bank *bank, int channel)
+{
+	kalman_bank_block *b = &(bank->blocks[channel / KALMAN_BANK_WIDTH]);
+	int i = channel % KALMAN_BANK_WIDTH;
+	float sigma_model = 100; // See kalman_initialize()
+	b->x[i] = 0;
+	b->v[i] = 0;
+	b->a[i] = 0;
+	b->p00[i] = sigma_model;
+	b->p11[i] = sigma_model;
+	b->p22[i] = sigma_model;
+	b->p01[i] = 0;
+	b->p02[i] = 0;
+	b->p12[i] = 0;
+	b->dt[i] = 0;
+	b->z[i] = 0;
+	b->time_prev[i] = KALMAN_BANK_UNSTARTED;
+}
+
+/** Updates every channel in a block using the measurements and times
+ * stored in the block's 'z' and 'dt' arrays. This is the same math
+ * as kalman_estimate_time() (which contains comments describing each
+ * step) except that the matrix operations are written out and
+ * simplified: H is [1,0,0], P is symmetric, and A is upper
+ * triangular. The loop has a fixed length and no branches so that
+ * the compiler can turn it into SIMD instructions. */
+static void kalman_bank_update_block(kalman_bank_block *b)
+{
+	for(int i=0; i<KALMAN_BANK_WIDTH; i++)
+	{
+		float dt = b->dt[i];
+		float z = b->z[i];
+
+		/* Project the state ahead: xminus = A * x */
+		float half_dt2 = .5f*dt*dt;
+		float xm0 = b->x[i] + dt*b->v[i] + half_dt2*b->a[i];
+		float xm1 = b->v[i] + dt*b->a[i];
+		float xm2 = b->a[i];
+
+		/* A*P, only the entries needed for the upper triangle of
+		 * (A*P)*A^T */
+		float ap00 = b->p00[i] + dt*b->p01[i] + half_dt2*b->p02[i];
+		float ap01 = b->p01[i] + dt*b->p11[i] + half_dt2*b->p12[i];
+		float ap02 = b->p02[i] + dt*b->p12[i] + half_dt2*b->p22[i];
+		float ap11 = b->p11[i] + dt*b->p12[i];
+		float ap12 = b->p12[i] + dt*b->p22[i];
+		float ap22 = b->p22[i];
+
+		/* Q without calling pow(). See kalman_estimate_time() */
+		float q = b->qScale[i];
+		float dt2 = dt*dt;
+		float dt3 = dt2*dt;
+		float q22 = q*dt;
+		float q12 = q*dt2*(1.0f/2);
+		float q11 = q*dt3*(1.0f/3);
+		float q02 = q*dt3*(1.0f/6);
+		float q01 = q*dt3*dt*(1.0f/8);
+		float q00 = q*dt3*dt2*(1.0f/20);
+
+		/* Pminus = A*P*A^T + Q */
+		float m00 = ap00 + dt*ap01 + half_dt2*ap02 + q00;
+		float m01 = ap01 + dt*ap02 + q01;
+		float m02 = ap02 + q02;
+		float m11 = ap11 + dt*ap12 + q11;
+		float m12 = ap12 + q12;
+		float m22 = ap22 + q22;
+
+		/* K = Pminus*H^T / (H*Pminus*H^T + R) */
+		float inv_s = 1.0f / (m00 + b->r[i]);
+		float k0 = m00*inv_s;
+		float k1 = m01*inv_s;
+		float k2 = m02*inv_s;
+
+		/* x = xminus + K*(z - H*xminus) */
+		float err = z - xm0;
+
+		/* If this is the first measurement (or time did not move
+		 * forward), use the measurement as-is and leave P alone. */
+		int ok = dt > 0;
+		b->x[i] = ok ? xm0 + k0*err : z;
+		b->v[i] = ok ? xm1 + k1*err : 0;
+		b->a[i] = ok ? xm2 + k2*err : 0;
+
+		/* P = Pminus - K*H*Pminus. The first row is written as
+		 * Pminus*(1-k0) = Pminus*R/S, which avoids subtracting two
+		 * nearly equal numbers when R is small (floats don't have
+		 * the precision to do that well). */
+		float r_inv_s = b->r[i]*inv_s;
+		b->p00[i] = ok ? m00*r_inv_s : b->p00[i];
+		b->p01[i] = ok ? m01*r_inv_s : b->p01[i];
+		b->p02[i] = ok ? m02*r_inv_s : b->p02[i];
+		b->p11[i] = ok ? m11 - k1*m01 : b->p11[i];
+		b->p12[i] = ok ? m12 - k1*m02 : b->p12[i];
+		b->p22[i] = ok ? m22 - k2*m02 : b->p22[i];
+	}
+}
+
+/** Filters a new measurement for every channel in a bank. Each
+ * channel can have a different timestamp (for example, when the
+ * channels are from different tracked objects). If all channels
+ * were measured at the same time, kalman_bank_estimate_time() can
+ * be used instead.
+ *
+ * If a channel's time isn't newer than the time of its previous
+ * measurement, the channel is restarted at the measured value (see
+ * kalman_estimate_time()).
+
+   @param bank A bank initialized with kalman_bank_init().
+
+   @param measured An array of bank->count new, unfiltered measurements.
+
+   @param times An array of bank->count times (in microseconds) that
+   the measurements were taken.
+
+   @param filtered An array of bank->count values which will be filled
+   in with the filtered data. It may be the same as 'measured'.
+*/
+void kalman_bank_estimate(kalman_bank *bank, const float *measured, const long *times, float *filtered)
+{
+	for(int blk=0; blk<bank->numBlocks; blk++)
+	{
+		kalman_bank_block *b = &(bank->blocks[blk]);
+		int first = blk*KALMAN_BANK_WIDTH;
+		int n = bank->count - first;
+		if(n > KALMAN_BANK_WIDTH)
+			n = KALMAN_BANK_WIDTH;
+
+		for(int i=0; i<n; i++)
+		{
+			long prev = b->time_prev[i];
+			b->dt[i] = prev == KALMAN_BANK_UNSTARTED ? 0 : (times[first+i]-prev)/1000000.0f;
+			b->time_prev[i] = times[first+i];
+			b->z[i] = measured[first+i];
+		}
+		kalman_bank_update_block(b);
+		for(int i=0; i<n; i++)
+			filtered[first+i] = b->x[i];
+	}
+}
+
+/** Filters a new measurement for every channel in a bank where all
+ * of the measurements were taken at the same time. See
+ * kalman_bank_estimate().
+
+   @param bank A bank initialized with kalman_bank_init().
+
+   @param measured An array of bank->count new, unfiltered measurements.
+
+   @param time The time (in microseconds) that the measurements were taken.
+
+   @param filtered An array of bank->count values which will be filled
+   in with the filtered data. It may be the same as 'measured'.
+*/
+void kalman_bank_estimate_time(kalman_bank *bank, const float *measured, long time, float *filtered)
+{
+	for(int blk=0; blk<bank->numBlocks; blk++)
+	{
+		kalman_bank_block *b = &(bank->blocks[blk]);
+		int first = blk*KALMAN_BANK_WIDTH;
+		int n = bank->count - first;
+		if(n > KALMAN_BANK_WIDTH)
+			n = KALMAN_BANK_WIDTH;
+
+		for(int i=0; i<n; i++)
+		{
+			long prev = b->time_prev[i];
+			b->dt[i] = prev == KALMAN_BANK_UNSTARTED ? 0 : (time-prev)/1000000.0f;
+			b->time_prev[i] = time;
+			b->z[i] = measured[first+i];
+		}
+		kalman_bank_update_block(b);
+		for(int i=0; i<n; i++)
+			filtered[first+i] = b->x[i];
+	}
+}
+
+/** Predicts the value of every channel in a bank at some time in the
+ * future. See kalman_predict().
+
+   @param bank A bank that has been updated with kalman_bank_estimate().
+
+   @param time The time in microseconds to predict the values at.
+
+   @param predicted An array of bank->count values which will be
+   filled in with the predicted values.
+*/
+void kalman_bank_predict(const kalman_bank *bank, long time, float *predicted)
+{
+	for(int c=0; c<bank->count; c++)
+	{
+		const kalman_bank_block *b = &(bank->blocks[c / KALMAN_BANK_WIDTH]);
+		int i = c % KALMAN_BANK_WIDTH;
+		float dt = (time - b->time_prev[i])/1000000.0f;
+		predicted[c] = b->x[i] + b->v[i]*dt + .5f*b->a[i]*dt*dt;
+	}
+}
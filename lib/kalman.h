@@ -18,7 +18,7 @@ typedef struct {
 	int isEnabled; /**< If set to 0, disable kalman filter */
 	
 	double xk_prev[3]; /**< Filtered position, velocity, and acceleration */
-	long time_prev;    /**< Time of previous measurement in milliseconds */
+	long time_prev;    /**< Time of previous measurement in microseconds */
 
 	double p[9];   /**< Estimated error of our current state */
 	double qScale; /**< Scaling factor for Q matrix (system error) */
@@ -29,6 +29,55 @@ typedef struct {
 
 void kalman_initialize(kalman_state * state, float sigma_meas, float qScale);
 float kalman_estimate(kalman_state * state, float measured);
+float kalman_estimate_time(kalman_state * state, float measured, long time);
+float kalman_predict(const kalman_state * state, long time);
+
+
+/** Number of channels in a kalman_bank_block. This matches the
+ * number of floats in an AVX register. */
+#define KALMAN_BANK_WIDTH 8
+
+/** Value of kalman_bank_block.time_prev for a channel that has not
+ * received any measurements. */
+#define KALMAN_BANK_UNSTARTED (-1L)
+
+/** State for KALMAN_BANK_WIDTH channels of a kalman_bank. Each
+ * variable is an array with one entry per channel so that the
+ * compiler can update all of the channels in a block at once with
+ * SIMD instructions. The covariance matrix P is symmetric, so only
+ * the upper triangle is stored. */
+typedef struct {
+	float x[KALMAN_BANK_WIDTH]; /**< Filtered position */
+	float v[KALMAN_BANK_WIDTH]; /**< Filtered velocity */
+	float a[KALMAN_BANK_WIDTH]; /**< Filtered acceleration */
+	float p00[KALMAN_BANK_WIDTH], p01[KALMAN_BANK_WIDTH], p02[KALMAN_BANK_WIDTH]; /**< Estimated error of our current state */
+	float p11[KALMAN_BANK_WIDTH], p12[KALMAN_BANK_WIDTH], p22[KALMAN_BANK_WIDTH];
+	float r[KALMAN_BANK_WIDTH];      /**< Variance of measurement error */
+	float qScale[KALMAN_BANK_WIDTH]; /**< Scaling factor for Q matrix (system error) */
+	float dt[KALMAN_BANK_WIDTH];     /**< Time since the previous measurement in seconds */
+	float z[KALMAN_BANK_WIDTH];      /**< Newest measurement */
+	long time_prev[KALMAN_BANK_WIDTH]; /**< Time of previous measurement in microseconds, or KALMAN_BANK_UNSTARTED */
+} kalman_bank_block;
+
+/** A set of independent kalman filters (called channels) that are
+ * updated together. For example, the X, Y, and Z position of many
+ * tracked objects. Each channel uses the same model as
+ * kalman_state. Channel i is stored in blocks[i/KALMAN_BANK_WIDTH]
+ * at index i%KALMAN_BANK_WIDTH. */
+typedef struct {
+	int count;     /**< Number of channels */
+	int numBlocks; /**< Number of blocks (count divided by KALMAN_BANK_WIDTH, rounded up) */
+	kalman_bank_block *blocks; /**< Aligned array of blocks */
+	void *memory;  /**< Allocation holding 'blocks' */
+} kalman_bank;
+
+void kalman_bank_init(kalman_bank *bank, int count, float sigma_meas, float qScale);
+void kalman_bank_free(kalman_bank *bank);
+void kalman_bank_set_noise(kalman_bank *bank, int channel, float sigma_meas, float qScale);
+void kalman_bank_reset(kalman_bank *bank, int channel);
+void kalman_bank_estimate(kalman_bank *bank, const float *measured, const long *times, float *filtered);
+void kalman_bank_estimate_time(kalman_bank *bank, const float *measured, long time, float *filtered);
+void kalman_bank_predict(const kalman_bank *bank, long time, float *predicted);
 
 #ifdef __cplusplus
 } // end extern "C"
@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h> // for FLT_MAX
+#include <stdint.h> // uintptr_t
+#include <stddef.h> // offsetof()
 #include <libgen.h> // for dirname()
 #include <sys/time.h> // gettimeofday()
 #include <unistd.h> // usleep()
@@ -40,6 +42,9 @@
 
 #include "kuhl-util.h"
 #include "vecmat.h"
+#include "mesh-optimize.h"
+#include "mesh-simplify.h"
+#include "frustum-cull.h"
 #ifdef KUHL_UTIL_USE_IMAGEMAGICK
 #include "imageio.h"
 #else /* use STB image loading if ImageMagick isn't available' */
@@ -526,7 +531,7 @@ static void kuhl_geometry_sanity_check(kuhl_geometry *geom)
     @param bbox The bounding box to rotate (xmin, xmax, ymin, ...)
     @param mat The 4x4 transformation matrix to apply to the bounding box
 */
-void kuhl_bbox_transform(float bbox[6], float mat[16])
+void kuhl_bbox_transform(float bbox[6], const float mat[16])
 {
 	if(mat == NULL)
 		return;
@@ -534,16 +539,17 @@ void kuhl_bbox_transform(float bbox[6], float mat[16])
 	int xmin=0, xmax=1, ymin=2, ymax=3, zmin=4, zmax=5;
 
 	// The 8 vertices of the bounding box
-	float coords[8][3] = { {bbox[xmin], bbox[ymin], bbox[zmin] },
-	                       {bbox[xmin], bbox[ymin], bbox[zmax] },
-	                       {bbox[xmin], bbox[ymax], bbox[zmin] },
-	                       {bbox[xmin], bbox[ymax], bbox[zmax] },
-	                       {bbox[xmax], bbox[ymin], bbox[zmax] },
-	                       {bbox[xmax], bbox[ymax], bbox[zmin] },
-	                       {bbox[xmax], bbox[ymax], bbox[zmax] } };
+	float coords[8][4] = { {bbox[xmin], bbox[ymin], bbox[zmin], 1 },
+	                       {bbox[xmin], bbox[ymin], bbox[zmax], 1 },
+	                       {bbox[xmin], bbox[ymax], bbox[zmin], 1 },
+	                       {bbox[xmin], bbox[ymax], bbox[zmax], 1 },
+	                       {bbox[xmax], bbox[ymin], bbox[zmin], 1 },
+	                       {bbox[xmax], bbox[ymin], bbox[zmax], 1 },
+	                       {bbox[xmax], bbox[ymax], bbox[zmin], 1 },
+	                       {bbox[xmax], bbox[ymax], bbox[zmax], 1 } };
 	// Transform the 8 vertices of the bounding box
 	for(int i=0; i<8; i++)
-		mat4f_mult_vec4f_new(coords[i], mat, coords[i]);
+		mat4f_mult_vec4f(coords[i], mat);
 	
 	/* Calculate new axis aligned bounding box */
 	for(int i=0; i<6; i=i+2) // set min values to the largest float
@@ -571,10 +577,58 @@ void kuhl_bbox_transform(float bbox[6], float mat[16])
 }
     
 
-#if 0
+/** Calculates the axis-aligned bounding box of a list of
+    kuhl_geometry objects, including the matrix of each object. The
+    result can be used to build a bounding volume hierarchy over the
+    copies of a model in a scene (see bvh_build_boxes()).
+
+    @param geom The first kuhl_geometry in a list.
+    @param mat A matrix applied to the whole list (for example, the
+    model matrix of one copy of the model) or NULL.
+    @param bbox Filled in with the bounding box (xmin, xmax, ymin, ...).
+
+    @return 1 if the bounds of every object in the list are known (see
+    kuhl_geometry::bsphere). Objects with unknown bounds are left out
+    of the box.
+*/
+int kuhl_geometry_bbox(const kuhl_geometry *geom, const float mat[16], float bbox[6])
+{
+	for(int i=0; i<6; i=i+2) // set min values to the largest float
+		bbox[i] = FLT_MAX;
+	for(int i=1; i<6; i=i+2) // set max values to the smallest float
+		bbox[i] = -FLT_MAX;
+
+	int known = 1;
+	for(const kuhl_geometry *g = geom; g != NULL; g = g->next)
+	{
+		if(g->bsphere[3] < 0)
+		{
+			known = 0;
+			continue;
+		}
+		float box[6], m[16];
+		memcpy(box, g->aabb, sizeof(float)*6);
+		if(mat != NULL)
+			mat4f_mult_mat4f_new(m, mat, g->matrix);
+		else
+			mat4f_copy(m, g->matrix);
+		kuhl_bbox_transform(box, m);
+		for(int i=0; i<3; i++)
+		{
+			bbox[i*2]   = fminf(bbox[i*2],   box[i*2]);
+			bbox[i*2+1] = fmaxf(bbox[i*2+1], box[i*2+1]);
+		}
+	}
+	return known;
+}
+
 /** Checks if the axis-aligned bounding box of two kuhl_geometry objects intersect.
 
-    @return 1 if the bounding boxes intersect; 0 otherwise
+    If the bounding box of some of the geometry isn't known (see
+    kuhl_geometry_bbox()), the geometry might be anywhere and it is
+    assumed to collide.
+
+    @return 1 if the bounding boxes intersect or if a bounding box isn't known; 0 otherwise
 
     @param geom1 One of the pieces of geometry.
     @param mat1 A 4x4 transformation matrix to be applied to the bounding box of geom1 prior to checking for collision.
@@ -585,13 +639,9 @@ int kuhl_geometry_collide(kuhl_geometry *geom1, float mat1[16],
                           kuhl_geometry *geom2, float mat2[16])
 {
 	float box1[6], box2[6];
-	for(int i=0; i<6; i++)
-	{
-		box1[i] = geom1->aabbox[i];
-		box2[i] = geom2->aabbox[i];
-	}
-	kuhl_bbox_transform(box1, mat1);
-	kuhl_bbox_transform(box2, mat1);
+	if(!kuhl_geometry_bbox(geom1, mat1, box1) ||
+	   !kuhl_geometry_bbox(geom2, mat2, box2))
+		return 1;
 
 	int xmin=0, xmax=1, ymin=2, ymax=3, zmin=4, zmax=5;
 	// If the smallest x coordinate in geom1 is larger than the
@@ -611,9 +661,24 @@ int kuhl_geometry_collide(kuhl_geometry *geom1, float mat1[16],
 	if(box1[zmax] < box2[zmin]) return 0;
 	return 1;
 }
-#endif
 
 
+/** Stops drawing a kuhl_geometry object with the batches created by
+ * kuhl_geometry_merge(). The batches contain a copy of the vertices,
+ * indices and texture of each mesh, so they must not be used after
+ * any of those change. Afterwards, all of the meshes in the list are
+ * drawn individually again.
+ *
+ * @param geom The geometry that is about to change.
+ */
+static void kuhl_geometry_unmerge(kuhl_geometry *geom)
+{
+	if(geom->merged_into == NULL || geom->merged_into->disabled)
+		return;
+	geom->merged_into->disabled = 1;
+	msg(DEBUG, "A merged mesh changed; drawing each mesh individually from now on.\n");
+}
+
 /** Adds a texture to the provided kuhl_geometry object.
  *
  * @param geom The geometry object to add a texture to.
@@ -695,6 +760,7 @@ void kuhl_geometry_texture(kuhl_geometry *geom, GLuint texture, const char* name
 		exit(EXIT_FAILURE);
 	}
 
+	kuhl_geometry_unmerge(geom);
 	geom->textures[destIndex].name = strdup(name);
 	geom->textures[destIndex].textureId = texture;
 }
@@ -724,6 +790,128 @@ int kuhl_geometry_attrib_index(kuhl_geometry *geom, const char *name)
 	return -1;
 }
 
+/** Frees the name of an attribute and its buffer object. The buffer
+ * is only deleted if no other attribute is stored in it.
+ *
+ * @param geom The geometry object containing the attribute.
+ *
+ * @param index The index into geom->attribs[] of the attribute.
+ */
+static void kuhl_geometry_attrib_release(kuhl_geometry *geom, unsigned int index)
+{
+	kuhl_attrib *attrib = &(geom->attribs[index]);
+	free(attrib->name);
+	attrib->name = NULL;
+
+	int shared = 0;
+	for(unsigned int i=0; i<geom->attrib_count; i++)
+	{
+		if(i != index && geom->attribs[i].bufferobject == attrib->bufferobject)
+			shared = 1;
+	}
+	if(!shared && !attrib->external && glIsBuffer(attrib->bufferobject))
+		glDeleteBuffers(1, &(attrib->bufferobject));
+	attrib->bufferobject = 0;
+	attrib->external = 0;
+}
+
+/** Finds the kuhl_attrib that an attribute should be stored in. If
+ * another attribute in kuhl_geometry has the same name, it is
+ * released and overwritten.
+ *
+ * @param geom The geometry object to store the attribute in.
+ *
+ * @param name The GLSL variable name of the attribute.
+ *
+ * @return A kuhl_attrib with only the name filled in.
+ */
+static kuhl_attrib* kuhl_geometry_attrib_slot(kuhl_geometry *geom, const char *name)
+{
+	int destIndex = kuhl_geometry_attrib_index(geom, name);
+	if(destIndex < 0)
+	{
+		/* If this is a new attribute for this geometry object */
+		destIndex = geom->attrib_count;
+		geom->attrib_count++;
+	}
+	else
+	{
+		/* If overwriting, free resources from old attribute. */
+		kuhl_geometry_attrib_release(geom, destIndex);
+	}
+
+	/* If we are writing past the end of the array. */
+	if(destIndex == MAX_ATTRIBUTES)
+	{
+		fprintf(stderr, "%s: You tried to add more than %d attributes to a kuhl_geometry object\n",
+		        __func__, MAX_ATTRIBUTES);
+		exit(EXIT_FAILURE);
+	}
+
+	kuhl_attrib *attrib = &(geom->attribs[destIndex]);
+	attrib->name = strdup(name);
+	return attrib;
+}
+
+/** Copies one vertex attribute of a kuhl_geometry object out of its
+ * buffer and into an array. Works with attributes that have a buffer
+ * to themselves, interleaved attributes and attributes in buffers
+ * owned by the caller.
+ *
+ * @param geom The geometry object containing the attribute.
+ *
+ * @param index The index into geom->attribs[] of the attribute.
+ *
+ * @param dest Where the attribute of the first vertex is written.
+ *
+ * @param destStride Number of floats from one vertex to the next in dest.
+ */
+static void kuhl_geometry_attrib_copy(const kuhl_geometry *geom, unsigned int index,
+                                      GLfloat *dest, GLuint destStride)
+{
+	const kuhl_attrib *attrib = &(geom->attribs[index]);
+	if(geom->vertex_count == 0)
+		return;
+	GLsizei stride = attrib->stride;
+	if(stride == 0)
+		stride = sizeof(GLfloat) * attrib->components;
+
+	/* Read from the first vertex to the end of the last one. */
+	GLsizeiptr size = stride * (geom->vertex_count-1) + sizeof(GLfloat) * attrib->components;
+	GLfloat *packed = kuhl_malloc(size);
+	glBindBuffer(GL_COPY_READ_BUFFER, attrib->bufferobject);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, attrib->offset, size, packed);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	kuhl_errorcheck();
+
+	GLuint strideFloats = stride / sizeof(GLfloat);
+	for(unsigned int v=0; v<geom->vertex_count; v++)
+		memcpy(dest + v*destStride, packed + v*strideFloats,
+		       sizeof(GLfloat)*attrib->components);
+	free(packed);
+}
+
+/** Moves an attribute that was stored with
+ * kuhl_geometry_attrib_interleaved() or kuhl_geometry_attrib_buffer()
+ * into a buffer of its own. The space that the attribute used in the
+ * other buffer is left unused.
+ *
+ * @param geom The geometry object containing the attribute.
+ *
+ * @param index The index into geom->attribs[] of the attribute.
+ */
+static void kuhl_geometry_attrib_separate(kuhl_geometry *geom, unsigned int index)
+{
+	GLuint components = geom->attribs[index].components;
+	GLfloat *data = kuhl_malloc(sizeof(GLfloat) * components * geom->vertex_count);
+	kuhl_geometry_attrib_copy(geom, index, data, components);
+
+	char *name = strdup(geom->attribs[index].name);
+	kuhl_geometry_attrib(geom, data, components, name, 0);
+	free(name);
+	free(data);
+}
+
 /** Retrieves vertex attribute information stored in an OpenGL array
  * buffer.
  *
@@ -759,6 +947,22 @@ GLfloat* kuhl_geometry_attrib_get(kuhl_geometry *geom, const char *name, GLint *
 	if(index < 0)
 		return NULL;
 
+	/* The caller may move the vertices, so the bounds are no longer
+	 * known. */
+	if(strcmp(name, "in_Position") == 0)
+		geom->bsphere[3] = -1;
+
+	/* The caller may change the attribute. */
+	kuhl_geometry_unmerge(geom);
+
+	/* An interleaved attribute shares its buffer with other
+	 * attributes. Give it a buffer of its own so that the caller gets
+	 * a tightly packed array and so that the other attributes aren't
+	 * copied around when this one changes. Buffers that belong to the
+	 * caller are never mapped here. */
+	if(geom->attribs[index].stride != 0 || geom->attribs[index].external)
+		kuhl_geometry_attrib_separate(geom, index);
+
 	/* Bind the VAO and the buffer we are interested in */
 	kuhl_attrib *attrib = &(geom->attribs[index]);
 	if(!glIsBuffer(attrib->bufferobject) || !glIsVertexArray(geom->vao))
@@ -822,6 +1026,7 @@ void kuhl_geometry_program(kuhl_geometry *geom, GLuint program, int kg_options)
 		msg(WARNING, "GLSL program %d is not a valid program.\n",program);
 	}
 	
+	kuhl_geometry_unmerge(geom);
 	geom->program = program;
 	
 	glBindVertexArray(geom->vao);
@@ -834,21 +1039,15 @@ void kuhl_geometry_program(kuhl_geometry *geom, GLuint program, int kg_options)
 		GLint attribLocation = kuhl_get_attribute(geom->program, attrib->name);
 		glEnableVertexAttribArray(attribLocation);
 
-		/* Get the size of the buffer */
-		GLint bufferSize = 0;
-		glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bufferSize);
-		GLint bufferNumFloats = bufferSize/sizeof(GLfloat);
-		GLint components = bufferNumFloats / geom->vertex_count;
-
 		/* Connect this vertex attribute with the (possibly different)
 		 * attribute location. */
 		glVertexAttribPointer(
 			attribLocation, // attribute location in glsl program
-			components, // number of elements (x,y,z)
+			attrib->components, // number of elements (x,y,z)
 			GL_FLOAT, // type of each element
 			GL_FALSE, // should OpenGL normalize values?
-			0,        // no extra data between each position
-			0 );      // offset of first element
+			attrib->stride, // bytes between vertices (0=tightly packed)
+			(const GLvoid*) (uintptr_t) attrib->offset ); // offset of first element
 		kuhl_errorcheck();
 	}
 
@@ -859,6 +1058,49 @@ void kuhl_geometry_program(kuhl_geometry *geom, GLuint program, int kg_options)
 }
 
 
+/** Calculates the bounding box and bounding sphere of the vertex
+ * positions of a geometry (before geom->matrix is applied).
+ *
+ * @param geom The geometry.
+ *
+ * @param positions geom->vertex_count positions.
+ *
+ * @param components The number of floats per position. Missing
+ * coordinates are 0.
+ */
+static void kuhl_geometry_bounds(kuhl_geometry *geom, const GLfloat *positions, GLuint components)
+{
+	if(geom->vertex_count == 0)
+	{
+		geom->bsphere[3] = -1;
+		return;
+	}
+	float bbox[6] = { FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX };
+	for(GLuint i=0; i<geom->vertex_count; i++)
+	{
+		for(unsigned int j=0; j<3; j++)
+		{
+			float value = j < components ? positions[i*components+j] : 0;
+			bbox[j*2]   = fminf(bbox[j*2],   value);
+			bbox[j*2+1] = fmaxf(bbox[j*2+1], value);
+		}
+	}
+
+	/* The bounding sphere is centered on the bounding box. */
+	float center[3] = { (bbox[0]+bbox[1])/2, (bbox[2]+bbox[3])/2, (bbox[4]+bbox[5])/2 };
+	float radius = 0;
+	for(GLuint i=0; i<geom->vertex_count; i++)
+	{
+		float diff[3];
+		for(unsigned int j=0; j<3; j++)
+			diff[j] = (j < components ? positions[i*components+j] : 0) - center[j];
+		radius = fmaxf(radius, vec3f_norm(diff));
+	}
+	memcpy(geom->aabb, bbox, sizeof(float)*6);
+	vec3f_copy(geom->bsphere, center);
+	geom->bsphere[3] = radius;
+}
+
 /** Adds a vertex attribute (such as vertex position, normal, color,
  * texture coordinate, etc) to the geometry object.
  *
@@ -907,6 +1149,9 @@ void kuhl_geometry_attrib(kuhl_geometry *geom, const GLfloat *data, GLuint compo
 		return;
 	}
 
+	if(strcmp(name, "in_Position") == 0)
+		kuhl_geometry_bounds(geom, data, components);
+
 	/* If this attribute isn't available in the GLSL program, move
 	 * on to the next one. */
 	GLint attribLocation = kuhl_get_attribute(geom->program, name);
@@ -918,36 +1163,14 @@ void kuhl_geometry_attrib(kuhl_geometry *geom, const GLfloat *data, GLuint compo
 		return;
 	}
 
-	/* If another attribute in kuhl_geometry has the same name,
-	 * overwrite it. */
-	int destIndex = kuhl_geometry_attrib_index(geom, name);
-
-	if(destIndex < 0)
-	{
-		/* If this is a new attribute for this geometry object */
-		destIndex = geom->attrib_count;
-		geom->attrib_count++;
-	}
-	else
-	{
-		/* If overwriting, free resources from old attribute. */
-		free(geom->attribs[destIndex].name);
-		if(glIsBuffer(geom->attribs[destIndex].bufferobject))
-			glDeleteBuffers(1, &(geom->attribs[destIndex].bufferobject));
-	}
-//	printf("%s: Storing attribute %s at index %d in kuhl_geometry; connected to location %d in program %d\n", __func__, name, destIndex, attribLocation, geom->program);
-	
-	/* If we are writing past the end of the array. */
-	if(destIndex == MAX_ATTRIBUTES)
-	{
-		fprintf(stderr, "%s: You tried to add more than %d attributes to a kuhl_geometry object\n",
-		        __func__, MAX_ATTRIBUTES);
-		exit(EXIT_FAILURE);
-	}
-
-	/* Set up this attribute. */
-	kuhl_attrib *attrib = &(geom->attribs[destIndex]);
-	attrib->name = strdup(name);
+	/* Set up this attribute. If another attribute in kuhl_geometry
+	 * has the same name, overwrite it. */
+	kuhl_geometry_unmerge(geom);
+	kuhl_attrib *attrib = kuhl_geometry_attrib_slot(geom, name);
+	attrib->components = components;
+	attrib->stride = 0;
+	attrib->offset = 0;
+	attrib->external = 0;
 
 	/* Switch to our vertex array object. */
 	glBindVertexArray(geom->vao);
@@ -988,6 +1211,190 @@ void kuhl_geometry_attrib(kuhl_geometry *geom, const GLfloat *data, GLuint compo
 	glBindVertexArray(0);
 }
 
+/** Adds several vertex attributes to the geometry object and stores
+ * them interleaved in a single buffer (all of the attributes for the
+ * first vertex, then all of the attributes for the second vertex,
+ * etc). Compared to calling kuhl_geometry_attrib() for each
+ * attribute, the GPU reads each vertex from one place in memory
+ * instead of one place per attribute, and fewer buffer objects are
+ * created.
+ *
+ * Attributes that aren't used by the GLSL program are left out of
+ * the buffer. If kuhl_geometry_attrib_get() is called for one of the
+ * attributes, that attribute is moved into a buffer of its own.
+ *
+ * @param geom The geometry to add the attributes to.
+ *
+ * @param sources The attributes. Each one is described the same way
+ * as the parameters to kuhl_geometry_attrib().
+ *
+ * @param count The number of attributes in sources.
+ */
+void kuhl_geometry_attrib_interleaved(kuhl_geometry *geom, const kuhl_attrib_source *sources, unsigned int count)
+{
+	if(geom == NULL || sources == NULL)
+	{
+		msg(WARNING, "Geometry struct or attribute list is null.\n");
+		return;
+	}
+	if(count > MAX_ATTRIBUTES)
+	{
+		fprintf(stderr, "%s: You tried to add more than %d attributes to a kuhl_geometry object\n",
+		        __func__, MAX_ATTRIBUTES);
+		exit(EXIT_FAILURE);
+	}
+	if(!glIsVertexArray(geom->vao))
+	{
+		msg(WARNING, "This geometry object has an invalid vertex array object %d (detected while setting interleaved attributes)\n", geom->vao);
+		return;
+	}
+
+	/* Find the attributes that the GLSL program uses and where each
+	 * of them goes inside of a vertex. */
+	GLint locations[MAX_ATTRIBUTES];
+	GLuint offsets[MAX_ATTRIBUTES];
+	GLuint stride = 0; // floats per vertex
+	for(unsigned int i=0; i<count; i++)
+	{
+		const kuhl_attrib_source *src = &(sources[i]);
+		locations[i] = -1;
+		if(src->name == NULL || strlen(src->name) == 0 || src->data == NULL || src->components == 0)
+		{
+			msg(WARNING, "Skipping interleaved attribute %u: name, data or components were not set.\n", i);
+			continue;
+		}
+		if(strcmp(src->name, "in_Position") == 0)
+			kuhl_geometry_bounds(geom, src->data, src->components);
+		locations[i] = kuhl_get_attribute(geom->program, src->name);
+		if(locations[i] == -1)
+		{
+			if(src->warnIfAttribMissing)
+				msg(WARNING, "Attribute '%s' was missing in geometry object.\n", src->name);
+			continue;
+		}
+		offsets[i] = stride;
+		stride += src->components;
+	}
+	if(stride == 0)
+		return;
+
+	/* Copy each attribute into its place in every vertex. */
+	GLfloat *packed = kuhl_malloc(sizeof(GLfloat)*geom->vertex_count*stride);
+	for(unsigned int i=0; i<count; i++)
+	{
+		if(locations[i] == -1)
+			continue;
+		GLuint components = sources[i].components;
+		for(unsigned int v=0; v<geom->vertex_count; v++)
+			memcpy(packed + v*stride + offsets[i], sources[i].data + v*components,
+			       sizeof(GLfloat)*components);
+	}
+
+	glBindVertexArray(geom->vao);
+	GLuint bufferobject = 0;
+	glGenBuffers(1, &bufferobject);
+	glBindBuffer(GL_ARRAY_BUFFER, bufferobject);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*geom->vertex_count*stride,
+	             packed, GL_STATIC_DRAW);
+	free(packed);
+	kuhl_errorcheck();
+
+	for(unsigned int i=0; i<count; i++)
+	{
+		if(locations[i] == -1)
+			continue;
+		kuhl_attrib *attrib = kuhl_geometry_attrib_slot(geom, sources[i].name);
+		attrib->bufferobject = bufferobject;
+		attrib->components = sources[i].components;
+		attrib->stride = sizeof(GLfloat)*stride;
+		attrib->offset = sizeof(GLfloat)*offsets[i];
+		attrib->external = 0;
+
+		glEnableVertexAttribArray(locations[i]);
+		glVertexAttribPointer(locations[i], attrib->components, GL_FLOAT, GL_FALSE,
+		                      attrib->stride, (const GLvoid*) (uintptr_t) attrib->offset);
+		kuhl_errorcheck();
+	}
+
+	// unbind
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+/** Connects a vertex attribute to data in a buffer object that the
+ * caller created and continues to own, such as a stream_buffer that
+ * the CPU rewrites every frame. kuhl_geometry_delete() doesn't delete
+ * the buffer and kuhl_geometry_draw() doesn't unmap it, so it may
+ * stay persistently mapped.
+ *
+ * Call this function again whenever the data moves to a different
+ * place in the buffer. If the attribute already uses the same buffer,
+ * only its offset and layout are updated.
+ *
+ * @param geom The geometry to add the attribute to.
+ *
+ * @param buffer The buffer object containing the data.
+ *
+ * @param components The number of floats per vertex in this attribute.
+ *
+ * @param stride Bytes from one vertex to the next, 0 if tightly packed.
+ *
+ * @param offset Byte offset of the attribute of the first vertex in the buffer.
+ *
+ * @param name The GLSL variable name that this attribute should be
+ * connected to.
+ *
+ * @param warnIfAttribMissing If nonzero, print a warning if the
+ * attribute isn't present in the GLSL program for this geometry
+ * object.
+ */
+void kuhl_geometry_attrib_buffer(kuhl_geometry *geom, GLuint buffer, GLuint components,
+                                 GLsizei stride, GLintptr offset,
+                                 const char *name, int warnIfAttribMissing)
+{
+	if(geom == NULL || name == NULL || !glIsVertexArray(geom->vao))
+	{
+		msg(WARNING, "Invalid geometry or GLSL variable name while connecting a buffer to an attribute.\n");
+		return;
+	}
+
+	/* The contents of the buffer aren't known. */
+	if(strcmp(name, "in_Position") == 0)
+		geom->bsphere[3] = -1;
+
+	GLint attribLocation = kuhl_get_attribute(geom->program, name);
+	if(attribLocation == -1)
+	{
+		if(warnIfAttribMissing)
+			msg(WARNING, "Attribute '%s' was missing in geometry object.\n", name);
+		return;
+	}
+
+	kuhl_attrib *attrib;
+	int index = kuhl_geometry_attrib_index(geom, name);
+	if(index >= 0 && geom->attribs[index].external && geom->attribs[index].bufferobject == buffer)
+		attrib = &(geom->attribs[index]);
+	else
+	{
+		kuhl_geometry_unmerge(geom);
+		attrib = kuhl_geometry_attrib_slot(geom, name);
+	}
+	attrib->bufferobject = buffer;
+	attrib->components = components;
+	attrib->stride = stride;
+	attrib->offset = offset;
+	attrib->external = 1;
+
+	glBindVertexArray(geom->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glEnableVertexAttribArray(attribLocation);
+	glVertexAttribPointer(attribLocation, components, GL_FLOAT, GL_FALSE,
+	                      stride, (const GLvoid*) (uintptr_t) offset);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	kuhl_errorcheck();
+}
+
 /** Calculates the number of objects in the kuhl_geometry linked list.
 
     @param geom The geometry object which you want to know the length of.
@@ -1056,9 +1463,18 @@ void kuhl_geometry_new(kuhl_geometry *geom, GLuint program, unsigned int vertexC
 	geom->indices = NULL;
 	geom->indices_len = 0;
 	geom->indices_bufferobject = 0;
+	geom->indices_type = GL_UNSIGNED_INT;
+	geom->lod_count = 0;
+	geom->lod_level = 0;
+	vec4f_set(geom->bsphere, 0, 0, 0, -1);
+	for(int i=0; i<6; i++)
+		geom->aabb[i] = 0;
 
 	mat4f_identity(geom->matrix);
 	geom->has_been_drawn = 0;
+	geom->material = 0;
+	geom->merged = NULL;
+	geom->merged_into = NULL;
 	
 #if KUHL_UTIL_USE_ASSIMP
 	geom->assimp_node  = NULL;
@@ -1070,7 +1486,9 @@ void kuhl_geometry_new(kuhl_geometry *geom, GLuint program, unsigned int vertexC
 }
 
 /** Applies a set of indices to the geometry so that vertices can be
- * re-used by multiple triangles or lines.
+ * re-used by multiple triangles or lines. If the geometry has 65536 or
+ * fewer vertices, the indices are stored in the index buffer as 16-bit
+ * values, which halves the memory that the GPU reads them from.
  *
  * @param geom The geometry that the indices should be used with.
  *
@@ -1099,8 +1517,11 @@ void kuhl_geometry_indices(kuhl_geometry *geom, GLuint *indices, GLuint indexCou
 		exit(EXIT_FAILURE);
 	}
 	
+	kuhl_geometry_unmerge(geom);
 	geom->indices_len = indexCount;
 	geom->indices     = indices;
+	geom->lod_count   = 0;
+	geom->lod_level   = 0;
 
 	/* Verify that the indices the user passed in are
 	 * appropriate. If there are only 10 vertices, then a user
@@ -1121,8 +1542,22 @@ void kuhl_geometry_indices(kuhl_geometry *geom, GLuint *indices, GLuint indexCou
 	kuhl_errorcheck();
 
 	/* Copy the indices data into the currently bound buffer. */
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*geom->indices_len,
-	             geom->indices, GL_STATIC_DRAW);
+	if(geom->vertex_count <= 65536)
+	{
+		GLushort *shortIndices = kuhl_malloc(sizeof(GLushort)*geom->indices_len);
+		for(GLuint i=0; i<geom->indices_len; i++)
+			shortIndices[i] = (GLushort) geom->indices[i];
+		geom->indices_type = GL_UNSIGNED_SHORT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*geom->indices_len,
+		             shortIndices, GL_STATIC_DRAW);
+		free(shortIndices);
+	}
+	else
+	{
+		geom->indices_type = GL_UNSIGNED_INT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*geom->indices_len,
+		             geom->indices, GL_STATIC_DRAW);
+	}
 	kuhl_errorcheck();
 	// Don't unbind GL_ELEMENT_ARRAY_BUFFER since the VAO keeps track of this for us.
 
@@ -1130,6 +1565,182 @@ void kuhl_geometry_indices(kuhl_geometry *geom, GLuint *indices, GLuint indexCou
 	glBindVertexArray(0);
 }
 
+/** Levels of detail stop when a level would have fewer triangles than this. */
+#define KUHL_LOD_MIN_TRIANGLES 64
+
+/** Applies a set of indices to the geometry (see
+ * kuhl_geometry_indices()) and a chain of simplified versions of
+ * them. Each level has about half of the triangles of the previous
+ * one and is made with mesh_simplify(), which collapses edges without
+ * moving any vertices, so every level draws with the same vertex
+ * attributes. All of the levels are stored in one index buffer after
+ * the full detail indices. Levels stop when a level would have fewer
+ * than 64 triangles, when simplifying stops making progress or after
+ * MAX_LODS levels.
+ *
+ * This also calculates the bounding sphere of the geometry that
+ * kuhl_geometry_lod_select() uses to choose a level. Geometry that
+ * isn't made of triangles gets the full detail indices only.
+ *
+ * @param geom The geometry to apply the indices to.
+ *
+ * @param indices The full detail indices. They are copied.
+ *
+ * @param indexCount The number of indices.
+ *
+ * @param positions The positions of the vertices (3 floats per vertex,
+ * the same data as the in_Position attribute).
+ */
+void kuhl_geometry_lod_generate(kuhl_geometry *geom, const GLuint *indices, GLuint indexCount, const GLfloat *positions)
+{
+	if(geom->primitive_type != GL_TRIANGLES || indexCount == 0)
+	{
+		kuhl_geometry_indices(geom, (GLuint*) indices, indexCount);
+		return;
+	}
+
+	kuhl_geometry_bounds(geom, positions, 3);
+	float radius = geom->bsphere[3];
+
+	/* Make room for every level: each one has at most 3/4 of the
+	 * indices of the level before it. */
+	GLuint *all = kuhl_malloc(sizeof(GLuint)*indexCount*4);
+	GLuint *level = kuhl_malloc(sizeof(GLuint)*indexCount);
+	memcpy(all, indices, sizeof(GLuint)*indexCount);
+	GLuint total = indexCount;
+	kuhl_lod lods[MAX_LODS];
+	unsigned int lodCount = 0;
+	GLuint previous = indexCount;
+	while(lodCount < MAX_LODS && previous/2 >= KUHL_LOD_MIN_TRIANGLES*3)
+	{
+		/* Simplify the full detail mesh each time so that the error
+		 * is measured from the original surface. */
+		float error;
+		GLuint count = mesh_simplify(level, indices, indexCount, positions, geom->vertex_count,
+		                             previous/2/3*3, &error);
+		if(count > previous*3/4)
+			break;
+		mesh_optimize_vertex_cache(level, count, geom->vertex_count);
+		memcpy(all + total, level, sizeof(GLuint)*count);
+		lods[lodCount].first = total;
+		lods[lodCount].count = count;
+		lods[lodCount].error = radius > 0 ? error / radius : 0;
+		lodCount++;
+		total += count;
+		previous = count;
+	}
+
+	kuhl_geometry_indices(geom, all, total);
+	free(level);
+	free(all);
+	geom->indices = NULL; // the array was freed
+	geom->indices_len = indexCount;
+	memcpy(geom->lods, lods, sizeof(kuhl_lod)*lodCount);
+	geom->lod_count = lodCount;
+}
+
+/** Largest error (in pixels) that kuhl_geometry_lod_select() allows.
+ * See kuhl_geometry_lod_threshold(). */
+static float kuhl_lod_pixels = 1;
+
+/** Sets how much kuhl_geometry_lod_select() lets the surface of a
+ * simplified level move on the screen.
+ *
+ * @param pixels Largest distance, in pixels, that a level may move
+ * the surface. The default is 1; larger values draw fewer triangles.
+ * 0 always draws the full detail indices.
+ */
+void kuhl_geometry_lod_threshold(float pixels)
+{
+	kuhl_lod_pixels = pixels;
+}
+
+/** Chooses the level of detail that kuhl_geometry_draw() and
+ * render_queue_add() use for each kuhl_geometry in a list. The
+ * bounding sphere of each geometry is projected onto the screen and
+ * the coarsest level whose error (relative to the sphere radius),
+ * multiplied by the projected radius in pixels, is within
+ * kuhl_geometry_lod_threshold() is chosen. Geometry without levels
+ * of detail and geometry that the camera is inside of is drawn at
+ * full detail; geometry that is entirely behind the camera is drawn
+ * at the coarsest level. Meshes that kuhl_geometry_merge() merged are
+ * always drawn at full detail.
+ *
+ * Call this before drawing each copy of a model since the level is
+ * stored in the kuhl_geometry.
+ *
+ * @param geom The first kuhl_geometry in a list.
+ *
+ * @param modelview The modelview matrix that the geometry will be
+ * drawn with.
+ *
+ * @param projection The projection matrix, for example from
+ * viewmat_get().
+ *
+ * @param viewportHeight The height of the viewport in pixels.
+ */
+void kuhl_geometry_lod_select(kuhl_geometry *geom, const float modelview[16], const float projection[16], int viewportHeight)
+{
+	for(kuhl_geometry *g = geom; g != NULL; g = g->next)
+	{
+		g->lod_level = 0;
+		if(g->lod_count == 0 || kuhl_lod_pixels <= 0 || g->bsphere[3] < 0)
+			continue;
+
+		float mv[16];
+		mat4f_mult_mat4f_new(mv, modelview, g->matrix);
+		float center[4] = { g->bsphere[0], g->bsphere[1], g->bsphere[2], 1 };
+		mat4f_mult_vec4f(center, mv);
+
+		/* The radius grows with the largest scale factor in the matrix. */
+		float scale = 0;
+		for(int i=0; i<3; i++)
+			scale = fmaxf(scale, vec3f_norm(mv+i*4));
+		float radius = g->bsphere[3] * scale;
+		float distance = -center[2];
+		if(distance < -radius) // behind the camera, it can't be seen
+		{
+			g->lod_level = g->lod_count;
+			continue;
+		}
+		if(distance <= radius)
+			continue;
+
+		float radiusPixels = radius / distance * projection[5] * viewportHeight / 2;
+		for(unsigned int level = g->lod_count; level > 0; level--)
+		{
+			if(g->lods[level-1].error * radiusPixels <= kuhl_lod_pixels)
+			{
+				g->lod_level = level;
+				break;
+			}
+		}
+	}
+}
+
+/** Returns the range of the index buffer of a kuhl_geometry that
+ * holds one of its levels of detail.
+ *
+ * @param geom The geometry.
+ *
+ * @param level The level, 0 for full detail. Levels that the geometry
+ * doesn't have are drawn at full detail.
+ *
+ * @param first Set to the position of the first index of the level.
+ *
+ * @return The number of indices in the level.
+ */
+GLuint kuhl_geometry_lod_range(const kuhl_geometry *geom, unsigned int level, GLuint *first)
+{
+	if(level == 0 || level > geom->lod_count)
+	{
+		*first = 0;
+		return geom->indices_len;
+	}
+	*first = geom->lods[level-1].first;
+	return geom->lods[level-1].count;
+}
+
 
 
 #if 0
@@ -1163,6 +1774,46 @@ void kuhl_geometry_init(kuhl_geometry *geom)
 }
 #endif
 
+/** Number of glDraw*() calls made by kuhl_geometry_draw() and
+ * kuhl_geometry_draw_instanced(). See kuhl_geometry_draw_calls(). */
+static unsigned long kuhl_geometry_draw_count = 0;
+
+/** Returns the number of OpenGL draw calls that kuhl_geometry_draw()
+ * and kuhl_geometry_draw_instanced() have made since the program
+ * started. Each kuhl_geometry object in a linked list is one draw
+ * call, except that each batch created by kuhl_geometry_merge() is
+ * one draw call no matter how many meshes it contains. To count the
+ * draw calls in a frame, subtract the value returned at the start of
+ * the frame from the value returned at the end of the frame.
+
+ @return The number of draw calls made so far.
+*/
+unsigned long kuhl_geometry_draw_calls(void)
+{
+	return kuhl_geometry_draw_count;
+}
+
+/** Number of vertices that kuhl_geometry_draw() and
+ * kuhl_geometry_draw_instanced() have drawn. See
+ * kuhl_geometry_draw_vertices(). */
+static unsigned long kuhl_geometry_vertex_count = 0;
+
+/** Returns the number of vertices that kuhl_geometry_draw() and
+ * kuhl_geometry_draw_instanced() have sent to OpenGL since the
+ * program started: the number of indices drawn (at the level of
+ * detail that was drawn) or, for geometry without indices, the number
+ * of vertices, times the number of instances. For triangles, divide
+ * by 3 to get the number of triangles. Like
+ * kuhl_geometry_draw_calls(), subtract the value at the start of a
+ * frame from the value at the end of the frame.
+
+ @return The number of vertices drawn so far.
+*/
+unsigned long kuhl_geometry_draw_vertices(void)
+{
+	return kuhl_geometry_vertex_count;
+}
+
 /** Draws a kuhl_geometry struct to the screen. The struct passed into
  * this function should have been set up with kuhl_geometry_new() and
  * at least one position attribute with kuhl_geometry_attrib() before
@@ -1173,9 +1824,13 @@ void kuhl_geometry_init(kuhl_geometry *geom)
  the objects in order. */
 void kuhl_geometry_draw(kuhl_geometry *geom)
 {
-	if(geom == NULL)
-		return;
-	
+	kuhl_geometry_draw_instanced(geom, 1);
+}
+
+/** Draws one kuhl_geometry object (but not the rest of the list it
+ * is in) with a single draw call. */
+static void kuhl_geometry_draw_single(kuhl_geometry *geom, GLsizei instances)
+{
 	kuhl_errorcheck();
 	
 	/* Record the OpenGL state so that we can restore it when we have
@@ -1285,9 +1940,13 @@ void kuhl_geometry_draw(kuhl_geometry *geom)
 
 	/* kuhl_geometry_attrib_get() allows vertex attribute buffers to
 	 * be mapped. Here, we check if the buffers are mapped. If they
-	 * are, we unmap them before we draw the geometry. */
+	 * are, we unmap them before we draw the geometry. Interleaved
+	 * buffers are never mapped. Buffers that belong to the caller
+	 * (such as a persistently mapped stream_buffer) are left alone. */
 	for(unsigned int i=0; i<geom->attrib_count; i++)
 	{
+		if(geom->attribs[i].stride != 0 || geom->attribs[i].external)
+			continue;
 		glBindBuffer(GL_ARRAY_BUFFER, geom->attribs[i].bufferobject);
 		GLint bufferIsMapped = 0;
 		glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_MAPPED, &bufferIsMapped);
@@ -1303,19 +1962,35 @@ void kuhl_geometry_draw(kuhl_geometry *geom)
 	 * draw the geometry. */
 	if(geom->indices_len > 0 && glIsBuffer(geom->indices_bufferobject))
 	{
-		glDrawElements(geom->primitive_type,
-		               geom->indices_len,
-		               GL_UNSIGNED_INT,
-		               NULL);
+		/* Draw the level of detail that kuhl_geometry_lod_select() chose. */
+		GLuint first;
+		GLuint count = kuhl_geometry_lod_range(geom, geom->lod_level, &first);
+		GLsizeiptr offset = first * (geom->indices_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+		if(instances == 1)
+			glDrawElements(geom->primitive_type,
+			               count,
+			               geom->indices_type,
+			               (void*) offset);
+		else
+			glDrawElementsInstanced(geom->primitive_type,
+			                        count,
+			                        geom->indices_type,
+			                        (void*) offset, instances);
 		kuhl_errorcheck();
+		kuhl_geometry_vertex_count += count * instances;
 	}
 	else
 	{
 		/* If the user didn't provide us with indices, just draw the
 		 * vertices in order. */
-		glDrawArrays(geom->primitive_type, 0, geom->vertex_count);
+		if(instances == 1)
+			glDrawArrays(geom->primitive_type, 0, geom->vertex_count);
+		else
+			glDrawArraysInstanced(geom->primitive_type, 0, geom->vertex_count, instances);
 		kuhl_errorcheck();
+		kuhl_geometry_vertex_count += geom->vertex_count * instances;
 	}
+	kuhl_geometry_draw_count++;
 
 
 	/* For each texture unit that we bound a texture to, unbind the
@@ -1349,9 +2024,558 @@ void kuhl_geometry_draw(kuhl_geometry *geom)
 	/* Unbind the VAO */
 	glBindVertexArray(previousVAO);
 	kuhl_errorcheck();
+}
+
+/** Copies the matrix of each mesh in a batch into the per-draw
+ * records and uploads the records that changed (for example, because
+ * kuhl_update_model() animated the model). Nothing is uploaded if the
+ * meshes didn't move. */
+static void kuhl_merged_batch_update(kuhl_merged_batch *batch)
+{
+	unsigned int first = batch->draw_count, last = 0;
+	for(unsigned int d=0; d<batch->draw_count; d++)
+	{
+		if(memcmp(batch->records[d].transform, batch->geoms[d]->matrix, sizeof(GLfloat)*16) == 0)
+			continue;
+		memcpy(batch->records[d].transform, batch->geoms[d]->matrix, sizeof(GLfloat)*16);
+		if(d < first)
+			first = d;
+		last = d;
+	}
+	if(first > last)
+		return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, batch->recordbuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, sizeof(kuhl_draw_record)*first,
+	                sizeof(kuhl_draw_record)*(last-first+1), batch->records+first);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	kuhl_errorcheck();
+}
+
+/** Sets up the indirect draw commands and the per-draw attributes of
+ * a batch to draw a different number of instances. Every instance of
+ * a mesh must read the same record, so the divisor of the per-draw
+ * attributes is the number of instances. The vertex array object of
+ * the batch must be bound. */
+static void kuhl_merged_batch_instances(kuhl_merged_batch *batch, GLsizei instances)
+{
+	GLuint program = batch->geoms[0]->program;
+	GLint loc = glGetAttribLocation(program, "in_DrawTransform");
+	for(int c=0; c<4; c++) // a mat4 uses four attribute locations
+		glVertexAttribDivisor(loc+c, instances);
+	loc = glGetAttribLocation(program, "in_MaterialIndex");
+	if(loc != -1)
+		glVertexAttribDivisor(loc, instances);
+
+	/* The instance count is the second value in each command. */
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->commandbuffer);
+	GLuint *commands = glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(GLuint)*5*batch->draw_count,
+	                                    GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+	for(unsigned int d=0; d<batch->draw_count; d++)
+		commands[d*5+1] = instances;
+	glUnmapBuffer(GL_DRAW_INDIRECT_BUFFER);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	kuhl_errorcheck();
+	batch->instances = instances;
+}
+
+/** Draws the batches created by kuhl_geometry_merge() with one
+ * glMultiDrawElementsIndirect() call per batch.
+
+ @return 1 if the batches were drawn, 0 if the meshes need to be
+ drawn individually instead.
+*/
+static int kuhl_geometry_merged_draw(kuhl_merged *merged, GLsizei instances)
+{
+	if(merged->disabled)
+		return 0;
+	kuhl_errorcheck();
+
+	GLint previouslyUsedProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previouslyUsedProgram);
+	GLint previouslyActiveTexture = 0;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &previouslyActiveTexture);
+	glActiveTexture(GL_TEXTURE0);
+	GLint previouslyBoundTexture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previouslyBoundTexture);
+	GLint previousVAO=0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+
+	for(unsigned int b=0; b<merged->batch_count; b++)
+	{
+		kuhl_merged_batch *batch = &(merged->batches[b]);
+		GLuint program = batch->geoms[0]->program;
+		kuhl_merged_batch_update(batch);
+		glUseProgram(program);
+
+		/* All of the meshes in the batch use the same texture (or
+		 * none). Materials that differ only by their color are
+		 * merged because the colors are vertex attributes. */
+		int hasTex = 0;
+		GLint loc = glGetUniformLocation(program, "tex");
+		if(loc != -1 && batch->texture != 0)
+		{
+			glUniform1i(loc, 0);
+			glBindTexture(GL_TEXTURE_2D, batch->texture);
+			hasTex = 1;
+		}
+		loc = glGetUniformLocation(program, "HasTex");
+		if(loc != -1)
+			glUniform1i(loc, hasTex);
+		loc = glGetUniformLocation(program, "NumBones");
+		if(loc != -1)
+			glUniform1i(loc, 0);
+		GLint mergedLoc = glGetUniformLocation(program, "MergedDraw");
+		if(mergedLoc != -1)
+			glUniform1i(mergedLoc, 1);
+
+		glBindVertexArray(batch->vao);
+		if(batch->instances != instances)
+			kuhl_merged_batch_instances(batch, instances);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->commandbuffer);
+		glMultiDrawElementsIndirect(batch->primitive_type, GL_UNSIGNED_INT, NULL,
+		                            batch->draw_count, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		kuhl_errorcheck();
+		kuhl_geometry_draw_count++;
+
+		/* Other code may draw with this program without setting the
+		 * uniform. */
+		if(mergedLoc != -1)
+			glUniform1i(mergedLoc, 0);
+		/* Each command draws all of the indices of one mesh. */
+		for(unsigned int d=0; d<batch->draw_count; d++)
+		{
+			batch->geoms[d]->has_been_drawn = 1;
+			kuhl_geometry_vertex_count += (unsigned long) batch->geoms[d]->indices_len * instances;
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, previouslyBoundTexture);
+	glActiveTexture(previouslyActiveTexture);
+	glUseProgram(previouslyUsedProgram);
+	glBindVertexArray(previousVAO);
+	kuhl_errorcheck();
+	return 1;
+}
+
+/** Draws several instances of a kuhl_geometry struct with a single
+ * draw call (per kuhl_geometry object in the list). The GLSL program
+ * can use gl_InstanceID to tell the instances apart. For example,
+ * assimp-stereo.vert draws instance 0 for the left eye and instance 1
+ * for the right eye (see viewmat_get_stereo()).
+ *
+ * If the list was merged with kuhl_geometry_merge(), the merged
+ * meshes are drawn with one draw call per batch and the rest of the
+ * list is drawn one object at a time.
+
+ @param geom The geometry to draw to the screen. If the kuhl_geometry
+ object is a part of a linked list, this function will draw each of
+ the objects in order.
+
+ @param instances The number of instances to draw. If 1, this is the
+ same as kuhl_geometry_draw().
+*/
+void kuhl_geometry_draw_instanced(kuhl_geometry *geom, GLsizei instances)
+{
+	if(geom == NULL || instances < 1)
+		return;
+
+	kuhl_merged *merged = NULL;
+	if(geom->merged != NULL && kuhl_geometry_merged_draw(geom->merged, instances))
+		merged = geom->merged;
+
+	for(kuhl_geometry *g = geom; g != NULL; g = g->next)
+	{
+		if(merged == NULL || g->merged_into != merged)
+			kuhl_geometry_draw_single(g, instances);
+	}
+}
+
+/** Checks if one kuhl_geometry object (but not the rest of the list
+ * it is in) may be inside of a view frustum. The bounding sphere of
+ * the geometry is tested first and then its bounding box, which fits
+ * long, thin meshes more tightly. Geometry whose bounds aren't known
+ * (a negative bsphere radius) is always considered visible.
+ *
+ * @param geom The geometry.
+ *
+ * @param planes The planes of the frustum from
+ * mat4f_frustum_planes() in the coordinates that geom->matrix
+ * transforms the geometry into. For example, pass it the
+ * projection * modelview matrix that the geometry is drawn with.
+ *
+ * @return 0 if the geometry is entirely outside of the frustum, 1
+ * otherwise.
+ */
+int kuhl_geometry_in_frustum(const kuhl_geometry *geom, const float planes[24])
+{
+	if(geom->bsphere[3] < 0)
+		return 1;
+
+	const float *m = geom->matrix;
+	float center[4] = { geom->bsphere[0], geom->bsphere[1], geom->bsphere[2], 1 };
+	mat4f_mult_vec4f(center, m);
+	/* The radius grows with the largest scale factor in the matrix. */
+	float scale = 0;
+	for(int i=0; i<3; i++)
+		scale = fmaxf(scale, vec3f_norm(m+i*4));
+	if(!frustum_cull_sphere(planes, center, geom->bsphere[3]*scale))
+		return 0;
+
+	/* Transform the center and half-size of the box. The
+	 * transformed box is enlarged so that it is axis aligned
+	 * again. */
+	float boxCenter[4], extent[3];
+	for(int i=0; i<3; i++)
+	{
+		boxCenter[i] = (geom->aabb[i*2] + geom->aabb[i*2+1])/2;
+		extent[i]    = (geom->aabb[i*2+1] - geom->aabb[i*2])/2;
+	}
+	boxCenter[3] = 1;
+	mat4f_mult_vec4f(boxCenter, m);
+	float boxExtent[3];
+	for(int row=0; row<3; row++)
+		boxExtent[row] = fabsf(m[row])*extent[0] + fabsf(m[4+row])*extent[1] + fabsf(m[8+row])*extent[2];
+
+	for(int p=0; p<6; p++)
+	{
+		const float *pl = planes + p*4;
+		float distance = vec3f_dot(pl, boxCenter) + pl[3];
+		float reach = fabsf(pl[0])*boxExtent[0] + fabsf(pl[1])*boxExtent[1] + fabsf(pl[2])*boxExtent[2];
+		if(distance < -reach)
+			return 0;
+	}
+	return 1;
+}
+
+/** Draws the objects in a list of kuhl_geometry objects that may be
+ * visible and skips the ones that are entirely outside of the view
+ * frustum (see kuhl_geometry_in_frustum()). Otherwise, this is the
+ * same as kuhl_geometry_draw(): the GLSL program should already be
+ * using the same modelview and projection matrices. Meshes that
+ * kuhl_geometry_merge() merged are drawn as a batch without being
+ * culled.
+ *
+ * @param geom The geometry to draw.
+ *
+ * @param modelview The modelview matrix that the geometry is drawn with.
+ *
+ * @param projection The projection matrix that the geometry is drawn with.
+ *
+ * @return The number of kuhl_geometry objects that were culled.
+ */
+unsigned int kuhl_geometry_draw_culled(kuhl_geometry *geom, const float modelview[16], const float projection[16])
+{
+	if(geom == NULL)
+		return 0;
+
+	float projmodelview[16], planes[24];
+	mat4f_mult_mat4f_new(projmodelview, projection, modelview);
+	mat4f_frustum_planes(planes, projmodelview);
+
+	kuhl_merged *merged = NULL;
+	if(geom->merged != NULL && kuhl_geometry_merged_draw(geom->merged, 1))
+		merged = geom->merged;
+
+	unsigned int culled = 0;
+	for(kuhl_geometry *g = geom; g != NULL; g = g->next)
+	{
+		if(merged != NULL && g->merged_into == merged)
+			continue;
+		if(kuhl_geometry_in_frustum(g, planes))
+			kuhl_geometry_draw_single(g, 1);
+		else
+			culled++;
+	}
+	return culled;
+}
+
+/** Returns 1 if kuhl_geometry_merge() can draw a kuhl_geometry
+ * object in a batch. Meshes with bones are drawn individually because
+ * their bone matrices are uniform variables. */
+static int kuhl_geometry_mergeable(const kuhl_geometry *geom)
+{
+#ifdef KUHL_UTIL_USE_ASSIMP
+	if(geom->bones != NULL)
+		return 0;
+#endif
+	if(geom->merged_into != NULL || geom->attrib_count == 0 ||
+	   geom->indices_len == 0 || !glIsBuffer(geom->indices_bufferobject))
+		return 0;
+	if(geom->texture_count > 1 ||
+	   (geom->texture_count == 1 && strcmp(geom->textures[0].name, "tex") != 0))
+		return 0;
+	for(unsigned int i=0; i<geom->attrib_count; i++)
+		if(!glIsBuffer(geom->attribs[i].bufferobject))
+			return 0;
+	return glGetAttribLocation(geom->program, "in_DrawTransform") != -1;
+}
+
+/** Returns 1 if two kuhl_geometry objects can be drawn by the same
+ * batch: They must use the same program, texture and primitive type
+ * and have the same vertex attributes. */
+static int kuhl_geometry_merge_compatible(const kuhl_geometry *a, const kuhl_geometry *b)
+{
+	if(a->program != b->program || a->primitive_type != b->primitive_type ||
+	   a->texture_count != b->texture_count || a->attrib_count != b->attrib_count)
+		return 0;
+	if(a->texture_count == 1 && a->textures[0].textureId != b->textures[0].textureId)
+		return 0;
+	for(unsigned int i=0; i<a->attrib_count; i++)
+	{
+		if(strcmp(a->attribs[i].name, b->attribs[i].name) != 0 ||
+		   a->attribs[i].components != b->attribs[i].components)
+			return 0;
+	}
+	return 1;
+}
+
+/** Creates the buffers for one batch of kuhl_geometry_merge() and
+ * the vertex array object that draws them.
+ *
+ * @param batch The batch to fill in. batch->geoms and batch->draw_count must already be set.
+ */
+static void kuhl_merged_batch_new(kuhl_merged_batch *batch)
+{
+	const kuhl_geometry *first = batch->geoms[0];
+	GLuint program = first->program;
+
+	/* All meshes in the batch have the same attributes; store them
+	 * interleaved. */
+	GLuint stride = 0;
+	for(unsigned int i=0; i<first->attrib_count; i++)
+		stride += first->attribs[i].components;
+	GLuint vertexCount = 0, indexCount = 0;
+	for(unsigned int d=0; d<batch->draw_count; d++)
+	{
+		vertexCount += batch->geoms[d]->vertex_count;
+		indexCount += batch->geoms[d]->indices_len;
+	}
+
+	GLfloat *vertices = kuhl_malloc(sizeof(GLfloat)*stride*vertexCount);
+	GLuint *indices = kuhl_malloc(sizeof(GLuint)*indexCount);
+	/* DrawElementsIndirectCommand: count, instanceCount, firstIndex, baseVertex, baseInstance */
+	GLuint *commands = kuhl_malloc(sizeof(GLuint)*5*batch->draw_count);
+	batch->records = kuhl_malloc(sizeof(kuhl_draw_record)*batch->draw_count);
+
+	GLuint firstVertex = 0, firstIndex = 0;
+	for(unsigned int d=0; d<batch->draw_count; d++)
+	{
+		const kuhl_geometry *g = batch->geoms[d];
+		GLuint offset = 0;
+		for(unsigned int i=0; i<g->attrib_count; i++)
+		{
+			kuhl_geometry_attrib_copy(g, i, vertices + firstVertex*stride + offset, stride);
+			offset += g->attribs[i].components;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, g->indices_bufferobject);
+		if(g->indices_type == GL_UNSIGNED_SHORT)
+		{
+			/* The batch holds all of its indices as 32-bit values. */
+			GLushort *shortIndices = kuhl_malloc(sizeof(GLushort)*g->indices_len);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLushort)*g->indices_len, shortIndices);
+			for(GLuint i=0; i<g->indices_len; i++)
+				indices[firstIndex+i] = shortIndices[i];
+			free(shortIndices);
+		}
+		else
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLuint)*g->indices_len, indices+firstIndex);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		kuhl_errorcheck();
+
+		/* The base instance selects the record of this mesh from the
+		 * per-draw attributes. */
+		commands[d*5+0] = g->indices_len;
+		commands[d*5+1] = 1;
+		commands[d*5+2] = firstIndex;
+		commands[d*5+3] = firstVertex;
+		commands[d*5+4] = d;
+
+		memcpy(batch->records[d].transform, g->matrix, sizeof(GLfloat)*16);
+		batch->records[d].material = g->material;
+
+		firstVertex += g->vertex_count;
+		firstIndex += g->indices_len;
+	}
+
+	batch->texture = first->texture_count == 1 ? first->textures[0].textureId : 0;
+	batch->primitive_type = first->primitive_type;
+	batch->instances = 1;
+
+	glGenVertexArrays(1, &(batch->vao));
+	glBindVertexArray(batch->vao);
+
+	glGenBuffers(1, &(batch->vertexbuffer));
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vertexbuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*stride*vertexCount, vertices, GL_STATIC_DRAW);
+	GLuint offset = 0;
+	for(unsigned int i=0; i<first->attrib_count; i++)
+	{
+		GLint loc = glGetAttribLocation(program, first->attribs[i].name);
+		if(loc != -1)
+		{
+			glEnableVertexAttribArray(loc);
+			glVertexAttribPointer(loc, first->attribs[i].components, GL_FLOAT, GL_FALSE,
+			                      sizeof(GLfloat)*stride,
+			                      (const GLvoid*) (uintptr_t) (sizeof(GLfloat)*offset));
+		}
+		offset += first->attribs[i].components;
+	}
+
+	glGenBuffers(1, &(batch->indexbuffer));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->indexbuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indexCount, indices, GL_STATIC_DRAW);
+
+	/* The per-draw records advance once per mesh instead of once per
+	 * vertex. */
+	glGenBuffers(1, &(batch->recordbuffer));
+	glBindBuffer(GL_ARRAY_BUFFER, batch->recordbuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(kuhl_draw_record)*batch->draw_count, batch->records, GL_DYNAMIC_DRAW);
+	GLint loc = glGetAttribLocation(program, "in_DrawTransform");
+	for(int c=0; c<4; c++) // a mat4 uses four attribute locations, one per column
+	{
+		glEnableVertexAttribArray(loc+c);
+		glVertexAttribPointer(loc+c, 4, GL_FLOAT, GL_FALSE, sizeof(kuhl_draw_record),
+		                      (const GLvoid*) (offsetof(kuhl_draw_record, transform) + sizeof(GLfloat)*4*c));
+		glVertexAttribDivisor(loc+c, 1);
+	}
+	loc = glGetAttribLocation(program, "in_MaterialIndex");
+	if(loc != -1)
+	{
+		glEnableVertexAttribArray(loc);
+		glVertexAttribIPointer(loc, 1, GL_UNSIGNED_INT, sizeof(kuhl_draw_record),
+		                       (const GLvoid*) offsetof(kuhl_draw_record, material));
+		glVertexAttribDivisor(loc, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &(batch->commandbuffer));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->commandbuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(GLuint)*5*batch->draw_count, commands, GL_STATIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	kuhl_errorcheck();
+
+	free(vertices);
+	free(indices);
+	free(commands);
+}
+
+/** Packs the meshes in a kuhl_geometry list into as few vertex and
+ * index buffers as possible so that kuhl_geometry_draw() can draw
+ * them with one glMultiDrawElementsIndirect() call per buffer pair
+ * instead of one draw call per mesh. Meshes are drawn by the same
+ * call if they use the same program, texture, primitive type and
+ * vertex attributes.
+ *
+ * The matrix of each mesh (and its material index) is sent to the
+ * GLSL program in per-instance vertex attributes. The program must
+ * have a "mat4 in_DrawTransform" attribute that it uses instead of the
+ * GeomTransform uniform when the "int MergedDraw" uniform is 1 (see
+ * assimp.vert). It may also have a "uint in_MaterialIndex"
+ * attribute. Meshes with bones, without indices, or whose program
+ * doesn't have in_DrawTransform are still drawn individually.
+ *
+ * The matrices may continue to change (kuhl_update_model() works as
+ * before). If the vertices, indices, textures or program of a merged
+ * mesh change, the batches are no longer used and every mesh is drawn
+ * individually. The buffers of each mesh are kept for this reason and
+ * so that kuhl_geometry_attrib_get() continues to work.
+ *
+ * @param first_geom The first kuhl_geometry object in a list. Draw
+ * the list starting with this object.
+ *
+ * @return The number of batches that were created. 0 if OpenGL 4.3 (or
+ * ARB_multi_draw_indirect and ARB_base_instance) isn't available or
+ * if there was nothing to merge; the meshes are drawn individually in
+ * that case.
+ */
+int kuhl_geometry_merge(kuhl_geometry *first_geom)
+{
+	if(first_geom == NULL || first_geom->merged != NULL)
+		return 0;
+	if(!GLEW_VERSION_4_3 && !(GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance))
+	{
+		msg(INFO, "glMultiDrawElementsIndirect() is not available; meshes will be drawn individually.\n");
+		return 0;
+	}
+
+	/* Find the meshes that can be merged and which batch each one goes in. */
+	unsigned int geomCount = kuhl_geometry_count(first_geom);
+	kuhl_geometry **members = kuhl_malloc(sizeof(kuhl_geometry*)*geomCount);
+	unsigned int *batchOf = kuhl_malloc(sizeof(unsigned int)*geomCount);
+	kuhl_geometry **batchFirst = kuhl_malloc(sizeof(kuhl_geometry*)*geomCount);
+	unsigned int memberCount = 0, batchCount = 0;
+	for(kuhl_geometry *g = first_geom; g != NULL; g = g->next)
+	{
+		if(!kuhl_geometry_mergeable(g))
+			continue;
+		unsigned int b = 0;
+		while(b < batchCount && !kuhl_geometry_merge_compatible(batchFirst[b], g))
+			b++;
+		if(b == batchCount)
+			batchFirst[batchCount++] = g;
+		members[memberCount] = g;
+		batchOf[memberCount] = b;
+		memberCount++;
+	}
+
+	/* Merging doesn't reduce the number of draw calls. */
+	if(batchCount == memberCount)
+	{
+		msg(DEBUG, "None of the %u meshes can be merged; they will be drawn individually.\n", geomCount);
+		free(members);
+		free(batchOf);
+		free(batchFirst);
+		return 0;
+	}
+
+	kuhl_merged *merged = kuhl_malloc(sizeof(kuhl_merged));
+	merged->batches = kuhl_malloc(sizeof(kuhl_merged_batch)*batchCount);
+	merged->batch_count = batchCount;
+	merged->disabled = 0;
+	for(unsigned int b=0; b<batchCount; b++)
+	{
+		kuhl_merged_batch *batch = &(merged->batches[b]);
+		batch->geoms = kuhl_malloc(sizeof(kuhl_geometry*)*memberCount);
+		batch->draw_count = 0;
+		for(unsigned int m=0; m<memberCount; m++)
+		{
+			if(batchOf[m] == b)
+				batch->geoms[batch->draw_count++] = members[m];
+		}
+		kuhl_merged_batch_new(batch);
+	}
+	for(unsigned int m=0; m<memberCount; m++)
+		members[m]->merged_into = merged;
+	first_geom->merged = merged;
+
+	msg(DEBUG, "Merged %u of %u meshes into %u multi-draw batches.\n", memberCount, geomCount, batchCount);
+	free(members);
+	free(batchOf);
+	free(batchFirst);
+	return batchCount;
+}
 
-	/* Draw the next nodes in the list. */
-	kuhl_geometry_draw(geom->next);
+/** Deletes the batches created by kuhl_geometry_merge(). */
+static void kuhl_merged_delete(kuhl_merged *merged)
+{
+	for(unsigned int b=0; b<merged->batch_count; b++)
+	{
+		kuhl_merged_batch *batch = &(merged->batches[b]);
+		for(unsigned int d=0; d<batch->draw_count; d++)
+			batch->geoms[d]->merged_into = NULL;
+		glDeleteVertexArrays(1, &(batch->vao));
+		glDeleteBuffers(1, &(batch->vertexbuffer));
+		glDeleteBuffers(1, &(batch->indexbuffer));
+		glDeleteBuffers(1, &(batch->recordbuffer));
+		glDeleteBuffers(1, &(batch->commandbuffer));
+		free(batch->geoms);
+		free(batch->records);
+	}
+	free(merged->batches);
+	free(merged);
 }
 
 /** Deletes kuhl_geometry struct by freeing the OpenGL buffers that
@@ -1370,23 +2594,25 @@ void kuhl_geometry_delete(kuhl_geometry *geom)
 {
 	while(geom->next != NULL)
 		kuhl_geometry_delete(geom->next);
+
+	if(geom->merged != NULL)
+		kuhl_merged_delete(geom->merged);
+	geom->merged = NULL;
+	kuhl_geometry_unmerge(geom);
 	
+	/* Interleaved attributes share a buffer; it is deleted along
+	 * with the last attribute that uses it. */
 	for(unsigned int i=0; i<geom->attrib_count; i++)
-	{
-		kuhl_attrib *attrib = &(geom->attribs[i]);
-		if(attrib->name)
-			free(attrib->name);
-		attrib->name = NULL;
-		if(glIsBuffer(attrib->bufferobject))
-			glDeleteBuffers(1, &(attrib->bufferobject));
-		attrib->bufferobject = 0;
-	}
+		kuhl_geometry_attrib_release(geom, i);
 	geom->attrib_count = 0;
 
 	if(glIsBuffer(geom->indices_bufferobject))
 		glDeleteBuffers(1, &(geom->indices_bufferobject));
 	geom->indices_bufferobject = 0;
 	geom->indices_len = 0;
+	geom->indices_type = GL_UNSIGNED_INT;
+	geom->lod_count = 0;
+	geom->lod_level = 0;
 	
 	if(glIsVertexArray(geom->vao))
 		glDeleteVertexArrays(1, &(geom->vao));
@@ -2574,6 +3800,76 @@ kuhl_geometry* kuhl_geometry_append(kuhl_geometry *a, kuhl_geometry *b)
 
 
 
+static int kuhl_model_interleave = 1; /**< Should kuhl_load_model() interleave vertex attributes? */
+
+/** Sets how kuhl_load_model() stores the vertex attributes of each
+ * mesh. By default, all of the attributes are interleaved in one
+ * buffer (see kuhl_geometry_attrib_interleaved()). This is usually
+ * faster to draw. Programs that modify the attributes of a model
+ * don't need to change this; kuhl_geometry_attrib_get() moves the
+ * attribute it returns into its own buffer.
+ *
+ * @param interleave 1 to store all attributes of a mesh in one
+ * buffer, 0 to store each attribute in its own buffer. Applies to
+ * models that are loaded afterwards.
+ */
+void kuhl_load_model_interleave(int interleave)
+{
+	kuhl_model_interleave = interleave;
+}
+
+static int kuhl_model_merge = 0; /**< Should kuhl_load_model() merge the meshes of a model? */
+
+/** Sets whether kuhl_load_model() calls kuhl_geometry_merge() so that
+ * models with many meshes are drawn with a few
+ * glMultiDrawElementsIndirect() calls instead of one draw call per
+ * mesh. Off by default. The GLSL program must support merged draws
+ * (see kuhl_geometry_merge() and assimp.vert); otherwise, or if the
+ * OpenGL context doesn't support multi-draw indirect, the meshes are
+ * drawn individually as usual.
+ *
+ * @param merge 1 to merge the meshes of models that are loaded
+ * afterwards, 0 to draw each mesh individually.
+ */
+void kuhl_load_model_merge(int merge)
+{
+	kuhl_model_merge = merge;
+}
+
+static int kuhl_model_optimize = 0; /**< Should kuhl_load_model() reorder triangles and vertices for the vertex cache? */
+
+/** Sets whether kuhl_load_model() reorders the triangles and vertices
+ * of each triangle mesh with mesh_optimize_vertex_cache() and
+ * mesh_optimize_vertex_fetch() so that the GPU transforms fewer
+ * vertices and reads the vertex data mostly sequentially. The model
+ * looks the same, but the vertices of each mesh are stored in a
+ * different order than they are in the model file. Off by default
+ * because it makes large models take longer to load.
+ *
+ * @param optimize 1 to optimize models that are loaded afterwards, 0
+ * to keep the order from the model file.
+ */
+void kuhl_load_model_optimize(int optimize)
+{
+	kuhl_model_optimize = optimize;
+}
+
+static int kuhl_model_lod = 0; /**< Should kuhl_load_model() generate levels of detail? */
+
+/** Sets whether kuhl_load_model() simplifies each triangle mesh into
+ * a chain of levels of detail with kuhl_geometry_lod_generate(). The
+ * program chooses the level to draw for each copy of the model with
+ * kuhl_geometry_lod_select(); otherwise, the full detail mesh is
+ * drawn. Off by default because simplifying large models takes time.
+ *
+ * @param lod 1 to generate levels of detail for models that are
+ * loaded afterwards, 0 to only store the full detail mesh.
+ */
+void kuhl_load_model_lod(int lod)
+{
+	kuhl_model_lod = lod;
+}
+
 /** Recursively calls itself to create one or more kuhl_geometry
  * structs for all of the nodes in the scene.
  *
@@ -2679,8 +3975,14 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 
 		geom->assimp_node = (struct aiNode*) nd;
 		geom->assimp_scene = (struct aiScene*) sc;
+		geom->material = mesh->mMaterialIndex;
 		mat4f_copy(geom->matrix, currentTransform);
 
+		/* The attributes are collected here and then stored in the
+		 * kuhl_geometry struct all at once. */
+		kuhl_attrib_source sources[6];
+		unsigned int sourceCount = 0;
+
 		/* Store the vertex position attribute into the kuhl_geometry struct */
 		float *vertexPositions = kuhl_malloc(sizeof(float)*mesh->mNumVertices*3);
 		for(unsigned int i=0; i<mesh->mNumVertices; i++)
@@ -2689,8 +3991,7 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 			vertexPositions[i*3+1] = (mesh->mVertices)[i].y;
 			vertexPositions[i*3+2] = (mesh->mVertices)[i].z;
 		}
-		kuhl_geometry_attrib(geom, vertexPositions, 3, "in_Position", 0);
-		free(vertexPositions);
+		sources[sourceCount++] = (kuhl_attrib_source) { vertexPositions, 3, "in_Position", 0 };
 
 		/* Store the normal vectors in the kuhl_geometry struct */
 		if(mesh->mNormals != NULL)
@@ -2702,8 +4003,7 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 				normals[i*3+1] = (mesh->mNormals)[i].y;
 				normals[i*3+2] = (mesh->mNormals)[i].z;
 			}
-			kuhl_geometry_attrib(geom, normals, 3, "in_Normal", 0);
-			free(normals);
+			sources[sourceCount++] = (kuhl_attrib_source) { normals, 3, "in_Normal", 0 };
 		}
 
 		/* Store the vertex color attribute */
@@ -2720,8 +4020,7 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 				if(colorComps == 4)
 					colors[i*colorComps+3] = mesh->mColors[0][i].a;
 			}
-			kuhl_geometry_attrib(geom, colors, 4, "in_Color", 0);
-			free(colors);
+			sources[sourceCount++] = (kuhl_attrib_source) { colors, colorComps, "in_Color", 0 };
 		}
 		/* If there are no vertex colors, try to use material colors instead */
 		else
@@ -2742,7 +4041,7 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 					colors[i*3+1] = diffuse.g;
 					colors[i*3+2] = diffuse.b;
 				}
-				kuhl_geometry_attrib(geom, colors, 3, "in_Color", 0);
+				sources[sourceCount++] = (kuhl_attrib_source) { colors, 3, "in_Color", 0 };
 			}
 		}
 		
@@ -2756,8 +4055,7 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 				texCoord[i*2+0] = mesh->mTextureCoords[0][i].x;
 				texCoord[i*2+1] = mesh->mTextureCoords[0][i].y;
 			}
-			kuhl_geometry_attrib(geom, texCoord, 2, "in_TexCoord", 1);
-			free(texCoord);
+			sources[sourceCount++] = (kuhl_attrib_source) { texCoord, 2, "in_TexCoord", 1 };
 		}
 
 		/* Fill in bone information */
@@ -2815,11 +4113,56 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 					exit(EXIT_FAILURE);
 				}
 			}
-			kuhl_geometry_attrib(geom, indices, 4, "in_BoneIndex", 0);
-			kuhl_geometry_attrib(geom, weights, 4, "in_BoneWeight", 0);
-			free(indices);
-			free(weights);
+			sources[sourceCount++] = (kuhl_attrib_source) { indices, 4, "in_BoneIndex", 0 };
+			sources[sourceCount++] = (kuhl_attrib_source) { weights, 4, "in_BoneWeight", 0 };
 		} // end if there are bones 
+
+		/* Get indices to draw with */
+		GLuint numIndices = mesh->mNumFaces * meshPrimitiveType;
+		GLuint *meshIndices = NULL;
+		if(numIndices > 0)
+		{
+			meshIndices = kuhl_malloc(sizeof(GLuint)*numIndices);
+			for(unsigned int t = 0; t<mesh->mNumFaces; t++) // for each face
+			{
+				const struct aiFace* face = &mesh->mFaces[t];
+				for(unsigned int x = 0; x < meshPrimitiveType; x++) // for each index
+					meshIndices[t*meshPrimitiveType+x] = face->mIndices[x];
+			}
+		}
+
+		/* Reorder the triangles for the vertex cache and then the
+		 * vertices in the order that the triangles use them. */
+		if(kuhl_model_optimize && meshPrimitiveTypeGL == GL_TRIANGLES && numIndices > 0)
+		{
+			mesh_optimize_vertex_cache(meshIndices, numIndices, mesh->mNumVertices);
+			unsigned int *remap = kuhl_malloc(sizeof(unsigned int)*mesh->mNumVertices);
+			mesh_optimize_vertex_fetch(meshIndices, numIndices, mesh->mNumVertices, remap);
+			for(unsigned int i=0; i<sourceCount; i++)
+				mesh_optimize_remap((GLfloat*) sources[i].data, sources[i].components,
+				                    mesh->mNumVertices, remap);
+			free(remap);
+		}
+
+		if(kuhl_model_interleave)
+			kuhl_geometry_attrib_interleaved(geom, sources, sourceCount);
+		else
+		{
+			for(unsigned int i=0; i<sourceCount; i++)
+				kuhl_geometry_attrib(geom, sources[i].data, sources[i].components,
+				                     sources[i].name, sources[i].warnIfAttribMissing);
+		}
+
+		if(numIndices > 0)
+		{
+			if(kuhl_model_lod)
+				kuhl_geometry_lod_generate(geom, meshIndices, numIndices, vertexPositions);
+			else
+				kuhl_geometry_indices(geom, meshIndices, numIndices);
+			free(meshIndices);
+		}
+		for(unsigned int i=0; i<sourceCount; i++)
+			free((GLfloat*) sources[i].data);
 		
 		/* Find our texture and tell our kuhl_geometry object about
 		 * it. */
@@ -2855,21 +4198,6 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 			}
 		}
 
-		if(mesh->mNumFaces > 0)
-		{
-			/* Get indices to draw with */
-			GLuint numIndices = mesh->mNumFaces * meshPrimitiveType;
-			GLuint *indices = kuhl_malloc(sizeof(GLuint)*numIndices);
-			for(unsigned int t = 0; t<mesh->mNumFaces; t++) // for each face
-			{
-				const struct aiFace* face = &mesh->mFaces[t];
-				for(unsigned int x = 0; x < meshPrimitiveType; x++) // for each index
-					indices[t*meshPrimitiveType+x] = face->mIndices[x];
-			}
-			kuhl_geometry_indices(geom, indices, numIndices);
-			free(indices);
-		}
-
 
 		/* Initialize list of bone matrices if this mesh has bones. */
 		if(mesh->mNumBones > 0)
@@ -2883,6 +4211,9 @@ static kuhl_geometry* kuhl_private_load_model(const struct aiScene *sc,
 			for(unsigned int b=mesh->mNumBones; b < MAX_BONES; b++)
 				mat4f_identity(bones->matrices[b]);
 			geom->bones = bones;
+			/* The bones move the vertices away from the bounds
+			 * that were calculated from in_Position. */
+			geom->bsphere[3] = -1;
 		}
 
 		msg(DEBUG, "Mesh #%03u in node \"%s\" (node has %d meshes): verts=%d indices=%d primType=%d normals=%s colors=%s texCoords=%s bones=%d tex=%s\n",
@@ -3043,6 +4374,9 @@ kuhl_geometry* kuhl_load_model(const char *modelFilename, const char *textureDir
 	 * also call kuhl_update_model(). */
 	kuhl_update_model(ret, 0, -1);
 
+	if(kuhl_model_merge)
+		kuhl_geometry_merge(ret);
+
 	/* Calculate bounding box information for the model */
 	float bboxLocal[6];
 	kuhl_private_calc_bbox(scene->mRootNode, NULL, scene, bboxLocal);
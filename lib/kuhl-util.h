@@ -48,6 +48,7 @@ extern "C" {
 #define MAX_BONES 128
 #define MAX_ATTRIBUTES 16
 #define MAX_TEXTURES 8
+#define MAX_LODS 8 /**< Maximum number of simplified levels of detail per kuhl_geometry */
 	
 #if KUHL_UTIL_USE_ASSIMP
 typedef struct
@@ -72,9 +73,23 @@ enum
 typedef struct
 {
 	char*    name; /**< GLSL variable name the attribute information should be linked with. */
-	GLuint   bufferobject; /**< OpenGL buffer the attribute is stored in */
+	GLuint   bufferobject; /**< OpenGL buffer the attribute is stored in. Interleaved attributes share a buffer. */
+	GLuint   components; /**< Number of floats per vertex */
+	GLsizei  stride; /**< Bytes from one vertex to the next in the buffer. 0 if the attribute has the buffer to itself. */
+	GLuint   offset; /**< Byte offset of the attribute in the first vertex */
+	int      external; /**< 1 if the buffer belongs to the caller (see kuhl_geometry_attrib_buffer()) */
 } kuhl_attrib;
 
+/** Describes one of the attributes that kuhl_geometry_attrib_interleaved()
+ * packs into a single buffer. */
+typedef struct
+{
+	const GLfloat *data; /**< vertex_count * components floats, the same as the data passed to kuhl_geometry_attrib() */
+	GLuint components; /**< Number of floats per vertex */
+	const char *name; /**< GLSL variable name */
+	int warnIfAttribMissing; /**< Print a warning if the GLSL program doesn't use this attribute */
+} kuhl_attrib_source;
+
 /** There is an array of kuhl_texture structs inside of
  * kuhl_geometry. */
 typedef struct
@@ -82,6 +97,51 @@ typedef struct
 	char* name; /**< GLSL variable name the texture should be linked with. */
 	GLuint textureId; /**< OpenGL texture id/name of the texture */
 } kuhl_texture;
+
+/** One simplified level of detail of a kuhl_geometry. Its indices
+ * are stored in the same index buffer as the full detail indices. */
+typedef struct
+{
+	GLuint first; /**< Position of the first index of this level in the index buffer */
+	GLuint count; /**< Number of indices in this level */
+	float error; /**< Largest distance that the surface moved, relative to the radius of the bounding sphere */
+} kuhl_lod;
+
+/** The data that kuhl_geometry_merge() stores for each mesh it draws
+ * with glMultiDrawElementsIndirect(). The GLSL program reads it
+ * through per-instance vertex attributes. */
+typedef struct
+{
+	GLfloat transform[16]; /**< The matrix of the mesh (in_DrawTransform, replaces the GeomTransform uniform) */
+	GLuint material; /**< Material index of the mesh (in_MaterialIndex) */
+} kuhl_draw_record;
+
+/** A set of meshes that kuhl_geometry_merge() packed into one vertex
+ * buffer and one index buffer. All of the meshes use the same
+ * program, texture, primitive type and vertex attributes and are
+ * drawn with a single glMultiDrawElementsIndirect() call. */
+typedef struct
+{
+	GLuint vao; /**< Vertex array object for the merged buffers */
+	GLuint vertexbuffer; /**< Interleaved vertex attributes of every mesh */
+	GLuint indexbuffer; /**< Indices of every mesh */
+	GLuint recordbuffer; /**< One kuhl_draw_record per mesh */
+	GLuint commandbuffer; /**< One indirect draw command per mesh */
+	GLuint texture; /**< Texture bound to the "tex" sampler, 0 if none */
+	GLenum primitive_type;
+	GLsizei instances; /**< Number of instances that the commands and the divisor of the per-draw attributes are set up for */
+	unsigned int draw_count; /**< Number of meshes */
+	struct _kuhl_geometry_ **geoms; /**< The meshes in the order they are drawn */
+	kuhl_draw_record *records; /**< Copy of the data in recordbuffer */
+} kuhl_merged_batch;
+
+/** The batches that draw a kuhl_geometry list after kuhl_geometry_merge(). */
+typedef struct
+{
+	kuhl_merged_batch *batches;
+	unsigned int batch_count;
+	int disabled; /**< Set when a mesh changes after it was merged. The meshes are drawn individually afterwards. */
+} kuhl_merged;
 	
 /** The kuhl_geometry struct is used to quickly draw 3D objects in
  * OpenGL 3.0. For more information, see the example programs and the
@@ -105,10 +165,21 @@ typedef struct _kuhl_geometry_
 	GLuint *indices; /**< Allows you to specify which vertices are a part of a primitive. This is useful if a single vertex is shared by multiple primitives. If this is set to NULL, the vertices are drawn in order. - User should set this. */
 	GLuint indices_len; /**< How many indices are there? - User should set this. */
 	GLuint indices_bufferobject; /**< What is the OpenGL buffer object that holds the indices? - Set by kuhl_geometry_init(). */
+	GLenum indices_type; /**< GL_UNSIGNED_SHORT if the index buffer holds 16-bit indices, otherwise GL_UNSIGNED_INT - Set by kuhl_geometry_indices(). */
+
+	float aabb[6]; /**< Bounding box (xmin,xmax,ymin,ymax,zmin,zmax) of the vertices before matrix is applied - Set with bsphere. */
+	float bsphere[4]; /**< Bounding sphere (x,y,z,radius) of the vertices before matrix is applied - Set when in_Position is given to kuhl_geometry_attrib() or kuhl_geometry_attrib_interleaved(). A negative radius means that the bounds are unknown. */
+	kuhl_lod lods[MAX_LODS]; /**< Simplified levels of detail, lods[0] is level 1 - Set by kuhl_geometry_lod_generate(). */
+	unsigned int lod_count; /**< Number of simplified levels */
+	unsigned int lod_level; /**< Level that is drawn, 0 is full detail - Set by kuhl_geometry_lod_select(). */
 
 	
 	float matrix[16]; /**< A matrix that all of this geometry should be transformed by */
 	int has_been_drawn; /**< Has this piece of geometry been drawn yet? */
+	GLuint material; /**< Material index, only used by merged draws (see kuhl_draw_record) */
+
+	kuhl_merged *merged; /**< Batches that draw this list, set on the first kuhl_geometry in a list by kuhl_geometry_merge() */
+	kuhl_merged *merged_into; /**< Batches that draw this kuhl_geometry, NULL if it is drawn by itself */
 	
 #if KUHL_UTIL_USE_ASSIMP
 	struct aiNode *assimp_node; /**< Assimp node that this kuhl_geometry object was created from. */
@@ -157,22 +228,33 @@ GLint kuhl_get_attribute(GLuint program, const char *attributeName);
 
 
 
-void kuhl_bbox_transform(float bbox[6], float mat[16]);
+void kuhl_bbox_transform(float bbox[6], const float mat[16]);
 
-#if 0
+int kuhl_geometry_bbox(const kuhl_geometry *geom, const float mat[16], float bbox[6]);
 int kuhl_geometry_collide(kuhl_geometry *geom1, float mat1[16],
                           kuhl_geometry *geom2, float mat2[16]);
-#endif
 
 void kuhl_geometry_new(kuhl_geometry *geom, GLuint program, unsigned int vertexCount, GLint primitive_type);
 void kuhl_geometry_draw(kuhl_geometry *geom);
+void kuhl_geometry_draw_instanced(kuhl_geometry *geom, GLsizei instances);
+unsigned long kuhl_geometry_draw_calls(void);
+unsigned long kuhl_geometry_draw_vertices(void);
+int kuhl_geometry_in_frustum(const kuhl_geometry *geom, const float planes[24]);
+unsigned int kuhl_geometry_draw_culled(kuhl_geometry *geom, const float modelview[16], const float projection[16]);
+int kuhl_geometry_merge(kuhl_geometry *first_geom);
 void kuhl_geometry_delete(kuhl_geometry *geom);
 unsigned int kuhl_geometry_count(const kuhl_geometry *geom);
 
 void kuhl_geometry_program(kuhl_geometry *geom, GLuint program, int kg_options);
 GLfloat* kuhl_geometry_attrib_get(kuhl_geometry *geom, const char *name, GLint *size);
 void kuhl_geometry_indices(kuhl_geometry *geom, GLuint *indices, GLuint indexCount);
+void kuhl_geometry_lod_generate(kuhl_geometry *geom, const GLuint *indices, GLuint indexCount, const GLfloat *positions);
+void kuhl_geometry_lod_select(kuhl_geometry *geom, const float modelview[16], const float projection[16], int viewportHeight);
+void kuhl_geometry_lod_threshold(float pixels);
+GLuint kuhl_geometry_lod_range(const kuhl_geometry *geom, unsigned int level, GLuint *first);
 void kuhl_geometry_attrib(kuhl_geometry *geom, const GLfloat *data, GLuint components, const char* name, int kg_options);
+void kuhl_geometry_attrib_interleaved(kuhl_geometry *geom, const kuhl_attrib_source *sources, unsigned int count);
+void kuhl_geometry_attrib_buffer(kuhl_geometry *geom, GLuint buffer, GLuint components, GLsizei stride, GLintptr offset, const char *name, int warnIfAttribMissing);
 void kuhl_geometry_texture(kuhl_geometry *geom, GLuint texture, const char* name, int kg_options);
 
 
@@ -188,6 +270,10 @@ void kuhl_screenshot(const char *outputImageFilename);
 void kuhl_video_record(const char *fileLabel, int fps);
 
 #ifdef KUHL_UTIL_USE_ASSIMP
+void kuhl_load_model_interleave(int interleave);
+void kuhl_load_model_merge(int merge);
+void kuhl_load_model_optimize(int optimize);
+void kuhl_load_model_lod(int lod);
 void kuhl_update_model(kuhl_geometry *first_geom, unsigned int animationNum, float time);
 kuhl_geometry* kuhl_load_model(const char *modelFilename, const char *textureDirname, GLuint program, float bbox[6]);
 #endif // end use assimp
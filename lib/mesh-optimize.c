@@ -0,0 +1,318 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "mesh-optimize.h"
+#include "msg.h"
+
+/* Constants from Forsyth's article. */
+#define MESH_OPTIMIZE_DECAY_POWER 1.5f     /**< How quickly the score falls off toward the end of the cache */
+#define MESH_OPTIMIZE_LAST_TRI_SCORE 0.75f /**< Score of the vertices of the most recent triangle */
+#define MESH_OPTIMIZE_VALENCE_SCALE 2.0f   /**< Bonus for vertices with few triangles left */
+#define MESH_OPTIMIZE_VALENCE_POWER 0.5f
+#define MESH_OPTIMIZE_VALENCE_TABLE 32     /**< Valence scores are precomputed up to this many triangles */
+
+/** Allocates memory or exits. */
+static void* mesh_optimize_malloc(size_t size)
+{
+	void *ptr = malloc(size > 0 ? size : 1);
+	if(ptr == NULL)
+	{
+		msg(FATAL, "Unable to allocate %zu bytes to optimize a mesh.\n", size);
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+/** The score of a vertex. Triangles with high scoring vertices are
+ * drawn first. Vertices that are near the front of the cache score
+ * highly, and so do vertices that only have a few triangles left
+ * (so that they don't get left behind).
+
+    @param cachePos Position of the vertex in the cache, -1 if it isn't in the cache.
+    @param remaining The number of triangles using this vertex that haven't been drawn yet.
+*/
+static float mesh_optimize_vertex_score(int cachePos, unsigned int remaining)
+{
+	static float cacheScore[MESH_OPTIMIZE_CACHE_SIZE];
+	static float valenceScore[MESH_OPTIMIZE_VALENCE_TABLE];
+	static int tablesReady = 0;
+	if(!tablesReady)
+	{
+		for(int i=0; i<MESH_OPTIMIZE_CACHE_SIZE; i++)
+		{
+			/* The last triangle's vertices get a fixed score so that
+			 * the next triangle doesn't prefer one of them. */
+			if(i < 3)
+				cacheScore[i] = MESH_OPTIMIZE_LAST_TRI_SCORE;
+			else
+				cacheScore[i] = powf(1.0f - (i-3) / (float) (MESH_OPTIMIZE_CACHE_SIZE-3), MESH_OPTIMIZE_DECAY_POWER);
+		}
+		for(int i=1; i<MESH_OPTIMIZE_VALENCE_TABLE; i++)
+			valenceScore[i] = MESH_OPTIMIZE_VALENCE_SCALE * powf(i, -MESH_OPTIMIZE_VALENCE_POWER);
+		tablesReady = 1;
+	}
+
+	if(remaining == 0)
+		return -1; // no triangles need this vertex
+	float score = 0;
+	if(cachePos >= 0)
+		score = cacheScore[cachePos];
+	if(remaining < MESH_OPTIMIZE_VALENCE_TABLE)
+		score += valenceScore[remaining];
+	else
+		score += MESH_OPTIMIZE_VALENCE_SCALE * powf(remaining, -MESH_OPTIMIZE_VALENCE_POWER);
+	return score;
+}
+
+/** Reorders the triangles of a mesh so that a GPU's post-transform
+ * vertex cache is used well. The vertices aren't changed.
+
+    @param indices The indices of a triangle list (3 per triangle). The triangles are reordered in place.
+
+    @param indexCount The number of indices.
+
+    @param vertexCount The number of vertices. Every index must be smaller than this.
+*/
+void mesh_optimize_vertex_cache(unsigned int *indices, unsigned int indexCount, unsigned int vertexCount)
+{
+	unsigned int triCount = indexCount / 3;
+	if(triCount < 2)
+		return;
+
+	/* Count the triangles that use each vertex and make a list of
+	 * them. The triangles of vertex v are
+	 * adjacent[adjacentStart[v]] ... adjacent[adjacentStart[v]+remaining[v]-1];
+	 * triangles are removed from the list as they are drawn. */
+	unsigned int *remaining = mesh_optimize_malloc(sizeof(unsigned int)*vertexCount);
+	unsigned int *adjacentStart = mesh_optimize_malloc(sizeof(unsigned int)*vertexCount);
+	unsigned int *adjacent = mesh_optimize_malloc(sizeof(unsigned int)*triCount*3);
+	memset(remaining, 0, sizeof(unsigned int)*vertexCount);
+	for(unsigned int i=0; i<triCount*3; i++)
+		remaining[indices[i]]++;
+	unsigned int start = 0;
+	for(unsigned int v=0; v<vertexCount; v++)
+	{
+		adjacentStart[v] = start;
+		start += remaining[v];
+		remaining[v] = 0;
+	}
+	for(unsigned int i=0; i<triCount*3; i++)
+	{
+		unsigned int v = indices[i];
+		adjacent[adjacentStart[v] + remaining[v]++] = i/3;
+	}
+
+	int *cachePos = mesh_optimize_malloc(sizeof(int)*vertexCount);
+	float *vertexScore = mesh_optimize_malloc(sizeof(float)*vertexCount);
+	for(unsigned int v=0; v<vertexCount; v++)
+	{
+		cachePos[v] = -1;
+		vertexScore[v] = mesh_optimize_vertex_score(-1, remaining[v]);
+	}
+
+	float *triScore = mesh_optimize_malloc(sizeof(float)*triCount);
+	char *drawn = mesh_optimize_malloc(triCount);
+	memset(drawn, 0, triCount);
+	unsigned int best = 0;
+	for(unsigned int t=0; t<triCount; t++)
+	{
+		triScore[t] = vertexScore[indices[t*3]] + vertexScore[indices[t*3+1]] + vertexScore[indices[t*3+2]];
+		if(triScore[t] > triScore[best])
+			best = t;
+	}
+
+	unsigned int *output = mesh_optimize_malloc(sizeof(unsigned int)*triCount*3);
+	unsigned int cache[MESH_OPTIMIZE_CACHE_SIZE+3];
+	unsigned int cacheCount = 0;
+	unsigned int nextUndrawn = 0; // all triangles before this one have been drawn
+
+	for(unsigned int out=0; out<triCount; out++)
+	{
+		/* If none of the vertices in the cache have triangles left,
+		 * start over with the next triangle that hasn't been drawn. */
+		if(best == UINT_MAX)
+		{
+			while(drawn[nextUndrawn])
+				nextUndrawn++;
+			best = nextUndrawn;
+		}
+
+		const unsigned int *tri = indices + best*3;
+		memcpy(output + out*3, tri, sizeof(unsigned int)*3);
+		drawn[best] = 1;
+
+		/* Remove the triangle from the lists of its vertices. */
+		for(int c=0; c<3; c++)
+		{
+			unsigned int v = tri[c];
+			unsigned int *list = adjacent + adjacentStart[v];
+			for(unsigned int j=0; j<remaining[v]; j++)
+			{
+				if(list[j] == best)
+				{
+					list[j] = list[remaining[v]-1];
+					remaining[v]--;
+					break;
+				}
+			}
+		}
+
+		/* Move the triangle's vertices to the front of the
+		 * cache. Vertices pushed past the end leave the cache. */
+		unsigned int newCache[MESH_OPTIMIZE_CACHE_SIZE+3];
+		unsigned int newCount = 0;
+		for(int c=0; c<3; c++)
+		{
+			if(newCount > 0 && newCache[newCount-1] == tri[c])
+				continue;
+			if(newCount == 2 && newCache[0] == tri[c])
+				continue;
+			newCache[newCount++] = tri[c];
+		}
+		for(unsigned int i=0; i<cacheCount; i++)
+		{
+			unsigned int v = cache[i];
+			if(v != tri[0] && v != tri[1] && v != tri[2])
+				newCache[newCount++] = v;
+		}
+
+		/* Update the scores of the vertices that moved and of their
+		 * triangles. The best of those triangles is drawn next. */
+		for(unsigned int i=0; i<newCount; i++)
+		{
+			unsigned int v = newCache[i];
+			cachePos[v] = i < MESH_OPTIMIZE_CACHE_SIZE ? (int) i : -1;
+			vertexScore[v] = mesh_optimize_vertex_score(cachePos[v], remaining[v]);
+		}
+		best = UINT_MAX;
+		float bestScore = -1;
+		for(unsigned int i=0; i<newCount; i++)
+		{
+			unsigned int v = newCache[i];
+			const unsigned int *list = adjacent + adjacentStart[v];
+			for(unsigned int j=0; j<remaining[v]; j++)
+			{
+				unsigned int t = list[j];
+				const unsigned int *ti = indices + t*3;
+				triScore[t] = vertexScore[ti[0]] + vertexScore[ti[1]] + vertexScore[ti[2]];
+				if(triScore[t] > bestScore)
+				{
+					bestScore = triScore[t];
+					best = t;
+				}
+			}
+		}
+
+		cacheCount = newCount < MESH_OPTIMIZE_CACHE_SIZE ? newCount : MESH_OPTIMIZE_CACHE_SIZE;
+		memcpy(cache, newCache, sizeof(unsigned int)*cacheCount);
+	}
+
+	memcpy(indices, output, sizeof(unsigned int)*triCount*3);
+	free(output);
+	free(drawn);
+	free(triScore);
+	free(vertexScore);
+	free(cachePos);
+	free(adjacent);
+	free(adjacentStart);
+	free(remaining);
+}
+
+/** Renumbers the vertices of a mesh in the order that the indices
+ * first use them so that the GPU reads the vertex data mostly
+ * sequentially. Vertices that no index uses are moved to the end.
+ * Every vertex attribute must be reordered with mesh_optimize_remap()
+ * afterwards.
+
+    @param indices The indices of the mesh. They are changed to refer to the renumbered vertices.
+
+    @param indexCount The number of indices.
+
+    @param vertexCount The number of vertices.
+
+    @param remap vertexCount values that are set to the new number of each vertex.
+
+    @return The number of vertices that are used by the indices.
+*/
+unsigned int mesh_optimize_vertex_fetch(unsigned int *indices, unsigned int indexCount, unsigned int vertexCount, unsigned int *remap)
+{
+	for(unsigned int v=0; v<vertexCount; v++)
+		remap[v] = UINT_MAX;
+	unsigned int next = 0;
+	for(unsigned int i=0; i<indexCount; i++)
+	{
+		unsigned int v = indices[i];
+		if(remap[v] == UINT_MAX)
+			remap[v] = next++;
+		indices[i] = remap[v];
+	}
+	unsigned int used = next;
+	for(unsigned int v=0; v<vertexCount; v++)
+		if(remap[v] == UINT_MAX)
+			remap[v] = next++;
+	return used;
+}
+
+/** Reorders a vertex attribute with the remap array from
+ * mesh_optimize_vertex_fetch().
+
+    @param data components*vertexCount values, reordered in place.
+    @param components The number of values per vertex.
+    @param vertexCount The number of vertices.
+    @param remap The new number of each vertex.
+*/
+void mesh_optimize_remap(float *data, unsigned int components, unsigned int vertexCount, const unsigned int *remap)
+{
+	float *copy = mesh_optimize_malloc(sizeof(float)*components*vertexCount);
+	memcpy(copy, data, sizeof(float)*components*vertexCount);
+	for(unsigned int v=0; v<vertexCount; v++)
+		memcpy(data + remap[v]*components, copy + v*components, sizeof(float)*components);
+	free(copy);
+}
+
+/** Estimates the average cache miss ratio (vertices transformed per
+ * triangle) of a triangle list by simulating a FIFO cache, which is
+ * how most GPUs have behaved.
+
+    @param indices The indices of a triangle list.
+    @param indexCount The number of indices.
+    @param vertexCount The number of vertices.
+    @param cacheSize The number of vertices the simulated cache holds.
+
+    @return The number of cache misses per triangle.
+*/
+float mesh_optimize_acmr(const unsigned int *indices, unsigned int indexCount, unsigned int vertexCount, unsigned int cacheSize)
+{
+	unsigned int triCount = indexCount / 3;
+	if(triCount == 0)
+		return 0;
+
+	/* A vertex is in the cache if fewer than cacheSize vertices have
+	 * been added since it was added. */
+	unsigned long *addedAt = mesh_optimize_malloc(sizeof(unsigned long)*vertexCount);
+	for(unsigned int v=0; v<vertexCount; v++)
+		addedAt[v] = ULONG_MAX;
+	unsigned long misses = 0;
+	for(unsigned int i=0; i<triCount*3; i++)
+	{
+		unsigned int v = indices[i];
+		if(addedAt[v] == ULONG_MAX || misses - addedAt[v] >= cacheSize)
+		{
+			addedAt[v] = misses;
+			misses++;
+		}
+	}
+	free(addedAt);
+	return misses / (float) triCount;
+}
@@ -0,0 +1,52 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Reorders the triangles and vertices of an indexed triangle mesh
+    so that the GPU draws it with less work. The mesh looks the same
+    afterwards.
+
+    The GPU keeps recently transformed vertices in a small cache. A
+    vertex that is used again while it is still in the cache isn't
+    transformed again. mesh_optimize_vertex_cache() reorders the
+    triangles with Tom Forsyth's "Linear-Speed Vertex Cache
+    Optimisation" so that triangles sharing vertices are drawn close
+    together. mesh_optimize_vertex_fetch() then renumbers the vertices
+    in the order that the triangles first use them so that the
+    vertex data is read from memory mostly sequentially.
+
+    The average cache miss ratio (ACMR) is the number of vertices that
+    are transformed per triangle. It is between 0.5 (for large regular
+    meshes) and 3 (no vertex is ever reused); mesh_optimize_acmr()
+    estimates it for a given cache size.
+
+    Typical use:
+
+    mesh_optimize_vertex_cache(indices, indexCount, vertexCount);
+    unsigned int *remap = malloc(sizeof(unsigned int)*vertexCount);
+    mesh_optimize_vertex_fetch(indices, indexCount, vertexCount, remap);
+    mesh_optimize_remap(positions, 3, vertexCount, remap); // and every other vertex attribute
+
+    @author Scott Kuhl
+ */
+
+#ifndef __MESH_OPTIMIZE_H__
+#define __MESH_OPTIMIZE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MESH_OPTIMIZE_CACHE_SIZE 32 /**< Size of the LRU cache that mesh_optimize_vertex_cache() optimizes for */
+
+void mesh_optimize_vertex_cache(unsigned int *indices, unsigned int indexCount, unsigned int vertexCount);
+unsigned int mesh_optimize_vertex_fetch(unsigned int *indices, unsigned int indexCount, unsigned int vertexCount, unsigned int *remap);
+void mesh_optimize_remap(float *data, unsigned int components, unsigned int vertexCount, const unsigned int *remap);
+float mesh_optimize_acmr(const unsigned int *indices, unsigned int indexCount, unsigned int vertexCount, unsigned int cacheSize);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __MESH_OPTIMIZE_H__
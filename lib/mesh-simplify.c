@@ -0,0 +1,389 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "mesh-simplify.h"
+#include "msg.h"
+
+/** A symmetric 4x4 matrix that measures the sum of the squared
+ * distances from a point to a set of planes, each weighted by the
+ * area of the triangle it came from. */
+typedef struct {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double area; /**< Sum of the weights, used to turn the sum into an average */
+} mesh_simplify_quadric;
+
+/** A possible collapse of vertex u onto vertex v. */
+typedef struct {
+	unsigned int u, v;
+	float cost;
+} mesh_simplify_collapse;
+
+/** Allocates memory or exits. */
+static void* mesh_simplify_malloc(size_t size)
+{
+	void *ptr = malloc(size > 0 ? size : 1);
+	if(ptr == NULL)
+	{
+		msg(FATAL, "Unable to allocate %zu bytes to simplify a mesh.\n", size);
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+/** Sets q to the quadric of the plane of a triangle. */
+static void mesh_simplify_quadric_triangle(mesh_simplify_quadric *q, const float *p0, const float *p1, const float *p2)
+{
+	double e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+	double e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+	double n[3] = { e1[1]*e2[2] - e1[2]*e2[1],
+	                e1[2]*e2[0] - e1[0]*e2[2],
+	                e1[0]*e2[1] - e1[1]*e2[0] };
+	double len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+	memset(q, 0, sizeof(mesh_simplify_quadric));
+	if(len == 0)
+		return;
+	n[0] /= len; n[1] /= len; n[2] /= len;
+	double d = -(n[0]*p0[0] + n[1]*p0[1] + n[2]*p0[2]);
+	double w = len / 2; // area of the triangle
+
+	q->a2 = w*n[0]*n[0]; q->ab = w*n[0]*n[1]; q->ac = w*n[0]*n[2]; q->ad = w*n[0]*d;
+	q->b2 = w*n[1]*n[1]; q->bc = w*n[1]*n[2]; q->bd = w*n[1]*d;
+	q->c2 = w*n[2]*n[2]; q->cd = w*n[2]*d;
+	q->d2 = w*d*d;
+	q->area = w;
+}
+
+static void mesh_simplify_quadric_add(mesh_simplify_quadric *q, const mesh_simplify_quadric *r)
+{
+	q->a2 += r->a2; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+	q->b2 += r->b2; q->bc += r->bc; q->bd += r->bd;
+	q->c2 += r->c2; q->cd += r->cd;
+	q->d2 += r->d2;
+	q->area += r->area;
+}
+
+/** Returns the average squared distance from p to the planes in the
+ * sum of two quadrics. */
+static double mesh_simplify_quadric_error(const mesh_simplify_quadric *q, const mesh_simplify_quadric *r, const float *p)
+{
+	mesh_simplify_quadric s = *q;
+	mesh_simplify_quadric_add(&s, r);
+	if(s.area == 0)
+		return 0;
+	double x = p[0], y = p[1], z = p[2];
+	double e = s.a2*x*x + 2*s.ab*x*y + 2*s.ac*x*z + 2*s.ad*x
+	         + s.b2*y*y + 2*s.bc*y*z + 2*s.bd*y
+	         + s.c2*z*z + 2*s.cd*z
+	         + s.d2;
+	return fabs(e) / s.area;
+}
+
+/** Makes a list of the triangles that use each vertex. The triangles
+ * of vertex v are tris[start[v]] ... tris[start[v+1]-1]. */
+static void mesh_simplify_adjacency(const unsigned int *indices, unsigned int indexCount, unsigned int vertexCount,
+                                    unsigned int *start, unsigned int *tris)
+{
+	memset(start, 0, sizeof(unsigned int)*(vertexCount+1));
+	for(unsigned int i=0; i<indexCount; i++)
+		start[indices[i]+1]++;
+	for(unsigned int v=0; v<vertexCount; v++)
+		start[v+1] += start[v];
+	for(unsigned int i=0; i<indexCount; i++)
+		tris[start[indices[i]]++] = i/3;
+	/* Filling the lists moved each start to the start of the next
+	 * vertex; move them back. */
+	for(unsigned int v=vertexCount; v>0; v--)
+		start[v] = start[v-1];
+	start[0] = 0;
+}
+
+/** Returns 1 if triangle t contains vertex v. */
+static int mesh_simplify_has_vertex(const unsigned int *indices, unsigned int t, unsigned int v)
+{
+	return indices[t*3] == v || indices[t*3+1] == v || indices[t*3+2] == v;
+}
+
+/** Returns the number of triangles that use both vertex a and vertex b. */
+static unsigned int mesh_simplify_edge_triangles(const unsigned int *indices, const unsigned int *start, const unsigned int *tris,
+                                                 unsigned int a, unsigned int b)
+{
+	unsigned int count = 0;
+	for(unsigned int i=start[a]; i<start[a+1]; i++)
+		if(mesh_simplify_has_vertex(indices, tris[i], b))
+			count++;
+	return count;
+}
+
+/** Returns the normal of a triangle scaled by twice its area, with vertex u moved to position p. */
+static void mesh_simplify_normal(double n[3], const unsigned int *tri, const float *positions, unsigned int u, const float *p)
+{
+	const float *p0 = tri[0] == u ? p : positions+tri[0]*3;
+	const float *p1 = tri[1] == u ? p : positions+tri[1]*3;
+	const float *p2 = tri[2] == u ? p : positions+tri[2]*3;
+	double e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+	double e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+	n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+	n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+	n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+}
+
+/** Returns 1 if vertex u can be moved onto vertex v without flipping
+ * a triangle or making the surface non-manifold. */
+static int mesh_simplify_collapse_ok(const unsigned int *indices, const float *positions,
+                                     const unsigned int *start, const unsigned int *tris,
+                                     unsigned int *mark, unsigned int stamp,
+                                     unsigned int u, unsigned int v)
+{
+	/* The only vertices that are neighbors of both u and v must be
+	 * the ones across from the edge in the triangles that share it;
+	 * otherwise the collapse would join two parts of the surface. */
+	unsigned int shared = 0, common = 0;
+	for(unsigned int i=start[u]; i<start[u+1]; i++)
+	{
+		const unsigned int *tri = indices + tris[i]*3;
+		if(mesh_simplify_has_vertex(indices, tris[i], v))
+		{
+			shared++;
+			continue;
+		}
+		for(int c=0; c<3; c++)
+		{
+			unsigned int n = tri[c];
+			if(n == u || mark[n] == stamp)
+				continue;
+			mark[n] = stamp;
+			if(mesh_simplify_edge_triangles(indices, start, tris, v, n) > 0)
+				common++;
+		}
+	}
+	/* Neighbors across from the shared edge are counted above only if
+	 * they are also in a triangle that doesn't use v. */
+	for(unsigned int i=start[u]; i<start[u+1]; i++)
+	{
+		if(!mesh_simplify_has_vertex(indices, tris[i], v))
+			continue;
+		const unsigned int *tri = indices + tris[i]*3;
+		for(int c=0; c<3; c++)
+			if(tri[c] != u && tri[c] != v && mark[tri[c]] == stamp)
+				common--;
+	}
+	if(shared == 0 || common != 0)
+		return 0;
+
+	/* The triangles that remain must face the same way afterwards. */
+	const float *p = positions + v*3;
+	for(unsigned int i=start[u]; i<start[u+1]; i++)
+	{
+		if(mesh_simplify_has_vertex(indices, tris[i], v))
+			continue;
+		const unsigned int *tri = indices + tris[i]*3;
+		double before[3], after[3];
+		mesh_simplify_normal(before, tri, positions, u, positions+u*3);
+		mesh_simplify_normal(after, tri, positions, u, p);
+		if(before[0]*after[0] + before[1]*after[1] + before[2]*after[2] <= 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int mesh_simplify_compare(const void *a, const void *b)
+{
+	float x = ((const mesh_simplify_collapse*) a)->cost;
+	float y = ((const mesh_simplify_collapse*) b)->cost;
+	return (x > y) - (x < y);
+}
+
+/** Removes triangles from a triangle mesh by collapsing edges until
+ * the mesh has targetIndexCount indices or no more edges can be
+ * collapsed.
+
+    @param destination Receives the indices of the simplified mesh. It
+    must have space for indexCount values and can be the same as
+    indices.
+
+    @param indices The indices of a triangle list (3 per triangle).
+
+    @param indexCount The number of indices.
+
+    @param positions 3 floats for the position of each vertex.
+
+    @param vertexCount The number of vertices.
+
+    @param targetIndexCount The number of indices to stop at. The
+    result may be slightly smaller.
+
+    @param resultError If not NULL, set to the largest distance that
+    the surface moved, estimated from the quadrics of the collapsed
+    vertices. It is in the same units as the positions.
+
+    @return The number of indices in the simplified mesh.
+*/
+unsigned int mesh_simplify(unsigned int *destination, const unsigned int *indices, unsigned int indexCount,
+                           const float *positions, unsigned int vertexCount,
+                           unsigned int targetIndexCount, float *resultError)
+{
+	/* Drop triangles that are already degenerate. */
+	unsigned int count = 0;
+	for(unsigned int i=0; i+2<indexCount; i+=3)
+	{
+		unsigned int a = indices[i], b = indices[i+1], c = indices[i+2];
+		if(a == b || b == c || a == c)
+			continue;
+		destination[count++] = a;
+		destination[count++] = b;
+		destination[count++] = c;
+	}
+	if(resultError)
+		*resultError = 0;
+	if(count <= targetIndexCount)
+		return count;
+
+	unsigned int *start = mesh_simplify_malloc(sizeof(unsigned int)*(vertexCount+1));
+	unsigned int *tris = mesh_simplify_malloc(sizeof(unsigned int)*count);
+	mesh_simplify_adjacency(destination, count, vertexCount, start, tris);
+
+	/* Each vertex starts with the quadrics of the triangles around
+	 * it. Vertices on an edge that isn't shared by exactly two
+	 * triangles (the border of the mesh, seams and non-manifold
+	 * edges) stay where they are. */
+	mesh_simplify_quadric *quadrics = mesh_simplify_malloc(sizeof(mesh_simplify_quadric)*vertexCount);
+	memset(quadrics, 0, sizeof(mesh_simplify_quadric)*vertexCount);
+	char *locked = mesh_simplify_malloc(vertexCount);
+	memset(locked, 0, vertexCount);
+	for(unsigned int t=0; t<count/3; t++)
+	{
+		const unsigned int *tri = destination + t*3;
+		mesh_simplify_quadric q;
+		mesh_simplify_quadric_triangle(&q, positions+tri[0]*3, positions+tri[1]*3, positions+tri[2]*3);
+		for(int c=0; c<3; c++)
+		{
+			mesh_simplify_quadric_add(&quadrics[tri[c]], &q);
+			unsigned int a = tri[c], b = tri[(c+1)%3];
+			if(mesh_simplify_edge_triangles(destination, start, tris, a, b) != 2)
+				locked[a] = locked[b] = 1;
+		}
+	}
+
+	unsigned int *remap = mesh_simplify_malloc(sizeof(unsigned int)*vertexCount);
+	unsigned int *mark = mesh_simplify_malloc(sizeof(unsigned int)*vertexCount);
+	char *touched = mesh_simplify_malloc(vertexCount);
+	float *bestCost = mesh_simplify_malloc(sizeof(float)*vertexCount);
+	unsigned int *bestTarget = mesh_simplify_malloc(sizeof(unsigned int)*vertexCount);
+	mesh_simplify_collapse *collapses = mesh_simplify_malloc(sizeof(mesh_simplify_collapse)*vertexCount);
+	for(unsigned int v=0; v<vertexCount; v++)
+	{
+		remap[v] = v;
+		mark[v] = 0;
+	}
+	unsigned int stamp = 0;
+	double maxError = 0;
+
+	/* Each pass collapses the cheapest edges that don't share any
+	 * triangles with each other, then removes the triangles that
+	 * became degenerate. */
+	while(count > targetIndexCount)
+	{
+		/* Find the cheapest edge to collapse each vertex along. */
+		for(unsigned int v=0; v<vertexCount; v++)
+			bestCost[v] = FLT_MAX;
+		for(unsigned int i=0; i<count; i++)
+		{
+			unsigned int u = destination[i];
+			if(locked[u])
+				continue;
+			unsigned int t = i/3;
+			for(int c=1; c<3; c++)
+			{
+				unsigned int v = destination[t*3 + (i%3+c)%3];
+				float cost = (float) mesh_simplify_quadric_error(&quadrics[u], &quadrics[v], positions+v*3);
+				if(cost < bestCost[u])
+				{
+					bestCost[u] = cost;
+					bestTarget[u] = v;
+				}
+			}
+		}
+		unsigned int collapseCount = 0;
+		for(unsigned int v=0; v<vertexCount; v++)
+		{
+			if(bestCost[v] == FLT_MAX)
+				continue;
+			collapses[collapseCount].u = v;
+			collapses[collapseCount].v = bestTarget[v];
+			collapses[collapseCount].cost = bestCost[v];
+			collapseCount++;
+		}
+		qsort(collapses, collapseCount, sizeof(mesh_simplify_collapse), mesh_simplify_compare);
+
+		memset(touched, 0, vertexCount);
+		unsigned int removeGoal = (count - targetIndexCount + 2) / 3;
+		unsigned int removed = 0, collapsed = 0;
+		for(unsigned int i=0; i<collapseCount && removed < removeGoal; i++)
+		{
+			unsigned int u = collapses[i].u, v = collapses[i].v;
+			if(touched[u] || touched[v])
+				continue;
+			if(!mesh_simplify_collapse_ok(destination, positions, start, tris, mark, ++stamp, u, v))
+				continue;
+
+			remap[u] = v;
+			mesh_simplify_quadric_add(&quadrics[v], &quadrics[u]);
+			if(collapses[i].cost > maxError)
+				maxError = collapses[i].cost;
+			collapsed++;
+
+			/* Don't collapse any other vertex whose triangles changed
+			 * during this pass. */
+			for(unsigned int j=start[u]; j<start[u+1]; j++)
+			{
+				const unsigned int *tri = destination + tris[j]*3;
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+				if(mesh_simplify_has_vertex(destination, tris[j], v))
+					removed++;
+			}
+		}
+		if(collapsed == 0)
+			break;
+
+		unsigned int newCount = 0;
+		for(unsigned int i=0; i<count; i+=3)
+		{
+			unsigned int a = remap[destination[i]];
+			unsigned int b = remap[destination[i+1]];
+			unsigned int c = remap[destination[i+2]];
+			if(a == b || b == c || a == c)
+				continue;
+			destination[newCount++] = a;
+			destination[newCount++] = b;
+			destination[newCount++] = c;
+		}
+		count = newCount;
+		mesh_simplify_adjacency(destination, count, vertexCount, start, tris);
+	}
+
+	if(resultError)
+		*resultError = (float) sqrt(maxError);
+
+	free(collapses);
+	free(bestTarget);
+	free(bestCost);
+	free(touched);
+	free(mark);
+	free(remap);
+	free(locked);
+	free(quadrics);
+	free(tris);
+	free(start);
+	return count;
+}
@@ -0,0 +1,49 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Reduces the number of triangles in an indexed triangle mesh by
+    collapsing edges, which is how kuhl_geometry_lod_generate() makes
+    the levels of detail of a mesh.
+
+    Each collapse moves one vertex onto a neighboring vertex and
+    removes the triangles that become degenerate. The edge whose
+    collapse changes the surface the least is chosen with Garland and
+    Heckbert's quadric error metric: each vertex keeps a quadric that
+    measures the squared distance to the planes of the triangles that
+    have been merged into it. No vertices are created or moved, so the
+    simplified indices can be drawn with the same vertex attributes as
+    the original mesh.
+
+    Vertices on open edges are never moved. Model loaders (including
+    ASSIMP) duplicate the vertices on texture and normal seams, which
+    makes the seams open edges, so the simplified mesh doesn't tear
+    along them. Collapses that would flip a triangle or make the
+    surface non-manifold are skipped.
+
+    Typical use:
+
+    unsigned int *lod = malloc(sizeof(unsigned int)*indexCount);
+    float error;
+    unsigned int lodCount = mesh_simplify(lod, indices, indexCount, positions, vertexCount, indexCount/2, &error);
+
+    @author Scott Kuhl
+ */
+
+#ifndef __MESH_SIMPLIFY_H__
+#define __MESH_SIMPLIFY_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+unsigned int mesh_simplify(unsigned int *destination, const unsigned int *indices, unsigned int indexCount,
+                           const float *positions, unsigned int vertexCount,
+                           unsigned int targetIndexCount, float *resultError);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __MESH_SIMPLIFY_H__
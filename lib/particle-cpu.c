@@ -0,0 +1,376 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "particle-cpu.h"
+#include "msg.h"
+
+/** Particle systems smaller than this many particles per thread use
+ * fewer threads; waking up a thread costs more than it saves. */
+#define PARTICLE_CPU_MIN_PER_THREAD 16384
+
+/* The thread pool shared by every particle_cpu. Thread 0 is the
+ * thread that calls particle_cpu_step(); the others are workers that
+ * wait for the next step. */
+static int particle_cpu_nthreads = 0; // 0 until the pool is started
+static pthread_t *particle_cpu_workers = NULL;
+static pthread_mutex_t particle_cpu_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t particle_cpu_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t particle_cpu_done = PTHREAD_COND_INITIALIZER;
+static unsigned long particle_cpu_generation = 0; // incremented for each step that uses the workers
+static int particle_cpu_pending = 0;  // workers that haven't finished the current step
+static int particle_cpu_started = 0;  // workers that are waiting for steps
+static int particle_cpu_stop = 0;     // tells the workers to exit
+
+/** The step that the workers are working on. */
+static struct {
+	particle_cpu *pc;
+	float timestep;
+	float *positions;
+	int threads;   // number of threads that the particles are split between
+} particle_cpu_job;
+
+
+/** Allocates the position and velocity arrays and sets the default
+ * gravity and bounce.
+
+    @param pc The particle_cpu to initialize.
+
+    @param count The number of particles.
+
+    @param positions 3*count floats (x,y,z for each particle) with the initial positions, or NULL to start every particle at the origin.
+
+    @param velocities 3*count floats with the initial velocities, or NULL if the particles start at rest.
+*/
+void particle_cpu_init(particle_cpu *pc, size_t count, const float *positions, const float *velocities)
+{
+	memset(pc, 0, sizeof(particle_cpu));
+	pc->count = count;
+	pc->accel[1] = -1;
+	pc->ground = 0;
+	pc->bounceLoss = .4;
+	for(int k=0; k<3; k++)
+	{
+		pc->pos[k] = calloc(count > 0 ? count : 1, sizeof(float));
+		pc->vel[k] = calloc(count > 0 ? count : 1, sizeof(float));
+		if(pc->pos[k] == NULL || pc->vel[k] == NULL)
+		{
+			msg(FATAL, "Unable to allocate memory for %zu particles.\n", count);
+			exit(EXIT_FAILURE);
+		}
+	}
+	particle_cpu_set(pc, positions, velocities);
+}
+
+/** Frees the memory used by a particle_cpu. */
+void particle_cpu_free(particle_cpu *pc)
+{
+	for(int k=0; k<3; k++)
+	{
+		free(pc->pos[k]);
+		free(pc->vel[k]);
+	}
+	memset(pc, 0, sizeof(particle_cpu));
+}
+
+/** Replaces the positions and/or velocities of all of the particles.
+
+    @param pc The particle system.
+
+    @param positions 3*count floats (x,y,z for each particle), or NULL to keep the current positions.
+
+    @param velocities 3*count floats, or NULL to keep the current velocities.
+*/
+void particle_cpu_set(particle_cpu *pc, const float *positions, const float *velocities)
+{
+	for(size_t i=0; i<pc->count; i++)
+	{
+		for(int k=0; k<3; k++)
+		{
+			if(positions)
+				pc->pos[k][i] = positions[i*3+k];
+			if(velocities)
+				pc->vel[k][i] = velocities[i*3+k];
+		}
+	}
+}
+
+/** Copies the positions of the particles into an array with 3 floats
+ * (x,y,z) per particle. */
+void particle_cpu_get_positions(const particle_cpu *pc, float *positions)
+{
+	for(size_t i=0; i<pc->count; i++)
+		for(int k=0; k<3; k++)
+			positions[i*3+k] = pc->pos[k][i];
+}
+
+
+/** Updates the particles from index 'begin' up to (but not including)
+ * 'end'. If 'positions' isn't NULL, the new positions of those
+ * particles are written into it. */
+static void particle_cpu_range(particle_cpu *pc, float timestep, float *positions, size_t begin, size_t end)
+{
+	float *px = pc->pos[0], *py = pc->pos[1], *pz = pc->pos[2];
+	float *vx = pc->vel[0], *vy = pc->vel[1], *vz = pc->vel[2];
+	const float loss = pc->bounceLoss;
+	const float ground = pc->ground;
+	float halfAccel[3], deltaVel[3];
+	for(int k=0; k<3; k++)
+	{
+		halfAccel[k] = timestep * pc->accel[k] / 2;
+		deltaVel[k] = timestep * pc->accel[k];
+	}
+
+	size_t i = begin;
+#ifdef __SSE__
+	const __m128 dt4 = _mm_set1_ps(timestep);
+	const __m128 loss4 = _mm_set1_ps(loss);
+	const __m128 ground4 = _mm_set1_ps(ground);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	__m128 halfAccel4[3], deltaVel4[3];
+	for(int k=0; k<3; k++)
+	{
+		halfAccel4[k] = _mm_set1_ps(halfAccel[k]);
+		deltaVel4[k] = _mm_set1_ps(deltaVel[k]);
+	}
+
+	/* Four particles at a time. */
+	for(; i+4 <= end; i+=4)
+	{
+		__m128 x = _mm_loadu_ps(px+i),  y = _mm_loadu_ps(py+i),  z = _mm_loadu_ps(pz+i);
+		__m128 u = _mm_loadu_ps(vx+i),  v = _mm_loadu_ps(vy+i),  w = _mm_loadu_ps(vz+i);
+
+		x = _mm_add_ps(x, _mm_mul_ps(dt4, _mm_add_ps(u, halfAccel4[0])));
+		y = _mm_add_ps(y, _mm_mul_ps(dt4, _mm_add_ps(v, halfAccel4[1])));
+		z = _mm_add_ps(z, _mm_mul_ps(dt4, _mm_add_ps(w, halfAccel4[2])));
+		u = _mm_add_ps(u, deltaVel4[0]);
+		v = _mm_add_ps(v, deltaVel4[1]);
+		w = _mm_add_ps(w, deltaVel4[2]);
+
+		if(loss > 0)
+		{
+			/* Each lane of 'below' is all ones for particles that
+			 * fell through the ground. Those lanes take the bounced
+			 * values; the other lanes keep their values. */
+			__m128 below = _mm_cmplt_ps(y, ground4);
+			if(_mm_movemask_ps(below) != 0)
+			{
+				__m128 bouncedY = _mm_add_ps(ground4, _mm_mul_ps(_mm_sub_ps(ground4, y), loss4));
+				y = _mm_or_ps(_mm_and_ps(below, bouncedY), _mm_andnot_ps(below, y));
+				__m128 scale = _mm_or_ps(_mm_and_ps(below, loss4), _mm_andnot_ps(below, _mm_set1_ps(1)));
+				u = _mm_mul_ps(u, scale);
+				v = _mm_xor_ps(_mm_mul_ps(v, scale), _mm_and_ps(below, signBit)); // negate Y velocity
+				w = _mm_mul_ps(w, scale);
+			}
+		}
+
+		_mm_storeu_ps(px+i, x);  _mm_storeu_ps(py+i, y);  _mm_storeu_ps(pz+i, z);
+		_mm_storeu_ps(vx+i, u);  _mm_storeu_ps(vy+i, v);  _mm_storeu_ps(vz+i, w);
+
+		if(positions)
+		{
+			/* Interleave the x, y and z values of the four
+			 * particles into x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3 */
+			__m128 xyLo = _mm_unpacklo_ps(x, y); // x0 y0 x1 y1
+			__m128 xyHi = _mm_unpackhi_ps(x, y); // x2 y2 x3 y3
+			__m128 a = _mm_shuffle_ps(z, xyLo, _MM_SHUFFLE(3,2,0,0));    // z0 z0 x1 y1
+			__m128 b = _mm_shuffle_ps(xyLo, z, _MM_SHUFFLE(1,1,3,3));    // y1 y1 z1 z1
+			__m128 c = _mm_shuffle_ps(z, xyHi, _MM_SHUFFLE(3,2,2,2));    // z2 z2 x3 y3
+			__m128 d = _mm_shuffle_ps(xyHi, z, _MM_SHUFFLE(3,3,3,3));    // y3 y3 z3 z3
+			float *out = positions + i*3;
+			_mm_storeu_ps(out,   _mm_shuffle_ps(xyLo, a, _MM_SHUFFLE(2,1,1,0))); // x0 y0 z0 x1
+			_mm_storeu_ps(out+4, _mm_shuffle_ps(b, xyHi, _MM_SHUFFLE(1,0,2,0))); // y1 z1 x2 y2
+			_mm_storeu_ps(out+8, _mm_shuffle_ps(c, d, _MM_SHUFFLE(2,0,2,0)));    // z2 x3 y3 z3
+		}
+	}
+#endif
+
+	/* The remaining particles (or all of them without SSE). */
+	for(; i<end; i++)
+	{
+		px[i] += timestep * (vx[i] + halfAccel[0]);
+		py[i] += timestep * (vy[i] + halfAccel[1]);
+		pz[i] += timestep * (vz[i] + halfAccel[2]);
+		vx[i] += deltaVel[0];
+		vy[i] += deltaVel[1];
+		vz[i] += deltaVel[2];
+		if(loss > 0 && py[i] < ground)
+		{
+			py[i] = ground + (ground - py[i]) * loss;
+			vx[i] *= loss;
+			vy[i] *= -loss;
+			vz[i] *= loss;
+		}
+		if(positions)
+		{
+			positions[i*3+0] = px[i];
+			positions[i*3+1] = py[i];
+			positions[i*3+2] = pz[i];
+		}
+	}
+}
+
+/** Updates the part of the current job that belongs to one thread. */
+static void particle_cpu_job_range(int thread)
+{
+	if(thread >= particle_cpu_job.threads)
+		return;
+	size_t count = particle_cpu_job.pc->count;
+	/* Keep the ranges multiples of 4 so that only the last one has
+	 * particles left over after the SSE loop. */
+	size_t per = ((count + particle_cpu_job.threads - 1) / particle_cpu_job.threads + 3) & ~((size_t)3);
+	size_t begin = per * thread;
+	size_t end = begin + per;
+	if(begin > count)
+		begin = count;
+	if(end > count)
+		end = count;
+	particle_cpu_range(particle_cpu_job.pc, particle_cpu_job.timestep, particle_cpu_job.positions, begin, end);
+}
+
+/** The function that each worker thread runs. */
+static void* particle_cpu_worker(void *arg)
+{
+	int thread = (int) (intptr_t) arg;
+	unsigned long seen = 0;
+	pthread_mutex_lock(&particle_cpu_lock);
+	seen = particle_cpu_generation;
+	particle_cpu_started++;
+	pthread_cond_signal(&particle_cpu_done);
+	while(1)
+	{
+		while(particle_cpu_generation == seen && !particle_cpu_stop)
+			pthread_cond_wait(&particle_cpu_start, &particle_cpu_lock);
+		if(particle_cpu_stop)
+			break;
+		seen = particle_cpu_generation;
+		pthread_mutex_unlock(&particle_cpu_lock);
+
+		particle_cpu_job_range(thread);
+
+		pthread_mutex_lock(&particle_cpu_lock);
+		particle_cpu_pending--;
+		if(particle_cpu_pending == 0)
+			pthread_cond_signal(&particle_cpu_done);
+	}
+	pthread_mutex_unlock(&particle_cpu_lock);
+	return NULL;
+}
+
+/** Sets the number of threads that particle_cpu_step() splits the
+ * particles between, including the thread that calls it.
+
+    @param threads The number of threads. If 0 or less, one thread per
+    processor is used.
+*/
+void particle_cpu_threads(int threads)
+{
+	if(threads <= 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int) cpus : 1;
+	}
+
+	/* Stop the old workers. */
+	if(particle_cpu_workers)
+	{
+		pthread_mutex_lock(&particle_cpu_lock);
+		particle_cpu_stop = 1;
+		pthread_cond_broadcast(&particle_cpu_start);
+		pthread_mutex_unlock(&particle_cpu_lock);
+		for(int i=1; i<particle_cpu_nthreads; i++)
+			pthread_join(particle_cpu_workers[i], NULL);
+		free(particle_cpu_workers);
+		particle_cpu_workers = NULL;
+		particle_cpu_stop = 0;
+		particle_cpu_started = 0;
+	}
+
+	particle_cpu_nthreads = 1;
+	particle_cpu_workers = malloc(sizeof(pthread_t)*threads);
+	if(particle_cpu_workers == NULL)
+		threads = 1;
+	for(int i=1; i<threads; i++)
+	{
+		if(pthread_create(&(particle_cpu_workers[i]), NULL, particle_cpu_worker, (void*) (intptr_t) i) != 0)
+		{
+			msg(WARNING, "Unable to start particle thread %d; using %d threads.\n", i, particle_cpu_nthreads);
+			break;
+		}
+		particle_cpu_nthreads++;
+	}
+
+	/* Wait until every worker is waiting for a step so that none of
+	 * them miss the first one. */
+	pthread_mutex_lock(&particle_cpu_lock);
+	while(particle_cpu_started < particle_cpu_nthreads-1)
+		pthread_cond_wait(&particle_cpu_done, &particle_cpu_lock);
+	pthread_mutex_unlock(&particle_cpu_lock);
+	msg(DEBUG, "Particles are updated with %d threads.\n", particle_cpu_nthreads);
+}
+
+/** Returns the number of threads that particle_cpu_step() splits the
+ * particles between. */
+int particle_cpu_thread_count(void)
+{
+	if(particle_cpu_nthreads == 0)
+		particle_cpu_threads(0);
+	return particle_cpu_nthreads;
+}
+
+/** Moves every particle forward in time. Gravity (pc->accel) is
+ * applied and particles that fall below pc->ground bounce. Returns
+ * after all of the particles have been updated.
+
+    @param pc The particle system.
+
+    @param timestep The amount of time to move the particles forward by.
+
+    @param positions If not NULL, 3*count floats that the new
+    positions are written into (x,y,z for each particle). The memory
+    is only written to, so it can be a mapped buffer object.
+*/
+void particle_cpu_step(particle_cpu *pc, float timestep, float *positions)
+{
+	int threads = particle_cpu_thread_count();
+	size_t maxThreads = pc->count / PARTICLE_CPU_MIN_PER_THREAD;
+	if(maxThreads < (size_t) threads)
+		threads = maxThreads > 0 ? (int) maxThreads : 1;
+
+	if(threads == 1)
+	{
+		particle_cpu_range(pc, timestep, positions, 0, pc->count);
+		return;
+	}
+
+	pthread_mutex_lock(&particle_cpu_lock);
+	particle_cpu_job.pc = pc;
+	particle_cpu_job.timestep = timestep;
+	particle_cpu_job.positions = positions;
+	particle_cpu_job.threads = threads;
+	particle_cpu_pending = particle_cpu_nthreads - 1;
+	particle_cpu_generation++;
+	pthread_cond_broadcast(&particle_cpu_start);
+	pthread_mutex_unlock(&particle_cpu_lock);
+
+	particle_cpu_job_range(0);
+
+	pthread_mutex_lock(&particle_cpu_lock);
+	while(particle_cpu_pending > 0)
+		pthread_cond_wait(&particle_cpu_done, &particle_cpu_lock);
+	pthread_mutex_unlock(&particle_cpu_lock);
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Moves particles with gravity and bounces them off of a ground
+    plane on the CPU. This is the CPU counterpart of particle-sim.h
+    for OpenGL contexts without transform feedback, and it uses the
+    same equations.
+
+    The positions and velocities are stored as a structure of arrays
+    (all of the x values, then all of the y values, etc.) so that four
+    particles can be updated at once with SSE instructions. The
+    particles are split between a pool of threads that is shared by
+    every particle_cpu. Each step can write the new positions (3
+    floats per particle, the layout used for vertex attributes)
+    directly into memory from stream_buffer_begin() or a mapped
+    vertex buffer. The positions are written sequentially and never
+    read back, which is what write-combined memory needs.
+
+    Typical use:
+
+    particle_cpu_init(&pc, vertexCount, positions, NULL);
+    particle_cpu_set(&pc, NULL, velocities); // when the particles start moving
+    Each frame:
+    float *dest = stream_buffer_begin(&sb);
+    particle_cpu_step(&pc, .1f, dest);
+    stream_buffer_end(&sb);
+
+    @author Scott Kuhl
+ */
+
+#ifndef __PARTICLE_CPU_H__
+#define __PARTICLE_CPU_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	size_t count;     /**< Number of particles */
+	float *pos[3];    /**< x, y and z arrays with the position of each particle */
+	float *vel[3];    /**< x, y and z arrays with the velocity of each particle */
+
+	float accel[3];   /**< Acceleration (gravity), default is 0,-1,0 */
+	float ground;     /**< Particles bounce off of the plane where y is this value (default 0) */
+	float bounceLoss; /**< Factor that the velocity is multiplied by when a particle bounces (default .4). If 0, particles don't bounce. */
+} particle_cpu;
+
+void particle_cpu_init(particle_cpu *pc, size_t count, const float *positions, const float *velocities);
+void particle_cpu_free(particle_cpu *pc);
+void particle_cpu_set(particle_cpu *pc, const float *positions, const float *velocities);
+void particle_cpu_get_positions(const particle_cpu *pc, float *positions);
+void particle_cpu_step(particle_cpu *pc, float timestep, float *positions);
+
+void particle_cpu_threads(int threads);
+int particle_cpu_thread_count(void);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __PARTICLE_CPU_H__
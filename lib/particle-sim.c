@@ -0,0 +1,219 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "particle-sim.h"
+#include "kuhl-util.h"
+#include "msg.h"
+
+/** The program that moves the particles. It is shared by every
+ * particle_sim and created the first time one is initialized. */
+static GLuint particle_sim_program = 0;
+
+/** Compiles and links particle_sim_program. */
+static void particle_sim_program_init()
+{
+	if(particle_sim_program != 0)
+		return;
+
+	/* Same integration as particle_cpu_range() in lib/particle-cpu.c. */
+	const char *vertSource =
+		"#version 150\n"
+		"in vec3 in_Position;\n"
+		"in vec3 in_Velocity;\n"
+		"uniform float Timestep;\n"
+		"uniform vec3 Accel;\n"
+		"uniform float Ground;\n"
+		"uniform float BounceLoss;\n"
+		"out vec3 out_Position;\n"
+		"out vec3 out_Velocity;\n"
+		"void main() {\n"
+		"	vec3 p = in_Position + Timestep * (in_Velocity + Timestep * Accel / 2.0);\n"
+		"	vec3 v = in_Velocity + Timestep * Accel;\n"
+		"	if(BounceLoss > 0.0 && p.y < Ground) {\n"
+		"		p.y = Ground + (Ground - p.y) * BounceLoss;\n"
+		"		v.y = -v.y;\n"
+		"		v *= BounceLoss;\n"
+		"	}\n"
+		"	out_Position = p;\n"
+		"	out_Velocity = v;\n"
+		"}\n";
+
+	GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(shader, 1, &vertSource, NULL);
+	glCompileShader(shader);
+	GLint status = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if(status == GL_FALSE)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, 1024, NULL, log);
+		msg(FATAL, "Unable to compile the particle simulation shader: %s\n", log);
+		exit(EXIT_FAILURE);
+	}
+
+	/* No fragment shader is needed because nothing is rasterized. */
+	particle_sim_program = glCreateProgram();
+	glAttachShader(particle_sim_program, shader);
+	glBindAttribLocation(particle_sim_program, 0, "in_Position");
+	glBindAttribLocation(particle_sim_program, 1, "in_Velocity");
+	const char *varyings[2] = { "out_Position", "out_Velocity" };
+	glTransformFeedbackVaryings(particle_sim_program, 2, varyings, GL_SEPARATE_ATTRIBS);
+	glLinkProgram(particle_sim_program);
+	glDeleteShader(shader); // deleted when the program is
+	glGetProgramiv(particle_sim_program, GL_LINK_STATUS, &status);
+	if(status == GL_FALSE)
+	{
+		kuhl_print_program_log(particle_sim_program);
+		msg(FATAL, "Unable to link the particle simulation program.\n");
+		exit(EXIT_FAILURE);
+	}
+	kuhl_errorcheck();
+}
+
+/** Creates the buffers for a particle simulation.
+
+    @param sim The particle_sim to initialize.
+
+    @param count The number of particles.
+
+    @param positions 3*count floats with the initial positions, or NULL to start every particle at the origin.
+
+    @param velocities 3*count floats with the initial velocities, or NULL if the particles start at rest.
+*/
+void particle_sim_init(particle_sim *sim, GLsizei count, const float *positions, const float *velocities)
+{
+	memset(sim, 0, sizeof(particle_sim));
+	sim->count = count;
+	sim->accel[1] = -1;
+	sim->ground = 0;
+	sim->bounceLoss = .4;
+
+	if(!GLEW_VERSION_3_0)
+	{
+		msg(FATAL, "Transform feedback is required to simulate particles on the GPU.\n");
+		exit(EXIT_FAILURE);
+	}
+	particle_sim_program_init();
+
+	GLsizeiptr size = sizeof(float)*3*count;
+	glGenBuffers(2, sim->positions);
+	glGenBuffers(2, sim->velocities);
+	glGenVertexArrays(2, sim->vaos);
+	for(int i=0; i<2; i++)
+	{
+		glBindVertexArray(sim->vaos[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, sim->positions[i]);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, sim->velocities[i]);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	kuhl_errorcheck();
+
+	/* Buffers that aren't given start out as zeros. */
+	float *zeros = NULL;
+	if(positions == NULL || velocities == NULL)
+		zeros = calloc(3*count, sizeof(float));
+	particle_sim_set(sim, positions ? positions : zeros, velocities ? velocities : zeros);
+	free(zeros);
+}
+
+/** Deletes the buffers used by a particle simulation. */
+void particle_sim_free(particle_sim *sim)
+{
+	glDeleteVertexArrays(2, sim->vaos);
+	glDeleteBuffers(2, sim->positions);
+	glDeleteBuffers(2, sim->velocities);
+	memset(sim, 0, sizeof(particle_sim));
+}
+
+/** Replaces the positions and/or velocities of all of the particles.
+
+    @param sim The particle simulation.
+
+    @param positions 3*count floats, or NULL to keep the current positions.
+
+    @param velocities 3*count floats, or NULL to keep the current velocities.
+*/
+void particle_sim_set(particle_sim *sim, const float *positions, const float *velocities)
+{
+	GLsizeiptr size = sizeof(float)*3*sim->count;
+	if(positions != NULL)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, sim->positions[sim->current]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, positions);
+	}
+	if(velocities != NULL)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, sim->velocities[sim->current]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, velocities);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	kuhl_errorcheck();
+}
+
+/** Moves every particle forward in time. Gravity (sim->accel) is
+ * applied and particles that fall below sim->ground bounce. The
+ * current program and vertex array object are restored afterwards.
+
+    @param sim The particle simulation.
+
+    @param timestep The amount of time to move the particles forward by.
+*/
+void particle_sim_step(particle_sim *sim, float timestep)
+{
+	if(sim->count == 0)
+		return;
+
+	GLint prevProgram = 0, prevVao = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prevVao);
+
+	glUseProgram(particle_sim_program);
+	glUniform1f(glGetUniformLocation(particle_sim_program, "Timestep"), timestep);
+	glUniform3fv(glGetUniformLocation(particle_sim_program, "Accel"), 1, sim->accel);
+	glUniform1f(glGetUniformLocation(particle_sim_program, "Ground"), sim->ground);
+	glUniform1f(glGetUniformLocation(particle_sim_program, "BounceLoss"), sim->bounceLoss);
+
+	/* Read from the current buffers and write into the other ones. */
+	int next = 1 - sim->current;
+	glBindVertexArray(sim->vaos[sim->current]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, sim->positions[next]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, sim->velocities[next]);
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, sim->count);
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, 0);
+	glBindVertexArray(prevVao);
+	glUseProgram(prevProgram);
+	kuhl_errorcheck();
+
+	sim->current = next;
+}
+
+/** Returns the buffer that holds the latest positions (3 floats per
+ * particle). The buffer changes after each particle_sim_step(). */
+GLuint particle_sim_positions(const particle_sim *sim)
+{
+	return sim->positions[sim->current];
+}
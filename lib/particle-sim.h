@@ -0,0 +1,61 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Moves particles (for example, the vertices of a model) with
+    gravity and bounces them off of a ground plane entirely on the
+    GPU. The position and velocity of each particle are stored in
+    buffer objects and never copied back to the CPU.
+
+    Each step draws the particles as points with a vertex program
+    that calculates their new positions and velocities. Transform
+    feedback writes the results into a second pair of buffers and
+    nothing is rasterized. The two pairs of buffers are swapped after
+    each step. Transform feedback is part of OpenGL 3.0, so this works
+    with the OpenGL 3.2 contexts that the samples create.
+
+    Typical use:
+
+    particle_sim_init(&sim, vertexCount, positions, NULL);
+    particle_sim_set(&sim, NULL, velocities); // when the particles start moving
+    Each frame:
+    particle_sim_step(&sim, .1f);
+    kuhl_geometry_attrib_buffer(geom, particle_sim_positions(&sim), 3, 0, 0, "in_Position", 1);
+
+    @author Scott Kuhl
+ */
+
+#ifndef __PARTICLE_SIM_H__
+#define __PARTICLE_SIM_H__
+
+#include <GL/glew.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	GLsizei count;        /**< Number of particles */
+	GLuint positions[2];  /**< Buffers with 3 floats per particle; positions[current] is the latest */
+	GLuint velocities[2]; /**< Buffers with 3 floats per particle; velocities[current] is the latest */
+	GLuint vaos[2];       /**< vaos[i] reads positions[i] and velocities[i] */
+	int current;          /**< Which pair of buffers holds the latest state */
+
+	float accel[3];       /**< Acceleration (gravity), default is 0,-1,0 */
+	float ground;         /**< Particles bounce off of the plane where y is this value (default 0) */
+	float bounceLoss;     /**< Factor that the velocity is multiplied by when a particle bounces (default .4). If 0, particles don't bounce. */
+} particle_sim;
+
+void particle_sim_init(particle_sim *sim, GLsizei count, const float *positions, const float *velocities);
+void particle_sim_free(particle_sim *sim);
+void particle_sim_set(particle_sim *sim, const float *positions, const float *velocities);
+void particle_sim_step(particle_sim *sim, float timestep);
+GLuint particle_sim_positions(const particle_sim *sim);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __PARTICLE_SIM_H__
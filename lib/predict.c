@@ -0,0 +1,136 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ *
+ * Predicts where a tracked object will be at some time in the near
+ * future (typically, when the frame we are about to render is
+ * displayed) from timestamped tracker samples. Position is filtered
+ * and extrapolated with a kalman filter. Orientation is extrapolated
+ * by rotating the newest sample at the object's angular velocity.
+ *
+ * @author Scott Kuhl
+ */
+#include <string.h>
+#include <math.h>
+
+#include "vecmat.h"
+#include "predict.h"
+
+/** Initializes a predict_state struct.
+
+    @param state The struct to initialize.
+
+    @param sigma_meas Standard deviation of the noise in the position
+    measurements. See kalman_initialize().
+
+    @param qScale Scaling factor for the system error of the position
+    filter. See kalman_initialize().
+*/
+void predict_init(predict_state *state, float sigma_meas, float qScale)
+{
+	memset(state, 0, sizeof(predict_state));
+	for(int i=0; i<3; i++)
+		kalman_initialize(&(state->pos[i]), sigma_meas, qScale);
+	vec4f_set(state->quat, 0, 0, 0, 1);
+	state->smoothing = 0.5;
+}
+
+/** Adds a new tracker sample to the predictor.
+
+    @param state A predict_state struct initialized by predict_init().
+
+    @param pos The position of the tracked object.
+
+    @param quat The orientation of the tracked object as a unit
+    quaternion (x,y,z,w).
+
+    @param time The time the sample was taken in microseconds (for
+    example, the time VRPN provides with each record).
+*/
+void predict_update(predict_state *state, const float pos[3], const float quat[4], long time)
+{
+	for(int i=0; i<3; i++)
+		kalman_estimate_time(&(state->pos[i]), pos[i], time);
+
+	float q[4];
+	quatf_normalize_new(q, quat);
+	double dt = (time - state->time) / 1000000.0;
+
+	/* If this is the first sample or if there was a large gap since
+	 * the previous one, we don't know the angular velocity. */
+	if(state->time == 0 || dt <= 0 || dt > 0.25)
+		vec3f_set(state->angvel, 0, 0, 0);
+	else
+	{
+		/* Find the rotation from the previous sample to this one:
+		 * q = delta * prev, so delta = q * conjugate(prev) */
+		float conj[4] = { -state->quat[0], -state->quat[1], -state->quat[2], state->quat[3] };
+		float delta[4];
+		quatf_mult_quatf_new(delta, q, conj);
+		if(delta[3] < 0) // use the shorter rotation
+			vec4f_scalarMult(delta, -1);
+
+		float sinHalf = vec3f_norm(delta);
+		float angvel[3] = { 0, 0, 0 };
+		if(sinHalf > 1e-8)
+		{
+			float angle = 2*atan2f(sinHalf, delta[3]);
+			vec3f_scalarMult_new(angvel, delta, angle/(sinHalf*dt));
+		}
+
+		for(int i=0; i<3; i++)
+			state->angvel[i] = state->smoothing*angvel[i] + (1-state->smoothing)*state->angvel[i];
+	}
+
+	vec4f_copy(state->quat, q);
+	state->time = time;
+}
+
+/** Predicts the position and orientation of the tracked object at a
+ * given time. Predictions are limited to PREDICT_MAX_MICROSECONDS
+ * past the newest sample.
+
+    @param state A predict_state struct that has been updated with
+    predict_update().
+
+    @param time The time we want to predict the pose at (for example,
+    the time the next frame will be displayed) in microseconds.
+
+    @param pos The predicted position.
+
+    @param quat The predicted orientation as a unit quaternion (x,y,z,w).
+*/
+void predict_get(const predict_state *state, long time, float pos[3], float quat[4])
+{
+	if(state->time == 0)
+	{
+		vec3f_set(pos, 0, 0, 0);
+		vec4f_set(quat, 0, 0, 0, 1);
+		return;
+	}
+
+	long ahead = time - state->time;
+	if(ahead < 0)
+		ahead = 0;
+	if(ahead > PREDICT_MAX_MICROSECONDS)
+		ahead = PREDICT_MAX_MICROSECONDS;
+
+	for(int i=0; i<3; i++)
+		pos[i] = kalman_predict(&(state->pos[i]), state->time + ahead);
+
+	/* Rotate the newest orientation at the angular velocity. */
+	float rate = vec3f_norm(state->angvel);
+	float angle = rate * ahead / 1000000.0;
+	if(rate < 1e-8 || angle < 1e-8)
+	{
+		vec4f_copy(quat, state->quat);
+		return;
+	}
+	float s = sinf(angle/2) / rate;
+	float delta[4] = { state->angvel[0]*s, state->angvel[1]*s, state->angvel[2]*s, cosf(angle/2) };
+	quatf_mult_quatf_new(quat, delta, state->quat);
+	quatf_normalize(quat);
+}
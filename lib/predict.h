@@ -0,0 +1,37 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#ifndef __PREDICT_H__
+#define __PREDICT_H__
+
+#include "kalman.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Predictions will not be made further than this many microseconds
+ * past the newest tracker sample. */
+#define PREDICT_MAX_MICROSECONDS 100000
+
+typedef struct {
+	kalman_state pos[3]; /**< Filters for the X, Y, and Z position */
+	float quat[4];       /**< Newest orientation (x,y,z,w) */
+	float angvel[3];     /**< Angular velocity (axis * radians per second) */
+	long time;           /**< Time of the newest sample in microseconds, 0 if we have no samples */
+	float smoothing;     /**< Weight (0 to 1] given to the newest angular velocity estimate */
+} predict_state;
+
+void predict_init(predict_state *state, float sigma_meas, float qScale);
+void predict_update(predict_state *state, const float pos[3], const float quat[4], long time);
+void predict_get(const predict_state *state, long time, float pos[3], float quat[4]);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // __PREDICT_H__
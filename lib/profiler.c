@@ -0,0 +1,363 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "kuhl-util.h"
+#include "rolling-stats.h"
+#include "profiler.h"
+
+/** Number of timer queries per viewport. If the GPU falls this many
+ * frames behind, measurements are skipped instead of waiting. */
+#define PROFILER_QUERIES 8
+
+/** A named CPU scope */
+typedef struct {
+	char *name;
+	long start;          /**< Time profiler_begin() was called, 0 if the scope isn't running */
+	rolling_stats stats; /**< Milliseconds */
+} profiler_scope;
+
+/** A ring of GL_TIME_ELAPSED queries for one viewport. Queries from
+ * 'collected' up to 'issued' are waiting for results. */
+typedef struct {
+	GLuint ids[PROFILER_QUERIES];
+	unsigned int issued;
+	unsigned int collected;
+	rolling_stats stats; /**< Milliseconds */
+} profiler_pool;
+
+static int profiler_initialized = 0;
+static int profiler_has_timer = 0; /**< Set to 1 if the context supports GL_TIME_ELAPSED queries */
+static profiler_scope profiler_scopes[PROFILER_MAX_SCOPES];
+static int profiler_scope_count = 0;
+static profiler_pool profiler_pools[PROFILER_MAX_VIEWPORTS];
+static int profiler_gpu_current = -1; /**< Viewport whose query is running, -1 if none */
+static long profiler_gpu_skipped = 0; /**< Measurements skipped because all queries were in use */
+static long profiler_frame_time = 0; /**< Time profiler_end_frame() was last called */
+static long profiler_report_interval = 0; /**< How often profiler_end_frame() prints a summary, 0 for never */
+static long profiler_report_time = 0; /**< Time the summary was last printed */
+
+/** Starts measuring. This must be called after an OpenGL context has
+ * been created. Calling it more than once has no effect. */
+void profiler_init(void)
+{
+	if(profiler_initialized)
+		return;
+	profiler_initialized = 1;
+
+	/* GL_TIME_ELAPSED queries are in OpenGL 3.3 and ARB_timer_query */
+	profiler_has_timer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	for(int i=0; i<PROFILER_MAX_VIEWPORTS; i++)
+	{
+		if(profiler_has_timer)
+			glGenQueries(PROFILER_QUERIES, profiler_pools[i].ids);
+		rolling_stats_init(&profiler_pools[i].stats, PROFILER_FRAMES);
+	}
+	kuhl_errorcheck();
+	if(profiler_has_timer == 0)
+		msg(WARNING, "Timer queries are not supported by this OpenGL context; only CPU times will be measured.\n");
+}
+
+/** Makes profiler_end_frame() print a summary periodically.
+
+    @param microseconds How often to print the summary, 0 to stop printing it.
+*/
+void profiler_report(long microseconds)
+{
+	profiler_report_interval = microseconds;
+	profiler_report_time = kuhl_microseconds();
+}
+
+/** @return 1 if profiler_init() has been called, 0 otherwise. */
+int profiler_enabled(void)
+{
+	return profiler_initialized;
+}
+
+/** @return 1 if GPU times are being measured, 0 otherwise. */
+int profiler_gpu_available(void)
+{
+	return profiler_initialized && profiler_has_timer;
+}
+
+/** Finds a scope by name.
+
+    @param create If 1, the scope is created if it doesn't exist.
+
+    @return The scope or NULL if it doesn't exist (or couldn't be created).
+*/
+static profiler_scope* profiler_find(const char *name, int create)
+{
+	for(int i=0; i<profiler_scope_count; i++)
+		if(strcmp(profiler_scopes[i].name, name) == 0)
+			return &(profiler_scopes[i]);
+	if(create == 0)
+		return NULL;
+	if(profiler_scope_count == PROFILER_MAX_SCOPES)
+	{
+		static int warned = 0;
+		if(!warned)
+			msg(WARNING, "Too many profiler scopes, not measuring %s (maximum is %d).\n", name, PROFILER_MAX_SCOPES);
+		warned = 1;
+		return NULL;
+	}
+	profiler_scope *scope = &(profiler_scopes[profiler_scope_count++]);
+	scope->name = strdup(name);
+	scope->start = 0;
+	rolling_stats_init(&scope->stats, PROFILER_FRAMES);
+	return scope;
+}
+
+/** Starts measuring the CPU time of a named part of a frame. Scopes
+ * with different names may overlap or nest.
+
+    @param name The name of the scope, the same name must be passed to profiler_end().
+*/
+void profiler_begin(const char *name)
+{
+	if(!profiler_initialized)
+		return;
+	profiler_scope *scope = profiler_find(name, 1);
+	if(scope)
+		scope->start = kuhl_microseconds();
+}
+
+/** Stops measuring a scope that profiler_begin() started.
+
+    @param name The name of the scope.
+*/
+void profiler_end(const char *name)
+{
+	if(!profiler_initialized)
+		return;
+	profiler_scope *scope = profiler_find(name, 0);
+	if(scope == NULL || scope->start == 0)
+		return;
+	rolling_stats_add(&scope->stats, (kuhl_microseconds() - scope->start)/1000.0f);
+	scope->start = 0;
+}
+
+/** Stores the results of any finished queries for a viewport without
+ * waiting for unfinished ones. */
+static void profiler_collect(profiler_pool *pool)
+{
+	while(pool->collected != pool->issued)
+	{
+		GLuint id = pool->ids[pool->collected % PROFILER_QUERIES];
+		GLint available = 0;
+		glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available)
+			break;
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(id, GL_QUERY_RESULT, &nanoseconds);
+		rolling_stats_add(&pool->stats, nanoseconds / 1000000.0f);
+		pool->collected++;
+	}
+}
+
+/** Starts measuring the GPU time for a viewport. Any running GPU
+ * measurement is ended first since only one GL_TIME_ELAPSED query
+ * can run at a time. viewmat_begin_eye() calls this.
+
+    @param viewportID The viewport that is about to be drawn.
+*/
+void profiler_gpu_begin(int viewportID)
+{
+	if(!profiler_initialized || !profiler_has_timer)
+		return;
+	profiler_gpu_end();
+	if(viewportID < 0 || viewportID >= PROFILER_MAX_VIEWPORTS)
+		return;
+
+	profiler_pool *pool = &(profiler_pools[viewportID]);
+	profiler_collect(pool);
+	if(pool->issued - pool->collected >= PROFILER_QUERIES)
+	{
+		/* The GPU is far behind. Skip this measurement rather than
+		 * wait for an old query to finish. */
+		profiler_gpu_skipped++;
+		return;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, pool->ids[pool->issued % PROFILER_QUERIES]);
+	profiler_gpu_current = viewportID;
+}
+
+/** Stops measuring the GPU time for the viewport that
+ * profiler_gpu_begin() was called for. */
+void profiler_gpu_end(void)
+{
+	if(profiler_gpu_current < 0)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	profiler_pools[profiler_gpu_current].issued++;
+	profiler_gpu_current = -1;
+}
+
+/** Should be called once per frame after the buffers are swapped;
+ * viewmat_end_frame() calls this. Records the time between frames in
+ * the "frame" scope, collects finished GPU measurements, and prints a
+ * summary if profiler_report() asked for one. */
+void profiler_end_frame(void)
+{
+	if(!profiler_initialized)
+		return;
+	profiler_gpu_end();
+	if(profiler_has_timer)
+		for(int i=0; i<PROFILER_MAX_VIEWPORTS; i++)
+			profiler_collect(&profiler_pools[i]);
+
+	long now = kuhl_microseconds();
+	profiler_scope *frame = profiler_find("frame", 1);
+	if(frame && profiler_frame_time > 0)
+		rolling_stats_add(&frame->stats, (now - profiler_frame_time)/1000.0f);
+	profiler_frame_time = now;
+
+	if(profiler_report_interval > 0 && now - profiler_report_time > profiler_report_interval)
+	{
+		profiler_report_time = now;
+		profiler_print();
+	}
+}
+
+/** Fills in profiler_stats from a rolling_stats struct.
+
+    @return 1 if there were any measurements, 0 otherwise.
+*/
+static int profiler_fill(rolling_stats *rs, profiler_stats *stats)
+{
+	float pcts[3] = { .5, .95, .99 };
+	float r[3];
+	memset(stats, 0, sizeof(profiler_stats));
+	stats->count = rolling_stats_percentiles(rs, pcts, r, 3);
+	if(stats->count == 0)
+		return 0;
+	stats->mean = rolling_stats_mean(rs);
+	stats->p50 = r[0];
+	stats->p95 = r[1];
+	stats->p99 = r[2];
+	return 1;
+}
+
+/** Gets the newest GPU time measurement for a viewport. Unlike
+ * profiler_gpu_stats(), this reacts immediately to changes (see the
+ * dynamic resolution code in viewmat.c).
+
+    @param viewportID The viewport.
+
+    @param ms To be filled in with the newest measurement in
+    milliseconds. Not changed if there are no measurements.
+
+    @return The number of measurements collected for the viewport so
+    far. If this hasn't changed since the last call, ms is the same
+    measurement as before.
+*/
+long profiler_gpu_latest(int viewportID, float *ms)
+{
+	if(!profiler_gpu_available() || viewportID < 0 || viewportID >= PROFILER_MAX_VIEWPORTS)
+		return 0;
+	rolling_stats *rs = &profiler_pools[viewportID].stats;
+	if(rs->count == 0)
+		return 0;
+	*ms = rs->values[(rs->next + rs->capacity - 1) % rs->capacity];
+	return rs->total;
+}
+
+/** Gets statistics about the recent CPU times of a scope. The "frame"
+ * scope contains the time between frames.
+
+    @param name The name of the scope.
+
+    @param stats To be filled in with the statistics.
+
+    @return 1 if the scope has measurements, 0 otherwise.
+*/
+int profiler_cpu_stats(const char *name, profiler_stats *stats)
+{
+	profiler_scope *scope = profiler_initialized ? profiler_find(name, 0) : NULL;
+	if(scope == NULL)
+	{
+		memset(stats, 0, sizeof(profiler_stats));
+		return 0;
+	}
+	return profiler_fill(&scope->stats, stats);
+}
+
+/** Gets statistics about the recent GPU times of a viewport.
+
+    @param viewportID The viewport.
+
+    @param stats To be filled in with the statistics.
+
+    @return 1 if the viewport has measurements, 0 otherwise (including
+    when timer queries are not supported).
+*/
+int profiler_gpu_stats(int viewportID, profiler_stats *stats)
+{
+	if(!profiler_gpu_available() || viewportID < 0 || viewportID >= PROFILER_MAX_VIEWPORTS)
+	{
+		memset(stats, 0, sizeof(profiler_stats));
+		return 0;
+	}
+	return profiler_fill(&profiler_pools[viewportID].stats, stats);
+}
+
+/** Writes a short summary of the median and 95th percentile of each
+ * CPU scope and of the GPU time of each viewport into a string. For
+ * example: "frame 16.7/17.1 draw 2.1/2.5 gpu0 3.0/3.2 ms (p50/p95)"
+
+    @param str The string to write into.
+
+    @param len The size of str.
+*/
+void profiler_summary(char *str, int len)
+{
+	if(len < 1)
+		return;
+	str[0] = '\0';
+	int used = 0;
+	profiler_stats stats;
+	for(int i=0; i<profiler_scope_count && used < len; i++)
+	{
+		if(profiler_fill(&profiler_scopes[i].stats, &stats))
+			used += snprintf(str+used, len-used, "%s %.1f/%.1f ", profiler_scopes[i].name, stats.p50, stats.p95);
+	}
+	for(int i=0; i<PROFILER_MAX_VIEWPORTS && used < len; i++)
+	{
+		if(profiler_gpu_stats(i, &stats))
+			used += snprintf(str+used, len-used, "gpu%d %.1f/%.1f ", i, stats.p50, stats.p95);
+	}
+	if(used < len)
+		snprintf(str+used, len-used, "ms (p50/p95)");
+}
+
+/** Prints the percentiles of each CPU scope and of the GPU time of
+ * each viewport. */
+void profiler_print(void)
+{
+	if(!profiler_initialized)
+		return;
+	profiler_stats stats;
+	for(int i=0; i<profiler_scope_count; i++)
+	{
+		if(profiler_fill(&profiler_scopes[i].stats, &stats))
+			msg(INFO, "cpu %-12s p50=%6.2f p95=%6.2f p99=%6.2f mean=%6.2f ms (%d frames)\n", profiler_scopes[i].name,
+			    stats.p50, stats.p95, stats.p99, stats.mean, stats.count);
+	}
+	for(int i=0; i<PROFILER_MAX_VIEWPORTS; i++)
+	{
+		if(profiler_gpu_stats(i, &stats))
+			msg(INFO, "gpu viewport %d   p50=%6.2f p95=%6.2f p99=%6.2f mean=%6.2f ms (%d frames)\n", i,
+			    stats.p50, stats.p95, stats.p99, stats.mean, stats.count);
+	}
+	if(profiler_gpu_skipped > 0)
+		msg(INFO, "Skipped %ld GPU measurements because the GPU was too far behind.\n", profiler_gpu_skipped);
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Measures how long parts of a frame take on the CPU and how long
+    each viewport takes on the GPU. Percentiles of recent frames can be
+    printed or read back (for example, to display them in a label).
+
+    CPU time is measured between profiler_begin() and profiler_end()
+    calls with the same name. GPU time is measured with
+    GL_TIME_ELAPSED queries. viewmat starts a query for each viewport
+    in viewmat_begin_eye() and ends it in viewmat_end_frame(), so
+    programs don't need to do anything to measure GPU time. Results
+    are collected when they become available---the profiler never
+    waits for the GPU. If the OpenGL context doesn't support timer
+    queries, only CPU times are measured.
+
+    Nothing is measured until profiler_init() is called. viewmat calls
+    it if VIEWMAT_PROFILE=1 and prints a summary every few seconds.
+
+    @author Scott Kuhl
+ */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFILER_MAX_SCOPES 32    /**< Maximum number of named CPU scopes */
+#define PROFILER_MAX_VIEWPORTS 4  /**< Maximum number of viewports that GPU time is measured for */
+#define PROFILER_FRAMES 300       /**< Number of recent frames that percentiles are calculated over */
+
+/** Statistics about the recent measurements of a scope or viewport. All times are in milliseconds. */
+typedef struct {
+	int count;  /**< Number of measurements the statistics are calculated from */
+	float mean;
+	float p50;
+	float p95;
+	float p99;
+} profiler_stats;
+
+void profiler_init(void);
+void profiler_report(long microseconds);
+int profiler_enabled(void);
+int profiler_gpu_available(void);
+
+void profiler_begin(const char *name);
+void profiler_end(const char *name);
+
+void profiler_gpu_begin(int viewportID);
+void profiler_gpu_end(void);
+void profiler_end_frame(void);
+
+int profiler_cpu_stats(const char *name, profiler_stats *stats);
+int profiler_gpu_stats(int viewportID, profiler_stats *stats);
+long profiler_gpu_latest(int viewportID, float *ms);
+void profiler_summary(char *str, int len);
+void profiler_print(void);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __PROFILER_H__
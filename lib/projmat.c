@@ -9,19 +9,274 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #else
 #include <GL/freeglut.h>
 #endif
+#ifndef MISSING_EGL
+#define EGL_NO_X11              // don't pull in Xlib through eglplatform.h
+#define MESA_EGL_NO_X11_HEADERS // older name for EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 #include "kuhl-util.h"
 #include "viewmat.h"
+#include "projmat.h"
+#include "profiler.h"
 
 float projmat_frustum[6];
 float projmat_master_frustum[6];
 float projmat_vfov = -1;
 int projmat_mode = -1; /**< -1=undefined, 0=vfov, 1=frustum */
 
+static int projmat_headless_mode = -1; /**< -1=not checked yet, 0=GLUT window, 1=offscreen */
+static int projmat_offscreen_size[2] = { 512, 512 }; /**< Size of the offscreen framebuffer */
+static int projmat_headless_frames = 600;           /**< Frames to draw before exiting */
+static double projmat_headless_frame_ms = 1000/60.0; /**< Milliseconds the clock advances per frame */
+static long projmat_headless_frame = 0;              /**< Frames drawn so far */
+static GLuint projmat_headless_framebuffer = 0;
+static GLuint projmat_headless_texture = 0;
+
+
+/** Checks if we should draw into an offscreen framebuffer instead of
+ * a GLUT window (PROJMAT_HEADLESS=1).
+ *
+ * @return 1 if there is no GLUT window, 0 otherwise.
+ */
+int projmat_headless()
+{
+	if(projmat_headless_mode < 0)
+	{
+		const char *headlessString = getenv("PROJMAT_HEADLESS");
+		projmat_headless_mode = headlessString && strcmp(headlessString, "1") == 0;
+	}
+	return projmat_headless_mode;
+}
+
+/** Creates an OpenGL 3.2 core profile context that isn't attached
+ * to a window. */
+static void projmat_headless_context()
+{
+#ifdef MISSING_EGL
+	msg(FATAL, "PROJMAT_HEADLESS=1 requires EGL, which was not found when this program was compiled.\n");
+	exit(EXIT_FAILURE);
+#else
+	/* Prefer a display that doesn't need a window system at all
+	 * (Mesa provides one, including for its software renderer). */
+	EGLDisplay display = EGL_NO_DISPLAY;
+	const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if(clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if(getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if(display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+	{
+		msg(FATAL, "Unable to initialize EGL (error 0x%x).\n", eglGetError());
+		exit(EXIT_FAILURE);
+	}
+	if(!eglBindAPI(EGL_OPENGL_API))
+	{
+		msg(FATAL, "EGL doesn't support desktop OpenGL (error 0x%x).\n", eglGetError());
+		exit(EXIT_FAILURE);
+	}
+
+	/* We draw into a framebuffer object, so the color and depth
+	 * sizes here don't matter much. Some surfaceless displays don't
+	 * offer pbuffers; we only need one if surfaceless contexts
+	 * aren't supported. */
+	EGLint configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+	                           EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	                           EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+	                           EGL_NONE };
+	EGLConfig config;
+	EGLint configCount = 0;
+	if(!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount < 1)
+	{
+		configAttribs[1] = 0;
+		if(!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount < 1)
+		{
+			msg(FATAL, "No suitable EGL configuration (error 0x%x).\n", eglGetError());
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	const EGLint contextAttribs[] = { EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+	                                  EGL_CONTEXT_MINOR_VERSION_KHR, 2,
+	                                  EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+	                                  EGL_NONE };
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if(context == EGL_NO_CONTEXT)
+	{
+		msg(FATAL, "Unable to create an OpenGL 3.2 core profile context with EGL (error 0x%x).\n", eglGetError());
+		exit(EXIT_FAILURE);
+	}
+
+	EGLSurface surface = EGL_NO_SURFACE;
+	const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if(extensions == NULL || strstr(extensions, "EGL_KHR_surfaceless_context") == NULL)
+	{
+		const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+	}
+	if(!eglMakeCurrent(display, surface, surface, context))
+	{
+		msg(FATAL, "Unable to make the EGL context current (error 0x%x).\n", eglGetError());
+		exit(EXIT_FAILURE);
+	}
+	msg(INFO, "Created an offscreen OpenGL context with EGL %d.%d (%s).\n",
+	    major, minor, eglQueryString(display, EGL_VENDOR));
+#endif
+}
+
+/** Creates an offscreen OpenGL context if PROJMAT_HEADLESS=1. Call
+ * this instead of creating a GLUT window and before initializing
+ * GLEW:
+
+ @code
+ if(!projmat_init_headless())
+ {
+     glutInit(&argc, argv);
+     ...
+     glutCreateWindow(argv[0]);
+ }
+ @endcode
+
+ In headless mode, PROJMAT_WINDOW_SIZE sets the size of the
+ offscreen framebuffer, PROJMAT_FRAMES sets the number of frames
+ that projmat_main_loop() draws before exiting and PROJMAT_FRAME_MS
+ sets how much projmat_elapsed_milliseconds() advances each frame.
+
+ Some versions of GLEW return GLEW_ERROR_NO_GLX_DISPLAY from
+ glewInit() when there is no window. The OpenGL functions are loaded
+ anyway, so the error can be ignored when projmat_headless() is set.
+
+ @return 1 if an offscreen context was created, 0 if the program
+ should create a GLUT window.
+*/
+int projmat_init_headless()
+{
+	if(!projmat_headless())
+		return 0;
+
+	const char* windowSizeString = getenv("PROJMAT_WINDOW_SIZE");
+	if(windowSizeString != NULL &&
+	   (sscanf(windowSizeString, "%d %d", &(projmat_offscreen_size[0]), &(projmat_offscreen_size[1])) != 2 ||
+	    projmat_offscreen_size[0] < 1 || projmat_offscreen_size[1] < 1))
+	{
+		msg(FATAL, "Unable to parse PROJMAT_WINDOW_SIZE environment variable.\n");
+		exit(EXIT_FAILURE);
+	}
+	const char* framesString = getenv("PROJMAT_FRAMES");
+	if(framesString != NULL &&
+	   (sscanf(framesString, "%d", &projmat_headless_frames) != 1 || projmat_headless_frames < 1))
+	{
+		msg(FATAL, "Unable to parse PROJMAT_FRAMES environment variable.\n");
+		exit(EXIT_FAILURE);
+	}
+	const char* frameMsString = getenv("PROJMAT_FRAME_MS");
+	if(frameMsString != NULL &&
+	   (sscanf(frameMsString, "%lf", &projmat_headless_frame_ms) != 1 || projmat_headless_frame_ms < 0))
+	{
+		msg(FATAL, "Unable to parse PROJMAT_FRAME_MS environment variable.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	projmat_headless_context();
+	msg(INFO, "Headless: %dx%d framebuffer, %d frames, %.3f ms per frame.\n",
+	    projmat_offscreen_size[0], projmat_offscreen_size[1],
+	    projmat_headless_frames, projmat_headless_frame_ms);
+	return 1;
+}
+
+/** Gets the size of the offscreen framebuffer. Only meaningful when
+ * projmat_headless() is set; use viewmat_window_size() otherwise.
+ *
+ * @param width To be filled in with the width of the framebuffer.
+ * @param height To be filled in with the height of the framebuffer.
+ */
+void projmat_headless_size(int *width, int *height)
+{
+	*width  = projmat_offscreen_size[0];
+	*height = projmat_offscreen_size[1];
+}
+
+/** Returns the framebuffer that takes the place of the window. This
+ * is 0 (the window) unless projmat_headless() is set. Code that
+ * binds another framebuffer should bind this one instead of 0 when
+ * it is done.
+ *
+ * @return The framebuffer that is displayed at the end of a frame.
+ */
+GLuint projmat_framebuffer()
+{
+	return projmat_headless_framebuffer;
+}
+
+/** Returns the number of milliseconds since the program started. In
+ * headless mode, the clock advances by exactly PROJMAT_FRAME_MS each
+ * frame so that animations are the same in every run regardless of
+ * how fast the frames are drawn.
+ *
+ * @return Milliseconds since the program started.
+ */
+long projmat_elapsed_milliseconds()
+{
+	if(projmat_headless())
+		return (long) (projmat_headless_frame * projmat_headless_frame_ms);
+	return glutGet(GLUT_ELAPSED_TIME);
+}
+
+/** Runs the program. If there is a GLUT window, this calls
+ * glutMainLoop() and the display callback that was registered with
+ * GLUT. In headless mode, it calls display() PROJMAT_FRAMES times,
+ * prints how long the frames took (and the profiler summary if the
+ * profiler is on) and exits.
+ *
+ * @param display The function that draws a frame.
+ */
+void projmat_main_loop(void (*display)(void))
+{
+	if(!projmat_headless())
+	{
+		glutMainLoop();
+		return;
+	}
+
+	long start = kuhl_microseconds();
+	for(projmat_headless_frame = 0; projmat_headless_frame < projmat_headless_frames; projmat_headless_frame++)
+		display();
+	glFinish();
+	double seconds = (kuhl_microseconds() - start) / 1000000.0;
+
+	msg(INFO, "Headless: drew %d frames in %.3f seconds (%.3f ms per frame, %.1f fps).\n",
+	    projmat_headless_frames, seconds, seconds*1000/projmat_headless_frames,
+	    projmat_headless_frames/seconds);
+	if(profiler_enabled())
+		profiler_print();
+	exit(EXIT_SUCCESS);
+}
+
+/** Creates the offscreen framebuffer that we draw into instead of a
+ * window and leaves it bound. */
+static void projmat_init_framebuffer()
+{
+	projmat_headless_framebuffer = kuhl_gen_framebuffer(projmat_offscreen_size[0], projmat_offscreen_size[1],
+	                                                    &projmat_headless_texture, NULL);
+	glBindFramebuffer(GL_FRAMEBUFFER, projmat_headless_framebuffer);
+	glViewport(0, 0, projmat_offscreen_size[0], projmat_offscreen_size[1]);
+	msg(INFO, "Headless: drawing into a framebuffer object with %s.\n", glGetString(GL_RENDERER));
+}
+
 
 /** 
  Updates the size and position of the GLUT window based on environment variables.
@@ -65,11 +320,15 @@ static void projmat_init_window()
 
 
 /** Initialize projmat. This will apply any adjustments to the GLUT
- * window and then find a view frustum to use from the environment
+ * window (or, in headless mode, create the offscreen framebuffer)
+ * and then find a view frustum to use from the environment
  * variables. */
 void projmat_init()
 {
-	projmat_init_window();
+	if(projmat_headless())
+		projmat_init_framebuffer();
+	else
+		projmat_init_window();
 
 	const char* frustumString = getenv("PROJMAT_FRUSTUM");
 	const char* masterFrustumString = getenv("PROJMAT_MASTER_FRUSTUM");
@@ -19,13 +19,24 @@
     PROJMAT_FULLSCREEN="1" - Make the window full screen.<br>
     PROJMAT_FRUSTUM="..." - The top bottom left right near far values for the current process view frustum.<br>
     PROJMAT_MASTER_FRUSTUM="..." - The top bottom left right near far values for master view frustum (if DGR is used).<br>
-    PROJMAT_VFOV="65" - Sets the vertical field of view of the display to 65 degrees.
+    PROJMAT_VFOV="65" - Sets the vertical field of view of the display to 65 degrees.<br>
+    PROJMAT_HEADLESS="1" - Draw into an offscreen framebuffer instead of a GLUT window (see projmat_init_headless()). PROJMAT_WINDOW_SIZE sets the size of the framebuffer.<br>
+    PROJMAT_FRAMES="600" - In headless mode, exit after drawing 600 frames.<br>
+    PROJMAT_FRAME_MS="16.667" - In headless mode, advance projmat_elapsed_milliseconds() by 16.667 milliseconds each frame.
 
     Either the PROJMAT_FRUSTUM should be set or PROJMAT_VFOV should be set, but not both.
 
     If no environment variables are set, projmat generates a frustum
     equivalent to a basic perspective projection matrix.
 
+    Headless mode lets programs run on computers without a display
+    (for example, to measure performance). It needs EGL; Mesa's
+    software renderer works. Programs that support it call
+    projmat_init_headless() instead of creating a GLUT window,
+    projmat_elapsed_milliseconds() instead of
+    glutGet(GLUT_ELAPSED_TIME) and projmat_main_loop() instead of
+    glutMainLoop().
+
 
     @author Scott Kuhl
  */
@@ -40,6 +51,13 @@ void projmat_init();
 void projmat_get_frustum(float result[6], int viewportWidth, int viewportHeight);
 void projmat_get_master_frustum(float result[6]);
 
+int projmat_headless();
+int projmat_init_headless();
+void projmat_headless_size(int *width, int *height);
+GLuint projmat_framebuffer();
+long projmat_elapsed_milliseconds();
+void projmat_main_loop(void (*display)(void));
+
 #ifdef __cplusplus
 } // end extern "C"
 #endif
@@ -0,0 +1,440 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "render-queue.h"
+#include "msg.h"
+
+/* Sizes of the fields in a sort key, in bits. They add up to 64. */
+#define RQ_VIEWPORT_BITS 4
+#define RQ_PASS_BITS 2
+#define RQ_PROGRAM_BITS 10
+#define RQ_TEXTURE_BITS 12
+#define RQ_VAO_BITS 12
+#define RQ_DEPTH_BITS 24
+
+/** The OpenGL state that render_queue_flush() has set. A name of 0
+ * means that the state is unknown; geometry never uses program,
+ * texture or vertex array object 0. */
+typedef struct {
+	GLuint program;
+	GLuint vao;
+	GLuint textures[MAX_TEXTURES]; /**< Texture bound to each texture unit */
+	const kuhl_geometry *samplers; /**< Geometry that the sampler uniforms of the program were last set for */
+	int hasTex;     /**< Value of the HasTex uniform, -1 if unknown */
+	int numBones;   /**< Value of the NumBones uniform, -1 if unknown */
+	int geomTransformSet; /**< Is geomTransform the value of the GeomTransform uniform? */
+	float geomTransform[16];
+
+	/* Uniform locations in the current program */
+	GLint matrixLoc;
+	GLint geomTransformLoc;
+	GLint hasTexLoc;
+	GLint numBonesLoc;
+	GLint boneMatLoc;
+} render_queue_state;
+
+
+/** Initializes a render_queue.
+
+    @param queue The queue to initialize.
+
+    @param matrixUniform The name of the mat4 uniform that the matrix
+    of each draw is sent to (for example, "ModelView").
+*/
+void render_queue_init(render_queue *queue, const char *matrixUniform)
+{
+	memset(queue, 0, sizeof(render_queue));
+	queue->matrix_uniform = strdup(matrixUniform);
+}
+
+/** Frees the memory used by a render_queue. */
+void render_queue_free(render_queue *queue)
+{
+	free(queue->items);
+	free(queue->matrix_uniform);
+	memset(queue, 0, sizeof(render_queue));
+}
+
+/** Removes all of the draws from a queue without drawing them. */
+void render_queue_clear(render_queue *queue)
+{
+	queue->count = 0;
+}
+
+/** Converts a distance from the camera into the depth field of a
+ * sort key. The bits of a positive float sort in the same order as
+ * the float itself, so the most significant bits are kept. */
+static uint64_t render_queue_depth_bits(float depth)
+{
+	if(!(depth > 0)) // also catches NaN
+		depth = 0;
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits >> (31 - RQ_DEPTH_BITS); // the sign bit is always 0
+}
+
+/** Creates a sort key for drawing a kuhl_geometry object.
+
+    @param viewportID The viewport that the geometry is drawn into.
+
+    @param pass RENDER_QUEUE_OPAQUE or RENDER_QUEUE_BLENDED.
+
+    @param geom The geometry (only this object, not the rest of its list).
+
+    @param depth Distance from the camera to the geometry. It only
+    needs to be correct relative to the other draws in the queue.
+
+    @return A key to pass to render_queue_submit().
+*/
+uint64_t render_queue_key(int viewportID, int pass, const kuhl_geometry *geom, float depth)
+{
+	/* All of the textures of the geometry combined into one value. */
+	uint64_t textureSet = 0;
+	for(unsigned int i=0; i<geom->texture_count; i++)
+		textureSet = textureSet*31 + geom->textures[i].textureId;
+
+	uint64_t program = geom->program & ((1 << RQ_PROGRAM_BITS)-1);
+	uint64_t texture = textureSet & ((1 << RQ_TEXTURE_BITS)-1);
+	uint64_t vao = geom->vao & ((1 << RQ_VAO_BITS)-1);
+	uint64_t depthBits = render_queue_depth_bits(depth);
+
+	uint64_t key = (uint64_t) (viewportID & ((1 << RQ_VIEWPORT_BITS)-1));
+	key = (key << RQ_PASS_BITS) | (pass & ((1 << RQ_PASS_BITS)-1));
+	if(pass == RENDER_QUEUE_BLENDED)
+	{
+		/* Farthest first. Invert the depth so that it sorts in
+		 * decreasing order. */
+		key = (key << RQ_DEPTH_BITS) | (~depthBits & ((1 << RQ_DEPTH_BITS)-1));
+		key = (key << RQ_PROGRAM_BITS) | program;
+		key = (key << RQ_TEXTURE_BITS) | texture;
+		key = (key << RQ_VAO_BITS) | vao;
+	}
+	else
+	{
+		/* Group by state, then closest first. */
+		key = (key << RQ_PROGRAM_BITS) | program;
+		key = (key << RQ_TEXTURE_BITS) | texture;
+		key = (key << RQ_VAO_BITS) | vao;
+		key = (key << RQ_DEPTH_BITS) | depthBits;
+	}
+	return key;
+}
+
+/** Adds a draw of a single kuhl_geometry object to the queue.
+
+    @param queue The queue to add to.
+
+    @param key The sort key. Usually created with render_queue_key(),
+    but any key with the viewport in its top 4 bits works.
+
+    @param geom The geometry to draw. Only this object is drawn, not the
+    rest of the list that it is a part of.
+
+    @param matrix A matrix to send to the matrix uniform of the queue
+    (see render_queue_init()) before drawing. It is copied.
+
+    @param instances Number of instances to draw (see
+    kuhl_geometry_draw_instanced()).
+*/
+void render_queue_submit(render_queue *queue, uint64_t key, kuhl_geometry *geom, const float matrix[16], GLsizei instances)
+{
+	if(geom == NULL || instances < 1)
+		return;
+	if(queue->count == queue->capacity)
+	{
+		unsigned int capacity = queue->capacity == 0 ? 256 : queue->capacity*2;
+		render_queue_item *items = realloc(queue->items, sizeof(render_queue_item)*capacity);
+		if(items == NULL)
+		{
+			msg(FATAL, "Unable to allocate space for %u draws.\n", capacity);
+			exit(EXIT_FAILURE);
+		}
+		queue->items = items;
+		queue->capacity = capacity;
+	}
+
+	render_queue_item *item = &(queue->items[queue->count]);
+	item->key = key;
+	item->order = queue->count;
+	item->geom = geom;
+	memcpy(item->matrix, matrix, sizeof(float)*16);
+	item->instances = instances;
+	item->lod = geom->lod_level;
+	queue->count++;
+}
+
+/** Adds draws of every kuhl_geometry object in a list to the queue,
+ * the same objects that kuhl_geometry_draw() would draw.
+
+    @param queue The queue to add to.
+
+    @param viewportID The viewport that the geometry is drawn into.
+
+    @param pass RENDER_QUEUE_OPAQUE or RENDER_QUEUE_BLENDED.
+
+    @param geom The first object in the list to draw.
+
+    @param matrix The matrix to send to the matrix uniform of the queue.
+
+    @param depth Distance from the camera to the geometry.
+*/
+void render_queue_add(render_queue *queue, int viewportID, int pass, kuhl_geometry *geom, const float matrix[16], float depth)
+{
+	for(kuhl_geometry *g = geom; g != NULL; g = g->next)
+		render_queue_submit(queue, render_queue_key(viewportID, pass, g, depth), g, matrix, 1);
+}
+
+static int render_queue_compare(const void *a, const void *b)
+{
+	const render_queue_item *x = (const render_queue_item*) a;
+	const render_queue_item *y = (const render_queue_item*) b;
+	if(x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return (x->order > y->order) - (x->order < y->order);
+}
+
+/** Returns 1 if two kuhl_geometry objects connect the same sampler
+ * variables to the same texture units. */
+static int render_queue_same_samplers(const kuhl_geometry *a, const kuhl_geometry *b)
+{
+	if(a == b)
+		return 1;
+	if(a == NULL || a->texture_count != b->texture_count)
+		return 0;
+	for(unsigned int i=0; i<a->texture_count; i++)
+		if(strcmp(a->textures[i].name, b->textures[i].name) != 0)
+			return 0;
+	return 1;
+}
+
+/** Switches to a different program and looks up the uniforms that
+ * are set for each draw. */
+static void render_queue_use_program(render_queue *queue, render_queue_state *state, GLuint program)
+{
+	glUseProgram(program);
+	state->program = program;
+	state->matrixLoc = glGetUniformLocation(program, queue->matrix_uniform);
+	state->geomTransformLoc = glGetUniformLocation(program, "GeomTransform");
+	state->hasTexLoc = glGetUniformLocation(program, "HasTex");
+	state->numBonesLoc = glGetUniformLocation(program, "NumBones");
+	state->boneMatLoc = glGetUniformLocation(program, "BoneMat");
+
+	/* Uniforms belong to the program; we don't know their values. */
+	state->samplers = NULL;
+	state->hasTex = -1;
+	state->numBones = -1;
+	state->geomTransformSet = 0;
+}
+
+/** Draws one item, changing only the state that differs from the
+ * previous item. */
+static void render_queue_draw(render_queue *queue, render_queue_state *state, const render_queue_item *item)
+{
+	kuhl_geometry *geom = item->geom;
+	render_queue_stats *stats = &(queue->stats);
+
+	if(geom->program != state->program)
+	{
+		render_queue_use_program(queue, state, geom->program);
+		stats->program_changes++;
+	}
+	else
+		stats->program_skips++;
+
+	/* Connect the sampler variables to texture units. */
+	if(!render_queue_same_samplers(state->samplers, geom))
+	{
+		int hasTex = 0;
+		for(unsigned int i=0; i<geom->texture_count; i++)
+		{
+			GLint loc = glGetUniformLocation(geom->program, geom->textures[i].name);
+			if(loc == -1)
+				continue;
+			glUniform1i(loc, i);
+			if(strcmp(geom->textures[i].name, "tex") == 0)
+				hasTex = 1;
+		}
+		if(state->hasTexLoc != -1 && hasTex != state->hasTex)
+			glUniform1i(state->hasTexLoc, hasTex);
+		state->hasTex = hasTex;
+		state->samplers = geom;
+	}
+
+	/* Bind the textures that aren't already bound. */
+	for(unsigned int i=0; i<geom->texture_count; i++)
+	{
+		GLuint texture = geom->textures[i].textureId;
+		if(state->textures[i] == texture)
+		{
+			stats->texture_skips++;
+			continue;
+		}
+		glActiveTexture(GL_TEXTURE0+i);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		state->textures[i] = texture;
+		stats->texture_changes++;
+	}
+
+	int numBones = 0;
+#ifdef KUHL_UTIL_USE_ASSIMP
+	if(geom->bones != NULL && state->boneMatLoc != -1)
+	{
+		glUniformMatrix4fv(state->boneMatLoc, MAX_BONES, 0, geom->bones->matrices[0]);
+		numBones = geom->bones->count;
+	}
+#endif
+	if(state->numBonesLoc != -1 && numBones != state->numBones)
+		glUniform1i(state->numBonesLoc, numBones);
+	state->numBones = numBones;
+
+	if(state->geomTransformLoc != -1 &&
+	   (!state->geomTransformSet || memcmp(state->geomTransform, geom->matrix, sizeof(float)*16) != 0))
+	{
+		glUniformMatrix4fv(state->geomTransformLoc, 1, 0, geom->matrix);
+		memcpy(state->geomTransform, geom->matrix, sizeof(float)*16);
+		state->geomTransformSet = 1;
+	}
+
+	if(state->matrixLoc != -1)
+		glUniformMatrix4fv(state->matrixLoc, 1, 0, item->matrix);
+
+	if(geom->vao != state->vao)
+	{
+		glBindVertexArray(geom->vao);
+		state->vao = geom->vao;
+		stats->vao_changes++;
+	}
+	else
+		stats->vao_skips++;
+
+	if(geom->indices_len > 0)
+	{
+		GLuint first;
+		GLuint count = kuhl_geometry_lod_range(geom, item->lod, &first);
+		GLsizeiptr offset = first * (geom->indices_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+		if(item->instances == 1)
+			glDrawElements(geom->primitive_type, count, geom->indices_type, (void*) offset);
+		else
+			glDrawElementsInstanced(geom->primitive_type, count, geom->indices_type, (void*) offset, item->instances);
+		stats->vertices += count * item->instances;
+	}
+	else
+	{
+		if(item->instances == 1)
+			glDrawArrays(geom->primitive_type, 0, geom->vertex_count);
+		else
+			glDrawArraysInstanced(geom->primitive_type, 0, geom->vertex_count, item->instances);
+		stats->vertices += geom->vertex_count * item->instances;
+	}
+	geom->has_been_drawn = 1;
+	stats->draws++;
+}
+
+/** Sorts the draws in the queue, draws them and empties the queue.
+
+    Unlike kuhl_geometry_draw(), the queue does not unmap vertex
+    attribute buffers that kuhl_geometry_attrib_get() mapped. Draw
+    geometry with kuhl_geometry_draw() after changing its attributes,
+    or unmap the buffers yourself. Lists that were merged with
+    kuhl_geometry_merge() are drawn one object at a time.
+
+    @param queue The queue to draw.
+
+    @param begin_viewport If not NULL, this function is called before
+    the draws of each viewport (in increasing order) so that it can
+    switch to the viewport and set uniforms such as the projection
+    matrix. It may change any OpenGL state. If NULL, the caller
+    should add draws for a single viewport and flush once per
+    viewport.
+*/
+void render_queue_flush(render_queue *queue, void (*begin_viewport)(int viewportID))
+{
+	memset(&(queue->stats), 0, sizeof(render_queue_stats));
+	if(queue->count == 0)
+		return;
+	kuhl_errorcheck();
+
+	qsort(queue->items, queue->count, sizeof(render_queue_item), render_queue_compare);
+
+	/* Record the OpenGL state so that we can restore it when we have
+	 * finished drawing. */
+	GLint previouslyUsedProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previouslyUsedProgram);
+	GLint previouslyBoundTexture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previouslyBoundTexture);
+	GLint previouslyActiveTexture = 0;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &previouslyActiveTexture);
+	GLint previousVAO=0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+
+	render_queue_state state;
+	memset(&state, 0, sizeof(render_queue_state));
+	int viewportID = -1;
+	for(unsigned int i=0; i<queue->count; i++)
+	{
+		int itemViewport = (int) (queue->items[i].key >> (64-RQ_VIEWPORT_BITS));
+		if(begin_viewport != NULL && itemViewport != viewportID)
+		{
+			begin_viewport(itemViewport);
+			memset(&state, 0, sizeof(render_queue_state));
+			viewportID = itemViewport;
+		}
+		render_queue_draw(queue, &state, &(queue->items[i]));
+	}
+	kuhl_errorcheck();
+
+	/* Unbind the textures, like kuhl_geometry_draw() does. */
+	for(unsigned int i=0; i<MAX_TEXTURES; i++)
+	{
+		if(state.textures[i] == 0)
+			continue;
+		glActiveTexture(GL_TEXTURE0+i);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glActiveTexture(previouslyActiveTexture);
+	glBindTexture(GL_TEXTURE_2D, previouslyBoundTexture);
+	glUseProgram(previouslyUsedProgram);
+	glBindVertexArray(previousVAO);
+	kuhl_errorcheck();
+
+	/* Add to the totals */
+	render_queue_stats *s = &(queue->stats), *t = &(queue->total);
+	t->draws += s->draws;
+	t->program_changes += s->program_changes;
+	t->program_skips += s->program_skips;
+	t->texture_changes += s->texture_changes;
+	t->texture_skips += s->texture_skips;
+	t->vao_changes += s->vao_changes;
+	t->vao_skips += s->vao_skips;
+	t->vertices += s->vertices;
+
+	queue->count = 0;
+}
+
+/** Describes render_queue_stats in one line of text, for example:
+ * "5000 draws; program 1 changed/4999 avoided; texture 1/4999; VAO 1/4999"
+
+    @param stats Statistics from a render_queue (the stats or total field).
+
+    @param str Where the text is written.
+
+    @param len Size of str in bytes.
+*/
+void render_queue_summary(const render_queue_stats *stats, char *str, int len)
+{
+	snprintf(str, len, "%lu draws; program %lu changed/%lu avoided; texture %lu/%lu; VAO %lu/%lu",
+	         stats->draws,
+	         stats->program_changes, stats->program_skips,
+	         stats->texture_changes, stats->texture_skips,
+	         stats->vao_changes, stats->vao_skips);
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Collects kuhl_geometry draws for a frame and draws them in an
+    order that avoids changing OpenGL state. kuhl_geometry_draw()
+    binds the program, textures and vertex array object of every
+    object it draws and restores the previous state afterwards. Drawing
+    through a render_queue instead only changes state when the next
+    draw needs something different.
+
+    Each draw is stored with a 64-bit sort key. From the most to the
+    least significant bits, the key contains the viewport, the pass,
+    the program, the set of textures, the vertex array object and the
+    distance from the camera. Opaque draws are sorted by state and then
+    front to back (so that the depth test rejects hidden fragments
+    early). Blended draws are sorted back to front first so that they
+    blend correctly, and by state only among draws at the same
+    distance. All opaque draws in a viewport are drawn before the
+    blended ones.
+
+    The program, texture and vertex array object fields hold the low
+    bits of the OpenGL names. If two names share the same low bits,
+    their draws may be interleaved in the sorted order. The result is
+    still correct because the queue compares the actual names before
+    changing state.
+
+    Each draw uses the level of detail that the kuhl_geometry had (see
+    kuhl_geometry_lod_select()) when it was added, so the same model
+    can be added several times at different levels.
+
+    Typical use, once per viewport:
+
+    render_queue_clear(&queue);
+    render_queue_add(&queue, viewportID, RENDER_QUEUE_OPAQUE, geom, modelview, depth);
+    ...
+    render_queue_flush(&queue, NULL);
+
+    @author Scott Kuhl
+ */
+
+#ifndef __RENDER_QUEUE_H__
+#define __RENDER_QUEUE_H__
+
+#include <stdint.h>
+#include "kuhl-util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Passes that a draw can be submitted in. Passes are drawn in this order. */
+enum
+{
+	RENDER_QUEUE_OPAQUE = 0,  /**< Sorted by state, then front to back */
+	RENDER_QUEUE_BLENDED = 1  /**< Sorted back to front, then by state */
+};
+
+/** Counts of the work done by render_queue_flush(). A "change" is an
+ * OpenGL call that the queue made; a "skip" is a call that
+ * kuhl_geometry_draw() would have made but the queue avoided because
+ * the state was already correct. */
+typedef struct {
+	unsigned long draws;
+	unsigned long program_changes;
+	unsigned long program_skips;
+	unsigned long texture_changes;
+	unsigned long texture_skips;
+	unsigned long vao_changes;
+	unsigned long vao_skips;
+	unsigned long vertices;  /**< Indices (or vertices, for geometry without indices) drawn */
+} render_queue_stats;
+
+/** One draw in a render_queue. */
+typedef struct {
+	uint64_t key;          /**< Sort key, see render_queue_key() */
+	unsigned int order;    /**< Order the draw was added in; keeps sorting stable */
+	kuhl_geometry *geom;   /**< The geometry to draw (not the rest of its list) */
+	float matrix[16];      /**< Sent to the matrix uniform before drawing */
+	GLsizei instances;     /**< Number of instances to draw */
+	unsigned int lod;      /**< Level of detail to draw, copied from geom->lod_level when the draw is added */
+} render_queue_item;
+
+typedef struct {
+	render_queue_item *items;
+	unsigned int count;    /**< Number of draws in the queue */
+	unsigned int capacity; /**< Number of draws that fit in items */
+	char *matrix_uniform;  /**< Name of the uniform that each draw's matrix is sent to */
+	render_queue_stats stats;  /**< Counts from the most recent render_queue_flush() */
+	render_queue_stats total;  /**< Sum of the counts from every render_queue_flush(). Programs may set it to zero (for example, at the start of each frame). */
+} render_queue;
+
+void render_queue_init(render_queue *queue, const char *matrixUniform);
+void render_queue_free(render_queue *queue);
+void render_queue_clear(render_queue *queue);
+
+uint64_t render_queue_key(int viewportID, int pass, const kuhl_geometry *geom, float depth);
+void render_queue_submit(render_queue *queue, uint64_t key, kuhl_geometry *geom, const float matrix[16], GLsizei instances);
+void render_queue_add(render_queue *queue, int viewportID, int pass, kuhl_geometry *geom, const float matrix[16], float depth);
+void render_queue_flush(render_queue *queue, void (*begin_viewport)(int viewportID));
+
+void render_queue_summary(const render_queue_stats *stats, char *str, int len);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __RENDER_QUEUE_H__
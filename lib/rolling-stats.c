@@ -0,0 +1,110 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rolling-stats.h"
+#include "msg.h"
+
+/** Initializes a rolling_stats struct.
+
+    @param stats The struct to initialize.
+
+    @param capacity The number of recent values to keep.
+*/
+void rolling_stats_init(rolling_stats *stats, int capacity)
+{
+	memset(stats, 0, sizeof(rolling_stats));
+	if(capacity < 1)
+		capacity = 1;
+	stats->values = malloc(sizeof(float)*capacity);
+	stats->scratch = malloc(sizeof(float)*capacity);
+	if(stats->values == NULL || stats->scratch == NULL)
+	{
+		msg(FATAL, "Unable to allocate space for %d values.\n", capacity);
+		exit(EXIT_FAILURE);
+	}
+	stats->capacity = capacity;
+}
+
+/** Frees the memory used by a rolling_stats struct. */
+void rolling_stats_free(rolling_stats *stats)
+{
+	free(stats->values);
+	free(stats->scratch);
+	memset(stats, 0, sizeof(rolling_stats));
+}
+
+/** Adds a value. If the struct is full, the oldest value is
+ * discarded. */
+void rolling_stats_add(rolling_stats *stats, float value)
+{
+	stats->values[stats->next] = value;
+	stats->next = (stats->next + 1) % stats->capacity;
+	if(stats->count < stats->capacity)
+		stats->count++;
+	stats->total++;
+}
+
+static int rolling_stats_compare(const void *a, const void *b)
+{
+	float x = *(const float*)a;
+	float y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+/** Calculates percentiles of the stored values.
+
+    @param stats The values to use.
+
+    @param pcts An array of percentiles to calculate, each between 0
+    and 1 (for example, .5 for the median).
+
+    @param results An array to be filled in with one value for each
+    entry in 'pcts'.
+
+    @param numPcts The length of 'pcts' and 'results'.
+
+    @return The number of values that the percentiles were calculated
+    from. If 0, 'results' is filled with zeros.
+*/
+int rolling_stats_percentiles(rolling_stats *stats, const float *pcts, float *results, int numPcts)
+{
+	if(stats->count == 0)
+	{
+		for(int i=0; i<numPcts; i++)
+			results[i] = 0;
+		return 0;
+	}
+
+	memcpy(stats->scratch, stats->values, sizeof(float)*stats->count);
+	qsort(stats->scratch, stats->count, sizeof(float), rolling_stats_compare);
+	for(int i=0; i<numPcts; i++)
+	{
+		float p = pcts[i];
+		if(p < 0)
+			p = 0;
+		if(p > 1)
+			p = 1;
+		results[i] = stats->scratch[(int)(p*(stats->count-1) + .5f)];
+	}
+	return stats->count;
+}
+
+/** Calculates the mean of the stored values. */
+float rolling_stats_mean(const rolling_stats *stats)
+{
+	if(stats->count == 0)
+		return 0;
+	double sum = 0;
+	for(int i=0; i<stats->count; i++)
+		sum += stats->values[i];
+	return sum / stats->count;
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Keeps the most recent values of a measurement (for example, how
+    long each frame took) so that percentiles of the recent values can
+    be printed periodically. Adding a value is cheap; calculating
+    percentiles sorts a copy of the values.
+
+    @author Scott Kuhl
+ */
+
+#ifndef __ROLLING_STATS_H__
+#define __ROLLING_STATS_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	float *values;   /**< Circular buffer of the most recent values */
+	float *scratch;  /**< Space to sort a copy of 'values' in */
+	int capacity;    /**< Number of values that can be stored */
+	int count;       /**< Number of values stored (at most capacity) */
+	int next;        /**< Index that the next value will be written to */
+	long total;      /**< Number of values ever added */
+} rolling_stats;
+
+void rolling_stats_init(rolling_stats *stats, int capacity);
+void rolling_stats_free(rolling_stats *stats);
+void rolling_stats_add(rolling_stats *stats, float value);
+int rolling_stats_percentiles(rolling_stats *stats, const float *pcts, float *results, int numPcts);
+float rolling_stats_mean(const rolling_stats *stats);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __ROLLING_STATS_H__
@@ -0,0 +1,173 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "stream-buffer.h"
+#include "kuhl-util.h"
+#include "msg.h"
+
+/* Binding the buffer to this target doesn't change any vertex array
+ * object or other state that the rest of the program relies on. */
+#define STREAM_BUFFER_TARGET GL_COPY_WRITE_BUFFER
+
+/** Creates a stream_buffer.
+
+    @param sb The stream_buffer to initialize.
+
+    @param size The number of bytes that are written each frame.
+
+    @param allowPersistent If 1, use a persistently mapped buffer when
+    the OpenGL context supports it. If 0, always orphan the buffer each
+    frame (useful to compare the two approaches).
+*/
+void stream_buffer_init(stream_buffer *sb, GLsizeiptr size, int allowPersistent)
+{
+	memset(sb, 0, sizeof(stream_buffer));
+	sb->size = size;
+	sb->region = STREAM_BUFFER_REGIONS-1; // the first stream_buffer_begin() moves to region 0
+
+	glGenBuffers(1, &(sb->buffer));
+	glBindBuffer(STREAM_BUFFER_TARGET, sb->buffer);
+
+	if(allowPersistent && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage))
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(STREAM_BUFFER_TARGET, size*STREAM_BUFFER_REGIONS, NULL, flags);
+		sb->mapped = glMapBufferRange(STREAM_BUFFER_TARGET, 0, size*STREAM_BUFFER_REGIONS, flags);
+		if(sb->mapped != NULL)
+			sb->persistent = 1;
+		else
+		{
+			/* Storage created with glBufferStorage() can't be
+			 * resized, so start over with a new buffer. */
+			msg(WARNING, "Unable to persistently map a %ld byte buffer; orphaning it each frame instead.\n",
+			    (long) size*STREAM_BUFFER_REGIONS);
+			glBindBuffer(STREAM_BUFFER_TARGET, 0);
+			glDeleteBuffers(1, &(sb->buffer));
+			glGenBuffers(1, &(sb->buffer));
+			glBindBuffer(STREAM_BUFFER_TARGET, sb->buffer);
+		}
+	}
+
+	if(!sb->persistent)
+	{
+		glBufferData(STREAM_BUFFER_TARGET, size, NULL, GL_STREAM_DRAW);
+		sb->scratch = kuhl_malloc(size);
+		sb->region = 0;
+	}
+	glBindBuffer(STREAM_BUFFER_TARGET, 0);
+	kuhl_errorcheck();
+
+	msg(DEBUG, "Stream buffer %u: %ld bytes per frame, %s\n", sb->buffer, (long) size,
+	    sb->persistent ? "persistently mapped, 3 regions" : "orphaned each frame");
+}
+
+/** Deletes the buffer object and frees the memory used by a stream_buffer. */
+void stream_buffer_free(stream_buffer *sb)
+{
+	for(int i=0; i<STREAM_BUFFER_REGIONS; i++)
+	{
+		if(sb->fences[i] != 0)
+			glDeleteSync(sb->fences[i]);
+	}
+	if(sb->mapped != NULL)
+	{
+		glBindBuffer(STREAM_BUFFER_TARGET, sb->buffer);
+		glUnmapBuffer(STREAM_BUFFER_TARGET);
+		glBindBuffer(STREAM_BUFFER_TARGET, 0);
+	}
+	glDeleteBuffers(1, &(sb->buffer));
+	free(sb->scratch);
+	memset(sb, 0, sizeof(stream_buffer));
+}
+
+/** Waits until the GPU has finished with a region of the buffer. */
+static void stream_buffer_wait(stream_buffer *sb, int region)
+{
+	GLsync fence = sb->fences[region];
+	if(fence == 0)
+		return;
+
+	/* Check without waiting first so that we only count real stalls. */
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if(result == GL_TIMEOUT_EXPIRED)
+	{
+		long start = kuhl_microseconds();
+		do {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); // 1 second
+		} while(result == GL_TIMEOUT_EXPIRED);
+		sb->stalls++;
+		sb->stall_microseconds += kuhl_microseconds() - start;
+	}
+	if(result == GL_WAIT_FAILED)
+		msg(ERROR, "Failed to wait for the GPU to finish with stream buffer %u.\n", sb->buffer);
+
+	glDeleteSync(fence);
+	sb->fences[region] = 0;
+}
+
+/** Returns memory that the data for this frame should be written
+ * into. The memory may be write-combined (uncached); write it
+ * sequentially and don't read from it. Call stream_buffer_end() when
+ * the data is written.
+
+    @param sb The stream_buffer to write to.
+
+    @return A pointer to sb->size bytes.
+*/
+void* stream_buffer_begin(stream_buffer *sb)
+{
+	if(sb->writing)
+		msg(WARNING, "stream_buffer_begin() was called twice without calling stream_buffer_end().\n");
+	sb->writing = 1;
+	sb->frames++;
+
+	if(!sb->persistent)
+		return sb->scratch;
+
+	/* Every command that uses the previous region has been issued;
+	 * the GPU is done with it when it reaches this fence. */
+	if(sb->frames > 1)
+		sb->fences[sb->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	sb->region = (sb->region + 1) % STREAM_BUFFER_REGIONS;
+	stream_buffer_wait(sb, sb->region);
+	return (char*) sb->mapped + sb->region * sb->size;
+}
+
+/** Finishes writing the data for this frame.
+
+    @param sb The stream_buffer that was written to.
+
+    @return The byte offset of the data in sb->buffer. Draw with the
+    data at this offset until the next call to stream_buffer_begin().
+*/
+GLintptr stream_buffer_end(stream_buffer *sb)
+{
+	if(!sb->writing)
+		msg(WARNING, "stream_buffer_end() was called without calling stream_buffer_begin().\n");
+	sb->writing = 0;
+
+	/* The mapping is coherent, so the GPU sees the writes without
+	 * flushing. */
+	if(sb->persistent)
+		return sb->region * sb->size;
+
+	/* Orphan the old storage so that we don't wait for the GPU to
+	 * finish with it. */
+	glBindBuffer(STREAM_BUFFER_TARGET, sb->buffer);
+	glBufferData(STREAM_BUFFER_TARGET, sb->size, NULL, GL_STREAM_DRAW);
+	glBufferSubData(STREAM_BUFFER_TARGET, 0, sb->size, sb->scratch);
+	glBindBuffer(STREAM_BUFFER_TARGET, 0);
+	kuhl_errorcheck();
+	return 0;
+}
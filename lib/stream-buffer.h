@@ -0,0 +1,69 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    A buffer object for data that the CPU rewrites every frame (for
+    example, vertex positions that are animated on the CPU) without
+    waiting for the GPU to finish using the previous data.
+
+    If OpenGL 4.4 or ARB_buffer_storage is available, the buffer is
+    created with glBufferStorage() and mapped once for the life of the
+    buffer (persistent, coherent mapping). It is divided into
+    STREAM_BUFFER_REGIONS regions that are written in turn: While the
+    GPU draws with one region, the CPU writes the next one. A fence is
+    placed after the commands that use each region, and the CPU only
+    waits if it comes back to a region that the GPU is still reading.
+
+    Otherwise, the buffer holds one region and each frame orphans it
+    by calling glBufferData() with NULL before uploading the new data
+    with glBufferSubData(). The driver gives us new memory if the GPU
+    is still using the old memory.
+
+    Each frame:
+
+    float *data = stream_buffer_begin(&sb);
+    ... write the data ...
+    GLintptr offset = stream_buffer_end(&sb);
+    ... draw with the data at 'offset' in sb.buffer, for example with kuhl_geometry_attrib_buffer() ...
+
+    @author Scott Kuhl
+ */
+
+#ifndef __STREAM_BUFFER_H__
+#define __STREAM_BUFFER_H__
+
+#include <GL/glew.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STREAM_BUFFER_REGIONS 3 /**< Number of regions in a persistently mapped buffer (triple buffering) */
+
+typedef struct {
+	GLuint buffer;       /**< The OpenGL buffer object */
+	GLsizeiptr size;     /**< Bytes in each region */
+	int persistent;      /**< 1 if the buffer is persistently mapped, 0 if it is orphaned each frame */
+	int region;          /**< Region that is being written or was written last */
+	int writing;         /**< Is the caller between stream_buffer_begin() and stream_buffer_end()? */
+	void *mapped;        /**< Persistently mapped memory of the whole buffer, NULL if orphaning */
+	void *scratch;       /**< Memory that is written when orphaning and uploaded by stream_buffer_end() */
+	GLsync fences[STREAM_BUFFER_REGIONS]; /**< Signaled when the GPU has finished with each region */
+
+	unsigned long frames; /**< Number of times stream_buffer_begin() was called */
+	unsigned long stalls; /**< Number of times stream_buffer_begin() had to wait for the GPU */
+	long stall_microseconds; /**< Total time spent waiting for the GPU */
+} stream_buffer;
+
+void stream_buffer_init(stream_buffer *sb, GLsizeiptr size, int allowPersistent);
+void stream_buffer_free(stream_buffer *sb);
+void* stream_buffer_begin(stream_buffer *sb);
+GLintptr stream_buffer_end(stream_buffer *sb);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // end __STREAM_BUFFER_H__
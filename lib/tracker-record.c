@@ -0,0 +1,160 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracker-record.h"
+#include "msg.h"
+
+/** Creates a new file to store tracker samples in. If the file
+ * exists, it is replaced.
+
+    @param filename The file to create.
+
+    @return A file to pass to tracker_record_write_name() and
+    tracker_record_write_sample() or NULL if the file couldn't be
+    created. Close it with fclose().
+*/
+FILE* tracker_record_create(const char *filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if(f == NULL)
+	{
+		msg(ERROR, "Unable to create tracker recording %s\n", filename);
+		return NULL;
+	}
+	if(fwrite(TRACKER_RECORD_MAGIC, 8, 1, f) != 1)
+	{
+		msg(ERROR, "Unable to write to tracker recording %s\n", filename);
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/** Stores the name of an object in a file. The name should be
+ * written before any samples for the object.
+
+    @param f A file from tracker_record_create().
+
+    @param object The number that samples for this object will use.
+
+    @param name The name of the object (typically object\@host).
+
+    @return 1 on success, 0 on failure.
+*/
+int tracker_record_write_name(FILE *f, int object, const char *name)
+{
+	size_t len = strlen(name);
+	if(len >= TRACKER_RECORD_NAME_MAX)
+		len = TRACKER_RECORD_NAME_MAX-1;
+	tracker_record_header header;
+	header.type = TRACKER_RECORD_NAME;
+	header.object = (uint16_t) object;
+	header.size = (uint32_t) len;
+	if(fwrite(&header, sizeof(header), 1, f) != 1 ||
+	   fwrite(name, 1, len, f) != len)
+		return 0;
+	return 1;
+}
+
+/** Stores a sample in a file. Samples are buffered by the C library;
+ * nothing is flushed to the disk here.
+
+    @param f A file from tracker_record_create().
+
+    @param object The object number used in tracker_record_write_name().
+
+    @param time The time of the sample in microseconds.
+
+    @param pos The position of the object.
+
+    @param quat The orientation of the object (x,y,z,w).
+
+    @return 1 on success, 0 on failure.
+*/
+int tracker_record_write_sample(FILE *f, int object, long time, const float pos[3], const float quat[4])
+{
+	struct {
+		tracker_record_header header;
+		tracker_record_sample sample;
+	} rec;
+	memset(&rec, 0, sizeof(rec)); // don't write uninitialized padding
+	rec.header.type = TRACKER_RECORD_SAMPLE;
+	rec.header.object = (uint16_t) object;
+	rec.header.size = sizeof(tracker_record_sample);
+	rec.sample.time = time;
+	memcpy(rec.sample.pos, pos, sizeof(float)*3);
+	memcpy(rec.sample.quat, quat, sizeof(float)*4);
+	return fwrite(&rec, sizeof(rec), 1, f) == 1;
+}
+
+/** Opens a file created by tracker_record_create() for reading.
+
+    @param filename The file to open.
+
+    @return A file to pass to tracker_record_read() or NULL if the
+    file couldn't be opened or isn't a tracker recording. Close it
+    with fclose().
+*/
+FILE* tracker_record_open(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if(f == NULL)
+	{
+		msg(ERROR, "Unable to open tracker recording %s\n", filename);
+		return NULL;
+	}
+	char magic[8];
+	if(fread(magic, 8, 1, f) != 1 || memcmp(magic, TRACKER_RECORD_MAGIC, 8) != 0)
+	{
+		msg(ERROR, "%s is not a tracker recording\n", filename);
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/** Reads the next record from a file. Records of unknown types are
+ * skipped.
+
+    @param f A file from tracker_record_open().
+
+    @param record The record to fill in.
+
+    @return 1 if a record was read, 0 at the end of the file or if
+    the file is damaged.
+*/
+int tracker_record_read(FILE *f, tracker_record *record)
+{
+	tracker_record_header header;
+	while(fread(&header, sizeof(header), 1, f) == 1)
+	{
+		record->type = header.type;
+		record->object = header.object;
+		if(header.type == TRACKER_RECORD_NAME && header.size < TRACKER_RECORD_NAME_MAX)
+		{
+			if(fread(record->name, 1, header.size, f) != header.size)
+				break;
+			record->name[header.size] = '\0';
+			return 1;
+		}
+		if(header.type == TRACKER_RECORD_SAMPLE && header.size == sizeof(tracker_record_sample))
+		{
+			if(fread(&(record->sample), sizeof(tracker_record_sample), 1, f) != 1)
+				break;
+			return 1;
+		}
+		/* Skip records we don't understand. */
+		if(fseek(f, header.size, SEEK_CUR) != 0)
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * @author Scott Kuhl
+ *
+ * Reads and writes files containing tracker samples. vrpn-help.cpp
+ * can record every sample it receives into one of these files
+ * (see vrpn_record_start()) and the fake VRPN server in the vrpn-fake
+ * directory can replay them.
+ *
+ * The file starts with an 8 byte magic string
+ * (TRACKER_RECORD_MAGIC). It is followed by records, each of which
+ * starts with a tracker_record_header. An object's name is stored
+ * once (a TRACKER_RECORD_NAME record) and samples refer to the object
+ * by number. Values are stored in the byte order of the computer
+ * that wrote the file.
+ */
+
+#ifndef __TRACKER_RECORD_H__
+#define __TRACKER_RECORD_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACKER_RECORD_MAGIC "TRKREC01"
+
+#define TRACKER_RECORD_NAME   1 /**< Record type: Name of an object */
+#define TRACKER_RECORD_SAMPLE 2 /**< Record type: A pose of an object */
+
+/** Longest object name (including the null terminator) that can be
+ * stored in a file. */
+#define TRACKER_RECORD_NAME_MAX 256
+
+/** Found at the start of each record in a file. */
+typedef struct {
+	uint16_t type;   /**< TRACKER_RECORD_NAME or TRACKER_RECORD_SAMPLE */
+	uint16_t object; /**< Object number that this record is about */
+	uint32_t size;   /**< Number of bytes that follow this header */
+} tracker_record_header;
+
+/** Stored after the header of a TRACKER_RECORD_SAMPLE record. */
+typedef struct {
+	int64_t time;  /**< Time of the sample in microseconds */
+	float pos[3];  /**< Position */
+	float quat[4]; /**< Orientation (x,y,z,w) */
+} tracker_record_sample;
+
+/** A record read from a file by tracker_record_read(). */
+typedef struct {
+	int type;   /**< TRACKER_RECORD_NAME or TRACKER_RECORD_SAMPLE */
+	int object; /**< Object number */
+	char name[TRACKER_RECORD_NAME_MAX]; /**< Name of the object (TRACKER_RECORD_NAME records only) */
+	tracker_record_sample sample;       /**< The sample (TRACKER_RECORD_SAMPLE records only) */
+} tracker_record;
+
+FILE* tracker_record_create(const char *filename);
+int tracker_record_write_name(FILE *f, int object, const char *name);
+int tracker_record_write_sample(FILE *f, int object, long time, const float pos[3], const float quat[4]);
+FILE* tracker_record_open(const char *filename);
+int tracker_record_read(FILE *f, tracker_record *record);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // __TRACKER_RECORD_H__
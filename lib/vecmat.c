@@ -1373,7 +1373,7 @@ void quatf_slerp_new(float result[4], const float start[4], const float end[4],
 		{
 			float omega = acosf(cosOmega);
 			float sinOmega = sinf(omega);
-			startScale = sinf((1.0-t)*omega / sinOmega);
+			startScale = sinf((1.0-t)*omega) / sinOmega;
 			endScale = sinf(t*omega)/sinOmega;
 		}
 		else
@@ -1431,7 +1431,7 @@ void quatd_slerp_new(double result[4], const double start[4], const double end[4
 		{
 			double omega = acos(cosOmega);
 			double sinOmega = sin(omega);
-			startScale = sin((1.0-t)*omega / sinOmega);
+			startScale = sin((1.0-t)*omega) / sinOmega;
 			endScale = sin(t*omega)/sinOmega;
 		}
 		else
@@ -1457,6 +1457,37 @@ void quatd_slerp_new(double result[4], const double start[4], const double end[4
 	vec4d_normalize(result);
 }
 
+/** Multiplies two quaternions (x,y,z,w) together. The resulting
+ * quaternion represents the rotation of q2 followed by the rotation
+ * of q1 (just like multiplying two rotation matrices).
+
+ @param result The location to store the product. It may be the same as q1 or q2.
+ @param q1 The quaternion on the left side of the multiplication.
+ @param q2 The quaternion on the right side of the multiplication.
+*/
+void quatf_mult_quatf_new(float result[4], const float q1[4], const float q2[4])
+{
+	int X=0,Y=1,Z=2,W=3;
+	float tmp[4];
+	tmp[X] = q1[W]*q2[X] + q1[X]*q2[W] + q1[Y]*q2[Z] - q1[Z]*q2[Y];
+	tmp[Y] = q1[W]*q2[Y] + q1[Y]*q2[W] + q1[Z]*q2[X] - q1[X]*q2[Z];
+	tmp[Z] = q1[W]*q2[Z] + q1[Z]*q2[W] + q1[X]*q2[Y] - q1[Y]*q2[X];
+	tmp[W] = q1[W]*q2[W] - q1[X]*q2[X] - q1[Y]*q2[Y] - q1[Z]*q2[Z];
+	vec4f_copy(result, tmp);
+}
+/** Multiplies two quaternions (x,y,z,w) together. See
+ * quatf_mult_quatf_new() for full documentation. */
+void quatd_mult_quatd_new(double result[4], const double q1[4], const double q2[4])
+{
+	int X=0,Y=1,Z=2,W=3;
+	double tmp[4];
+	tmp[X] = q1[W]*q2[X] + q1[X]*q2[W] + q1[Y]*q2[Z] - q1[Z]*q2[Y];
+	tmp[Y] = q1[W]*q2[Y] + q1[Y]*q2[W] + q1[Z]*q2[X] - q1[X]*q2[Z];
+	tmp[Z] = q1[W]*q2[Z] + q1[Z]*q2[W] + q1[X]*q2[Y] - q1[Y]*q2[X];
+	tmp[W] = q1[W]*q2[W] - q1[X]*q2[X] - q1[Y]*q2[Y] - q1[Z]*q2[Z];
+	vec4d_copy(result, tmp);
+}
+
 	
 
 
@@ -1797,6 +1828,54 @@ void mat4d_lookat_new(double result[16], double eyeX, double eyeY, double eyeZ,
 }
 
 
+/** Extracts the six planes of a view frustum from a projection
+ * matrix multiplied by a view matrix (or by a modelview matrix) with
+ * the method by Gribb and Hartmann. Each plane is stored as a, b, c,
+ * d where a point x,y,z is inside of the plane if a*x + b*y + c*z + d
+ * >= 0. The planes are normalized so that a*x + b*y + c*z + d is the
+ * distance from the point to the plane.
+ *
+ * The planes are in the coordinate system that the matrix transforms
+ * from. If the matrix is projection*view, they are in world
+ * coordinates; if it is projection*modelview, they are in the
+ * coordinates of the model.
+ *
+ * @param planes 24 values, filled in with the left, right, bottom,
+ * top, near and far planes (the same order as projmat_get_frustum()).
+ *
+ * @param m The projection*view matrix.
+ */
+void mat4f_frustum_planes(float planes[24], const float m[16])
+{
+	for(int i=0; i<6; i++)
+	{
+		int row = i/2;
+		float sign = (i%2 == 0) ? 1 : -1;
+		for(int j=0; j<4; j++)
+			planes[i*4+j] = m[j*4+3] + sign * m[j*4+row];
+		float len = vec3f_norm(planes+i*4);
+		if(len > 0)
+			vec4f_scalarDiv(planes+i*4, len);
+	}
+}
+/** Extracts the six planes of a view frustum from a projection
+ * matrix multiplied by a view matrix (double). For full
+ * documentation, see mat4f_frustum_planes().
+ */
+void mat4d_frustum_planes(double planes[24], const double m[16])
+{
+	for(int i=0; i<6; i++)
+	{
+		int row = i/2;
+		double sign = (i%2 == 0) ? 1 : -1;
+		for(int j=0; j<4; j++)
+			planes[i*4+j] = m[j*4+3] + sign * m[j*4+row];
+		double len = vec3d_norm(planes+i*4);
+		if(len > 0)
+			vec4d_scalarDiv(planes+i*4, len);
+	}
+}
+
 /** Pushes a copy of a matrix currently on top of the stack onto the
     top of the stack. A list structure is used to represent the stack.
 
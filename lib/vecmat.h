@@ -1573,6 +1573,10 @@ void quatd_rotateAxisVec_new(double quat[4], double degrees, const double axis[3
 void quatf_slerp_new(float  result[4], const float  start[4], const float  end[4], float  t);
 void quatd_slerp_new(double result[4], const double start[4], const double end[4], double t);
 
+/* Multiply quaternions */
+void quatf_mult_quatf_new(float  result[4], const float  q1[4], const float  q2[4]);
+void quatd_mult_quatd_new(double result[4], const double q1[4], const double q2[4]);
+
 /* Create a new translation matrix (rotation part set to
    identity). Any data in the 'result' matrix that you pass to these
    functions will be ignored and lost. */
@@ -1605,6 +1609,10 @@ void mat4d_lookat_new(double result[16], double eyeX, double eyeY, double eyeZ,
 void mat4f_lookatVec_new(float  result[16], const float  eye[3], const float  center[3], const float  up[3]);
 void mat4d_lookatVec_new(double result[16], const double eye[3], const double center[3], const double up[3]);
 
+/* Frustum planes (for culling) from a projection*view matrix */
+void mat4f_frustum_planes(float  planes[24], const float  m[16]);
+void mat4d_frustum_planes(double planes[24], const double m[16]);
+
 /* Matrix stack implementation */
 void mat4f_stack_push(list *l);
 void mat4f_stack_mult(list *l, float m[16]);
@@ -20,6 +20,8 @@
 #include "vrpn-help.h"
 #include "hmd-dsight-orient.h"
 #include "dgr.h"
+#include "rolling-stats.h"
+#include "profiler.h"
 
 #include "viewmat.h"
 #include "projmat.h"
@@ -70,6 +72,52 @@ static float viewports[MAX_VIEWPORTS][4]; /**< Contains one or more viewports. T
 static int viewports_size = 0; /**< Number of viewports in viewports array */
 static ViewmatModeType viewmat_mode = 0; /**< 0=mousemove, 1=IVS (using VRPN), 2=HMD (using VRPN), 3=none */
 static const char *viewmat_vrpn_obj = NULL; /**< Name of the VRPN object that we are tracking */
+static int viewmat_vrpn_handle = -1; /**< Handle from vrpn_open() for viewmat_vrpn_obj, -1 if we haven't opened it */
+static int viewmat_vrpn_opened = 0; /**< Set to 1 once we have tried to open viewmat_vrpn_obj */
+static int viewmat_vrpn_rotate = 0; /**< Set to 1 if the tracked object needs to be rotated, see viewmat_fix_rotation() */
+static long viewmat_predict_microseconds = 0; /**< How far into the future to predict the tracked pose, 0 to disable prediction */
+/* Late latching. See viewmat_late_latch(). */
+#define VIEWMAT_LATCH_BINDING 0 /**< Uniform buffer binding point of the ViewmatLatch block */
+#define VIEWMAT_LATCH_MAX_EYES 2 /**< Number of viewports that the matrices are late latched for */
+#define VIEWMAT_LATCH_BLOCK_SIZE (sizeof(float)*32) /**< Bytes in the ViewmatLatch block: a view and projection matrix */
+static GLuint viewmat_latch_ubo = 0; /**< Uniform buffer that programs read the matrices from, 0 if late latching is disabled */
+static GLuint viewmat_latch_staging = 0; /**< Persistently mapped buffer that the newest matrices are written into */
+static float *viewmat_latch_mapped = NULL; /**< Pointer to viewmat_latch_staging, NULL if it could not be mapped */
+static int viewmat_latch_stride = 0; /**< Floats between the blocks for each eye in both buffers */
+static void viewmat_get_matrices(float viewmatrix[16], float projmatrix[16], int viewportID);
+static void viewmat_late_latch_begin_eye(int viewportID);
+static void viewmat_late_latch_init();
+/* Dynamic resolution. See viewmat_dynres_init(). */
+static int viewmat_dynres_enabled = 0; /**< Set to 1 if viewports are drawn into viewmat_dynres_framebuffer */
+static int viewmat_dynres_adapt = 0; /**< Set to 1 if the scale changes based on the GPU time (requires timer queries) */
+static float viewmat_dynres_scale = 1; /**< Resolution scale used for the current frame */
+static float viewmat_dynres_min = .5; /**< Smallest scale, VIEWMAT_SCALE_MIN */
+static float viewmat_dynres_max = 1; /**< Largest scale, VIEWMAT_SCALE_MAX */
+static float viewmat_dynres_target = 14; /**< Target GPU time per frame in milliseconds, VIEWMAT_TARGET_MS */
+static GLint viewmat_dynres_framebuffer = 0; /**< Framebuffer that viewports are drawn into, 0 if not created yet */
+static GLuint viewmat_dynres_texture = 0; /**< Color buffer of viewmat_dynres_framebuffer */
+static int viewmat_dynres_size[2] = { 0, 0 }; /**< Width and height of viewmat_dynres_framebuffer */
+static int viewmat_dynres_drawn = 0; /**< Set to 1 when something was drawn into the framebuffer this frame */
+static long viewmat_dynres_measured[PROFILER_MAX_VIEWPORTS]; /**< Number of GPU measurements of each viewport that the scale has been adjusted for */
+static GLuint viewmat_dynres_program = 0; /**< GLSL program that upscales the framebuffer onto the screen */
+static GLuint viewmat_dynres_vao = 0; /**< Empty vertex array object used while upscaling */
+static void viewmat_dynres_begin_eye();
+static void viewmat_dynres_end_frame();
+static void viewmat_dynres_init();
+static int viewmat_single_pass_requested = 0; /**< Set to 1 if VIEWMAT_SINGLE_PASS=1, see viewmat_single_pass() */
+
+/* Tracker latency measurements. See viewmat_latency_init(). */
+#define VIEWMAT_LATENCY_FRAMES 1000 /**< Number of frames that percentiles are calculated over */
+#define VIEWMAT_LATENCY_REPORT_MICROSECONDS 5000000 /**< How often the percentiles are printed */
+static int viewmat_latency_enabled = 0; /**< Set to 1 if we are measuring tracker latency */
+static FILE *viewmat_latency_csv = NULL; /**< If not NULL, a row is written here for each frame */
+static long viewmat_latency_frame = 0; /**< Number of frames measured so far */
+static long viewmat_latency_sample = 0; /**< Tracker time of the sample used for the current frame, 0 if no sample has been used */
+static long viewmat_latency_received = 0; /**< Our time when that sample was received */
+static long viewmat_latency_used = 0; /**< Our time when that sample was used */
+static long viewmat_latency_report = 0; /**< Time that we last printed percentiles */
+static rolling_stats viewmat_latency_stats[3]; /**< Age (in milliseconds) of the sample when it was received, used, and swapped */
+static void viewmat_latency_end_frame();
 static HmdControlState viewmat_hmd;
 
 
@@ -83,6 +131,9 @@ static HmdControlState viewmat_hmd;
  * This causes window resizing to look a little ugly, but it is
  * functional and results in a more consistent framerate.
  *
+ * In headless mode (see projmat_init_headless()), this is the size of
+ * the offscreen framebuffer.
+ *
  * @param width To be filled in with the width of the GLUT window.
  *
  * @param height To be filled in with the height of the GLUT window.
@@ -94,6 +145,11 @@ void viewmat_window_size(int *width, int *height)
 		msg(ERROR, "width and/or height pointers were null.");
 		exit(EXIT_FAILURE);
 	}
+	if(projmat_headless())
+	{
+		projmat_headless_size(width, height);
+		return;
+	}
 	
 	// Initialize static variables upon startup
 	static int savedWidth  = -1;
@@ -138,6 +194,11 @@ void viewmat_begin_frame(void)
  * been rendered. */
 void viewmat_end_frame(void)
 {
+	/* Update the late latched pose right before the draw calls are
+	 * flushed to the GPU. */
+	viewmat_late_latch();
+	profiler_gpu_end();
+
 	if(viewmat_mode == VIEWMAT_HMD_OCULUS)
 	{
 #ifndef MISSING_OVR
@@ -172,10 +233,19 @@ void viewmat_end_frame(void)
 		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 	}
 
+	viewmat_dynres_end_frame();
+
 	/* Need to swap front and back buffers here unless we are using
-	 * Oculus. (Oculus draws to the screen directly). */
-	if(viewmat_mode != VIEWMAT_HMD_OCULUS)
+	 * Oculus. (Oculus draws to the screen directly). Without a window
+	 * there is nothing to swap, but the commands still need to be
+	 * sent to the GPU. */
+	if(projmat_headless())
+		glFlush();
+	else if(viewmat_mode != VIEWMAT_HMD_OCULUS)
 		glutSwapBuffers();
+
+	viewmat_latency_end_frame();
+	profiler_end_frame();
 }
 
 
@@ -211,6 +281,259 @@ int viewmat_get_blitted_framebuffer(int viewportID)
 }
 
 
+/** Compiles a shader for viewmat_dynres_init(). */
+static GLuint viewmat_dynres_shader(GLenum type, const char *source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint status = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if(status == GL_FALSE)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, 1024, NULL, log);
+		msg(FATAL, "Unable to compile the dynamic resolution shader: %s\n", log);
+		exit(EXIT_FAILURE);
+	}
+	return shader;
+}
+
+/** Sets up dynamic resolution scaling if VIEWMAT_DYNRES=1.
+ *
+ * Each viewport is drawn into an offscreen framebuffer at a fraction
+ * (the scale) of its size on the screen. viewmat_end_frame() stretches
+ * the framebuffer over the screen. After each frame, the scale is
+ * adjusted so that the GPU time for all of the viewports (see
+ * profiler.h) approaches the target. The following environment
+ * variables can be used:
+ *
+ * VIEWMAT_SCALE_MIN=.5 - The smallest scale to use.
+ *
+ * VIEWMAT_SCALE_MAX=1 - The largest scale to use. Values above 1
+ * supersample the scene.
+ *
+ * VIEWMAT_TARGET_MS=14 - The desired GPU time per frame in
+ * milliseconds. The default leaves a little room below a 60Hz
+ * refresh rate.
+ *
+ * If timer queries aren't available, VIEWMAT_SCALE_MAX is always used.
+ */
+static void viewmat_dynres_init()
+{
+	const char *dynresString = getenv("VIEWMAT_DYNRES");
+	if(dynresString == NULL || strcmp(dynresString, "1") != 0)
+		return;
+	if(viewmat_mode == VIEWMAT_HMD_OCULUS)
+	{
+		msg(WARNING, "VIEWMAT_DYNRES=1 is ignored in Oculus mode.\n");
+		return;
+	}
+
+	const char *minString = getenv("VIEWMAT_SCALE_MIN");
+	const char *maxString = getenv("VIEWMAT_SCALE_MAX");
+	const char *targetString = getenv("VIEWMAT_TARGET_MS");
+	if(minString)
+		viewmat_dynres_min = atof(minString);
+	if(maxString)
+		viewmat_dynres_max = atof(maxString);
+	if(targetString)
+		viewmat_dynres_target = atof(targetString);
+	if(viewmat_dynres_min <= 0 || viewmat_dynres_max > 4 || viewmat_dynres_min > viewmat_dynres_max ||
+	   viewmat_dynres_target <= 0)
+	{
+		msg(ERROR, "Invalid dynamic resolution settings: VIEWMAT_SCALE_MIN=%g VIEWMAT_SCALE_MAX=%g VIEWMAT_TARGET_MS=%g\n",
+		    viewmat_dynres_min, viewmat_dynres_max, viewmat_dynres_target);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Draw a triangle that covers the screen. The vertex positions
+	 * are calculated from gl_VertexID so no vertex attributes are
+	 * needed. */
+	const char *vertSource =
+		"#version 150\n"
+		"uniform vec2 Scale;\n"
+		"out vec2 texCoord;\n"
+		"void main() {\n"
+		"	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+		"	texCoord = p * Scale;\n"
+		"	gl_Position = vec4(p*2.0-1.0, 0, 1);\n"
+		"}\n";
+	const char *fragSource =
+		"#version 150\n"
+		"uniform sampler2D tex;\n"
+		"in vec2 texCoord;\n"
+		"out vec4 fragColor;\n"
+		"void main() {\n"
+		"	fragColor = texture(tex, texCoord);\n"
+		"}\n";
+	viewmat_dynres_program = glCreateProgram();
+	glAttachShader(viewmat_dynres_program, viewmat_dynres_shader(GL_VERTEX_SHADER, vertSource));
+	glAttachShader(viewmat_dynres_program, viewmat_dynres_shader(GL_FRAGMENT_SHADER, fragSource));
+	glLinkProgram(viewmat_dynres_program);
+	glGenVertexArrays(1, &viewmat_dynres_vao);
+	kuhl_errorcheck();
+
+	profiler_init();
+	viewmat_dynres_adapt = profiler_gpu_available();
+	viewmat_dynres_scale = viewmat_dynres_max;
+	viewmat_dynres_enabled = 1;
+	if(viewmat_dynres_adapt)
+		msg(INFO, "Dynamic resolution: scale %.2f to %.2f, target GPU time %.1f ms per frame.\n",
+		    viewmat_dynres_min, viewmat_dynres_max, viewmat_dynres_target);
+	else
+		msg(WARNING, "Dynamic resolution: GPU time can't be measured, always using scale %.2f.\n", viewmat_dynres_max);
+}
+
+/** Binds the framebuffer that viewports are drawn into when the
+ * resolution is scaled. The framebuffer is (re)created if the window
+ * has grown too large for it. */
+static void viewmat_dynres_begin_eye()
+{
+	if(viewmat_dynres_enabled == 0)
+		return;
+
+	int windowWidth, windowHeight;
+	viewmat_window_size(&windowWidth, &windowHeight);
+	int width  = (int) ceilf(windowWidth  * viewmat_dynres_max);
+	int height = (int) ceilf(windowHeight * viewmat_dynres_max);
+	if(width > viewmat_dynres_size[0] || height > viewmat_dynres_size[1])
+	{
+		if(viewmat_dynres_framebuffer != 0)
+		{
+			/* kuhl_gen_framebuffer() doesn't tell us about its depth
+			 * buffer, so ask the framebuffer for it. */
+			GLint depthbuffer = 0;
+			glBindFramebuffer(GL_FRAMEBUFFER, viewmat_dynres_framebuffer);
+			glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+			                                      GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &depthbuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, projmat_framebuffer());
+			GLuint oldDepth = depthbuffer;
+			GLuint oldFramebuffer = viewmat_dynres_framebuffer;
+			glDeleteRenderbuffers(1, &oldDepth);
+			glDeleteFramebuffers(1, &oldFramebuffer);
+			glDeleteTextures(1, &viewmat_dynres_texture);
+		}
+		viewmat_dynres_framebuffer = kuhl_gen_framebuffer(width, height, &viewmat_dynres_texture, NULL);
+		viewmat_dynres_size[0] = width;
+		viewmat_dynres_size[1] = height;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, viewmat_dynres_framebuffer);
+	viewmat_dynres_drawn = 1;
+}
+
+/** Adjusts the resolution scale based on the newest GPU time
+ * measurements. */
+static void viewmat_dynres_adjust()
+{
+	/* Add up the newest measurement of each viewport that has been
+	 * measured. Only adjust the scale once every one of those
+	 * viewports has a new measurement so that the sum doesn't mix
+	 * new times with times that were already used. */
+	float gpuTime = 0;
+	long measured[PROFILER_MAX_VIEWPORTS];
+	int timed = 0, fresh = 0;
+	for(int i=0; i<viewports_size && i<PROFILER_MAX_VIEWPORTS; i++)
+	{
+		float ms = 0;
+		measured[i] = profiler_gpu_latest(i, &ms);
+		if(measured[i] == 0)
+			continue;
+		timed++;
+		if(measured[i] != viewmat_dynres_measured[i])
+			fresh++;
+		gpuTime += ms;
+	}
+	if(timed == 0 || fresh < timed || gpuTime <= 0)
+		return;
+	for(int i=0; i<viewports_size && i<PROFILER_MAX_VIEWPORTS; i++)
+		viewmat_dynres_measured[i] = measured[i];
+
+	/* GPU time is roughly proportional to the number of pixels
+	 * drawn, which is proportional to the square of the scale. The
+	 * measurement is a few frames old, so only move part of the way
+	 * to the scale that would hit the target. Shrink quickly to
+	 * avoid dropped frames, grow slowly, and don't grow at all when
+	 * we are close to the target so the scale doesn't oscillate. */
+	float ideal = viewmat_dynres_scale * sqrtf(viewmat_dynres_target / gpuTime);
+	if(ideal < viewmat_dynres_scale)
+		viewmat_dynres_scale += .5f * (ideal - viewmat_dynres_scale);
+	else if(gpuTime < viewmat_dynres_target * .85f)
+		viewmat_dynres_scale += .1f * (ideal - viewmat_dynres_scale);
+
+	if(viewmat_dynres_scale < viewmat_dynres_min)
+		viewmat_dynres_scale = viewmat_dynres_min;
+	if(viewmat_dynres_scale > viewmat_dynres_max)
+		viewmat_dynres_scale = viewmat_dynres_max;
+}
+
+/** Stretches the framebuffer that the viewports were drawn into over
+ * the screen and picks the scale for the next frame. */
+static void viewmat_dynres_end_frame()
+{
+	if(viewmat_dynres_drawn == 0)
+		return;
+	viewmat_dynres_drawn = 0;
+
+	int windowWidth, windowHeight;
+	viewmat_window_size(&windowWidth, &windowHeight);
+
+	/* Save the state that we change. A textured triangle is used
+	 * instead of glBlitFramebuffer() because blitting into a
+	 * multisampled window is not allowed. */
+	GLint prevProgram, prevVAO, prevTexture, prevActive, prevViewport[4];
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prevVAO);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActive);
+	glActiveTexture(GL_TEXTURE0);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+	glGetIntegerv(GL_VIEWPORT, prevViewport);
+	GLenum caps[4] = { GL_DEPTH_TEST, GL_BLEND, GL_SCISSOR_TEST, GL_CULL_FACE };
+	GLboolean prevCaps[4];
+	for(int i=0; i<4; i++)
+	{
+		prevCaps[i] = glIsEnabled(caps[i]);
+		glDisable(caps[i]);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, projmat_framebuffer());
+	glViewport(0, 0, windowWidth, windowHeight);
+	glUseProgram(viewmat_dynres_program);
+	glUniform2f(glGetUniformLocation(viewmat_dynres_program, "Scale"),
+	            windowWidth  * viewmat_dynres_scale / viewmat_dynres_size[0],
+	            windowHeight * viewmat_dynres_scale / viewmat_dynres_size[1]);
+	glUniform1i(glGetUniformLocation(viewmat_dynres_program, "tex"), 0);
+	glBindTexture(GL_TEXTURE_2D, viewmat_dynres_texture);
+	glBindVertexArray(viewmat_dynres_vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glBindVertexArray(prevVAO);
+	glBindTexture(GL_TEXTURE_2D, prevTexture);
+	glActiveTexture(prevActive);
+	glUseProgram(prevProgram);
+	glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+	for(int i=0; i<4; i++)
+		if(prevCaps[i])
+			glEnable(caps[i]);
+	kuhl_errorcheck();
+
+	if(viewmat_dynres_adapt)
+		viewmat_dynres_adjust();
+}
+
+/** Returns the resolution scale that viewports are currently drawn
+ * at. This is 1 unless VIEWMAT_DYNRES=1 (see viewmat_dynres_init()).
+
+    @return The ratio between the size of the viewports that are drawn
+    into and their size on the screen.
+*/
+float viewmat_resolution_scale()
+{
+	return viewmat_dynres_enabled ? viewmat_dynres_scale : 1;
+}
+
+
 /** Changes the framebuffer (as needed) that OpenGL is rendering
  * to. Some HMDs (such as the Oculus Rift) require us to prerender the
  * left and right eye scenes to a texture. Those textures are then
@@ -257,6 +580,13 @@ void viewmat_begin_eye(int viewportID)
 			exit(EXIT_FAILURE);
 		}
 	}
+
+	viewmat_late_latch_begin_eye(viewportID);
+
+	viewmat_dynres_begin_eye();
+
+	/* Measure how long the GPU takes to draw this viewport. */
+	profiler_gpu_begin(viewportID);
 }
 
 /** Sets up viewmat to only have one viewport. This can be called
@@ -388,6 +718,123 @@ static void viewmat_refresh_viewports()
 	}
 }
 
+/** Gets the position and orientation of viewmat_vrpn_obj from
+ * VRPN. The object is opened the first time this is called; after
+ * that, no lookups or file I/O are needed.
+
+    @return 1 if we got data from the tracker, 0 otherwise.
+*/
+static int viewmat_vrpn_get(float pos[3], float orient[16])
+{
+	if(viewmat_vrpn_opened == 0)
+	{
+		viewmat_vrpn_opened = 1;
+		viewmat_vrpn_handle = vrpn_open(viewmat_vrpn_obj, NULL);
+
+		/* Currently, the "DK2" object over in the IVS lab is rotated
+		 * by approx 90 degrees. Check for it once here instead of
+		 * reading the VRPN hostname every frame. */
+		char *hostname = vrpn_default_host();
+		if(hostname != NULL && viewmat_vrpn_obj != NULL && strcmp(viewmat_vrpn_obj, "DK2") == 0 &&
+		   strlen(hostname) > 14 && strncmp(hostname, "tcp://141.219.", 14) == 0) // MTU vicon tracker
+			viewmat_vrpn_rotate = 1;
+		if(hostname)
+			free(hostname);
+	}
+	int ret;
+	if(viewmat_predict_microseconds > 0)
+		ret = vrpn_get_predicted(viewmat_vrpn_handle, kuhl_microseconds()+viewmat_predict_microseconds, pos, orient);
+	else
+		ret = vrpn_get_handle(viewmat_vrpn_handle, pos, orient);
+
+	/* Remember the first sample used in this frame so that
+	 * viewmat_end_frame() can report how old it was. */
+	if(viewmat_latency_enabled && ret && viewmat_latency_sample == 0)
+	{
+		vrpn_get_sample_time(viewmat_vrpn_handle, &viewmat_latency_sample, &viewmat_latency_received);
+		viewmat_latency_used = kuhl_microseconds();
+	}
+	return ret;
+}
+
+/** Checks the VIEWMAT_LATENCY and VIEWMAT_LATENCY_CSV environment
+ * variables and sets up tracker latency measurements if either is
+ * set. For every frame, we measure the age of the tracker sample that
+ * the frame's view matrix was computed from at three points: when
+ * the sample was received, when viewmat used it, and after the
+ * buffers were swapped in viewmat_end_frame(). The age is measured
+ * using the timestamp that the tracking system put on the sample, so
+ * the tracking system's clock needs to match ours (for example, when
+ * vrpn-fake runs on the same computer).
+ *
+ * If VIEWMAT_LATENCY is set to 1, percentiles of the recent frames
+ * are printed periodically. If VIEWMAT_LATENCY_CSV is set to a
+ * filename, one row per frame is written to the file.
+ */
+static void viewmat_latency_init()
+{
+	const char *latencyString = getenv("VIEWMAT_LATENCY");
+	if(latencyString != NULL && strcmp(latencyString, "0") != 0)
+		viewmat_latency_enabled = 1;
+
+	const char *csvString = getenv("VIEWMAT_LATENCY_CSV");
+	if(csvString != NULL && strlen(csvString) > 0)
+	{
+		viewmat_latency_csv = fopen(csvString, "w");
+		if(viewmat_latency_csv == NULL)
+			msg(ERROR, "Unable to write tracker latency to %s\n", csvString);
+		else
+		{
+			fprintf(viewmat_latency_csv, "frame,sample_us,received_us,used_us,swapped_us,age_received_ms,age_used_ms,age_swapped_ms\n");
+			viewmat_latency_enabled = 1;
+			msg(INFO, "Writing tracker latency for each frame to %s\n", csvString);
+		}
+	}
+
+	if(viewmat_latency_enabled)
+	{
+		for(int i=0; i<3; i++)
+			rolling_stats_init(&viewmat_latency_stats[i], VIEWMAT_LATENCY_FRAMES);
+		viewmat_latency_report = kuhl_microseconds();
+	}
+}
+
+/** Records the latency for the frame that was just swapped. See
+ * viewmat_latency_init(). */
+static void viewmat_latency_end_frame()
+{
+	if(viewmat_latency_enabled == 0 || viewmat_latency_sample == 0)
+		return;
+
+	long swapped = kuhl_microseconds();
+	float ages[3] = { (viewmat_latency_received - viewmat_latency_sample) / 1000.0f,
+	                  (viewmat_latency_used     - viewmat_latency_sample) / 1000.0f,
+	                  (swapped                  - viewmat_latency_sample) / 1000.0f };
+	for(int i=0; i<3; i++)
+		rolling_stats_add(&viewmat_latency_stats[i], ages[i]);
+
+	if(viewmat_latency_csv)
+	{
+		fprintf(viewmat_latency_csv, "%ld,%ld,%ld,%ld,%ld,%.3f,%.3f,%.3f\n", viewmat_latency_frame,
+		        viewmat_latency_sample, viewmat_latency_received, viewmat_latency_used, swapped,
+		        ages[0], ages[1], ages[2]);
+	}
+	viewmat_latency_frame++;
+	viewmat_latency_sample = 0;
+
+	if(swapped - viewmat_latency_report > VIEWMAT_LATENCY_REPORT_MICROSECONDS)
+	{
+		viewmat_latency_report = swapped;
+		float pcts[3] = { .5, .95, .99 };
+		float r[3][3];
+		int count = 0;
+		for(int i=0; i<3; i++)
+			count = rolling_stats_percentiles(&viewmat_latency_stats[i], pcts, r[i], 3);
+		msg(INFO, "Tracker sample age in ms (p50/p95/p99 of %d frames): received %.1f/%.1f/%.1f, used %.1f/%.1f/%.1f, swapped %.1f/%.1f/%.1f\n",
+		    count, r[0][0], r[0][1], r[0][2], r[1][0], r[1][1], r[1][2], r[2][0], r[2][1], r[2][2]);
+	}
+}
+
 /** Checks if VIEWMAT_VRPN_OBJECT environment variable is set. If it
     is, use VRPN to control the camera position and orientation.
     
@@ -402,11 +849,25 @@ static int viewmat_init_vrpn()
 	{
 		viewmat_vrpn_obj = vrpnObjString;
 		msg(INFO, "View is following tracker object: %s\n", viewmat_vrpn_obj);
+
+		/* Predict where the tracked object will be when the frame
+		 * is displayed. */
+		const char* predictString = getenv("VIEWMAT_PREDICT_MS");
+		if(predictString != NULL)
+		{
+			viewmat_predict_microseconds = (long) (atof(predictString)*1000);
+			if(viewmat_predict_microseconds < 0)
+				viewmat_predict_microseconds = 0;
+			if(viewmat_predict_microseconds > 0)
+				msg(INFO, "Predicting tracked pose %.1f ms into the future\n", viewmat_predict_microseconds/1000.0);
+		}
+
+		viewmat_latency_init();
 		
 		/* Try to connect to VRPN server */
 		float vrpnPos[3];
 		float vrpnOrient[16];
-		vrpn_get(viewmat_vrpn_obj, NULL, vrpnPos, vrpnOrient);
+		viewmat_vrpn_get(vrpnPos, vrpnOrient);
 		return 1;
 	}
 	return 0;
@@ -439,8 +900,11 @@ static void viewmat_init_mouse(float pos[3], float look[3], float up[3])
 	if(viewmat_init_vrpn() == 1)
 		return;
 		
-	glutMotionFunc(mousemove_glutMotionFunc);
-	glutMouseFunc(mousemove_glutMouseFunc);
+	if(!projmat_headless())
+	{
+		glutMotionFunc(mousemove_glutMotionFunc);
+		glutMouseFunc(mousemove_glutMouseFunc);
+	}
 	mousemove_set(pos[0],pos[1],pos[2],
 	              look[0],look[1],look[2],
 	              up[0],up[1],up[2]);
@@ -702,10 +1166,32 @@ void viewmat_init(float pos[3], float look[3], float up[3])
 
 	viewmat_refresh_viewports();
 
+	viewmat_late_latch_init();
+
+	viewmat_dynres_init();
+
+	const char *profileString = getenv("VIEWMAT_PROFILE");
+	if(profileString && strcmp(profileString, "1") == 0)
+	{
+		profiler_init();
+		profiler_report(5000000);
+		msg(INFO, "Printing CPU and GPU frame times every 5 seconds (VIEWMAT_PROFILE=1).\n");
+	}
+
+	const char *singlePassString = getenv("VIEWMAT_SINGLE_PASS");
+	if(singlePassString && strcmp(singlePassString, "1") == 0)
+	{
+		viewmat_single_pass_requested = 1;
+		if(viewmat_single_pass())
+			msg(INFO, "Programs that support it will draw both eyes in a single pass (VIEWMAT_SINGLE_PASS=1).\n");
+		else
+			msg(WARNING, "VIEWMAT_SINGLE_PASS=1 is ignored: Single pass rendering needs both eyes side-by-side in the same framebuffer (VIEWMAT_MODE=hmd or dsight).\n");
+	}
+
 	// If there are two "viewports" then it is likely that we are
 	// doing stereoscopic rendering. Displaying the mouse cursor can
 	// interfere with stereo images, so we disable the cursor here.
-	if(viewports_size == 2)
+	if(viewports_size == 2 && !projmat_headless())
 		glutSetCursor(GLUT_CURSOR_NONE);
 }
 
@@ -716,17 +1202,10 @@ void viewmat_init(float pos[3], float look[3], float up[3])
  * correct direction. */
 static void viewmat_fix_rotation(float orient[16])
 {
-	if(viewmat_vrpn_obj == NULL || strlen(viewmat_vrpn_obj) == 0)
-		return;
-
-	char *hostname = vrpn_default_host();
-	if(hostname == NULL)
-		return;
-	
 	/* Currently, the "DK2" object over in the IVS lab is rotated by
-	 * approx 90 degrees. Apply the fix here. */
-	if(strcmp(viewmat_vrpn_obj, "DK2") == 0 &&
-	   strlen(hostname) > 14 && strncmp(hostname, "tcp://141.219.", 14) == 0) // MTU vicon tracker
+	 * approx 90 degrees. Apply the fix here. viewmat_vrpn_get()
+	 * figures out if this is needed. */
+	if(viewmat_vrpn_rotate)
 	{
 		// The tracked object is oriented the wrong way in the IVS lab.
 		float offsetVicon[16];
@@ -735,8 +1214,6 @@ static void viewmat_fix_rotation(float orient[16])
 		// orient = orient * offsetVicon
 		mat4f_mult_mat4f_new(orient, orient, offsetVicon);
 	}
-	if(hostname)
-		free(hostname);
 }
 
 
@@ -780,7 +1257,7 @@ static void viewmat_get_mouse(float viewmatrix[16], int viewportNum)
 	else // if VRPN object is specified, use that instead
 	{
 		float pos[3], orient[16];
-		vrpn_get(viewmat_vrpn_obj, NULL, pos, orient);
+		viewmat_vrpn_get(pos, orient);
 
 		float pos4[4] = {pos[0],pos[1],pos[2],1};
 		viewmat_fix_rotation(orient);
@@ -863,7 +1340,7 @@ void viewmat_get_hmd_oculus(float viewmatrix[16], int viewportID)
 		                    eye_rdesc[eye].HmdToEyeViewOffset.z); // forward/back offset
 
 		float pos[3] = { 0,0,0 };
-		vrpn_get(viewmat_vrpn_obj, NULL, pos, rotMat);
+		viewmat_vrpn_get(pos, rotMat);
 		mat4f_translate_new(posMat, -pos[0], -pos[1], -pos[2]); // position
 		viewmat_fix_rotation(rotMat);
 	}
@@ -927,7 +1404,7 @@ void viewmat_get_ivs(float viewmatrix[16], float frustum[6])
 	{
 		/* get information from vrpn */
 		float orient[16];
-		vrpn_get(viewmat_vrpn_obj, NULL, pos, orient);
+		viewmat_vrpn_get(pos, orient);
 	}
 	/* Make sure all DGR hosts can get the position so that they
 	 * can update the frustum appropriately */
@@ -1079,6 +1556,17 @@ static void viewmat_validate_ipd(float viewmatrix[16], int viewportID)
  *
  */
 void viewmat_get(float viewmatrix[16], float projmatrix[16], int viewportID)
+{
+	viewmat_get_matrices(viewmatrix, projmatrix, viewportID);
+	viewmat_validate_ipd(viewmatrix, viewportID);
+	viewmat_validate_fps(viewportID);
+}
+
+/** Calculates the view and projection matrices for viewmat_get()
+ * without the sanity checks that viewmat_get() performs once per
+ * frame. This is used directly when the matrices are sampled again
+ * later in the frame (see viewmat_late_latch()). */
+static void viewmat_get_matrices(float viewmatrix[16], float projmatrix[16], int viewportID)
 {
 	int viewport[4]; // x,y of lower left corner, width, height
 	viewmat_get_viewport(viewport, viewportID);
@@ -1134,9 +1622,243 @@ void viewmat_get(float viewmatrix[16], float projmatrix[16], int viewportID)
 	{
 		mat4f_frustum_new(projmatrix, f[0], f[1], f[2], f[3], f[4], f[5]);
 	}
+}
 
-	viewmat_validate_ipd(viewmatrix, viewportID);
-	viewmat_validate_fps(viewportID);
+/** Writes the newest view and projection matrices for a viewport
+ * into the late latch buffers. If the staging buffer is mapped, the
+ * matrices are only written into it and the GPU copies them into the
+ * uniform buffer when it executes the copy that viewmat_begin_eye()
+ * queued. Otherwise, the uniform buffer is updated directly. */
+static void viewmat_late_latch_sample(int viewportID)
+{
+	float matrices[32];
+	viewmat_get_matrices(matrices, matrices+16, viewportID);
+	if(viewmat_latch_mapped)
+	{
+		memcpy(viewmat_latch_mapped + viewportID*viewmat_latch_stride, matrices, VIEWMAT_LATCH_BLOCK_SIZE);
+		return;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, viewmat_latch_ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, viewportID*viewmat_latch_stride, VIEWMAT_LATCH_BLOCK_SIZE, matrices);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/** Samples the newest head pose and writes it into the uniform buffer
+ * for every eye (see viewmat_late_latch_program()). viewmat calls
+ * this in viewmat_end_frame() right before the draw calls are flushed
+ * to the GPU. Programs may also call it themselves right after they
+ * have finished their CPU work for a frame.
+ *
+ * Draw calls that have already been issued will use the new pose if
+ * the GPU has not executed them yet. This only works if the OpenGL
+ * implementation supports persistently mapped buffers
+ * (ARB_buffer_storage); otherwise, the pose is sampled once per eye
+ * in viewmat_begin_eye() and this function does nothing.
+ */
+void viewmat_late_latch()
+{
+	if(viewmat_latch_mapped == NULL)
+		return;
+	for(int i=0; i<viewports_size && i<VIEWMAT_LATCH_MAX_EYES; i++)
+		viewmat_late_latch_sample(i);
+}
+
+/** Queues the update of the late latched matrices for a viewport and
+ * binds them to VIEWMAT_LATCH_BINDING. Called by
+ * viewmat_begin_eye(). */
+static void viewmat_late_latch_begin_eye(int viewportID)
+{
+	if(viewmat_latch_ubo == 0 || viewportID >= VIEWMAT_LATCH_MAX_EYES)
+		return;
+
+	/* Sample the pose now in case the GPU gets to this eye before
+	 * viewmat_late_latch() is called again. */
+	viewmat_late_latch_sample(viewportID);
+	GLintptr offset = viewportID*viewmat_latch_stride*sizeof(float);
+	if(viewmat_latch_mapped)
+	{
+		/* The GPU reads the staging buffer when it executes this
+		 * copy---not now. Anything written into the staging buffer
+		 * before then will be used by the draw calls for this
+		 * eye. */
+		glBindBuffer(GL_COPY_READ_BUFFER, viewmat_latch_staging);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, viewmat_latch_ubo);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, offset, VIEWMAT_LATCH_BLOCK_SIZE);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, VIEWMAT_LATCH_BINDING, viewmat_latch_ubo, offset, VIEWMAT_LATCH_BLOCK_SIZE);
+	kuhl_errorcheck();
+}
+
+/** Returns 1 if the view and projection matrices are available in a
+ * uniform buffer that viewmat keeps up to date (VIEWMAT_LATE_LATCH=1).
+
+    @return 1 if late latching is enabled, 0 otherwise.
+*/
+int viewmat_late_latch_enabled()
+{
+	return viewmat_latch_ubo != 0;
+}
+
+/** Makes the late latched view and projection matrices available to
+ * a GLSL program. The program should contain:
+ *
+ * layout(std140) uniform ViewmatLatch { mat4 LatchView; mat4 LatchProjection; };
+ *
+ * After viewmat_begin_eye(), LatchView and LatchProjection contain the
+ * same matrices as viewmat_get() for that eye except that they are
+ * updated with a newer head pose until the GPU starts drawing the
+ * eye. The block is not used by viewmat_get_stereo().
+ *
+ * @param program The GLSL program to use the matrices in.
+ */
+void viewmat_late_latch_program(GLuint program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "ViewmatLatch");
+	if(index == GL_INVALID_INDEX)
+	{
+		msg(WARNING, "GLSL program %d does not contain a ViewmatLatch uniform block.\n", program);
+		return;
+	}
+	glUniformBlockBinding(program, index, VIEWMAT_LATCH_BINDING);
+	kuhl_errorcheck();
+}
+
+/** Creates the buffers used for late latching if VIEWMAT_LATE_LATCH=1
+ * (see viewmat_late_latch()). */
+static void viewmat_late_latch_init()
+{
+	const char *latchString = getenv("VIEWMAT_LATE_LATCH");
+	if(latchString == NULL || strcmp(latchString, "1") != 0)
+		return;
+	if(dgr_is_enabled())
+	{
+		/* DGR slaves must use the matrices that the master sent at
+		 * the start of the frame. */
+		msg(WARNING, "VIEWMAT_LATE_LATCH=1 is ignored when DGR is used.\n");
+		return;
+	}
+
+	/* Each eye's block must start at a multiple of the uniform buffer
+	 * offset alignment. */
+	GLint align = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	GLint blockBytes = VIEWMAT_LATCH_BLOCK_SIZE;
+	if(align > 0)
+		blockBytes = (blockBytes + align-1) / align * align;
+	viewmat_latch_stride = blockBytes / sizeof(float);
+	GLsizeiptr bytes = blockBytes * VIEWMAT_LATCH_MAX_EYES;
+
+	glGenBuffers(1, &viewmat_latch_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, viewmat_latch_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	if(GLEW_ARB_buffer_storage)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &viewmat_latch_staging);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, viewmat_latch_staging);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, flags);
+		viewmat_latch_mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	kuhl_errorcheck();
+
+	if(viewmat_latch_mapped)
+		msg(INFO, "Late latching the head pose: Matrices are updated until the GPU starts drawing each eye.\n");
+	else
+		msg(INFO, "Late latching the head pose when each eye starts (persistently mapped buffers are unavailable).\n");
+}
+
+/** Returns 1 if both eyes should be drawn in a single pass with
+ * viewmat_get_stereo() instead of once per viewport with
+ * viewmat_get(). This happens when VIEWMAT_SINGLE_PASS=1 and the two
+ * eyes are drawn side-by-side into the same framebuffer (the "hmd" and
+ * "dsight" modes). Other modes draw each eye into a different
+ * framebuffer (Oculus) or need different state for each eye
+ * (anaglyph), so they always use one pass per viewport.
+ *
+ * @return 1 if single pass stereo rendering should be used, 0 otherwise.
+ */
+int viewmat_single_pass()
+{
+	if(viewmat_single_pass_requested == 0)
+		return 0;
+	return viewmat_mode == VIEWMAT_HMD || viewmat_mode == VIEWMAT_HMD_DSIGHT;
+}
+
+/** Gets the view and projection matrices for both eyes so that both
+ * eyes can be drawn with one draw call per object (see
+ * viewmat_single_pass()). Draw each object with two instances (see
+ * kuhl_geometry_draw_instanced()) and use gl_InstanceID in the vertex
+ * program to pick which eye's matrices to use (see
+ * assimp-stereo.vert).
+ *
+ * The returned projection matrices already place each eye into its
+ * half of 'viewport'. Since the eyes share one viewport, OpenGL will
+ * not clip triangles at the edge between the eyes. The vertex program
+ * should write a clip distance so that the left eye (instance 0) is
+ * only drawn where NDC x < split and the right eye is only drawn
+ * where NDC x > split:
+ *
+ * gl_ClipDistance[0] = (eye == 0 ? 1 : -1) * (split*gl_Position.w - gl_Position.x)
+ *
+ * and the program should call glEnable(GL_CLIP_DISTANCE0).
+ *
+ * @param viewmatrix To be filled in with the 4x4 view matrices for the left and right eyes.
+ *
+ * @param projmatrix To be filled in with the 4x4 projection matrices for the left and right eyes.
+ *
+ * @param viewport To be filled in with a viewport that contains both eyes (x, y, width, height).
+ *
+ * @param split To be filled in with the NDC x coordinate where the left eye ends and the right eye begins.
+ */
+void viewmat_get_stereo(float viewmatrix[2][16], float projmatrix[2][16], int viewport[4], float *split)
+{
+	if(viewmat_single_pass() == 0 || viewmat_num_viewports() != 2)
+	{
+		msg(ERROR, "viewmat_get_stereo() was called but single pass rendering is not available. Check viewmat_single_pass() first.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int eyeViewport[2][4];
+	for(int eye=0; eye<2; eye++)
+	{
+		viewmat_get(viewmatrix[eye], projmatrix[eye], eye);
+		viewmat_get_viewport(eyeViewport[eye], eye);
+	}
+
+	/* Find a viewport that covers both eyes */
+	for(int i=0; i<2; i++)
+	{
+		int lo = eyeViewport[0][i];
+		int hi = eyeViewport[0][i] + eyeViewport[0][i+2];
+		if(eyeViewport[1][i] < lo)
+			lo = eyeViewport[1][i];
+		if(eyeViewport[1][i] + eyeViewport[1][i+2] > hi)
+			hi = eyeViewport[1][i] + eyeViewport[1][i+2];
+		viewport[i] = lo;
+		viewport[i+2] = hi-lo;
+	}
+
+	/* Scale and translate each projection matrix so that the eye's
+	 * NDC cube maps onto its part of the shared viewport. In clip
+	 * coordinates, x' = scale*x + offset*w (and the same for y),
+	 * which only changes the first two rows of the matrix. */
+	for(int eye=0; eye<2; eye++)
+	{
+		for(int i=0; i<2; i++)
+		{
+			float scale = eyeViewport[eye][i+2] / (float) viewport[i+2];
+			float offset = (2*(eyeViewport[eye][i]-viewport[i]) + eyeViewport[eye][i+2]) / (float) viewport[i+2] - 1;
+			for(int col=0; col<4; col++)
+				projmatrix[eye][col*4+i] = scale*projmatrix[eye][col*4+i] + offset*projmatrix[eye][col*4+3];
+		}
+	}
+
+	*split = 2*(eyeViewport[0][0] + eyeViewport[0][2] - viewport[0]) / (float) viewport[2] - 1;
 }
 
 /** Gets the viewport information for a particular viewport.
@@ -1161,6 +1883,20 @@ void viewmat_get_viewport(int viewportValue[4], int viewportNum)
 	for(int i=0; i<4; i++)
 		viewportValue[i] = viewports[viewportNum][i];
 
+	/* When the resolution is scaled, the viewports are in the
+	 * smaller framebuffer that we are drawing into. Scale the edges
+	 * of the viewport so that neighboring viewports still touch. */
+	if(viewmat_dynres_enabled)
+	{
+		for(int i=0; i<2; i++)
+		{
+			int lo = (int) floorf(viewports[viewportNum][i]*viewmat_dynres_scale + .5f);
+			int hi = (int) floorf((viewports[viewportNum][i]+viewports[viewportNum][i+2])*viewmat_dynres_scale + .5f);
+			viewportValue[i] = lo;
+			viewportValue[i+2] = hi-lo;
+		}
+	}
+
 }
 
 /** Returns the number of viewports that viewmat has.
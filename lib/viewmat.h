@@ -22,6 +22,23 @@
     will be placed on the user's head. Currently only used in "ivs"
     mode.
 
+    VIEWMAT_SINGLE_PASS=1 - Draw both eyes with one draw call per
+    object in side-by-side HMD modes. Only programs that check
+    viewmat_single_pass() do this (see samples/flock.c).
+
+    VIEWMAT_LATE_LATCH=1 - Keep the view matrices in a uniform buffer
+    that is updated with the newest head pose right before the draw
+    calls are flushed (see viewmat_late_latch()). Only programs that
+    call viewmat_late_latch_program() use it.
+
+    VIEWMAT_PROFILE=1 - Measure CPU and GPU frame times and print them
+    every 5 seconds (see profiler.h).
+
+    VIEWMAT_DYNRES=1 - Draw the viewports at a lower resolution when
+    the GPU can't keep up and stretch them over the screen. See
+    VIEWMAT_SCALE_MIN, VIEWMAT_SCALE_MAX and VIEWMAT_TARGET_MS in
+    viewmat.c.
+
     @author Scott Kuhl
  */
 
@@ -42,6 +59,12 @@ void viewmat_init(float pos[3], float look[3], float up[3]);
 void viewmat_get(float viewmatrix[16], float projmatrix[16], int viewportNum);
 int viewmat_num_viewports();
 void viewmat_get_viewport(int viewportValue[4], int viewportNum);
+int viewmat_single_pass();
+void viewmat_get_stereo(float viewmatrix[2][16], float projmatrix[2][16], int viewport[4], float *split);
+float viewmat_resolution_scale();
+int viewmat_late_latch_enabled();
+void viewmat_late_latch_program(GLuint program);
+void viewmat_late_latch();
 
 #ifdef __cplusplus
 } // end extern "C"
@@ -25,42 +25,76 @@
 
 #include "kuhl-util.h"
 #include "vecmat.h"
-#include "kalman.h"
+#include "predict.h"
+#include "tracker-record.h"
+#include "vrpn-help.h"
 
 #ifndef MISSING_VRPN
+#include <pthread.h>
 
+/** Maximum number of object\@tracker combinations that we can track. */
+#define VRPN_MAX_TRACKERS 64
+/** How long the tracker thread sleeps between calls to mainloop(). */
+#define VRPN_POLL_MICROSECONDS 500
 
-/** A mapping of object\@tracker strings to vrpn_Tracker_Remote objects
- * so we can quickly find the appropriate object given an
- * object\@tracker string. */
-std::map<std::string, vrpn_Tracker_Remote*> nameToTracker;
-/** A mapping of object\@tracker strings to the data that the callback
- * functions store the data into. */
-std::map<std::string, vrpn_TRACKERCB> nameToCallbackData;
+/** Everything we know about a single object\@tracker. The newest
+ * record from the tracker is published by the tracker thread using a
+ * sequence lock so that the rendering thread can read it without
+ * waiting for a lock or calling into VRPN. */
+typedef struct {
+	char fullname[1024];          /**< The object\@tracker string */
+	int isVicon;                  /**< 1 if the data needs to be transformed from the MTU Vicon coordinate system */
+	vrpn_Tracker_Remote *tracker; /**< The VRPN tracker object */
+	kuhl_fps_state fps_state;     /**< Used to print how many records we are receiving */
+	unsigned int seq;             /**< Odd while the fields below are being written, incremented after each write */
+	int hasData;                  /**< 1 if 'data' has been filled in */
+	vrpn_TRACKERCB data;          /**< The newest record from the tracker */
+	predict_state predict;        /**< Predicts future poses from the records */
+	long clockOffset;             /**< Smallest difference between our clock and the time on a record (microseconds) */
+	long received;                /**< Our time when 'data' was received (microseconds) */
 
-static kuhl_fps_state fps_state;
-static kalman_state kalman;
+	/* Only used by the rendering thread. See vrpn_get_sample_time() */
+	long returnedTime;            /**< Tracker time of the record most recently returned to a caller */
+	long returnedReceived;        /**< Our time when that record was received */
+} vrpn_entry;
 
-static void smooth(vrpn_TRACKERCB &t)
-{
-#if 0
-	// TODO: We need to use the times returned by VRPN, not our own time.
-	double smoothed = kalman_estimate(&kalman, t.pos[0]);
-	// printf("%ld, %lf, %lf\n", kuhl_milliseconds(), t.pos[0], smoothed);
-	t.pos[0] = smoothed;
-#endif
-}
+/** Information about each object\@tracker that we are tracking. Only
+ * the first vrpn_entries_count entries are used. Entries are never
+ * removed. */
+static vrpn_entry vrpn_entries[VRPN_MAX_TRACKERS];
+/** Number of entries in vrpn_entries. Only the rendering thread
+ * increases it and it is only increased after the new entry is
+ * filled in. */
+static int vrpn_entries_count = 0;
+
+/** A mapping of object\@tracker strings to an index in vrpn_entries
+ * so we can quickly find the appropriate object given an
+ * object\@tracker string. Only used by the rendering thread. */
+static std::map<std::string, int> nameToIndex;
+
+/** Held while calling into VRPN. VRPN objects aren't thread safe and
+ * trackers on the same host share a vrpn_Connection. */
+static pthread_mutex_t vrpn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t vrpn_thread;
+/** 1 if the tracker thread is running, 0 if we have to call mainloop() ourselves. */
+static int vrpn_thread_running = 0;
+/** If not NULL, every record we receive is written to this file. See
+ * vrpn_record_start(). Only used while holding vrpn_mutex. */
+static FILE *vrpn_record_file = NULL;
 
 
 /** A callback function that will get called whenever the tracker
  * provides us with new data. This may be called repeatedly for each
  * record that we have missed if many records have been delivered
- * since the last call to the VRPN mainloop() function. */
-static void VRPN_CALLBACK handle_tracker(void *name, vrpn_TRACKERCB t)
+ * since the last call to the VRPN mainloop() function. It is called
+ * from the tracker thread (or from vrpn_get() if the thread couldn't
+ * be started). */
+static void VRPN_CALLBACK handle_tracker(void *userdata, vrpn_TRACKERCB t)
 {
-	float fps = kuhl_getfps(&fps_state);
-	if(fps_state.frame == 0)
-		msg(INFO, "VRPN records per second: %.1f\n", fps);
+	vrpn_entry *entry = (vrpn_entry*) userdata;
+	float fps = kuhl_getfps(&(entry->fps_state));
+	if(entry->fps_state.frame == 0)
+		msg(INFO, "VRPN records per second: %.1f (%s)\n", fps, entry->fullname);
 
 	/* Some tracking systems return large values when a point gets
 	 * lost. If the tracked point seems to be lost, ignore this
@@ -69,6 +103,9 @@ static void VRPN_CALLBACK handle_tracker(void *name, vrpn_TRACKERCB t)
 	vec3f_set(pos, t.pos[0], t.pos[1], t.pos[2]);
 	
 	long microseconds = (t.msg_time.tv_sec* 1000000L) + t.msg_time.tv_usec;
+	float quat[4];
+	for(int i=0; i<4; i++)
+		quat[i] = t.quat[i];
 
 	if(0)
 	{
@@ -76,14 +113,159 @@ static void VRPN_CALLBACK handle_tracker(void *name, vrpn_TRACKERCB t)
 		printf("Received position from vrpn: ");
 		vec3f_print(pos);
 	}
+
+	/* We are called from mainloop() which is always called while
+	 * holding vrpn_mutex. */
+	if(vrpn_record_file)
+		tracker_record_write_sample(vrpn_record_file, (int) (entry - vrpn_entries), microseconds, pos, quat);
 	
 	if(vec3f_norm(pos) > 100)
 		return;
-	
-	// Store the data in our map so that someone can use it later.
-	std::string s = (char*)name;
-	nameToCallbackData[s] = t;
-	smooth(nameToCallbackData[s]);
+
+	/* The tracker's clock may not match ours. The smallest
+	 * difference we see is our best guess at the offset between the
+	 * clocks (plus the smallest network delay). */
+	long now = kuhl_microseconds();
+	long offset = now - microseconds;
+
+	/* Publish the data so that someone can use it later. Readers
+	 * will retry if they see an odd sequence number or if the
+	 * sequence number changes while they are copying the data. */
+	unsigned int seq = entry->seq;
+	__atomic_store_n(&(entry->seq), seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if(entry->hasData == 0 || offset < entry->clockOffset)
+		entry->clockOffset = offset;
+	predict_update(&(entry->predict), pos, quat, microseconds);
+	entry->data = t;
+	entry->received = now;
+	entry->hasData = 1;
+	__atomic_store_n(&(entry->seq), seq+2, __ATOMIC_RELEASE);
+}
+
+/** Copies the newest record for an entry without waiting for the
+ * tracker thread.
+ *
+ * @param entry The entry to read.
+ * @param t Location to store the newest record.
+ * @param predict If not NULL, location to store the predictor state.
+ * @param clockOffset If not NULL, location to store the entry's clockOffset.
+ * @return 1 if the entry had data, 0 otherwise.
+ *
+ * The time of the record and when we received it are saved in
+ * entry->returnedTime and entry->returnedReceived.
+ */
+static int vrpn_entry_read(vrpn_entry *entry, vrpn_TRACKERCB *t, predict_state *predict, long *clockOffset)
+{
+	long received;
+	unsigned int before, after;
+	int hasData;
+	do
+	{
+		before = __atomic_load_n(&(entry->seq), __ATOMIC_ACQUIRE);
+		hasData = entry->hasData;
+		*t = entry->data;
+		if(predict)
+			*predict = entry->predict;
+		if(clockOffset)
+			*clockOffset = entry->clockOffset;
+		received = entry->received;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&(entry->seq), __ATOMIC_RELAXED);
+	} while(before != after || (before & 1));
+
+	if(hasData)
+	{
+		entry->returnedTime = (t->msg_time.tv_sec* 1000000L) + t->msg_time.tv_usec;
+		entry->returnedReceived = received;
+	}
+	return hasData;
+}
+
+/** Continuously calls mainloop() on every tracker so that records are
+ * received at the rate the tracker sends them instead of at the rate
+ * we render frames. */
+static void* vrpn_thread_main(void *unused)
+{
+	while(1)
+	{
+		pthread_mutex_lock(&vrpn_mutex);
+		int count = __atomic_load_n(&vrpn_entries_count, __ATOMIC_ACQUIRE);
+		for(int i=0; i<count; i++)
+			vrpn_entries[i].tracker->mainloop();
+		pthread_mutex_unlock(&vrpn_mutex);
+		usleep(VRPN_POLL_MICROSECONDS);
+	}
+	return NULL;
+}
+
+/** Connects to a tracker and adds it to vrpn_entries. Exits if we
+ * can't connect.
+ *
+ * @return The index of the new entry in vrpn_entries.
+ */
+static int vrpn_entry_create(const char *object, const char *hostname)
+{
+	std::string fullname = std::string(object) + "@" + hostname;
+	if(vrpn_entries_count >= VRPN_MAX_TRACKERS)
+	{
+		msg(FATAL, "Can't track more than %d objects with VRPN.\n", VRPN_MAX_TRACKERS);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Start recording if the user asked us to. */
+	const char *recordFile = getenv("VRPN_RECORD");
+	if(vrpn_entries_count == 0 && recordFile != NULL && strlen(recordFile) > 0)
+		vrpn_record_start(recordFile);
+
+	pthread_mutex_lock(&vrpn_mutex);
+	msg(INFO, "Connecting to VRPN server: %s\n", hostname);
+	vrpn_Connection *connection = vrpn_get_connection_by_name(hostname);
+	/* Wait for a bit to see if we can connect. Sometimes we don't immediately connect! */
+	for(int i=0; i<1000 && !connection->connected(); i++)
+	{
+		usleep(1000); // 1000 microseconds * 1000 = up to 1 second of waiting.
+		connection->mainloop();
+	}
+	/* If connection failed, exit. */
+	if(!connection->connected())
+	{
+		delete connection;
+		msg(ERROR, "Failed to connect to tracker: %s\n", fullname.c_str());
+		exit(EXIT_FAILURE);
+	}
+
+	int index = vrpn_entries_count;
+	vrpn_entry *entry = &(vrpn_entries[index]);
+	snprintf(entry->fullname, 1024, "%s", fullname.c_str());
+	/* See the comment in vrpn_get_handle() about the MTU Vicon tracker */
+	entry->isVicon = (strlen(hostname) > 14 && strncmp(hostname, "tcp://141.219.", 14) == 0);
+	entry->seq = 0;
+	entry->hasData = 0;
+	entry->returnedTime = 0;
+	entry->returnedReceived = 0;
+	kuhl_getfps_init(&(entry->fps_state));
+	/* Values chosen with predict-eval (in the vrpn-fake directory)
+	 * for a head tracked with ~2mm of position noise. */
+	predict_init(&(entry->predict), 0.002, 5);
+	entry->tracker = new vrpn_Tracker_Remote(entry->fullname, connection);
+	entry->tracker->register_change_handler((void*) entry, handle_tracker);
+	if(vrpn_record_file)
+		tracker_record_write_name(vrpn_record_file, index, entry->fullname);
+
+	/* Make the new entry visible to the tracker thread. */
+	__atomic_store_n(&vrpn_entries_count, index+1, __ATOMIC_RELEASE);
+	nameToIndex[fullname] = index;
+	pthread_mutex_unlock(&vrpn_mutex);
+
+	if(vrpn_thread_running == 0)
+	{
+		if(pthread_create(&vrpn_thread, NULL, vrpn_thread_main, NULL) == 0)
+			vrpn_thread_running = 1;
+		else
+			msg(WARNING, "Unable to start VRPN thread; tracking data will only be updated when vrpn_get() is called.\n");
+	}
+	return index;
 }
 
 #endif
@@ -134,8 +316,11 @@ char* vrpn_default_host()
 
 
 
-/** Uses the VRPN library to get the position and orientation of a
- * tracked object.
+/** Connects to a tracked object. The returned handle can be passed
+ * to vrpn_get_handle() to get the newest position and orientation of
+ * the object without any string manipulation, lookups, or file
+ * I/O. Calling vrpn_open() multiple times with the same object and
+ * hostname returns the same handle.
  *
  * @param object The name of the object being tracked.
  *
@@ -143,153 +328,336 @@ char* vrpn_default_host()
  * tracking system computer. If hostname is set to NULL, the
  * ~/.vrpn-server file is consulted.
  *
- * @param pos An array to be filled in with the position information
- * for the tracked object. If we are unable to track the object, a
- * message may be printed and pos will be set to a fixed value.
- *
- * @param orient An array to be filled in with the orientation matrix
- * for the tracked object. The orientation matrix is in row-major
- * order can be used with OpenGL. If the tracking system is moving an
- * object around on the screen, this matrix can be used directly. If
- * the tracking system is moving the OpenGL camera, this matrix may
- * need to be inverted. If we are unable to track the object, a
- * message may be printed and orient will be set to the identity
- * matrix.
- *
- * @return 1 if we returned data from the tracker. 0 if there was
- * problems connecting to the tracker.
+ * @return A handle for the tracked object or -1 if there was a
+ * problem. This function exits if we can't connect to the VRPN
+ * server.
  */
-int vrpn_get(const char *object, const char *hostname, float pos[3], float orient[16])
+int vrpn_open(const char *object, const char *hostname)
 {
-	/* Set to default values */
-	vec3f_set(pos, 10000,10000,10000);
-	mat4f_identity(orient);
 #ifdef MISSING_VRPN
-	printf("You are missing VRPN support.\n");
-	return 0;
+	msg(ERROR, "You are missing VRPN support.\n");
+	return -1;
 #else
 	if(object == NULL || strlen(object) == 0)
 	{
 		msg(WARNING, "Empty or NULL object name was passed into this function.\n");
-		return 0;
+		return -1;
 	}
 	if(hostname != NULL && strlen(hostname) == 0)
 	{
 		msg(WARNING, "Hostname is an empty string.\n");
-		return 0;
+		return -1;
 	}
 	
 	/* Construct an object@hostname string. */
 	std::string hostnamecpp;
-	std::string objectcpp;
 	if(hostname == NULL)
 	{
 		char *hostnameInFile = vrpn_default_host();
 		if(hostnameInFile)
+		{
 			hostnamecpp = hostnameInFile;
+			free(hostnameInFile);
+		}
 		else
 		{
 			msg(ERROR, "Failed to find hostname of VRPN server.\n");
 			exit(EXIT_FAILURE);
 		}
-		
 	}
 	else
 		hostnamecpp = hostname;
 
-	objectcpp = object;
-	std::string fullname = objectcpp + "@" + hostnamecpp;
+	std::string fullname = std::string(object) + "@" + hostnamecpp;
+
+	/* If this is our first time, create a tracker for the
+	 * object@hostname string and register the callback handler. */
+	std::map<std::string, int>::iterator it = nameToIndex.find(fullname);
+	if(it != nameToIndex.end())
+		return it->second;
+	return vrpn_entry_create(object, hostnamecpp.c_str());
+#endif
+}
+
+#ifndef MISSING_VRPN
+/** Converts a position and quaternion from a tracker into the
+ * position and orientation matrix that we provide to callers. */
+static void vrpn_entry_convert(const vrpn_entry *entry, const float posIn[3], const double quat[4],
+                               float pos[3], float orient[16])
+{
+	float pos4[4];
+	for(int i=0; i<3; i++)
+		pos4[i] = posIn[i];
+	pos4[3]=1;
+
+	double orientd[16];
+	// Convert quaternion into orientation matrix.
+	q_to_ogl_matrix(orientd, quat);
+	for(int i=0; i<16; i++)
+		orient[i] = (float) orientd[i];
 
-	/* Check if we have a tracker object for that string in our map. */
-	if(nameToTracker.count(fullname))
+	/* VICON in the MTU IVS lab is typically calibrated so that:
+	 * X = points to the right (while facing screen)
+	 * Y = points into the screen
+	 * Z = up
+	 * (left-handed coordinate system)
+	 *
+	 * PPT is typically calibrated so that:
+	 * X = the points to the wall that has two closets at both corners
+	 * Y = up
+	 * Z = points to the door
+	 * (right-handed coordinate system)
+	 *
+	 * By default, OpenGL assumes that:
+	 * X = points to the right (while facing screen in the IVS lab)
+	 * Y = up
+	 * Z = points OUT of the screen (i.e., -Z points into the screen in te IVS lab)
+	 * (right-handed coordinate system)
+	 *
+	 * Below, we convert the position and orientation
+	 * information into the OpenGL convention.
+	 */
+	if(entry->isVicon) // MTU vicon tracker
 	{
-		/* If we already have a tracker object, ask it to run the main
-		 * loop (and therefore call our handle_tracker() function if
-		 * there is new data). */
-		nameToTracker[fullname]->mainloop();
-
-		/* If our callback has been called, get the callback object
-		 * and get the data out of it. */
-		if(nameToCallbackData.count(fullname))
-		{
-			vrpn_TRACKERCB t = nameToCallbackData[fullname];
-			float pos4[4];
-			for(int i=0; i<3; i++)
-				pos4[i] = t.pos[i];
-			pos4[3]=1;
-
-			double orientd[16];
-			// Convert quaternion into orientation matrix.
-			q_to_ogl_matrix(orientd, t.quat);
-			for(int i=0; i<16; i++)
-				orient[i] = (float) orientd[i];
-
-			/* VICON in the MTU IVS lab is typically calibrated so that:
-			 * X = points to the right (while facing screen)
-			 * Y = points into the screen
-			 * Z = up
-			 * (left-handed coordinate system)
-			 *
-			 * PPT is typically calibrated so that:
-			 * X = the points to the wall that has two closets at both corners
-			 * Y = up
-			 * Z = points to the door
-			 * (right-handed coordinate system)
-			 *
-			 * By default, OpenGL assumes that:
-			 * X = points to the right (while facing screen in the IVS lab)
-			 * Y = up
-			 * Z = points OUT of the screen (i.e., -Z points into the screen in te IVS lab)
-			 * (right-handed coordinate system)
-			 *
-			 * Below, we convert the position and orientation
-			 * information into the OpenGL convention.
-			 */
-			if(strlen(hostnamecpp.c_str()) > 14 && strncmp(hostnamecpp.c_str(), "tcp://141.219.", 14) == 0) // MTU vicon tracker
-			{
-				float viconTransform[16] = { 1,0,0,0,  // column major order!
-				                             0,0,-1,0,
-				                             0,1,0,0,
-				                             0,0,0,1 };
-				mat4f_mult_mat4f_new(orient, viconTransform, orient);
-				mat4f_mult_vec4f_new(pos4, viconTransform, pos4);
-				vec3f_copy(pos,pos4);
-				return 1; // we successfully collected some data
-			}
-			else // Non-Vicon tracker
-			{
-				/* Don't transform other tracking systems */
-				// orient is already filled in
-				vec3f_copy(pos, pos4);
-				return 1; // we successfully collected some data
-			}
-		}
+		float viconTransform[16] = { 1,0,0,0,  // column major order!
+		                             0,0,-1,0,
+		                             0,1,0,0,
+		                             0,0,0,1 };
+		mat4f_mult_mat4f_new(orient, viconTransform, orient);
+		mat4f_mult_vec4f_new(pos4, viconTransform, pos4);
 	}
-	else
+	/* Don't transform other tracking systems */
+
+	vec3f_copy(pos, pos4);
+}
+
+/** Gets an entry for a handle and makes sure it has up-to-date data.
+ *
+ * @return The entry or NULL if the handle is invalid.
+ */
+static vrpn_entry* vrpn_entry_get(int handle)
+{
+	if(handle < 0 || handle >= vrpn_entries_count)
+		return NULL;
+
+	vrpn_entry *entry = &(vrpn_entries[handle]);
+	/* If the tracker thread isn't running, ask VRPN to run the main
+	 * loop (and therefore call our handle_tracker() function if
+	 * there is new data). */
+	if(vrpn_thread_running == 0)
 	{
-		/* If this is our first time, create a tracker for the object@hostname string, register the callback handler. */
-		msg(INFO, "Connecting to VRPN server: %s\n", hostnamecpp.c_str());
-		vrpn_Connection *connection = vrpn_get_connection_by_name(hostnamecpp.c_str());
-		/* Wait for a bit to see if we can connect. Sometimes we don't immediately connect! */
-		for(int i=0; i<1000 && !connection->connected(); i++)
-		{
-		    usleep(1000); // 1000 microseconds * 1000 = up to 1 second of waiting.
-		    connection->mainloop();
-		}
-		/* If connection failed, exit. */
-		if(!connection->connected())
-		{
-		    delete connection;
-		    msg(ERROR, "Failed to connect to tracker: %s\n", fullname.c_str());
-		    exit(EXIT_FAILURE);
-		}
-		vrpn_Tracker_Remote *tkr = new vrpn_Tracker_Remote(fullname.c_str(), connection);
-		nameToTracker[fullname] = tkr;
-		tkr->register_change_handler((void*) fullname.c_str(), handle_tracker);
-		kuhl_getfps_init(&fps_state);
-		kalman_initialize(&kalman, 0.1, 0.1);
+		pthread_mutex_lock(&vrpn_mutex);
+		entry->tracker->mainloop();
+		pthread_mutex_unlock(&vrpn_mutex);
+	}
+	return entry;
+}
+#endif
+
+/** Gets the newest position and orientation of an object opened with
+ * vrpn_open(). When the tracker thread is running, this function only
+ * copies the data that the thread most recently received.
+ *
+ * @param handle A handle returned by vrpn_open().
+ *
+ * @param pos An array to be filled in with the position information
+ * for the tracked object. If we are unable to track the object, pos
+ * will be set to a fixed value.
+ *
+ * @param orient An array to be filled in with the orientation matrix
+ * for the tracked object. See vrpn_get() for more information. If we
+ * are unable to track the object, orient will be set to the identity
+ * matrix.
+ *
+ * @return 1 if we returned data from the tracker. 0 if the handle is
+ * invalid or if we haven't received any data yet.
+ */
+int vrpn_get_handle(int handle, float pos[3], float orient[16])
+{
+	/* Set to default values */
+	vec3f_set(pos, 10000,10000,10000);
+	mat4f_identity(orient);
+#ifdef MISSING_VRPN
+	return 0;
+#else
+	vrpn_entry *entry = vrpn_entry_get(handle);
+	if(entry == NULL)
+		return 0;
+
+	/* If our callback has been called, get the data out of it. */
+	vrpn_TRACKERCB t;
+	if(vrpn_entry_read(entry, &t, NULL, NULL) == 0)
+		return 0;
+
+	float posIn[3] = { (float) t.pos[0], (float) t.pos[1], (float) t.pos[2] };
+	vrpn_entry_convert(entry, posIn, t.quat, pos, orient);
+	return 1; // we successfully collected some data
+#endif
+}
+
+/** Predicts the position and orientation of an object opened with
+ * vrpn_open() at a time in the near future. Typically, 'time' is
+ * when the frame being rendered will be displayed. The prediction is
+ * based on the timestamps of the records from the tracker. Position
+ * is filtered and extrapolated with a kalman filter and orientation
+ * is extrapolated using the object's angular velocity. See
+ * predict.c.
+ *
+ * @param handle A handle returned by vrpn_open().
+ *
+ * @param time The time to predict the pose at in microseconds (see
+ * kuhl_microseconds()).
+ *
+ * @param pos An array to be filled in with the predicted position.
+ *
+ * @param orient An array to be filled in with the predicted
+ * orientation matrix.
+ *
+ * @return 1 if we returned data from the tracker. 0 if the handle is
+ * invalid or if we haven't received any data yet.
+ */
+int vrpn_get_predicted(int handle, long time, float pos[3], float orient[16])
+{
+	/* Set to default values */
+	vec3f_set(pos, 10000,10000,10000);
+	mat4f_identity(orient);
+#ifdef MISSING_VRPN
+	return 0;
+#else
+	vrpn_entry *entry = vrpn_entry_get(handle);
+	if(entry == NULL)
+		return 0;
+
+	vrpn_TRACKERCB t;
+	predict_state predict;
+	long clockOffset;
+	if(vrpn_entry_read(entry, &t, &predict, &clockOffset) == 0)
+		return 0;
+
+	/* Convert the time into the tracker's clock. */
+	float predPos[3], predQuat[4];
+	predict_get(&predict, time - clockOffset, predPos, predQuat);
+	double quat[4];
+	for(int i=0; i<4; i++)
+		quat[i] = predQuat[i];
+	vrpn_entry_convert(entry, predPos, quat, pos, orient);
+	return 1;
+#endif
+}
+
+
+/** Uses the VRPN library to get the position and orientation of a
+ * tracked object. This function is convenient but looks up the object
+ * by name every time it is called. Programs that call it every frame
+ * should use vrpn_open() once and then call vrpn_get_handle().
+ *
+ * @param object The name of the object being tracked.
+ *
+ * @param hostname The IP address or hostname of the VRPN server or
+ * tracking system computer. If hostname is set to NULL, the
+ * ~/.vrpn-server file is consulted.
+ *
+ * @param pos An array to be filled in with the position information
+ * for the tracked object. If we are unable to track the object, a
+ * message may be printed and pos will be set to a fixed value.
+ *
+ * @param orient An array to be filled in with the orientation matrix
+ * for the tracked object. The orientation matrix is in row-major
+ * order can be used with OpenGL. If the tracking system is moving an
+ * object around on the screen, this matrix can be used directly. If
+ * the tracking system is moving the OpenGL camera, this matrix may
+ * need to be inverted. If we are unable to track the object, a
+ * message may be printed and orient will be set to the identity
+ * matrix.
+ *
+ * @return 1 if we returned data from the tracker. 0 if there was
+ * problems connecting to the tracker.
+ */
+int vrpn_get(const char *object, const char *hostname, float pos[3], float orient[16])
+{
+	int handle = vrpn_open(object, hostname);
+	return vrpn_get_handle(handle, pos, orient);
+}
+
+/** Gets the timestamps of the record that was used to calculate the
+ * pose most recently returned by vrpn_get_handle() or
+ * vrpn_get_predicted() for this handle. This can be used to measure
+ * how old the tracking data is when it is used (see viewmat.c).
+ *
+ * @param handle A handle returned by vrpn_open().
+ *
+ * @param time Set to the time the tracking system put on the record
+ * (microseconds). When the tracking system and this computer share a
+ * clock (for example, vrpn-fake running on the same computer), this
+ * can be compared directly to kuhl_microseconds().
+ *
+ * @param received If not NULL, set to our time when the record was
+ * received (microseconds).
+ *
+ * @return 1 if a pose has been returned for this handle, 0 otherwise.
+ */
+int vrpn_get_sample_time(int handle, long *time, long *received)
+{
+#ifndef MISSING_VRPN
+	if(handle >= 0 && handle < vrpn_entries_count && vrpn_entries[handle].returnedTime != 0)
+	{
+		*time = vrpn_entries[handle].returnedTime;
+		if(received)
+			*received = vrpn_entries[handle].returnedReceived;
+		return 1;
 	}
+#endif
+	*time = 0;
+	if(received)
+		*received = 0;
+	return 0;
+}
+
+/** Starts writing every record that we receive from every tracked
+ * object into a file (see tracker-record.h). The file can be replayed
+ * with the fake VRPN server in the vrpn-fake directory. Records are
+ * written as they are received, before any filtering or
+ * prediction. Recording also starts automatically if the VRPN_RECORD
+ * environment variable is set to a filename when the first object is
+ * opened.
+ *
+ * @param filename The file to write to. If a recording is already in
+ * progress, it is stopped first.
+ *
+ * @return 1 if recording started, 0 otherwise.
+ */
+int vrpn_record_start(const char *filename)
+{
+#ifdef MISSING_VRPN
+	msg(ERROR, "You are missing VRPN support.\n");
 	return 0;
+#else
+	vrpn_record_stop();
+	FILE *f = tracker_record_create(filename);
+	if(f == NULL)
+		return 0;
+
+	pthread_mutex_lock(&vrpn_mutex);
+	for(int i=0; i<vrpn_entries_count; i++)
+		tracker_record_write_name(f, i, vrpn_entries[i].fullname);
+	vrpn_record_file = f;
+	pthread_mutex_unlock(&vrpn_mutex);
+	msg(INFO, "Recording tracker data to %s\n", filename);
+	return 1;
+#endif
+}
+
+/** Stops a recording started with vrpn_record_start() and closes
+ * the file. Does nothing if we aren't recording. */
+void vrpn_record_stop()
+{
+#ifndef MISSING_VRPN
+	pthread_mutex_lock(&vrpn_mutex);
+	FILE *f = vrpn_record_file;
+	vrpn_record_file = NULL;
+	pthread_mutex_unlock(&vrpn_mutex);
+	if(f)
+		fclose(f);
 #endif
 }
 
@@ -23,8 +23,14 @@
 extern "C" {
 #endif
 
+int vrpn_open(const char *object, const char *hostname);
+int vrpn_get_handle(int handle, float pos[3], float orient[16]);
+int vrpn_get_predicted(int handle, long time, float pos[3], float orient[16]);
+int vrpn_get_sample_time(int handle, long *time, long *received);
 int vrpn_get(const char *object, const char *hostname, float pos[3], float orient[16]);
 char* vrpn_default_host();
+int vrpn_record_start(const char *filename);
+void vrpn_record_stop();
 	
 #ifdef __cplusplus
 } // end extern "C"
@@ -0,0 +1,154 @@
+/*
+  This program reports how well the triangles of model files use the
+  GPU's post-transform vertex cache. The average cache miss ratio
+  (ACMR) is the number of vertices that are transformed per triangle;
+  lower is better. It is estimated by simulating a FIFO cache (see
+  mesh_optimize_acmr()) for the triangles in three orders:
+
+  file       - The order in the model file.
+  assimp     - The order after the processing that kuhl_load_model()
+               always does, which includes ASSIMP's
+               aiProcess_ImproveCacheLocality.
+  optimized  - The assimp order after mesh_optimize_vertex_cache(),
+               which is what kuhl_load_model() draws after
+               kuhl_load_model_optimize(1).
+
+  The processing can change the number of triangles, so each ACMR is
+  divided by the triangles in its own order. The triangle, vertex
+  and "16-bit" columns describe the meshes after the processing. The
+  "16-bit" column is the percentage of indices that are in meshes
+  with few enough vertices for kuhl_geometry_indices() to store them
+  as 16-bit values.
+
+  No OpenGL context is needed:
+
+  ./acmr ../models/duck/duck.dae ../models/cube/cube.obj
+  ./acmr -c 32 model.dae      # simulate a larger cache
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "kuhl-util.h"
+#include "mesh-optimize.h"
+
+/** Totals for all of the triangle meshes in a model. */
+typedef struct {
+	unsigned long triangles[3]; /**< Triangles in the file, assimp and optimized orders */
+	unsigned long vertices;     /**< Vertices after the assimp processing */
+	unsigned long shortIndices; /**< Indices in meshes with 65536 or fewer vertices, after the assimp processing */
+	double misses[3];           /**< Cache misses for the file, assimp and optimized orders */
+} model_stats;
+
+/** Copies the indices of a triangle mesh into a new array. */
+static unsigned int* mesh_indices(const struct aiMesh *mesh)
+{
+	unsigned int *indices = kuhl_malloc(sizeof(unsigned int)*mesh->mNumFaces*3);
+	for(unsigned int t=0; t<mesh->mNumFaces; t++)
+		memcpy(indices+t*3, mesh->mFaces[t].mIndices, sizeof(unsigned int)*3);
+	return indices;
+}
+
+/** Adds the triangles and cache misses of every triangle mesh in a
+ * scene to stats->triangles[order] and stats->misses[order]. If order
+ * is 1 (the scene was processed the same way as kuhl_load_model()),
+ * the vertex counts and the triangles and misses for the optimized
+ * order (2) are also added. */
+static void scene_stats(const struct aiScene *scene, int order, unsigned int cacheSize, model_stats *stats)
+{
+	for(unsigned int m=0; m<scene->mNumMeshes; m++)
+	{
+		const struct aiMesh *mesh = scene->mMeshes[m];
+		if(mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE || mesh->mNumFaces == 0)
+			continue;
+
+		unsigned int indexCount = mesh->mNumFaces*3;
+		unsigned int *indices = mesh_indices(mesh);
+		stats->triangles[order] += mesh->mNumFaces;
+		stats->misses[order] += mesh->mNumFaces *
+			mesh_optimize_acmr(indices, indexCount, mesh->mNumVertices, cacheSize);
+		if(order == 1)
+		{
+			stats->vertices += mesh->mNumVertices;
+			if(mesh->mNumVertices <= 65536)
+				stats->shortIndices += indexCount;
+			mesh_optimize_vertex_cache(indices, indexCount, mesh->mNumVertices);
+			stats->triangles[2] += mesh->mNumFaces;
+			stats->misses[2] += mesh->mNumFaces *
+				mesh_optimize_acmr(indices, indexCount, mesh->mNumVertices, cacheSize);
+		}
+		free(indices);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int cacheSize = 16;
+	int opt;
+	while((opt = getopt(argc, argv, "c:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'c': cacheSize = strtoul(optarg, NULL, 10); break;
+			default: cacheSize = 0; break;
+		}
+	}
+	if(optind >= argc || cacheSize == 0)
+	{
+		printf("Usage: %s [-c cacheSize] modelFile [modelFile ...]\n", argv[0]);
+		printf("  -c cacheSize  Number of vertices in the simulated FIFO cache (default 16)\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* The file order only needs the processing that is required to
+	 * get indexed triangles. The assimp order uses the same flags as
+	 * kuhl_load_model(). */
+	unsigned int fileFlags = aiProcess_Triangulate|aiProcess_SortByPType|aiProcess_JoinIdenticalVertices;
+	unsigned int assimpFlags = aiProcess_Triangulate|aiProcess_SortByPType|aiProcessPreset_TargetRealtime_Quality;
+
+	printf("ACMR with a %u vertex FIFO cache\n", cacheSize);
+	printf("%-30s | %9s | %9s | %7s | %7s | %9s | %9s\n", "model", "triangles", "vertices", "file", "assimp", "optimized", "16-bit");
+	for(int i=optind; i<argc; i++)
+	{
+		model_stats stats;
+		memset(&stats, 0, sizeof(model_stats));
+
+		const struct aiScene *scene = aiImportFile(argv[i], fileFlags);
+		if(scene == NULL)
+		{
+			printf("%-30s | %s\n", argv[i], aiGetErrorString());
+			continue;
+		}
+		scene_stats(scene, 0, cacheSize, &stats);
+		aiReleaseImport(scene);
+
+		scene = aiImportFile(argv[i], assimpFlags);
+		if(scene == NULL)
+		{
+			printf("%-30s | %s\n", argv[i], aiGetErrorString());
+			continue;
+		}
+		scene_stats(scene, 1, cacheSize, &stats);
+		aiReleaseImport(scene);
+
+		if(stats.triangles[0] == 0 || stats.triangles[1] == 0)
+		{
+			printf("%-30s | no triangles\n", argv[i]);
+			continue;
+		}
+		printf("%-30s | %9lu | %9lu | %7.3f | %7.3f | %9.3f | %8.1f%%\n",
+		       argv[i], stats.triangles[1], stats.vertices,
+		       stats.misses[0] / stats.triangles[0],
+		       stats.misses[1] / stats.triangles[1],
+		       stats.misses[2] / stats.triangles[2],
+		       100.0 * stats.shortIndices / (stats.triangles[1]*3));
+	}
+
+	exit(EXIT_SUCCESS);
+}
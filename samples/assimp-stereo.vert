@@ -0,0 +1,71 @@
+#version 150 // GLSL 150 = OpenGL 3.2
+
+// This is the same as assimp.vert except that it draws both eyes in
+// a single pass. Each object is drawn with two instances: Instance 0
+// is the left eye and instance 1 is the right eye. See
+// viewmat_get_stereo().
+
+in vec3 in_Position;
+in vec2 in_TexCoord;
+in vec3 in_Normal;
+in vec3 in_Color;
+
+in vec4 in_BoneIndex;
+in vec4 in_BoneWeight;
+uniform mat4 BoneMat[128];
+uniform int NumBones;
+
+uniform float farPlane;
+uniform mat4 Model;
+uniform mat4 View[2];       // view matrix for each eye
+uniform mat4 Projection[2]; // projection matrix for each eye
+uniform float EyeSplit;     // NDC x coordinate where the left eye ends
+uniform mat4 GeomTransform;
+
+out vec2 out_TexCoord;
+out vec3 out_Color;
+out float out_Depth;
+out vec3 out_Normal;   // normal vector (camera/eye coordinates)
+out vec3 out_EyeCoord; // vertex position (camera/eye coordinates)
+out float gl_ClipDistance[1];
+
+void main() 
+{
+	int eye = gl_InstanceID % 2;
+
+	// Copy texture coordinates and color to fragment program
+	out_TexCoord = in_TexCoord;
+	out_Color = in_Color;
+
+	mat4 actualModelView;
+	if(NumBones > 0)
+	{
+		mat4 m = in_BoneWeight.x * BoneMat[int(in_BoneIndex.x)] +
+			in_BoneWeight.y * BoneMat[int(in_BoneIndex.y)] +
+			in_BoneWeight.z * BoneMat[int(in_BoneIndex.z)] +
+			in_BoneWeight.w * BoneMat[int(in_BoneIndex.w)];
+		actualModelView = View[eye] * Model * m;
+	}
+	else
+		actualModelView = View[eye] * Model * GeomTransform;
+
+	// Transform normal from object coordinates to camera coordinates
+	out_Normal = transpose(inverse(mat3(actualModelView)))*in_Normal.xyz;
+
+	// Transform vertex from object to unhomogenized Normalized Device
+	// Coordinates (NDC). The projection matrix places the vertex in
+	// this eye's half of the viewport.
+	gl_Position = Projection[eye] * actualModelView * vec4(in_Position.xyz, 1);
+
+	// Both eyes share one viewport, so OpenGL won't clip triangles at
+	// the edge between the eyes for us. Keep the left eye left of
+	// EyeSplit and the right eye right of it.
+	float distance = EyeSplit*gl_Position.w - gl_Position.x;
+	gl_ClipDistance[0] = (eye == 0) ? distance : -distance;
+
+	// See assimp.vert for how this is used.
+	out_Depth = ((actualModelView*vec4(in_Position.xyz, 1)).z)/-farPlane ;
+
+	// Calculate the position of the vertex in eye coordinates:
+	out_EyeCoord = vec3(actualModelView * vec4(in_Position.xyz, 1));
+}
@@ -15,6 +15,11 @@ uniform mat4 ModelView;
 uniform mat4 Projection;
 uniform mat4 GeomTransform;
 
+// Meshes merged by kuhl_geometry_merge() get their GeomTransform from
+// an attribute so that many meshes can be drawn with one draw call.
+in mat4 in_DrawTransform;
+uniform int MergedDraw;
+
 out vec2 out_TexCoord;
 out vec3 out_Color;
 out float out_Depth;
@@ -36,6 +41,8 @@ void main()
 			in_BoneWeight.w * BoneMat[int(in_BoneIndex.w)];
 		actualModelView = ModelView * m;
 	}
+	else if(MergedDraw > 0)
+		actualModelView = ModelView * in_DrawTransform;
 	else
 		actualModelView = ModelView * GeomTransform;
 
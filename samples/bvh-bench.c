@@ -0,0 +1,389 @@
+/*
+  This program measures how long it takes to build the bounding
+  volume hierarchies in bvh.h and how many queries they answer per
+  second.
+
+  Triangles: The triangle meshes in each model file are combined into
+  one mesh (the transformations of the nodes in the file are
+  ignored) and a tree is built over its triangles. The bundled models
+  are small, so a sphere with about a million triangles is generated
+  too (see -g).
+
+  Instances: A tree is built over the bounding boxes of copies of a
+  model scattered in a 50m cube, like the copies that flock.c draws.
+
+  Each tree is built with one thread and with one thread per
+  processor. The refit column is the time to update the tree after
+  every item moves a little (see bvh_refit()). Rays start outside of
+  the tree and point at random places inside of it; the first rays
+  are also checked against testing every triangle. Frustum queries
+  use a 60 degree perspective projection from random places around
+  the tree and box queries use boxes that are 10% of the size of the
+  tree.
+
+  No OpenGL context is needed:
+
+  ./bvh-bench ../models/duck/duck.dae ../models/sphere/sphere.obj
+  ./bvh-bench -g 4000000 -n 1000000
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "kuhl-util.h"
+#include "vecmat.h"
+#include "bvh.h"
+
+#define NUM_CHECKED_RAYS 100
+
+static int numRays = 100000;
+static int numQueries = 2000;
+
+/** A random point inside of a box. */
+static void random_point(float point[3], const float box[6])
+{
+	for(int i=0; i<3; i++)
+		point[i] = box[i*2] + drand48()*(box[i*2+1]-box[i*2]);
+}
+
+/** A random point on a sphere around the center of a box, twice as
+ * far away from the center as the corners of the box. */
+static void random_outside(float point[3], const float box[6])
+{
+	float center[3] = { (box[0]+box[1])/2, (box[2]+box[3])/2, (box[4]+box[5])/2 };
+	float size[3] = { box[1]-box[0], box[3]-box[2], box[5]-box[4] };
+	float dir[3];
+	do {
+		vec3f_set(dir, drand48()*2-1, drand48()*2-1, drand48()*2-1);
+	} while(vec3f_norm(dir) > 1 || vec3f_norm(dir) < .01);
+	vec3f_normalize(dir);
+	vec3f_scalarMult(dir, vec3f_norm(size));
+	vec3f_add_new(point, center, dir);
+}
+
+/** Returns how far along a ray it hits a triangle, or -1 if it
+ * doesn't (Moller-Trumbore, both sides). */
+static float ray_triangle(const float *p0, const float *p1, const float *p2,
+                          const float origin[3], const float dir[3])
+{
+	float e1[3], e2[3], p[3], t[3], q[3];
+	vec3f_sub_new(e1, p1, p0);
+	vec3f_sub_new(e2, p2, p0);
+	vec3f_cross_new(p, dir, e2);
+	float det = vec3f_dot(e1, p);
+	if(det == 0)
+		return -1;
+	vec3f_sub_new(t, origin, p0);
+	float u = vec3f_dot(t, p)/det;
+	vec3f_cross_new(q, t, e1);
+	float v = vec3f_dot(dir, q)/det;
+	if(u < 0 || v < 0 || u+v > 1)
+		return -1;
+	return vec3f_dot(e2, q)/det;
+}
+
+/** Times building a tree with one thread and with one thread per
+ * processor. The second tree is kept. */
+static void time_build(bvh *tree, const unsigned int *indices, const float *positions, const float *boxes,
+                       unsigned int count, float ms[2])
+{
+	for(int i=0; i<2; i++)
+	{
+		bvh_build_threads(i == 0 ? 1 : 0);
+		long start = kuhl_microseconds();
+		if(boxes)
+			bvh_build_boxes(tree, boxes, count);
+		else
+			bvh_build_triangles(tree, indices, count, positions);
+		ms[i] = (kuhl_microseconds() - start) / 1000.0f;
+		if(i == 0)
+			bvh_free(tree);
+	}
+}
+
+/** Times the queries on a tree and prints one line of results. */
+static void time_queries(const char *label, const bvh *tree, float buildMs[2], float refitMs)
+{
+	const float *box = tree->nodes[0].bounds;
+
+	int hits = 0;
+	long start = kuhl_microseconds();
+	for(int i=0; i<numRays; i++)
+	{
+		float origin[3], target[3], dir[3];
+		random_outside(origin, box);
+		random_point(target, box);
+		vec3f_sub_new(dir, target, origin);
+		bvh_hit hit;
+		hits += bvh_raycast(tree, origin, dir, FLT_MAX, &hit);
+	}
+	float raySeconds = (kuhl_microseconds() - start) / 1000000.0f;
+
+	unsigned long frustumResults = 0;
+	start = kuhl_microseconds();
+	for(int i=0; i<numQueries; i++)
+	{
+		float eye[3], look[3], view[16], proj[16], projview[16], planes[24];
+		random_outside(eye, box);
+		random_point(look, box);
+		float up[3] = { 0, 1, 0 };
+		float offset[3];
+		vec3f_sub_new(offset, look, eye);
+		float distance = vec3f_norm(offset);
+		mat4f_lookatVec_new(view, eye, look, up);
+		mat4f_perspective_new(proj, 60, 1, distance*.01, distance*10);
+		mat4f_mult_mat4f_new(projview, proj, view);
+		mat4f_frustum_planes(planes, projview);
+		frustumResults += bvh_query_frustum(tree, planes, NULL, 0);
+	}
+	float frustumSeconds = (kuhl_microseconds() - start) / 1000000.0f;
+
+	unsigned long boxResults = 0;
+	start = kuhl_microseconds();
+	for(int i=0; i<numQueries; i++)
+	{
+		float center[3], query[6];
+		random_point(center, box);
+		for(int j=0; j<3; j++)
+		{
+			float half = (box[j*2+1]-box[j*2]) * .05f;
+			query[j*2]   = center[j] - half;
+			query[j*2+1] = center[j] + half;
+		}
+		boxResults += bvh_query_box(tree, query, NULL, 0);
+	}
+	float boxSeconds = (kuhl_microseconds() - start) / 1000000.0f;
+
+	printf("%-30s | %9u | %8.1f | %8.1f | %8u | %7.2f | %9.0f | %5.1f%% | %9.0f %7lu | %9.0f %7lu\n",
+	       label, tree->item_count, buildMs[0], buildMs[1], tree->node_count, refitMs,
+	       numRays / raySeconds, 100.0 * hits / numRays,
+	       numQueries / frustumSeconds, frustumResults / numQueries,
+	       numQueries / boxSeconds, boxResults / numQueries);
+}
+
+/** Builds and measures a tree over the triangles of a mesh. The
+ * positions are moved a little to measure bvh_refit(). */
+static void bench_triangles(const char *label, const unsigned int *indices, unsigned int triangleCount,
+                            float *positions, unsigned int vertexCount)
+{
+	bvh tree;
+	float buildMs[2];
+	time_build(&tree, indices, positions, NULL, triangleCount, buildMs);
+
+	/* Check the first rays against every triangle. */
+	int agree = 0;
+	const float *box = tree.nodes[0].bounds;
+	for(int r=0; r<NUM_CHECKED_RAYS; r++)
+	{
+		float origin[3], target[3], dir[3];
+		random_outside(origin, box);
+		random_point(target, box);
+		vec3f_sub_new(dir, target, origin);
+		float closest = FLT_MAX;
+		for(unsigned int t=0; t<triangleCount; t++)
+		{
+			float d = ray_triangle(positions + indices[t*3]*3, positions + indices[t*3+1]*3,
+			                       positions + indices[t*3+2]*3, origin, dir);
+			if(d >= 0 && d < closest)
+				closest = d;
+		}
+		bvh_hit hit;
+		int found = bvh_raycast(&tree, origin, dir, FLT_MAX, &hit);
+		if((!found && closest == FLT_MAX) ||
+		   (found && fabsf(hit.distance - closest) <= 1e-4f * fmaxf(1, closest)))
+			agree++;
+	}
+	if(agree != NUM_CHECKED_RAYS)
+		printf("%s: only %d of %d rays hit the same triangle as testing every triangle\n",
+		       label, agree, NUM_CHECKED_RAYS);
+
+	/* Ripple the surface by 1% of its size. */
+	float diagonal[3] = { box[1]-box[0], box[3]-box[2], box[5]-box[4] };
+	float size = vec3f_norm(diagonal);
+	for(unsigned int v=0; v<vertexCount; v++)
+		positions[v*3+1] += sinf(positions[v*3]*10) * size * .01f;
+	long start = kuhl_microseconds();
+	bvh_refit(&tree);
+	float refitMs = (kuhl_microseconds() - start) / 1000.0f;
+
+	time_queries(label, &tree, buildMs, refitMs);
+	bvh_free(&tree);
+}
+
+/** Combines the triangle meshes in a model file and measures a tree
+ * over them. */
+static void bench_model(const char *filename)
+{
+	const struct aiScene *scene = aiImportFile(filename, aiProcess_Triangulate|aiProcess_SortByPType|aiProcess_JoinIdenticalVertices);
+	if(scene == NULL)
+	{
+		printf("%-30s | %s\n", filename, aiGetErrorString());
+		return;
+	}
+	unsigned int triangleCount = 0, vertexCount = 0;
+	for(unsigned int m=0; m<scene->mNumMeshes; m++)
+	{
+		const struct aiMesh *mesh = scene->mMeshes[m];
+		if(mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE)
+			continue;
+		triangleCount += mesh->mNumFaces;
+		vertexCount += mesh->mNumVertices;
+	}
+	if(triangleCount == 0)
+	{
+		printf("%-30s | no triangles\n", filename);
+		aiReleaseImport(scene);
+		return;
+	}
+
+	float *positions = kuhl_malloc(sizeof(float)*3*vertexCount);
+	unsigned int *indices = kuhl_malloc(sizeof(unsigned int)*3*triangleCount);
+	unsigned int t = 0, v = 0;
+	for(unsigned int m=0; m<scene->mNumMeshes; m++)
+	{
+		const struct aiMesh *mesh = scene->mMeshes[m];
+		if(mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE)
+			continue;
+		for(unsigned int f=0; f<mesh->mNumFaces; f++, t++)
+			for(int k=0; k<3; k++)
+				indices[t*3+k] = mesh->mFaces[f].mIndices[k] + v;
+		for(unsigned int i=0; i<mesh->mNumVertices; i++, v++)
+			vec3f_set(positions+v*3, mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+	}
+	aiReleaseImport(scene);
+
+	bench_triangles(filename, indices, triangleCount, positions, vertexCount);
+	free(positions);
+	free(indices);
+}
+
+/** Generates a unit sphere with about the given number of triangles
+ * and measures a tree over it. */
+static void bench_sphere(unsigned int triangles)
+{
+	unsigned int rings = (unsigned int) sqrtf(triangles/4.0f);
+	if(rings < 2)
+		rings = 2;
+	unsigned int segments = rings*2;
+	unsigned int vertexCount = (rings+1)*(segments+1);
+	unsigned int triangleCount = rings*segments*2;
+	float *positions = kuhl_malloc(sizeof(float)*3*vertexCount);
+	unsigned int *indices = kuhl_malloc(sizeof(unsigned int)*3*triangleCount);
+	for(unsigned int r=0; r<=rings; r++)
+	{
+		for(unsigned int s=0; s<=segments; s++)
+		{
+			float theta = M_PI * r / rings, phi = 2 * M_PI * s / segments;
+			vec3f_set(positions + (r*(segments+1)+s)*3,
+			          sinf(theta)*cosf(phi), cosf(theta), sinf(theta)*sinf(phi));
+		}
+	}
+	unsigned int t = 0;
+	for(unsigned int r=0; r<rings; r++)
+	{
+		for(unsigned int s=0; s<segments; s++)
+		{
+			unsigned int a = r*(segments+1)+s, b = a+segments+1;
+			unsigned int quad[6] = { a, b, a+1,  a+1, b, b+1 };
+			memcpy(indices + t*3, quad, sizeof(quad));
+			t += 2;
+		}
+	}
+
+	bench_triangles("generated sphere", indices, triangleCount, positions, vertexCount);
+	free(positions);
+	free(indices);
+}
+
+/** Measures a tree over the boxes of copies of a model that is about
+ * 1m tall scattered in a 50m cube. */
+static void bench_instances(unsigned int copies)
+{
+	float *boxes = kuhl_malloc(sizeof(float)*6*copies);
+	for(unsigned int i=0; i<copies; i++)
+	{
+		float center[3], half = .25 + drand48()*.5;
+		vec3f_set(center, drand48()*50-25, drand48()*50-25, drand48()*50-25);
+		for(int j=0; j<3; j++)
+		{
+			boxes[i*6+j*2]   = center[j] - half;
+			boxes[i*6+j*2+1] = center[j] + half;
+		}
+	}
+
+	bvh tree;
+	float buildMs[2];
+	time_build(&tree, NULL, NULL, boxes, copies, buildMs);
+
+	/* Move each copy up to 10cm. */
+	for(unsigned int i=0; i<copies; i++)
+	{
+		for(int j=0; j<3; j++)
+		{
+			float move = drand48()*.2-.1;
+			boxes[i*6+j*2]   += move;
+			boxes[i*6+j*2+1] += move;
+		}
+	}
+	long start = kuhl_microseconds();
+	bvh_refit(&tree);
+	float refitMs = (kuhl_microseconds() - start) / 1000.0f;
+
+	char label[64];
+	snprintf(label, 64, "%u instances", copies);
+	time_queries(label, &tree, buildMs, refitMs);
+	bvh_free(&tree);
+	free(boxes);
+}
+
+int main(int argc, char** argv)
+{
+	int sphereTriangles = 1000000;
+	int copies = 100000;
+	int opt;
+	while((opt = getopt(argc, argv, "g:n:r:q:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'g': sphereTriangles = atoi(optarg); break;
+			case 'n': copies = atoi(optarg); break;
+			case 'r': numRays = atoi(optarg); break;
+			case 'q': numQueries = atoi(optarg); break;
+			default:
+				printf("Usage: %s [-g triangles] [-n copies] [-r rays] [-q queries] [modelFile ...]\n", argv[0]);
+				printf("  -g triangles  Triangles in the generated sphere, 0 to skip it (default %d)\n", sphereTriangles);
+				printf("  -n copies     Copies of a model in the instance tree, 0 to skip it (default %d)\n", copies);
+				printf("  -r rays       Rays to cast into each tree (default %d)\n", numRays);
+				printf("  -q queries    Frustum and box queries on each tree (default %d)\n", numQueries);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if(sphereTriangles < 0 || copies < 0 || numRays < 1 || numQueries < 1)
+	{
+		printf("Usage: %s [-g triangles] [-n copies] [-r rays] [-q queries] [modelFile ...]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%ld processors, %d rays and %d frustum and box queries per tree\n",
+	       sysconf(_SC_NPROCESSORS_ONLN), numRays, numQueries);
+	printf("%-30s | %9s | %8s | %8s | %8s | %7s | %9s | %6s | %17s | %17s\n",
+	       "items", "count", "build 1", "build N", "nodes", "refit", "rays", "hit", "frustum queries", "box queries");
+	printf("%-30s | %9s | %8s | %8s | %8s | %7s | %9s | %6s | %9s %7s | %9s %7s\n",
+	       "", "", "(ms)", "(ms)", "", "(ms)", "/sec", "", "/sec", "found", "/sec", "found");
+	for(int i=optind; i<argc; i++)
+		bench_model(argv[i]);
+	if(sphereTriangles > 0)
+		bench_sphere(sphereTriangles);
+	if(copies > 0)
+		bench_instances(copies);
+
+	exit(EXIT_SUCCESS);
+}
@@ -3,10 +3,36 @@
  * and other miscellaneous changes were made.
  *
  * Changes by: Scott Kuhl
+ *
+ * The vertex positions are updated every frame. Except in "gpu" mode,
+ * they are updated on the CPU by particle_cpu_step() (see
+ * particle-cpu.h), which splits the vertices between several threads
+ * and writes the new positions directly into the buffer that is drawn.
+ * The -m option picks that buffer:
+ *
+ * stream - Write them into a persistently mapped buffer with three
+ *          regions (see stream-buffer.h) so that the CPU never waits
+ *          for the GPU to finish drawing the previous frame. This is
+ *          the default. If persistent mapping isn't supported, it
+ *          works the same way as "orphan".
+ * orphan - Orphan a buffer each frame and upload the positions with
+ *          glBufferSubData().
+ * map    - Map the vertex buffer that the model was loaded into with
+ *          kuhl_geometry_attrib_get(). Mapping waits until the GPU is
+ *          finished with the buffer.
+ * gpu    - Don't update them on the CPU at all. The positions and
+ *          velocities stay on the GPU and are updated there (see
+ *          particle-sim.h). Use this mode for models with millions of
+ *          vertices.
+ *
+ * With PROJMAT_HEADLESS=1, the model explodes immediately and the
+ * time spent updating the vertices is printed when the program exits.
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
 #include <GL/glew.h>
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -19,6 +45,10 @@
 #include "dgr.h"
 #include "projmat.h"
 #include "viewmat.h"
+#include "profiler.h"
+#include "stream-buffer.h"
+#include "particle-sim.h"
+#include "particle-cpu.h"
 
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
@@ -57,6 +87,29 @@ typedef struct {
 
 particle **particles;
 
+/** Ways to send the updated vertex positions to the GPU (see the -m
+ * option). */
+enum { UPDATE_STREAM, UPDATE_ORPHAN, UPDATE_MAP, UPDATE_GPU };
+int updateMode = UPDATE_STREAM;
+const char *updateModeNames[] = { "stream", "orphan", "map", "gpu" };
+
+/** The positions and velocities of the vertices of each
+ * kuhl_geometry when they are updated on the CPU. The stream buffers
+ * may be write-combined memory that is slow to read, so the positions
+ * are kept here and only written into the buffers. */
+particle_cpu *cpus = NULL;
+/** One stream buffer for the positions of each kuhl_geometry in
+ * UPDATE_STREAM and UPDATE_ORPHAN modes. */
+stream_buffer *streams = NULL;
+/** One particle simulation for each kuhl_geometry in UPDATE_GPU mode. */
+particle_sim *sims = NULL;
+
+/** Set to 1 when explode() is called. The vertices don't move until then. */
+int exploded = 0;
+
+/** Change this to change the speed of the explosion. */
+#define TIMESTEP 0.1f
+
 #define GLSL_VERT_FILE "assimp.vert"
 #define GLSL_FRAG_FILE "assimp.frag"
 
@@ -90,58 +143,57 @@ void explode()
 			for(int k=0; k<3; k++)
 				particles[i][j].velocity[k] += (drand48()-.5);
 		}
+
+		if(updateMode == UPDATE_GPU)
+			particle_sim_set(&sims[i], NULL, (float*) particles[i]);
+		else
+			particle_cpu_set(&cpus[i], NULL, (float*) particles[i]);
 		g = g->next;
 	}
+	exploded = 1;
+}
+
+/** Finishes writing into the stream buffer of one kuhl_geometry
+ * and tells the geometry to draw with the new positions. */
+void stream_positions_end(kuhl_geometry *g, int i)
+{
+	GLintptr offset = stream_buffer_end(&streams[i]);
+	kuhl_geometry_attrib_buffer(g, streams[i].buffer, 3, 0, offset, "in_Position", 1);
 }
 
-/** Update the vertex positions and the velocity stored in the
- * particles array. */
+/** Update the vertex positions and the velocities.
+ *
+ * Gravity is pushing particles down -Y, but we are operating in
+ * object coordinates. If GeomTransform (i.e., g->matrix) is used to
+ * rotate the model, then gravity might not push the particles down in
+ * world coordinates. */
 void update()
 {
+	/* Nothing moves until the explosion occurs. */
+	if(!exploded)
+		return;
+
 	kuhl_geometry *g = modelgeom;
 	for(unsigned int i=0; i<kuhl_geometry_count(modelgeom); i++)
 	{
-		int numFloats = 0;
-		GLfloat *pos = kuhl_geometry_attrib_get(g, "in_Position",
-		                                        &numFloats);
-
-		for(unsigned int j=0; j<g->vertex_count; j++)
+		if(updateMode == UPDATE_GPU)
 		{
-			/* If the first point isn't moving, don't update anything */
-			if(vec3f_norm(particles[i][j].velocity) == 0)
-				return;
-
-			/* Gravity is pushing particles down -Y, but we are
-			 * operating in object coordinates. If GeomTransform
-			 * (i.e., g->matrix) is used to rotate the model, then
-			 * gravity might not push the particles down in world
-			 * coordinates. */
-			float accel[3] = { 0, -1, 0};
-			float timestep = 0.1f; // change this to change speed of explosion
-			for(int k=0; k<3; k++)
-			{
-				pos[j*3+k] += timestep * (particles[i][j].velocity[k] + timestep * accel[k]/2);
-				particles[i][j].velocity[k] += timestep * accel[k];
-			}
-#if 1   /* Bounce the particles off the xz-plane. */
-			if(pos[j*3+1] < 0)
-			{
-				/* How much velocity is lost when a bounce occurs? */
-				float velocityLossFactor = .4;
-				/* If particle fell through floor, negate its position */
-				pos[j*3+1] *= -velocityLossFactor;
-				/* Negative the Y velocity */
-				particles[i][j].velocity[1] *= -1;
-				/* Scale velocity in all directions */
-				vec3f_scalarMult(particles[i][j].velocity, velocityLossFactor); // lose energy on bounce
-			}
-#endif
+			particle_sim_step(&sims[i], TIMESTEP);
+			kuhl_geometry_attrib_buffer(g, particle_sim_positions(&sims[i]), 3, 0, 0, "in_Position", 1);
+		}
+		else if(updateMode == UPDATE_MAP)
+		{
+			int numFloats = 0;
+			GLfloat *pos = kuhl_geometry_attrib_get(g, "in_Position", &numFloats);
+			particle_cpu_step(&cpus[i], TIMESTEP, pos);
+		}
+		else
+		{
+			particle_cpu_step(&cpus[i], TIMESTEP, stream_buffer_begin(&streams[i]));
+			stream_positions_end(g, i);
 		}
 		g = g->next;
 	}
-
-
-	
 }
 
 
@@ -279,15 +331,37 @@ void get_model_matrix(float result[16])
  * function should not be called directly by the programmer. Instead,
  * we can call glutPostRedisplay() to request that GLUT call display()
  * at some point. */
+static kuhl_fps_state fps_state;
 void display()
 {
 	/* If we are using DGR, send or receive data to keep multiple
 	 * processes/computers synchronized. */
 	dgr_update();
 
-	dgr_setget("style", &renderStyle, sizeof(int));
+	float fps = kuhl_getfps(&fps_state);
+
+	/* Update the vertices once per frame (not once per viewport). In
+	 * headless mode, run as fast as possible. */
+	if(!projmat_headless())
+		kuhl_limitfps(60);
+	profiler_begin("update");
+	update();
+	profiler_end("update");
+
+	/* Print the time spent updating the vertices once per second. */
+	if(fps_state.frame == 0)
+	{
+		profiler_stats cpu;
+		profiler_cpu_stats("update", &cpu);
+		unsigned long stalls = 0;
+		if(streams != NULL)
+			for(unsigned int i=0; i<kuhl_geometry_count(modelgeom); i++)
+				stalls += streams[i].stalls;
+		msg(INFO, "%s: update time per frame (ms) p50=%.2f p95=%.2f, %lu stalls, %.1f fps\n",
+		    updateModeNames[updateMode],
+		    cpu.p50, cpu.p95, stalls, fps);
+	}
 
-	
 	/* Render the scene once for each viewport. Frequently one
 	 * viewport will fill the entire screen. However, this loop will
 	 * run twice for HMDs (once for the left eye and once for the
@@ -353,8 +427,6 @@ void display()
 
 		kuhl_errorcheck();
 
-		kuhl_limitfps(60);
-		update();
 		kuhl_geometry_draw(modelgeom); /* Draw the model */
 		kuhl_errorcheck();
 
@@ -374,7 +446,8 @@ void display()
 	 * ourselves recursively because it will not leave time for GLUT
 	 * to call other callback functions for when a key is pressed, the
 	 * window is resized, etc. */
-	glutPostRedisplay();
+	if(!projmat_headless())
+		glutPostRedisplay();
 }
 
 
@@ -386,46 +459,71 @@ int main(int argc, char** argv)
 {
 	char *modelFilename    = NULL;
 	char *modelTexturePath = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "m:h")) != -1)
+	{
+		if(opt == 'm' && strcmp(optarg, "gpu") == 0)
+			updateMode = UPDATE_GPU;
+		else
+		if(opt == 'm' && strcmp(optarg, "stream") == 0)
+			updateMode = UPDATE_STREAM;
+		else if(opt == 'm' && strcmp(optarg, "orphan") == 0)
+			updateMode = UPDATE_ORPHAN;
+		else if(opt == 'm' && strcmp(optarg, "map") == 0)
+			updateMode = UPDATE_MAP;
+		else
+			optind = argc; // print the usage information
+	}
 	
-	if(argc == 2)
+	if(argc - optind == 1)
 	{
-		modelFilename = argv[1];
+		modelFilename = argv[optind];
 		modelTexturePath = NULL;
 	}
-	else if(argc == 3)
+	else if(argc - optind == 2)
 	{
-		modelFilename = argv[1];
-		modelTexturePath = argv[2];
+		modelFilename = argv[optind];
+		modelTexturePath = argv[optind+1];
 	}
 	else
 	{
 		printf("Usage:\n"
-		       "%s modelFile     - Textures are assumed to be in the same directory as the model.\n"
+		       "%s [-m stream|orphan|map|gpu] modelFile     - Textures are assumed to be in the same directory as the model.\n"
 		       "- or -\n"
-		       "%s modelFile texturePath\n", argv[0], argv[0]);
+		       "%s [-m stream|orphan|map|gpu] modelFile texturePath\n"
+		       "-m chooses how the updated vertices are sent to the GPU (default: stream).\n", argv[0], argv[0]);
 		exit(1);
 	}
 
-	/* set up our GLUT window */
-	glutInit(&argc, argv);
-	glutInitWindowSize(512, 512);
-	glutSetOption(GLUT_MULTISAMPLE, 4); // set msaa samples; default to 4
-	/* Ask GLUT to for a double buffered, full color window that
-	 * includes a depth buffer */
+	/* set up our GLUT window---or an offscreen context if
+	 * PROJMAT_HEADLESS=1 */
+	if(!projmat_init_headless())
+	{
+		glutInit(&argc, argv);
+		glutInitWindowSize(512, 512);
+		glutSetOption(GLUT_MULTISAMPLE, 4); // set msaa samples; default to 4
+		/* Ask GLUT to for a double buffered, full color window that
+		 * includes a depth buffer */
 #ifdef __APPLE__
-	glutInitDisplayMode(GLUT_3_2_CORE_PROFILE | GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
+		glutInitDisplayMode(GLUT_3_2_CORE_PROFILE | GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
 #else
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
-	glutInitContextVersion(3,2);
-	glutInitContextProfile(GLUT_CORE_PROFILE);
+		glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
+		glutInitContextVersion(3,2);
+		glutInitContextProfile(GLUT_CORE_PROFILE);
 #endif
-	glutCreateWindow(argv[0]); // set window title to executable name
+		glutCreateWindow(argv[0]); // set window title to executable name
+
+		// setup callbacks
+		glutDisplayFunc(display);
+		glutKeyboardFunc(keyboard);
+	}
 	glEnable(GL_MULTISAMPLE);
 
 	/* Initialize GLEW */
 	glewExperimental = GL_TRUE;
 	GLenum glewError = glewInit();
-	if(glewError != GLEW_OK)
+	if(glewError != GLEW_OK && !projmat_headless())
 	{
 		fprintf(stderr, "Error initializing GLEW: %s\n", glewGetErrorString(glewError));
 		exit(EXIT_FAILURE);
@@ -438,15 +536,14 @@ int main(int argc, char** argv)
 	 * http://www.opengl.org/wiki/OpenGL_Loading_Library */
 	glGetError();
 
-	// setup callbacks
-	glutDisplayFunc(display);
-	glutKeyboardFunc(keyboard);
-
 	/* Compile and link a GLSL program composed of a vertex shader and
 	 * a fragment shader. */
 	program = kuhl_create_program(GLSL_VERT_FILE, GLSL_FRAG_FILE);
 
 	dgr_init();     /* Initialize DGR based on environment variables. */
+	/* Slaves will receive renderStyle directly from the master each
+	 * time dgr_update() is called. */
+	dgr_register("style", &renderStyle, sizeof(int));
 	projmat_init(); /* Figure out which projection matrix we should use based on environment variables */
 
 	float initCamPos[3]  = {0,1.55,2}; // 1.55m is a good approx eyeheight
@@ -480,9 +577,56 @@ int main(int argc, char** argv)
 		i++;
 	}
 
+	/* Copy the positions out of the buffer that the model was loaded
+	 * into and draw with the stream buffers (or the particle
+	 * simulation's buffers) from now on. */
+	if(updateMode == UPDATE_GPU)
+	{
+		sims = malloc(sizeof(particle_sim)*geomCount);
+		i = 0;
+		for(kuhl_geometry *g = modelgeom; g != NULL; g=g->next)
+		{
+			GLint numFloats = 0;
+			GLfloat *pos = kuhl_geometry_attrib_get(g, "in_Position", &numFloats);
+			particle_sim_init(&sims[i], g->vertex_count, pos, NULL);
+			kuhl_geometry_attrib_buffer(g, particle_sim_positions(&sims[i]), 3, 0, 0, "in_Position", 1);
+			i++;
+		}
+	}
+	else
+	{
+		cpus = malloc(sizeof(particle_cpu)*geomCount);
+		if(updateMode != UPDATE_MAP)
+			streams = malloc(sizeof(stream_buffer)*geomCount);
+		i = 0;
+		for(kuhl_geometry *g = modelgeom; g != NULL; g=g->next)
+		{
+			GLint numFloats = 0;
+			GLfloat *pos = kuhl_geometry_attrib_get(g, "in_Position", &numFloats);
+			particle_cpu_init(&cpus[i], g->vertex_count, pos, NULL);
+			if(updateMode != UPDATE_MAP)
+			{
+				stream_buffer_init(&streams[i], sizeof(GLfloat)*3*g->vertex_count,
+				                   updateMode == UPDATE_STREAM);
+				particle_cpu_get_positions(&cpus[i], stream_buffer_begin(&streams[i]));
+				stream_positions_end(g, i);
+			}
+			i++;
+		}
+		msg(INFO, "Updating vertices with %d threads.\n", particle_cpu_thread_count());
+	}
+
+	kuhl_getfps_init(&fps_state);
+	profiler_init(); // measure the time that update() takes (see display())
+
+	/* There is nobody to press 'x' in headless mode. */
+	if(projmat_headless())
+		explode();
+
 	/* Tell GLUT to start running the main loop and to call display(),
-	 * keyboard(), etc callback methods as needed. */
-	glutMainLoop();
+	 * keyboard(), etc callback methods as needed. In headless mode,
+	 * call display() PROJMAT_FRAMES times and exit. */
+	projmat_main_loop(display);
 	/* // An alternative approach:
 	   while(1)
 	   glutMainLoopEvent();
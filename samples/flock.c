@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include <GL/glew.h>
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -19,20 +20,52 @@
 #include "dgr.h"
 #include "projmat.h"
 #include "viewmat.h"
+#include "profiler.h"
+#include "render-queue.h"
+#include "frustum-cull.h"
+#include "mousemove.h"
 
 GLuint fpsLabel = 0;
 float fpsLabelAspectRatio = 0;
 kuhl_geometry labelQuad;
 
 GLuint program = 0; // id value for the GLSL program
+GLuint stereoProgram = 0; // id value for the GLSL program that draws both eyes at once, 0 if unused
+GLuint latchProgram = 0; // id value for the GLSL program that uses late latched view matrices, 0 if unused
 kuhl_geometry *modelgeom = NULL;
 float bbox[6], fitMatrix[16];
 
 #define NUM_MODELS 5000
 float positions[NUM_MODELS][3];
 
+/* Draw the models through a render queue that sorts them to avoid
+ * state changes. Press 'r' to switch to calling kuhl_geometry_draw()
+ * for each model. */
+int useRenderQueue = 1;
+render_queue renderQueue;
+
+/* Draw distant models with fewer triangles (see
+ * kuhl_geometry_lod_select()). Press 'l' to draw every model at full
+ * detail. */
+int useLod = 1;
+
+/* Skip the models whose bounding spheres are outside of the view
+ * frustum. The spheres are tested four at a time (see
+ * frustum-cull.h). Press 'c' to draw every model. */
+int useCulling = 1;
+float sphereX[NUM_MODELS], sphereY[NUM_MODELS], sphereZ[NUM_MODELS], sphereRadius[NUM_MODELS];
+unsigned char visible[NUM_MODELS], visibleRightEye[NUM_MODELS];
+unsigned long modelsTested = 0, modelsCulled = 0; // since the last message
+
+/* Move the camera in a circle through the flock so that models move
+ * in and out of view. Press 'o' to start or stop. The camera orbits
+ * by default in headless mode. */
+int orbit = 0;
+
 #define GLSL_VERT_FILE "assimp.vert"
 #define GLSL_FRAG_FILE "assimp.frag"
+#define GLSL_STEREO_VERT_FILE "assimp-stereo.vert" // used when viewmat_single_pass() is 1
+#define GLSL_LATCH_VERT_FILE "assimp-latch.vert" // used when viewmat_late_latch_enabled() is 1
 
 /* Called by GLUT whenever a key is pressed. */
 void keyboard(unsigned char key, int x, int y)
@@ -50,6 +83,23 @@ void keyboard(unsigned char key, int x, int y)
 		case 'F': // switch to window from full screen mode
 			glutPositionWindow(0,0);
 			break;
+		case 'r': // switch between the render queue and drawing each model directly
+			useRenderQueue = !useRenderQueue;
+			msg(INFO, "Render queue: %s\n", useRenderQueue ? "on" : "off");
+			break;
+		case 'l': // switch levels of detail on and off
+			useLod = !useLod;
+			kuhl_geometry_lod_threshold(useLod ? 1 : 0);
+			msg(INFO, "Levels of detail: %s\n", useLod ? "on" : "off");
+			break;
+		case 'c': // switch frustum culling on and off
+			useCulling = !useCulling;
+			msg(INFO, "Frustum culling: %s\n", useCulling ? "on" : "off");
+			break;
+		case 'o': // start or stop moving the camera in a circle
+			orbit = !orbit;
+			msg(INFO, "Orbit: %s\n", orbit ? "on" : "off");
+			break;
 	}
 
 	/* Whenever any key is pressed, request that display() get
@@ -69,6 +119,156 @@ void get_model_matrix(float result[16], float placeToPutModel[3])
 }
 
 
+/* Sets visible[i] to 1 for each model that may be inside of the
+ * view frustum of the view and projection matrices and 0 for the
+ * models that are not. */
+static void cull_models(unsigned char vis[NUM_MODELS], const float viewMat[16], const float perspective[16])
+{
+	if(!useCulling)
+	{
+		memset(vis, 1, NUM_MODELS);
+		return;
+	}
+	float projview[16], planes[24];
+	mat4f_mult_mat4f_new(projview, perspective, viewMat);
+	mat4f_frustum_planes(planes, projview);
+	frustum_cull_spheres(planes, sphereX, sphereY, sphereZ, sphereRadius, NUM_MODELS, vis);
+}
+
+/* Adds the models that cull_models() culled to the counts that are
+ * printed once per second. */
+static void count_culled(const unsigned char vis[NUM_MODELS])
+{
+	modelsTested += NUM_MODELS;
+	for(int i=0; i<NUM_MODELS; i++)
+		modelsCulled += !vis[i];
+}
+
+/* Clears a viewport and sets up OpenGL state for drawing into it. */
+static void display_clear(const int viewport[4])
+{
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	/* Clear the current viewport. Without glScissor(), glClear()
+	 * clears the entire screen. We could call glClear() before
+	 * this viewport loop---but on order for all variations of
+	 * this code to work (Oculus support, etc), we can only draw
+	 * after viewmat_begin_eye(). */
+	glScissor(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glEnable(GL_SCISSOR_TEST);
+	glClearColor(.2,.2,.2,0); // set clear color to grey
+	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	glEnable(GL_DEPTH_TEST); // turn on depth testing
+	kuhl_errorcheck();
+
+	/* Turn on blending (note, if you are using transparent textures,
+	   the transparency may not look correct unless you draw further
+	   items before closer items.). */
+	glEnable(GL_BLEND);
+	glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+}
+
+/* Draws the frames per second label into the current viewport. */
+static void display_label()
+{
+	// If DGR is being used, only display dgr counter if we are
+	// the master process.
+	if(dgr_is_enabled() && !dgr_is_master())
+		return;
+
+	glUseProgram(program);
+
+	/* The shape of the frames per second quad depends on the
+	 * aspect ratio of the label texture and the aspect ratio of
+	 * the window (because we are placing the quad in normalized
+	 * device coordinates). */
+	int windowWidth, windowHeight;
+	viewmat_window_size(&windowWidth, &windowHeight);
+	float windowAspect  = windowWidth / (float) windowHeight;
+	float stretchLabel[16];
+	mat4f_scale_new(stretchLabel, 1/8.0 * fpsLabelAspectRatio / windowAspect, 1/8.0, 1);
+
+	/* Position label in the upper left corner of the screen */
+	float transLabel[16];
+	mat4f_translate_new(transLabel, -.9, .8, 0);
+	float modelview[16];
+	mat4f_mult_mat4f_new(modelview, transLabel, stretchLabel);
+	glUniformMatrix4fv(kuhl_get_uniform("ModelView"), 1, 0, modelview);
+
+	/* Make sure we don't use a projection matrix */
+	float identity[16];
+	mat4f_identity(identity);
+	glUniformMatrix4fv(kuhl_get_uniform("Projection"), 1, 0, identity);
+
+	/* Don't use depth testing and make sure we use the texture
+	 * rendering style */
+	glDisable(GL_DEPTH_TEST);
+	glUniform1i(kuhl_get_uniform("renderStyle"), 1);
+	kuhl_geometry_draw(&labelQuad); /* Draw the quad */
+	glEnable(GL_DEPTH_TEST);
+	kuhl_errorcheck();
+
+	glUseProgram(0); // stop using a GLSL program.
+}
+
+/* Draws the models for both eyes with one draw call per model (see
+ * viewmat_get_stereo() and assimp-stereo.vert). */
+static void display_single_pass(int renderStyle)
+{
+	/* Both eyes share a framebuffer in the modes that support single
+	 * pass rendering, so this doesn't change the framebuffer. */
+	viewmat_begin_eye(0);
+
+	float viewMat[2][16], perspective[2][16];
+	int viewport[4];
+	float split;
+	viewmat_get_stereo(viewMat, perspective, viewport, &split);
+	display_clear(viewport);
+
+	glUseProgram(stereoProgram);
+	kuhl_errorcheck();
+	glUniformMatrix4fv(kuhl_get_uniform("View"), 2, 0, viewMat[0]);
+	glUniformMatrix4fv(kuhl_get_uniform("Projection"), 2, 0, perspective[0]);
+	glUniform1f(kuhl_get_uniform("EyeSplit"), split);
+	glUniform1i(kuhl_get_uniform("renderStyle"), renderStyle);
+	// Copy far plane value into vertex program so we can render depth buffer.
+	float f[6]; // left, right, bottom, top, near>0, far>0
+	projmat_get_frustum(f, viewport[2]/2, viewport[3]);
+	glUniform1f(kuhl_get_uniform("farPlane"), f[5]);
+
+	/* A model is drawn if either eye can see it. */
+	cull_models(visible, viewMat[0], perspective[0]);
+	cull_models(visibleRightEye, viewMat[1], perspective[1]);
+	for(int i=0; i<NUM_MODELS; i++)
+		visible[i] |= visibleRightEye[i];
+	count_culled(visible);
+
+	/* Keep each eye on its side of the viewport */
+	glEnable(GL_CLIP_DISTANCE0);
+	for(int i=0; i<NUM_MODELS; i++)
+	{
+		if(!visible[i])
+			continue;
+		float modelMat[16], modelview[16];
+		get_model_matrix(modelMat, positions[i]);
+		glUniformMatrix4fv(kuhl_get_uniform("Model"), 1, 0, modelMat);
+
+		/* Both eyes see the model from nearly the same distance. */
+		mat4f_mult_mat4f_new(modelview, viewMat[0], modelMat);
+		kuhl_geometry_lod_select(modelgeom, modelview, perspective[0], viewport[3]);
+
+		kuhl_errorcheck();
+		kuhl_geometry_draw_instanced(modelgeom, 2); /* Draw the model for both eyes */
+		kuhl_errorcheck();
+	}
+	glDisable(GL_CLIP_DISTANCE0);
+
+	glUseProgram(0); // stop using a GLSL program.
+}
+
+
 /* Called by GLUT whenever the window needs to be redrawn. This
  * function should not be called directly by the programmer. Instead,
  * we can call glutPostRedisplay() to request that GLUT call display()
@@ -92,7 +292,13 @@ void display()
 		if(fps_state.frame == 0)
 		{
 			char label[1024];
-			snprintf(label, 1024, "FPS: %0.1f", fps);
+			profiler_stats gpu;
+			if(profiler_gpu_stats(0, &gpu))
+				snprintf(label, 1024, "FPS: %0.1f GPU: %0.1f ms", fps, gpu.p95);
+			else
+				snprintf(label, 1024, "FPS: %0.1f", fps);
+			if(viewmat_resolution_scale() != 1)
+				snprintf(label+strlen(label), 1024-strlen(label), " Scale: %0.2f", viewmat_resolution_scale());
 
 			/* Delete old label if it exists */
 			if(fpsLabel != 0) 
@@ -118,11 +324,32 @@ void display()
 	dgr_setget("style", &renderStyle, sizeof(int));
 
 	
+	/* Measure how much CPU time it takes to issue the draw calls for
+	 * this frame. */
+	profiler_begin("draw");
+	unsigned long drawCallsStart = kuhl_geometry_draw_calls();
+	unsigned long verticesStart = kuhl_geometry_draw_vertices();
+	memset(&renderQueue.total, 0, sizeof(render_queue_stats));
+
+	/* Circle the center of the flock once every 30 seconds at eye
+	 * height. */
+	if(orbit)
+	{
+		float angle = (projmat_elapsed_milliseconds() % 30000) / 30000.0f * 2 * M_PI;
+		mousemove_set(20*sinf(angle), 1.55, 20*cosf(angle),
+		              0, 0, 0,
+		              0, 1, 0);
+	}
+
 	/* Render the scene once for each viewport. Frequently one
 	 * viewport will fill the entire screen. However, this loop will
 	 * run twice for HMDs (once for the left eye and once for the
-	 * right. */
+	 * right. If viewmat_single_pass() is set, the models for both
+	 * eyes are drawn before the loop and the loop only draws the
+	 * label in each eye. */
 	viewmat_begin_frame();
+	if(viewmat_single_pass())
+		display_single_pass(renderStyle);
 	for(int viewportID=0; viewportID<viewmat_num_viewports(); viewportID++)
 	{
 		viewmat_begin_eye(viewportID);
@@ -130,39 +357,28 @@ void display()
 		/* Where is the viewport that we are drawing onto and what is its size? */
 		int viewport[4]; // x,y of lower left corner, width, height
 		viewmat_get_viewport(viewport, viewportID);
-		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
-
-		/* Clear the current viewport. Without glScissor(), glClear()
-		 * clears the entire screen. We could call glClear() before
-		 * this viewport loop---but on order for all variations of
-		 * this code to work (Oculus support, etc), we can only draw
-		 * after viewmat_begin_eye(). */
-		glScissor(viewport[0], viewport[1], viewport[2], viewport[3]);
-		glEnable(GL_SCISSOR_TEST);
-		glClearColor(.2,.2,.2,0); // set clear color to grey
-		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-		glDisable(GL_SCISSOR_TEST);
-		glEnable(GL_DEPTH_TEST); // turn on depth testing
-		kuhl_errorcheck();
-
-		/* Turn on blending (note, if you are using transparent textures,
-		   the transparency may not look correct unless you draw further
-		   items before closer items.). */
-		glEnable(GL_BLEND);
-		glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
-		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+		if(viewmat_single_pass())
+		{
+			glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+			display_label();
+			continue;
+		}
+		display_clear(viewport);
 
 		/* Get the view or camera matrix; update the frustum values if needed. */
 		float viewMat[16], perspective[16];
 		viewmat_get(viewMat, perspective, viewportID);
 
-		glUseProgram(program);
+		glUseProgram(latchProgram ? latchProgram : program);
 		kuhl_errorcheck();
-		/* Send the perspective projection matrix to the vertex program. */
-		glUniformMatrix4fv(kuhl_get_uniform("Projection"),
-		                   1, // number of 4x4 float matrices
-		                   0, // transpose
-		                   perspective); // value
+		/* Send the perspective projection matrix to the vertex
+		 * program. The late latching program gets the view and
+		 * projection matrices from viewmat instead. */
+		if(latchProgram == 0)
+			glUniformMatrix4fv(kuhl_get_uniform("Projection"),
+			                   1, // number of 4x4 float matrices
+			                   0, // transpose
+			                   perspective); // value
 
 		glUniform1i(kuhl_get_uniform("renderStyle"), renderStyle);
 		// Copy far plane value into vertex program so we can render depth buffer.
@@ -170,65 +386,77 @@ void display()
 		projmat_get_frustum(f, viewport[2], viewport[3]);
 		glUniform1f(kuhl_get_uniform("farPlane"), f[5]);
 
+		cull_models(visible, viewMat, perspective);
+		count_culled(visible);
+
 		float modelview[16];
 		for(int i=0; i<NUM_MODELS; i++)
 		{
+			if(!visible[i])
+				continue;
 			float modelMat[16];
 			get_model_matrix(modelMat, positions[i]);
-
 			mat4f_mult_mat4f_new(modelview, viewMat, modelMat); // modelview = view * model
-
-			/* Send the modelview matrix to the vertex program. */
-			glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
-			                   1, // number of 4x4 float matrices
-			                   0, // transpose
-			                   modelview); // value
+			kuhl_geometry_lod_select(modelgeom, modelview, perspective, viewport[3]);
+
+			if(useRenderQueue)
+			{
+				/* The distance to the model sorts the models front
+				 * to back. */
+				render_queue_add(&renderQueue, viewportID, RENDER_QUEUE_OPAQUE, modelgeom,
+				                 latchProgram ? modelMat : modelview, -modelview[14]);
+				continue;
+			}
+
+			if(latchProgram)
+				glUniformMatrix4fv(kuhl_get_uniform("Model"), 1, 0, modelMat);
+			else
+			{
+				/* Send the modelview matrix to the vertex program. */
+				glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
+				                   1, // number of 4x4 float matrices
+				                   0, // transpose
+				                   modelview); // value
+			}
 
 			kuhl_errorcheck();
 			kuhl_geometry_draw(modelgeom); /* Draw the model */
 			kuhl_errorcheck();
 		}
+		render_queue_flush(&renderQueue, NULL);
 
-		if(dgr_is_enabled() == 0 || dgr_is_master())
-		{
-
-			/* The shape of the frames per second quad depends on the
-			 * aspect ratio of the label texture and the aspect ratio of
-			 * the window (because we are placing the quad in normalized
-			 * device coordinates). */
-			float windowAspect  = glutGet(GLUT_WINDOW_WIDTH) /(float) glutGet(GLUT_WINDOW_HEIGHT);
-			float stretchLabel[16];
-			mat4f_scale_new(stretchLabel, 1/8.0 * fpsLabelAspectRatio / windowAspect, 1/8.0, 1);
-
-			/* Position label in the upper left corner of the screen */
-			float transLabel[16];
-			mat4f_translate_new(transLabel, -.9, .8, 0);
-			mat4f_mult_mat4f_new(modelview, transLabel, stretchLabel);
-			glUniformMatrix4fv(kuhl_get_uniform("ModelView"), 1, 0, modelview);
-
-			/* Make sure we don't use a projection matrix */
-			float identity[16];
-			mat4f_identity(identity);
-			glUniformMatrix4fv(kuhl_get_uniform("Projection"), 1, 0, identity);
-
-			/* Don't use depth testing and make sure we use the texture
-			 * rendering style */
-			glDisable(GL_DEPTH_TEST);
-			glUniform1i(kuhl_get_uniform("renderStyle"), 1);
-			kuhl_geometry_draw(&labelQuad); /* Draw the quad */
-			glEnable(GL_DEPTH_TEST);
-			kuhl_errorcheck();
-		}
-
+		display_label();
 		glUseProgram(0); // stop using a GLSL program.
 
 	} // finish viewport loop
+
+	/* Print the draw calls and CPU time per frame once per second. */
+	unsigned long drawCalls = kuhl_geometry_draw_calls() - drawCallsStart + renderQueue.total.draws;
+	unsigned long vertices = kuhl_geometry_draw_vertices() - verticesStart + renderQueue.total.vertices;
+	profiler_end("draw");
+	if(fps_state.frame == 0)
+	{
+		profiler_stats cpu;
+		profiler_cpu_stats("draw", &cpu);
+		msg(INFO, "%s: %lu draw calls and %lu triangles per frame, CPU time per frame (ms) p50=%.2f p95=%.2f p99=%.2f, %.1f fps (%.2f ms per frame), %.1f%% of models culled\n",
+		    viewmat_single_pass() ? "single pass stereo" : "one pass per viewport",
+		    drawCalls, vertices/3, cpu.p50, cpu.p95, cpu.p99, fps, fps > 0 ? 1000/fps : 0,
+		    modelsTested > 0 ? 100.0 * modelsCulled / modelsTested : 0);
+		modelsTested = modelsCulled = 0;
+		if(renderQueue.total.draws > 0)
+		{
+			char summary[256];
+			render_queue_summary(&renderQueue.total, summary, 256);
+			msg(INFO, "Render queue per frame: %s\n", summary);
+		}
+	}
+
 	viewmat_end_frame();
 	
 	/* Update the model for the next frame based on the time. We
 	 * convert the time to seconds and then use mod to cause the
 	 * animation to repeat. */
-	int time = glutGet(GLUT_ELAPSED_TIME);
+	int time = projmat_elapsed_milliseconds();
 	dgr_setget("time", &time, sizeof(int));
 	kuhl_update_model(modelgeom, 0, ((time%10000)/1000.0));
 
@@ -242,7 +470,8 @@ void display()
 	 * ourselves recursively because it will not leave time for GLUT
 	 * to call other callback functions for when a key is pressed, the
 	 * window is resized, etc. */
-	glutPostRedisplay();
+	if(!projmat_headless())
+		glutPostRedisplay();
 }
 
 /* This illustrates how to draw a quad by drawing two triangles and reusing vertices. */
@@ -286,26 +515,34 @@ int main(int argc, char** argv)
 {
 	char *modelFilename = "../models/duck/duck.dae";
 
-	/* set up our GLUT window */
-	glutInit(&argc, argv);
-	glutInitWindowSize(512, 512);
-	glutSetOption(GLUT_MULTISAMPLE, 4); // set msaa samples; default to 4
-	/* Ask GLUT to for a double buffered, full color window that
-	 * includes a depth buffer */
+	/* set up our GLUT window---or an offscreen context if
+	 * PROJMAT_HEADLESS=1 */
+	if(!projmat_init_headless())
+	{
+		glutInit(&argc, argv);
+		glutInitWindowSize(512, 512);
+		glutSetOption(GLUT_MULTISAMPLE, 4); // set msaa samples; default to 4
+		/* Ask GLUT to for a double buffered, full color window that
+		 * includes a depth buffer */
 #ifdef __APPLE__
-	glutInitDisplayMode(GLUT_3_2_CORE_PROFILE | GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
+		glutInitDisplayMode(GLUT_3_2_CORE_PROFILE | GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
 #else
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
-	glutInitContextVersion(3,2);
-	glutInitContextProfile(GLUT_CORE_PROFILE);
+		glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
+		glutInitContextVersion(3,2);
+		glutInitContextProfile(GLUT_CORE_PROFILE);
 #endif
-	glutCreateWindow(argv[0]); // set window title to executable name
+		glutCreateWindow(argv[0]); // set window title to executable name
+
+		// setup callbacks
+		glutDisplayFunc(display);
+		glutKeyboardFunc(keyboard);
+	}
 	glEnable(GL_MULTISAMPLE);
 
 	/* Initialize GLEW */
 	glewExperimental = GL_TRUE;
 	GLenum glewError = glewInit();
-	if(glewError != GLEW_OK)
+	if(glewError != GLEW_OK && !projmat_headless())
 	{
 		fprintf(stderr, "Error initializing GLEW: %s\n", glewGetErrorString(glewError));
 		exit(EXIT_FAILURE);
@@ -318,10 +555,6 @@ int main(int argc, char** argv)
 	 * http://www.opengl.org/wiki/OpenGL_Loading_Library */
 	glGetError();
 
-	// setup callbacks
-	glutDisplayFunc(display);
-	glutKeyboardFunc(keyboard);
-
 	/* Compile and link a GLSL program composed of a vertex shader and
 	 * a fragment shader. */
 	program = kuhl_create_program(GLSL_VERT_FILE, GLSL_FRAG_FILE);
@@ -338,12 +571,28 @@ int main(int argc, char** argv)
 	glClearColor(.2,.2,.2,1);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	// Load the model from the file
-	modelgeom = kuhl_load_model(modelFilename, NULL, program, bbox);
+	/* If both eyes are drawn at once, the model needs to be drawn
+	 * with a vertex program that handles both eyes. Otherwise, if
+	 * viewmat late latches the head pose, use a vertex program that
+	 * reads the view matrix from viewmat's uniform buffer. */
+	GLuint modelProgram = program;
+	if(viewmat_single_pass())
+		modelProgram = stereoProgram = kuhl_create_program(GLSL_STEREO_VERT_FILE, GLSL_FRAG_FILE);
+	else if(viewmat_late_latch_enabled())
+	{
+		modelProgram = latchProgram = kuhl_create_program(GLSL_LATCH_VERT_FILE, GLSL_FRAG_FILE);
+		viewmat_late_latch_program(latchProgram);
+	}
+
+	// Load the model from the file with levels of detail
+	kuhl_load_model_lod(1);
+	modelgeom = kuhl_load_model(modelFilename, NULL, modelProgram, bbox);
 	kuhl_bbox_fit(fitMatrix, bbox, 1);
 	init_geometryQuad(&labelQuad, program);
+	render_queue_init(&renderQueue, latchProgram ? "Model" : "ModelView");
 
 	kuhl_getfps_init(&fps_state);
+	profiler_init(); // measure CPU and GPU time (see the label and display())
 
 	for(int i=0; i<NUM_MODELS; i++)
 	{
@@ -351,10 +600,26 @@ int main(int argc, char** argv)
 		positions[i][1] = drand48()*50-25;
 		positions[i][2] = drand48()*50-25;
 	}
+
+	/* The bounding sphere of each model surrounds its bounding box
+	 * after fitMatrix (which scales uniformly) is applied. */
+	float modelCenter[4] = { (bbox[0]+bbox[1])/2, (bbox[2]+bbox[3])/2, (bbox[4]+bbox[5])/2, 1 };
+	mat4f_mult_vec4f(modelCenter, fitMatrix);
+	float bboxSize[3] = { bbox[1]-bbox[0], bbox[3]-bbox[2], bbox[5]-bbox[4] };
+	float modelRadius = vec3f_norm(bboxSize)/2 * vec3f_norm(fitMatrix);
+	for(int i=0; i<NUM_MODELS; i++)
+	{
+		sphereX[i] = positions[i][0] + modelCenter[0];
+		sphereY[i] = positions[i][1] + modelCenter[1];
+		sphereZ[i] = positions[i][2] + modelCenter[2];
+		sphereRadius[i] = modelRadius;
+	}
+	orbit = projmat_headless();
 	
 	/* Tell GLUT to start running the main loop and to call display(),
-	 * keyboard(), etc callback methods as needed. */
-	glutMainLoop();
+	 * keyboard(), etc callback methods as needed. In headless mode,
+	 * call display() PROJMAT_FRAMES times and exit. */
+	projmat_main_loop(display);
 	/* // An alternative approach:
 	   while(1)
 	   glutMainLoopEvent();
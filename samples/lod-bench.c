@@ -0,0 +1,238 @@
+/*
+  This program measures how levels of detail (see
+  kuhl_load_model_lod() and kuhl_geometry_lod_select()) change the
+  number of triangles drawn and the time per frame in the scene that
+  flock.c draws: thousands of copies of a model scattered in a 50m
+  cube in front of the camera.
+
+  The model is loaded once with levels of detail. Each frame, every
+  copy is drawn with the level that kuhl_geometry_lod_select() chooses
+  for the viewmat projection. The frames are drawn with levels of
+  detail turned off (full detail) and with several error thresholds
+  (the largest distance in pixels that a simplified surface may move
+  on the screen). Each frame is timed from the first draw call until
+  glFinish() returns. The "levels" column is the number of copies
+  drawn at each level, from full detail to the coarsest level.
+
+  The program works with a window or in headless mode:
+
+  PROJMAT_HEADLESS=1 ./lod-bench
+  PROJMAT_HEADLESS=1 ./lod-bench -n 1000 ../models/duck/duck.dae
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <GL/glew.h>
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/freeglut.h>
+#endif
+
+#include "kuhl-util.h"
+#include "vecmat.h"
+#include "projmat.h"
+#include "viewmat.h"
+#include "dgr.h"
+#include "rolling-stats.h"
+
+#define GLSL_VERT_FILE "assimp.vert"
+#define GLSL_FRAG_FILE "assimp.frag"
+
+static GLuint program = 0;
+static kuhl_geometry *modelgeom = NULL;
+static float fitMatrix[16];
+static float (*positions)[3] = NULL;
+static int numModels = 5000;
+
+/* The camera doesn't move, so the matrices are calculated once. */
+static int viewport[4];
+static float viewMat[16], perspective[16];
+
+/** Draws every copy of the model once. If pixels is 0, levels of
+ * detail are turned off. Counts the copies drawn at each level (of
+ * the first mesh in the model). */
+static void draw_scene(float pixels, int levelCounts[MAX_LODS+1])
+{
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glClearColor(.2,.2,.2,0);
+	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+
+	glUseProgram(program);
+	glUniformMatrix4fv(kuhl_get_uniform("Projection"), 1, 0, perspective);
+	glUniform1i(kuhl_get_uniform("renderStyle"), 2);
+	float f[6]; // left, right, bottom, top, near>0, far>0
+	projmat_get_frustum(f, viewport[2], viewport[3]);
+	glUniform1f(kuhl_get_uniform("farPlane"), f[5]);
+
+	kuhl_geometry_lod_threshold(pixels);
+	for(int i=0; i<numModels; i++)
+	{
+		float moveToPosition[16], modelMat[16], modelview[16];
+		mat4f_translateVec_new(moveToPosition, positions[i]);
+		mat4f_mult_mat4f_new(modelMat, moveToPosition, fitMatrix);
+		mat4f_mult_mat4f_new(modelview, viewMat, modelMat);
+		kuhl_geometry_lod_select(modelgeom, modelview, perspective, viewport[3]);
+		levelCounts[modelgeom->lod_level]++;
+
+		glUniformMatrix4fv(kuhl_get_uniform("ModelView"), 1, 0, modelview);
+		kuhl_geometry_draw(modelgeom);
+	}
+	glUseProgram(0);
+}
+
+/** Draws 'frames' frames with one threshold and prints one line of
+ * results. */
+static void bench(const char *label, float pixels, int frames)
+{
+	rolling_stats total, cpu;
+	rolling_stats_init(&total, frames);
+	rolling_stats_init(&cpu, frames);
+	glFinish();
+	unsigned long vertices = 0;
+	int levelCounts[MAX_LODS+1];
+	for(int f=0; f<frames+2; f++)
+	{
+		memset(levelCounts, 0, sizeof(levelCounts));
+		unsigned long verticesBefore = kuhl_geometry_draw_vertices();
+		long start = kuhl_microseconds();
+		draw_scene(pixels, levelCounts);
+		long cpuTime = kuhl_microseconds() - start;
+		vertices = kuhl_geometry_draw_vertices() - verticesBefore;
+		/* Waiting for the GPU keeps frames from overlapping. */
+		glFinish();
+		long totalTime = kuhl_microseconds() - start;
+
+		if(f >= 2) // skip the first frames while the driver warms up
+		{
+			rolling_stats_add(&total, totalTime / 1000.0f);
+			rolling_stats_add(&cpu, cpuTime / 1000.0f);
+		}
+	}
+	kuhl_errorcheck();
+
+	char levels[256] = "";
+	for(unsigned int i=0; i<=modelgeom->lod_count; i++)
+		snprintf(levels+strlen(levels), sizeof(levels)-strlen(levels), "%s%d", i == 0 ? "" : "/", levelCounts[i]);
+
+	float pcts[2] = { .5, .95 };
+	float t[2], c[2];
+	rolling_stats_percentiles(&total, pcts, t, 2);
+	rolling_stats_percentiles(&cpu, pcts, c, 2);
+	printf("%-10s | %10lu | %9.3f | %9.3f | %10.3f | %s\n",
+	       label, vertices/3, t[0], t[1], c[0], levels);
+	rolling_stats_free(&total);
+	rolling_stats_free(&cpu);
+}
+
+int main(int argc, char** argv)
+{
+	int frames = 20;
+	int opt;
+	while((opt = getopt(argc, argv, "n:f:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n': numModels = atoi(optarg); break;
+			case 'f': frames = atoi(optarg); break;
+			default:
+				printf("Usage: %s [-n models] [-f frames] [modelFile]\n", argv[0]);
+				printf("  -n models  Copies of the model in the scene (default %d)\n", numModels);
+				printf("  -f frames  Frames to measure with each threshold (default %d)\n", frames);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if(numModels < 1 || frames < 1)
+	{
+		printf("Usage: %s [-n models] [-f frames] [modelFile]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	const char *modelFilename = "../models/duck/duck.dae";
+	if(optind < argc)
+		modelFilename = argv[optind];
+
+	/* set up our GLUT window---or an offscreen context if
+	 * PROJMAT_HEADLESS=1 */
+	if(!projmat_init_headless())
+	{
+		glutInit(&argc, argv);
+		glutInitWindowSize(512, 512);
+#ifdef __APPLE__
+		glutInitDisplayMode(GLUT_3_2_CORE_PROFILE | GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+#else
+		glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+		glutInitContextVersion(3,2);
+		glutInitContextProfile(GLUT_CORE_PROFILE);
+#endif
+		glutCreateWindow(argv[0]); // set window title to executable name
+	}
+
+	/* Initialize GLEW */
+	glewExperimental = GL_TRUE;
+	GLenum glewError = glewInit();
+	if(glewError != GLEW_OK && !projmat_headless())
+	{
+		fprintf(stderr, "Error initializing GLEW: %s\n", glewGetErrorString(glewError));
+		exit(EXIT_FAILURE);
+	}
+	glGetError();
+
+	program = kuhl_create_program(GLSL_VERT_FILE, GLSL_FRAG_FILE);
+	dgr_init();
+	projmat_init();
+
+	/* The same camera as flock.c */
+	float initCamPos[3]  = {0,1.55,2};
+	float initCamLook[3] = {0,0,0};
+	float initCamUp[3]   = {0,1,0};
+	viewmat_init(initCamPos, initCamLook, initCamUp);
+	viewmat_get_viewport(viewport, 0);
+	viewmat_get(viewMat, perspective, 0);
+
+	float bbox[6];
+	long loadStart = kuhl_microseconds();
+	kuhl_load_model_lod(1);
+	modelgeom = kuhl_load_model(modelFilename, NULL, program, bbox);
+	if(modelgeom == NULL)
+		exit(EXIT_FAILURE);
+	kuhl_bbox_fit(fitMatrix, bbox, 1);
+	long loadTime = kuhl_microseconds() - loadStart;
+
+	/* The same placement as flock.c */
+	positions = kuhl_malloc(sizeof(float)*3*numModels);
+	for(int i=0; i<numModels; i++)
+	{
+		positions[i][0] = drand48()*50-25;
+		positions[i][1] = drand48()*50-25;
+		positions[i][2] = drand48()*50-25;
+	}
+
+	glEnable(GL_DEPTH_TEST);
+
+	printf("%s: %u meshes, loaded with levels of detail in %.1f ms\n",
+	       modelFilename, kuhl_geometry_count(modelgeom), loadTime / 1000.0);
+	for(kuhl_geometry *g = modelgeom; g != NULL; g = g->next)
+	{
+		printf("  mesh: %u triangles", g->indices_len/3);
+		for(unsigned int i=0; i<g->lod_count; i++)
+			printf(", %u (error %.4f)", g->lods[i].count/3, g->lods[i].error);
+		printf("\n");
+	}
+	printf("%d models, %d frames\n", numModels, frames);
+	printf("%-10s | %10s | %9s | %9s | %10s | %s\n", "threshold", "triangles", "frame p50", "frame p95", "submit p50", "levels");
+	printf("%-10s | %10s | %9s | %9s | %10s |\n", "(pixels)", "/frame", "(ms)", "(ms)", "(ms)");
+
+	/* Run each threshold twice, alternating, so that clocks ramping
+	 * up don't favor whichever threshold is measured last. */
+	for(int i=0; i<2; i++)
+	{
+		bench("off", 0, frames);
+		bench("1", 1, frames);
+		bench("4", 4, frames);
+	}
+
+	free(positions);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,177 @@
+/*
+  This program measures how many particles per second the CPU can
+  move with particle_cpu_step() (see particle-cpu.h) with different
+  numbers of threads. For comparison, it also measures the loop that
+  explode.c used before: one thread updating an array of structs with
+  the position and velocity of each particle.
+
+  Each step writes the new positions into a separate array the same
+  way that explode writes them into a stream buffer. After the
+  measurements, the positions from particle_cpu_step() are compared
+  with the positions from the simple loop.
+
+  No OpenGL context is needed:
+
+  ./particle-bench                 # 1M and 10M particles
+  ./particle-bench -n 2000000 -t 8
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "kuhl-util.h"
+#include "vecmat.h"
+#include "particle-cpu.h"
+#include "rolling-stats.h"
+
+#define TIMESTEP 0.1f
+
+/** The position and velocity of a particle, stored the way that
+ * explode.c used to store them. */
+typedef struct {
+	float pos[3];
+	float vel[3];
+} particle;
+
+/** The loop from explode.c: one thread, an array of structs. */
+static void step_simple(particle *p, size_t count, float *positions)
+{
+	float accel[3] = { 0, -1, 0 };
+	float timestep = TIMESTEP;
+	float velocityLossFactor = .4;
+	for(size_t j=0; j<count; j++)
+	{
+		for(int k=0; k<3; k++)
+		{
+			p[j].pos[k] += timestep * (p[j].vel[k] + timestep * accel[k]/2);
+			p[j].vel[k] += timestep * accel[k];
+		}
+		if(p[j].pos[1] < 0)
+		{
+			p[j].pos[1] *= -velocityLossFactor;
+			p[j].vel[1] *= -1;
+			vec3f_scalarMult(p[j].vel, velocityLossFactor);
+		}
+		vec3f_copy(positions+j*3, p[j].pos);
+	}
+}
+
+/** Prints one line of results from the step times (in milliseconds). */
+static void print_result(const char *label, int threads, size_t count, rolling_stats *rs)
+{
+	float pcts[2] = { .5, .95 };
+	float t[2];
+	rolling_stats_percentiles(rs, pcts, t, 2);
+	printf("%-10s | %7d | %9.3f | %9.3f | %10.1f\n",
+	       label, threads, t[0], t[1], count / t[0] / 1000.0);
+}
+
+static void bench(size_t count, int maxThreads, int steps)
+{
+	/* Particles start above the ground moving in random directions
+	 * so that some of them bounce during the measurements. */
+	float *startPos = kuhl_malloc(sizeof(float)*3*count);
+	float *startVel = kuhl_malloc(sizeof(float)*3*count);
+	for(size_t i=0; i<count*3; i++)
+	{
+		startPos[i] = drand48();
+		startVel[i] = drand48()*10-5;
+	}
+	float *positions = kuhl_malloc(sizeof(float)*3*count);
+	float *expected = kuhl_malloc(sizeof(float)*3*count);
+
+	printf("\n%zu particles, %d steps\n", count, steps);
+	printf("%-10s | %7s | %9s | %9s | %s\n", "update", "threads", "step p50", "step p95", "Mparticles/sec");
+	printf("%-10s | %7s | %9s | %9s |\n", "", "", "(ms)", "(ms)");
+
+	rolling_stats rs;
+	rolling_stats_init(&rs, steps);
+
+	particle *simple = kuhl_malloc(sizeof(particle)*count);
+	for(size_t i=0; i<count; i++)
+	{
+		vec3f_copy(simple[i].pos, startPos+i*3);
+		vec3f_copy(simple[i].vel, startVel+i*3);
+	}
+	for(int s=0; s<steps; s++)
+	{
+		long start = kuhl_microseconds();
+		step_simple(simple, count, expected);
+		rolling_stats_add(&rs, (kuhl_microseconds() - start) / 1000.0f);
+	}
+	print_result("simple", 1, count, &rs);
+	free(simple);
+
+	float maxDiff = 0;
+	for(int threads=1; threads <= maxThreads; threads *= 2)
+	{
+		particle_cpu_threads(threads);
+		particle_cpu pc;
+		particle_cpu_init(&pc, count, startPos, startVel);
+		rolling_stats_free(&rs);
+		rolling_stats_init(&rs, steps);
+		for(int s=0; s<steps; s++)
+		{
+			long start = kuhl_microseconds();
+			particle_cpu_step(&pc, TIMESTEP, positions);
+			rolling_stats_add(&rs, (kuhl_microseconds() - start) / 1000.0f);
+		}
+		print_result("soa+sse", particle_cpu_thread_count(), count, &rs);
+		particle_cpu_free(&pc);
+
+		for(size_t i=0; i<count*3; i++)
+			maxDiff = fmaxf(maxDiff, fabsf(positions[i] - expected[i]));
+
+		/* Also measure the number of processors if it isn't a power of two. */
+		if(threads < maxThreads && threads*2 > maxThreads)
+			threads = maxThreads/2;
+	}
+	printf("Largest difference from the simple loop: %g\n", maxDiff);
+
+	rolling_stats_free(&rs);
+	free(startPos);
+	free(startVel);
+	free(positions);
+	free(expected);
+}
+
+int main(int argc, char** argv)
+{
+	size_t count = 0;
+	int maxThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int steps = 20;
+	int opt;
+	while((opt = getopt(argc, argv, "n:t:s:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n': count = strtoul(optarg, NULL, 10); break;
+			case 't': maxThreads = atoi(optarg); break;
+			case 's': steps = atoi(optarg); break;
+			default:
+				printf("Usage: %s [-n particles] [-t threads] [-s steps]\n", argv[0]);
+				printf("  -n particles  Number of particles (default: 1M and 10M)\n");
+				printf("  -t threads    Largest number of threads to measure (default %d)\n", maxThreads);
+				printf("  -s steps      Steps to measure for each number of threads (default %d)\n", steps);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if(maxThreads < 1 || steps < 1)
+	{
+		printf("Usage: %s [-n particles] [-t threads] [-s steps]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	srand48(1);
+	if(count > 0)
+		bench(count, maxThreads, steps);
+	else
+	{
+		bench(1000000, maxThreads, steps);
+		bench(10000000, maxThreads, steps);
+	}
+	exit(EXIT_SUCCESS);
+}
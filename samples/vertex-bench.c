@@ -0,0 +1,224 @@
+/*
+  This program measures how quickly the GPU draws the vertices of a
+  model when kuhl_load_model() stores the vertex attributes of each
+  mesh in separate buffers, when it interleaves them in one buffer
+  (see kuhl_load_model_interleave()) and when it merges all of the
+  meshes into a few buffers that are drawn with multi-draw indirect
+  calls (see kuhl_load_model_merge()). The "optimized" layout is
+  interleaved with the triangles and vertices reordered for the
+  vertex cache (see kuhl_load_model_optimize()). For each layout, it also
+  reports the number of draw calls per frame and how long the CPU
+  spends submitting them.
+
+  The model is loaded once with each layout and drawn several times
+  per frame. Each frame is timed from the first draw call until
+  glFinish() returns, which works the same way with every driver
+  (some software renderers always report 0 for timer queries). By
+  default, primitives are discarded before they are rasterized so
+  that the time depends on fetching and transforming vertices, not on
+  filling pixels (-r turns rasterization back on).
+
+  Large models with many vertices give the most useful results for
+  the vertex layouts; models with many small meshes show the
+  difference that merging makes. The program works with a window or in headless mode:
+
+  PROJMAT_HEADLESS=1 ./vertex-bench ../models/duck/duck.dae
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <GL/glew.h>
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/freeglut.h>
+#endif
+
+#include "kuhl-util.h"
+#include "vecmat.h"
+#include "projmat.h"
+#include "rolling-stats.h"
+
+#define GLSL_VERT_FILE "assimp.vert"
+#define GLSL_FRAG_FILE "assimp.frag"
+
+static GLuint program = 0;
+
+/** Counts the buffer objects used for vertex attributes and the
+ * indices drawn for every kuhl_geometry in a list. */
+static void count_geometry(kuhl_geometry *geom, int *buffers, long *indices)
+{
+	*buffers = 0;
+	*indices = 0;
+	for(kuhl_geometry *g = geom; g != NULL; g = g->next)
+	{
+		*indices += g->indices_len > 0 ? g->indices_len : g->vertex_count;
+		/* Merged meshes are drawn from the buffers of their batch. */
+		if(g->merged_into != NULL)
+			continue;
+		for(unsigned int i=0; i<g->attrib_count; i++)
+		{
+			/* Attributes that share a buffer are next to each other. */
+			if(i == 0 || g->attribs[i].bufferobject != g->attribs[i-1].bufferobject)
+				(*buffers)++;
+		}
+	}
+	if(geom->merged != NULL)
+		*buffers += geom->merged->batch_count;
+}
+
+/** Draws the model 'draws' times per frame for 'frames' frames and
+ * prints one line of results. */
+static void bench(const char *label, kuhl_geometry *geom, int draws, int frames)
+{
+	int buffers;
+	long indices;
+	count_geometry(geom, &buffers, &indices);
+
+	rolling_stats total, cpu;
+	rolling_stats_init(&total, frames);
+	rolling_stats_init(&cpu, frames);
+	glFinish();
+	unsigned long calls = 0;
+	for(int f=0; f<frames+10; f++)
+	{
+		unsigned long callsBefore = kuhl_geometry_draw_calls();
+		long start = kuhl_microseconds();
+		for(int d=0; d<draws; d++)
+			kuhl_geometry_draw(geom);
+		long cpuTime = kuhl_microseconds() - start;
+		calls = kuhl_geometry_draw_calls() - callsBefore;
+		/* Waiting for the GPU keeps frames from overlapping. */
+		glFinish();
+		long totalTime = kuhl_microseconds() - start;
+
+		if(f >= 10) // skip the first few frames while the driver warms up
+		{
+			rolling_stats_add(&total, totalTime / 1000.0f);
+			rolling_stats_add(&cpu, cpuTime / 1000.0f);
+		}
+	}
+	kuhl_errorcheck();
+
+	float pcts[2] = { .5, .95 };
+	float t[2], c[2];
+	rolling_stats_percentiles(&total, pcts, t, 2);
+	rolling_stats_percentiles(&cpu, pcts, c, 2);
+	printf("%-12s | %7d | %7lu | %9.3f | %9.3f | %10.3f | %10.1f\n",
+	       label, buffers, calls, t[0], t[1], c[0], indices * (double) draws / t[0] / 1000.0);
+	rolling_stats_free(&total);
+	rolling_stats_free(&cpu);
+}
+
+int main(int argc, char** argv)
+{
+	int draws = 20;
+	int frames = 100;
+	int rasterize = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "n:f:rh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n': draws = atoi(optarg); break;
+			case 'f': frames = atoi(optarg); break;
+			case 'r': rasterize = 1; break;
+			default:
+				printf("Usage: %s [-n draws] [-f frames] [-r] modelFile\n", argv[0]);
+				printf("  -n draws   Times the model is drawn per frame (default %d)\n", draws);
+				printf("  -f frames  Frames to measure with each layout (default %d)\n", frames);
+				printf("  -r         Rasterize the triangles instead of discarding them\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+	if(optind >= argc || draws < 1 || frames < 1)
+	{
+		printf("Usage: %s [-n draws] [-f frames] [-r] modelFile\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	const char *modelFilename = argv[optind];
+
+	/* set up our GLUT window---or an offscreen context if
+	 * PROJMAT_HEADLESS=1 */
+	if(!projmat_init_headless())
+	{
+		glutInit(&argc, argv);
+		glutInitWindowSize(512, 512);
+#ifdef __APPLE__
+		glutInitDisplayMode(GLUT_3_2_CORE_PROFILE | GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+#else
+		glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+		glutInitContextVersion(3,2);
+		glutInitContextProfile(GLUT_CORE_PROFILE);
+#endif
+		glutCreateWindow(argv[0]); // set window title to executable name
+	}
+
+	/* Initialize GLEW */
+	glewExperimental = GL_TRUE;
+	GLenum glewError = glewInit();
+	if(glewError != GLEW_OK && !projmat_headless())
+	{
+		fprintf(stderr, "Error initializing GLEW: %s\n", glewGetErrorString(glewError));
+		exit(EXIT_FAILURE);
+	}
+	glGetError();
+
+	projmat_init();
+	program = kuhl_create_program(GLSL_VERT_FILE, GLSL_FRAG_FILE);
+
+	/* Load the model once with each layout. */
+	float bbox[6];
+	kuhl_load_model_interleave(0);
+	kuhl_geometry *separate = kuhl_load_model(modelFilename, NULL, program, bbox);
+	kuhl_load_model_interleave(1);
+	kuhl_geometry *interleaved = kuhl_load_model(modelFilename, NULL, program, bbox);
+	kuhl_load_model_optimize(1);
+	kuhl_geometry *optimized = kuhl_load_model(modelFilename, NULL, program, bbox);
+	kuhl_load_model_optimize(0);
+	kuhl_load_model_merge(1);
+	kuhl_geometry *merged = kuhl_load_model(modelFilename, NULL, program, bbox);
+	kuhl_load_model_merge(0);
+	if(separate == NULL || interleaved == NULL || optimized == NULL || merged == NULL)
+		exit(EXIT_FAILURE);
+	if(merged->merged == NULL)
+		printf("The meshes could not be merged; the merged layout draws each mesh individually.\n");
+
+	/* Fit the model into the view so that rasterizing it (with -r)
+	 * is a reasonable amount of work. */
+	float fitMatrix[16], view[16], modelview[16], proj[16];
+	kuhl_bbox_fit(fitMatrix, bbox, 1);
+	mat4f_lookat_new(view, 0, 0, 2, 0, 0, 0, 0, 1, 0);
+	mat4f_mult_mat4f_new(modelview, view, fitMatrix);
+	mat4f_perspective_new(proj, 65, 1, .1, 10);
+	glUseProgram(program);
+	glUniformMatrix4fv(kuhl_get_uniform("ModelView"), 1, 0, modelview);
+	glUniformMatrix4fv(kuhl_get_uniform("Projection"), 1, 0, proj);
+	glUniform1i(kuhl_get_uniform("renderStyle"), 2);
+
+	glEnable(GL_DEPTH_TEST);
+	if(!rasterize)
+		glEnable(GL_RASTERIZER_DISCARD);
+
+	int buffers;
+	long indices;
+	count_geometry(interleaved, &buffers, &indices);
+	printf("%s: %u meshes, %ld indices; %d draws per frame, %d frames, %s\n",
+	       modelFilename, kuhl_geometry_count(interleaved), indices, draws, frames,
+	       rasterize ? "rasterized" : "rasterizer discard");
+	printf("%-12s | %7s | %7s | %9s | %9s | %10s | %s\n", "layout", "buffers", "calls", "frame p50", "frame p95", "submit p50", "Mverts/sec");
+	printf("%-12s | %7s | %7s | %9s | %9s | %10s |\n", "", "", "/frame", "(ms)", "(ms)", "(ms)");
+
+	/* Run each layout twice, alternating, so that clocks ramping up
+	 * don't favor whichever layout is measured last. */
+	for(int i=0; i<2; i++)
+	{
+		bench("separate", separate, draws, frames);
+		bench("interleaved", interleaved, draws, frames);
+		bench("optimized", optimized, draws, frames);
+		bench("merged", merged, draws, frames);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,203 @@
+/* Copyright (c) 2015 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   dsight-fake simulates the orientation sensor in the Sensics dSight
+   HMD (see hmd-dsight-orient.c) using a pseudo-terminal. Every
+   request for an orientation is answered after a configurable delay
+   with an orientation that slowly turns around the vertical axis.
+
+   By default, it prints the name of the pseudo-terminal and answers
+   requests until it is killed. Run a program with
+   VIEWMAT_MODE=dsight and VIEWMAT_DSIGHT_FILE set to that name.
+
+   With -b, it measures how long updateHmdControl() takes on the
+   calling (rendering) thread when the sensor is read directly and
+   when it is read by the reader thread.
+
+   @author Scott Kuhl
+ */
+
+#define _XOPEN_SOURCE 600 // posix_openpt()
+#define _DEFAULT_SOURCE    // cfmakeraw()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <pthread.h>
+
+#include "kuhl-nodep.h"
+#include "hmd-dsight-orient.h"
+#include "rolling-stats.h"
+#include "msg.h"
+
+static int latency = 2000; /**< Microseconds to wait before replying to a request */
+static int masterFd = -1;  /**< Our side of the pseudo-terminal */
+
+/** Creates a pseudo-terminal that behaves like a raw serial device.
+
+    @return The name of the device that programs should open.
+*/
+static const char* fake_open()
+{
+	masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if(masterFd < 0 || grantpt(masterFd) != 0 || unlockpt(masterFd) != 0)
+	{
+		msg(FATAL, "Unable to create a pseudo-terminal: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	const char *name = ptsname(masterFd);
+
+	/* Turn off line editing, echo, etc. so bytes pass through
+	 * unchanged. We keep this descriptor open so that the settings
+	 * stay in place while programs open and close the device. */
+	int slaveFd = open(name, O_RDWR | O_NOCTTY);
+	struct termios tio;
+	if(slaveFd < 0 || tcgetattr(slaveFd, &tio) != 0)
+	{
+		msg(FATAL, "Unable to configure %s: %s\n", name, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slaveFd, TCSANOW, &tio);
+	return name;
+}
+
+/** Answers requests for orientations forever. */
+static void* fake_serve(void *unused)
+{
+	unsigned char request[3];
+	size_t have = 0;
+	while(1)
+	{
+		ssize_t result = read(masterFd, request+have, 3-have);
+		if(result <= 0)
+		{
+			if(result < 0 && errno == EINTR)
+				continue;
+			usleep(1000); // nobody has the device open
+			continue;
+		}
+		have += result;
+		if(have < 3)
+			continue;
+		have = 0;
+		if(request[0] != 0xf7 || request[1] != 0x00)
+			continue;
+
+		if(latency > 0)
+			usleep(latency);
+
+		/* Turn around the vertical axis once every 10 seconds. */
+		double angle = kuhl_microseconds() / 1000000.0 * 2*M_PI / 10;
+		float quat[4] = { 0, sin(angle/2), 0, cos(angle/2) };
+
+		/* The sensor sends big-endian floats. */
+		unsigned char reply[16];
+		for(int i=0; i<4; i++)
+		{
+			unsigned char *bytes = (unsigned char*) &quat[i];
+			unsigned short one = 1;
+			int little = *(unsigned char*)&one;
+			for(int j=0; j<4; j++)
+				reply[i*4+j] = little ? bytes[3-j] : bytes[j];
+		}
+		if(write(masterFd, reply, 16) != 16)
+			msg(WARNING, "Unable to write reply: %s\n", strerror(errno));
+	}
+	return NULL;
+}
+
+/** Measures the time that updateHmdControl() takes on this thread. */
+static void bench(const char *device, int useThread, int frames, int fps)
+{
+	HmdControlState state = initHmdControlThreaded(device, useThread);
+	rolling_stats stats;
+	rolling_stats_init(&stats, frames);
+
+	float quat[4];
+	long frameTime = 1000000L / fps;
+	for(int i=0; i<frames+10; i++)
+	{
+		long start = kuhl_microseconds();
+		updateHmdControl(&state, quat);
+		long elapsed = kuhl_microseconds() - start;
+		if(i >= 10) // skip the first few while the thread starts
+			rolling_stats_add(&stats, elapsed);
+
+		/* Pretend to render the rest of the frame. */
+		long remaining = frameTime - (kuhl_microseconds()-start);
+		if(remaining > 0)
+			usleep(remaining);
+	}
+	closeHmdControl(&state);
+
+	float pcts[3] = { .5, .99, 1 };
+	float r[3];
+	rolling_stats_percentiles(&stats, pcts, r, 3);
+	printf("%-20s | %10.1f | %10.1f | %10.1f | %10.1f | %7.1f%%\n",
+	       useThread ? "reader thread" : "render thread", rolling_stats_mean(&stats),
+	       r[0], r[1], r[2], rolling_stats_mean(&stats) * fps / 10000.0);
+	rolling_stats_free(&stats);
+}
+
+int main(int argc, char **argv)
+{
+	int benchmark = 0;
+	int frames = 300;
+	int fps = 60;
+	int opt;
+	while((opt = getopt(argc, argv, "l:bn:f:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'l': latency = atoi(optarg); break;
+			case 'b': benchmark = 1; break;
+			case 'n': frames = atoi(optarg); break;
+			case 'f': fps = atoi(optarg); break;
+			default:
+				printf("Usage: %s [-l microseconds] [-b [-n frames] [-f fps]]\n", argv[0]);
+				printf("  -l microseconds  Delay before replying to each request (default %d)\n", latency);
+				printf("  -b               Measure the time spent reading the sensor instead of serving forever\n");
+				printf("  -n frames        Frames to measure with -b (default %d)\n", frames);
+				printf("  -f fps           Frame rate to simulate with -b (default %d)\n", fps);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if(frames < 1 || fps < 1)
+	{
+		msg(FATAL, "Frames and fps must be positive.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	const char *device = fake_open();
+	if(!benchmark)
+	{
+		printf("Simulating a dSight orientation sensor with %d microseconds of latency.\n", latency);
+		printf("VIEWMAT_MODE=dsight VIEWMAT_DSIGHT_FILE=%s\n", device);
+		fflush(stdout);
+		fake_serve(NULL);
+		return 0;
+	}
+
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, fake_serve, NULL) != 0)
+	{
+		msg(FATAL, "Unable to start thread.\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("Time spent in updateHmdControl() per frame (microseconds), %d frames at %d fps, %d microseconds of sensor latency:\n",
+	       frames, fps, latency);
+	printf("%-20s | %10s | %10s | %10s | %10s | %s\n", "sensor read on", "mean", "p50", "p99", "max", "of frame");
+	bench(device, 0, frames, fps);
+	bench(device, 1, frames, fps);
+	return 0;
+}
@@ -1,6 +1,21 @@
 /* This program simulates a VRPN server to help support debugging and
    testing without access to a tracking system.
-   
+
+   By default, it sends a single object named "Tracker0" that moves
+   back and forth and spins at 100 records per second. It can also
+   send many objects at high rates (-n, -r) or replay a recording
+   made with vrpn_record_start() (-f). Nothing is printed per
+   record; a status line is printed once per second.
+
+   The -c option sends a pattern that vrpn-check uses to make sure
+   that the tracker thread in vrpn-help.cpp never returns a pose that
+   is made of parts of two different records.
+
+   Each record is stamped with the time it is sent. When this program
+   runs on the same computer as a program using viewmat, the
+   VIEWMAT_LATENCY environment variable can be used to measure how
+   old tracking data is when it is drawn (see viewmat.c).
+
    This file is based heavily on a VRPN server tutorial written by
    Sebastian Kuntz for VR Geeks (http://www.vrgeeks.org) in August
    2011.
@@ -9,9 +24,14 @@
 #define OBJECT_NAME "Tracker0"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <unistd.h>
 #include <iostream>
+#include <vector>
+#include <string>
+#include <map>
 
 #include "vrpn_Text.h"
 #include "vrpn_Tracker.h"
@@ -21,101 +41,297 @@
 
 #include "vecmat.h"
 #include "kuhl-util.h"
+#include "tracker-record.h"
 
 
 using namespace std;
 
+/** A tracker that sends whatever pose it is given. */
 class myTracker : public vrpn_Tracker
 {
   public:
-	myTracker( vrpn_Connection *c = 0 );
+	myTracker( const char *name, vrpn_Connection *c = 0 );
 	virtual ~myTracker() {};
 
 	virtual void mainloop();
-
-  protected:
-	struct timeval _timestamp;
-	kuhl_fps_state fps_state;
+	void send(const float position[3], const float quat[4]);
 };
 
-myTracker::myTracker( vrpn_Connection *c ) :
-	vrpn_Tracker( OBJECT_NAME, c )
+myTracker::myTracker( const char *name, vrpn_Connection *c ) :
+	vrpn_Tracker( name, c )
 {
-	kuhl_getfps_init(&fps_state);
 }
 
-
-long lastrecord = 0;
 void myTracker::mainloop()
 {
-	vrpn_gettimeofday(&_timestamp, NULL);
-	vrpn_Tracker::timestamp = _timestamp;
+	server_mainloop();
+}
+
+/** Packs a record with the current time and the given pose. The
+ * record is sent the next time the connection's mainloop() is
+ * called. */
+void myTracker::send(const float position[3], const float quat[4])
+{
+	vrpn_gettimeofday(&(vrpn_Tracker::timestamp), NULL);
+	for(int i=0; i<3; i++)
+		pos[i] = position[i];
+	for(int i=0; i<4; i++)
+		d_quat[i] = quat[i];
 
+	char msgbuf[1000];
+	int len = vrpn_Tracker::encode_to(msgbuf);
+	if (d_connection->pack_message(len, vrpn_Tracker::timestamp, position_m_id, d_sender_id, msgbuf,
+	                               vrpn_CONNECTION_LOW_LATENCY))
+	{
+		fprintf(stderr,"can't write message: tossing\n");
+	}
+}
+
+
+/** A sample loaded from a recording. */
+typedef struct {
+	int tracker; /**< Index into 'trackers' */
+	long time;   /**< Microseconds since the first sample in the file */
+	float pos[3];
+	float quat[4];
+} replay_sample;
+
+static vrpn_Connection_IP *connection = NULL;
+static vector<myTracker*> trackers;
+static vector<replay_sample> replay;
+
+/** Records sent since the last status line. */
+static long status_records = 0;
+/** Number of times we were so far behind schedule that we skipped ahead. */
+static long status_late = 0;
+static long status_time = 0;
+
+/** Prints a status line once per second. */
+static void status_update()
+{
+	long now = kuhl_microseconds();
+	if(status_time == 0)
+		status_time = now;
+	if(now - status_time < 1000000)
+		return;
+	printf("%.1f records/sec from %d object(s)", status_records*1000000.0/(now-status_time), (int)trackers.size());
+	if(status_late)
+		printf(", fell behind %ld time(s)", status_late);
 	printf("\n");
-	printf("Records sent per second: %.1f\n", kuhl_getfps(&fps_state));
+	fflush(stdout);
+	status_records = 0;
+	status_late = 0;
+	status_time = now;
+}
+
+/** Services the connection until 'time' (in microseconds, see
+ * kuhl_microseconds()). Sleeps when there is enough time to do so
+ * and spins otherwise so that rates in the kHz range can be kept
+ * up. */
+static void wait_until(long time)
+{
+	while(1)
+	{
+		for(size_t i=0; i<trackers.size(); i++)
+			trackers[i]->mainloop();
+		connection->mainloop();
+		long remaining = time - kuhl_microseconds();
+		if(remaining <= 0)
+			return;
+		if(remaining > 200)
+			usleep(remaining - 100);
+	}
+}
 
-	double angle = kuhl_milliseconds_start() / 1000.0;
+/** Loads a recording made with vrpn_record_start() and creates one
+ * tracker for each object in the file. The objects are named
+ * without the \@hostname part of the recorded name. */
+static void replay_load(const char *filename)
+{
+	FILE *f = tracker_record_open(filename);
+	if(f == NULL)
+		exit(EXIT_FAILURE);
 
-	// Position
-	pos[0] = sin( angle );
-	pos[1] = 1.55f; // approx normal eyeheight
-	pos[2] = 0.0f;
+	map<int,int> objectToTracker;
+	tracker_record rec;
+	long firstTime = -1;
+	while(tracker_record_read(f, &rec))
+	{
+		if(rec.type == TRACKER_RECORD_NAME)
+		{
+			char *at = strchr(rec.name, '@');
+			if(at)
+				*at = '\0';
+			printf("Replaying object: %s\n", rec.name);
+			objectToTracker[rec.object] = trackers.size();
+			trackers.push_back(new myTracker(rec.name, connection));
+		}
+		else if(rec.type == TRACKER_RECORD_SAMPLE)
+		{
+			if(objectToTracker.count(rec.object) == 0)
+				continue;
+			if(firstTime < 0)
+				firstTime = rec.sample.time;
+			replay_sample s;
+			s.tracker = objectToTracker[rec.object];
+			s.time = rec.sample.time - firstTime;
+			memcpy(s.pos, rec.sample.pos, sizeof(float)*3);
+			memcpy(s.quat, rec.sample.quat, sizeof(float)*4);
+			replay.push_back(s);
+		}
+	}
+	fclose(f);
 
-#if 0
-	double r[10]; // generate some random numbers to simulate imperfect tracking system.
-	for(int i=0; i<10; i++)
+	if(replay.size() == 0)
 	{
-		r[i] = 0;
-		r[i] = kuhl_gauss(); // generate some random numbers
+		fprintf(stderr, "%s does not contain any samples.\n", filename);
+		exit(EXIT_FAILURE);
 	}
-	
-	// Add random noise to position
-	pos[0] += r[0] * .10;
-	pos[1] += r[1] * .01;
-	pos[2] += r[2] * .01;
-#endif
-	printf("Pos = %f %f %f\n", pos[0], pos[1], pos[2]);
-
-	// Orientation
-	float rotMat[9];
-	// mat3f_rotateEuler_new(rotMat, 0, 0, 0, "XYZ");  // no rotation
-	mat3f_rotateEuler_new(rotMat, 0, angle*10, 0, "XYZ"); // yaw
-	//mat3f_rotateEuler_new(rotMat, r[3]*.05, angle*10 + r[4]*.05, r[5]*.05, "XYZ"); // yaw + noise
-	mat3f_print(rotMat);
-
-	// Convert rotation matrix into quaternion
-	float quat[4];
-	quatf_from_mat3f(quat, rotMat);
-	for(int i=0; i<4; i++)
-		d_quat[i] = quat[i];
+	printf("Loaded %lu samples spanning %.1f seconds.\n", (unsigned long) replay.size(),
+	       replay.back().time/1000000.0);
+}
 
+/** Sends the samples in 'replay' with the same timing that they
+ * were recorded with. */
+static void replay_run(int loop)
+{
+	do
+	{
+		long start = kuhl_microseconds();
+		for(size_t i=0; i<replay.size(); i++)
+		{
+			replay_sample *s = &(replay[i]);
+			long due = start + s->time;
+			if(kuhl_microseconds() - due > 100000)
+			{
+				/* More than 100ms behind. Restart the clock instead of
+				 * sending a burst of old records. */
+				start = kuhl_microseconds() - s->time;
+				status_late++;
+			}
+			else
+				wait_until(due);
+			trackers[s->tracker]->send(s->pos, s->quat);
+			status_records++;
+			status_update();
+		}
+		wait_until(kuhl_microseconds());
+	} while(loop);
+}
 
-	char msgbuf[1000];
-	int len = vrpn_Tracker::encode_to(msgbuf);
+/** Sends 'count' objects that move back and forth and spin. Each
+ * object sends 'rate' records per second. If 'check' is set, the
+ * records follow a pattern that vrpn-check can verify instead: the
+ * x, y and z coordinates of the position are always equal and the
+ * object is rotated around the Y axis by 36 degrees times that
+ * value. */
+static void synthesize_run(int count, double rate, int check)
+{
+	for(int i=0; i<count; i++)
+	{
+		char name[1024];
+		if(count == 1)
+			snprintf(name, 1024, "%s", OBJECT_NAME);
+		else
+			snprintf(name, 1024, "Tracker%d", i);
+		trackers.push_back(new myTracker(name, connection));
+	}
+	printf("Sending %d object(s) named %s%s at %.1f records/sec each.\n", count,
+	       count == 1 ? OBJECT_NAME : "Tracker0...Tracker", count == 1 ? "" : "N", rate);
 
-	printf("Microseconds since last record: %ld\n", kuhl_microseconds()-lastrecord);
-	lastrecord = kuhl_microseconds();
-	if (d_connection->pack_message(len, _timestamp, position_m_id, d_sender_id, msgbuf,
-	                               vrpn_CONNECTION_LOW_LATENCY))
+	double period = 1000000.0 / rate;
+	long start = kuhl_microseconds();
+	long tick = 0;
+	while(true)
 	{
-		fprintf(stderr,"can't write message: tossing\n");
+		long due = start + (long)(tick*period);
+		if(kuhl_microseconds() - due > 100000)
+		{
+			start = kuhl_microseconds() - (long)(tick*period);
+			status_late++;
+		}
+		else
+			wait_until(due);
+		tick++;
+
+		double angle = kuhl_milliseconds_start() / 1000.0;
+		for(int i=0; i<count; i++)
+		{
+			if(check)
+			{
+				float step = (tick % 1000) / 100.0f;
+				float pos[3] = { step, step, step };
+				float rotMat[9], quat[4];
+				mat3f_rotateEuler_new(rotMat, 0, step*36, 0, "XYZ");
+				quatf_from_mat3f(quat, rotMat);
+				trackers[i]->send(pos, quat);
+				continue;
+			}
+
+			// Position
+			float pos[3];
+			pos[0] = sin( angle + i*.1 );
+			pos[1] = 1.55f; // approx normal eyeheight
+			pos[2] = i*.1;
+
+			// Orientation
+			float rotMat[9];
+			mat3f_rotateEuler_new(rotMat, 0, angle*10 + i, 0, "XYZ"); // yaw
+
+			// Convert rotation matrix into quaternion
+			float quat[4];
+			quatf_from_mat3f(quat, rotMat);
+			trackers[i]->send(pos, quat);
+		}
+		status_records += count;
+		status_update();
 	}
+}
 
-	server_mainloop();
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n objects] [-r rate] [-c] [-f recording [-l]]\n", name);
+	printf("  -n objects   Number of objects to send (default 1)\n");
+	printf("  -r rate      Records per second for each object (default 100)\n");
+	printf("  -c           Send the pattern that vrpn-check expects\n");
+	printf("  -f file      Replay a file recorded with VRPN_RECORD / vrpn_record_start()\n");
+	printf("  -l           Replay the file in a loop\n");
+	exit(EXIT_FAILURE);
 }
 
 int main(int argc, char* argv[])
 {
-	vrpn_Connection_IP* m_Connection = new vrpn_Connection_IP();
-	myTracker* serverTracker = new myTracker(m_Connection);
+	int count = 1;
+	double rate = 100;
+	const char *replayFile = NULL;
+	int loop = 0;
+	int check = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "n:r:cf:lh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n': count = atoi(optarg); break;
+			case 'r': rate = atof(optarg); break;
+			case 'c': check = 1; break;
+			case 'f': replayFile = optarg; break;
+			case 'l': loop = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+	if(count < 1 || rate <= 0)
+		usage(argv[0]);
 
+	connection = new vrpn_Connection_IP();
 	cout << "Starting VRPN server." << endl;
 
-	while(true)
+	if(replayFile)
 	{
-		serverTracker->mainloop();
-		m_Connection->mainloop();
-
-		kuhl_limitfps(100);
+		replay_load(replayFile);
+		replay_run(loop);
 	}
+	else
+		synthesize_run(count, rate, check);
+
+	return 0;
 }
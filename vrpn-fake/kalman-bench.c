@@ -0,0 +1,251 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   kalman-bench compares the scalar kalman filter (kalman_state) with
+   the kalman filter bank (kalman_bank) in kalman.c.
+
+   First, it filters the same noisy signals with both implementations
+   and reports how much the results differ from each other and from
+   the noise-free signal. Then, it reports how many samples per second
+   each implementation can filter for several numbers of channels.
+
+   @author Scott Kuhl
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "kuhl-nodep.h"
+#include "kalman.h"
+#include "msg.h"
+
+/** Channels per tracked object. Channels for the same object share
+ * a timestamp. */
+#define CHANNELS_PER_OBJECT 3
+
+/** Noisy samples for 'channels' channels over 'steps' time steps. */
+typedef struct {
+	int channels;
+	int steps;
+	float *truth;    /**< Noise-free values, indexed by step*channels+channel */
+	float *measured; /**< truth plus noise */
+	long *times;     /**< Time of each sample in microseconds */
+} signals;
+
+/** Creates signals that resemble tracked objects at 'rate' Hz. Each
+ * object is sampled at slightly irregular times (like records
+ * arriving from a tracking system) and objects are not sampled at
+ * the same time as each other. */
+static void signals_create(signals *s, int channels, int steps, int rate, float sigma)
+{
+	s->channels = channels;
+	s->steps = steps;
+	s->truth = malloc(sizeof(float)*channels*steps);
+	s->measured = malloc(sizeof(float)*channels*steps);
+	s->times = malloc(sizeof(long)*channels*steps);
+	if(s->truth == NULL || s->measured == NULL || s->times == NULL)
+	{
+		msg(FATAL, "Unable to allocate samples for %d channels and %d steps\n", channels, steps);
+		exit(EXIT_FAILURE);
+	}
+
+	srand(1);
+	long period = 1000000L / rate;
+	for(int c=0; c<channels; c++)
+	{
+		float amplitude = .2 + .8*rand()/(float)RAND_MAX;
+		float freq = .2 + 2.0*rand()/(float)RAND_MAX;
+		float phase = 6.28*rand()/(float)RAND_MAX;
+		long offset = (c/CHANNELS_PER_OBJECT) * 997 % period;
+		for(int i=0; i<steps; i++)
+		{
+			int index = i*channels+c;
+			long time;
+			if(c % CHANNELS_PER_OBJECT == 0)
+				time = 1000000L + offset + i*period + (long)(period*.1*kuhl_gauss());
+			else
+				time = s->times[index - c % CHANNELS_PER_OBJECT];
+			/* Keep times increasing */
+			if(i > 0 && time <= s->times[index-channels])
+				time = s->times[index-channels] + 1;
+			s->times[index] = time;
+
+			double t = time / 1000000.0;
+			s->truth[index] = amplitude*sin(freq*t + phase) + .1*amplitude*sin(4.7*freq*t);
+			s->measured[index] = s->truth[index] + sigma*kuhl_gauss();
+		}
+	}
+}
+
+static void signals_free(signals *s)
+{
+	free(s->truth);
+	free(s->measured);
+	free(s->times);
+}
+
+/** Compares the two implementations on the same signals. */
+static void accuracy(int channels, int steps, float sigma, float qScale)
+{
+	signals s;
+	signals_create(&s, channels, steps, 120, sigma);
+
+	kalman_state *scalar = malloc(sizeof(kalman_state)*channels);
+	for(int c=0; c<channels; c++)
+	{
+		kalman_initialize(&scalar[c], sigma, qScale);
+		/* Make the first measurement restart the filter the same
+		 * way that kalman_bank does. */
+		scalar[c].time_prev = s.times[c];
+	}
+	kalman_bank bank;
+	kalman_bank_init(&bank, channels, sigma, qScale);
+
+	float *filtered = malloc(sizeof(float)*channels);
+	float *predicted = malloc(sizeof(float)*channels);
+	double errRaw = 0, errScalar = 0, errBank = 0;
+	double maxDiff = 0, maxPredictDiff = 0;
+	long count = 0;
+	const long ahead = 30000; // microseconds
+	for(int i=0; i<steps; i++)
+	{
+		const float *measured = s.measured + i*channels;
+		const long *times = s.times + i*channels;
+		kalman_bank_estimate(&bank, measured, times, filtered);
+
+		for(int c=0; c<channels; c++)
+		{
+			float scalarFiltered = kalman_estimate_time(&scalar[c], measured[c], times[c]);
+			float diff = fabsf(scalarFiltered - filtered[c]);
+			if(diff > maxDiff)
+				maxDiff = diff;
+
+			/* Skip the time when the filter is settling */
+			if(i < 60)
+				continue;
+			float truth = s.truth[i*channels+c];
+			errRaw += (measured[c]-truth)*(measured[c]-truth);
+			errScalar += (scalarFiltered-truth)*(scalarFiltered-truth);
+			errBank += (filtered[c]-truth)*(filtered[c]-truth);
+			count++;
+		}
+
+		/* Compare predictions a little after the newest sample */
+		long t = times[0] + ahead;
+		kalman_bank_predict(&bank, t, predicted);
+		for(int c=0; c<channels && i >= 60; c++)
+		{
+			float diff = fabsf(kalman_predict(&scalar[c], t) - predicted[c]);
+			if(diff > maxPredictDiff)
+				maxPredictDiff = diff;
+		}
+	}
+
+	printf("Accuracy: %d channels, %d samples each at ~120Hz, sigma=%g, qScale=%g\n", channels, steps, sigma, qScale);
+	printf("  RMS error vs. noise-free signal: measured %.6f, scalar %.6f, bank %.6f\n",
+	       sqrt(errRaw/count), sqrt(errScalar/count), sqrt(errBank/count));
+	printf("  Largest difference between scalar and bank: filtered %.3g, predicted %dms ahead %.3g\n",
+	       maxDiff, (int)(ahead/1000), maxPredictDiff);
+
+	free(filtered);
+	free(predicted);
+	free(scalar);
+	kalman_bank_free(&bank);
+	signals_free(&s);
+}
+
+/** Reports samples per second for each implementation. */
+static void throughput(int channels, long totalSamples, float sigma, float qScale)
+{
+	int steps = totalSamples / channels;
+	if(steps < 10)
+		steps = 10;
+	signals s;
+	signals_create(&s, channels, steps, 120, sigma);
+	float *filtered = malloc(sizeof(float)*channels);
+	float sink = 0;
+
+	/* Scalar filter */
+	kalman_state *scalar = malloc(sizeof(kalman_state)*channels);
+	for(int c=0; c<channels; c++)
+		kalman_initialize(&scalar[c], sigma, qScale);
+	long start = kuhl_microseconds();
+	for(int i=0; i<steps; i++)
+		for(int c=0; c<channels; c++)
+			sink += kalman_estimate_time(&scalar[c], s.measured[i*channels+c], s.times[i*channels+c]);
+	long scalarTime = kuhl_microseconds() - start;
+	free(scalar);
+
+	/* Bank with a timestamp for each channel */
+	kalman_bank bank;
+	kalman_bank_init(&bank, channels, sigma, qScale);
+	start = kuhl_microseconds();
+	for(int i=0; i<steps; i++)
+	{
+		kalman_bank_estimate(&bank, s.measured + i*channels, s.times + i*channels, filtered);
+		sink += filtered[0];
+	}
+	long bankTime = kuhl_microseconds() - start;
+	kalman_bank_free(&bank);
+
+	/* Bank where all channels share a timestamp */
+	kalman_bank_init(&bank, channels, sigma, qScale);
+	start = kuhl_microseconds();
+	for(int i=0; i<steps; i++)
+	{
+		kalman_bank_estimate_time(&bank, s.measured + i*channels, s.times[i*channels], filtered);
+		sink += filtered[0];
+	}
+	long sharedTime = kuhl_microseconds() - start;
+	kalman_bank_free(&bank);
+
+	double samples = (double)steps*channels;
+	printf("%8d | %12.2f | %12.2f | %12.2f | %6.1fx\n", channels,
+	       samples/scalarTime, samples/bankTime, samples/sharedTime,
+	       scalarTime/(double)bankTime);
+	if(sink == 12345) // keep the compiler from skipping the work
+		printf(" ");
+
+	free(filtered);
+	signals_free(&s);
+}
+
+int main(int argc, char **argv)
+{
+	float sigma = 0.002;
+	float qScale = 5;
+	long totalSamples = 3000000;
+	int opt;
+	while((opt = getopt(argc, argv, "s:q:n:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 's': sigma = atof(optarg); break;
+			case 'q': qScale = atof(optarg); break;
+			case 'n': totalSamples = atol(optarg); break;
+			default:
+				printf("Usage: %s [-s sigma] [-q qScale] [-n samples]\n", argv[0]);
+				printf("  -s sigma   Standard deviation of measurement noise (default %g)\n", sigma);
+				printf("  -q qScale  Kalman filter system noise scale (default %g)\n", qScale);
+				printf("  -n samples Samples to filter for each throughput test (default %ld)\n", totalSamples);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	accuracy(30, 6000, sigma, qScale);
+
+	printf("\nThroughput (million samples/second):\n");
+	printf("%8s | %12s | %12s | %12s | %s\n", "channels", "scalar", "bank", "bank shared", "speedup");
+	int channelCounts[] = { 3, 24, 96, 300, 3000 };
+	for(unsigned int i=0; i<sizeof(channelCounts)/sizeof(channelCounts[0]); i++)
+		throughput(channelCounts[i], totalSamples, sigma, qScale);
+	return 0;
+}
@@ -0,0 +1,281 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   predict-eval replays tracker samples through the pose predictor in
+   predict.c and reports how far the predicted pose is from the
+   recorded pose at a range of prediction horizons. The error is
+   compared against simply using the newest sample (which is what
+   happens when no prediction is used).
+
+   Samples are read from a recording made by vrpn-help (see
+   vrpn_record_start()) or from a text file where each line contains:
+   time_in_microseconds x y z qx qy qz qw
+
+   For recordings, only the first object in the file is used. In text
+   files, lines starting with '#' are ignored. If no file is provided,
+   a synthetic recording of someone looking around is used.
+
+   @author Scott Kuhl
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "kuhl-nodep.h"
+#include "vecmat.h"
+#include "predict.h"
+#include "tracker-record.h"
+#include "msg.h"
+
+/** A single tracker sample */
+typedef struct {
+	long time;     /**< Time in microseconds */
+	float pos[3];  /**< Position */
+	float quat[4]; /**< Orientation (x,y,z,w) */
+} sample;
+
+static sample *samples = NULL;
+static int samples_count = 0;
+
+static void samples_add(long time, const float pos[3], const float quat[4])
+{
+	static int capacity = 0;
+	if(samples_count == capacity)
+	{
+		capacity = capacity == 0 ? 1024 : capacity*2;
+		samples = realloc(samples, sizeof(sample)*capacity);
+	}
+	sample *s = &(samples[samples_count++]);
+	s->time = time;
+	vec3f_copy(s->pos, pos);
+	quatf_normalize_new(s->quat, quat);
+}
+
+/** Reads samples for the first object in a recording made by
+ * vrpn_record_start(). */
+static void samples_read_recording(const char *filename)
+{
+	FILE *f = tracker_record_open(filename);
+	if(f == NULL)
+		exit(EXIT_FAILURE);
+	tracker_record rec;
+	int object = -1;
+	while(tracker_record_read(f, &rec))
+	{
+		if(rec.type == TRACKER_RECORD_NAME && object < 0)
+		{
+			object = rec.object;
+			printf("Using samples for %s\n", rec.name);
+		}
+		else if(rec.type == TRACKER_RECORD_SAMPLE && rec.object == object)
+			samples_add(rec.sample.time, rec.sample.pos, rec.sample.quat);
+	}
+	fclose(f);
+}
+
+static void samples_read(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if(f == NULL)
+	{
+		msg(FATAL, "Unable to open %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	char magic[8];
+	if(fread(magic, 8, 1, f) == 1 && memcmp(magic, TRACKER_RECORD_MAGIC, 8) == 0)
+	{
+		fclose(f);
+		samples_read_recording(filename);
+		return;
+	}
+	rewind(f);
+	char line[1024];
+	while(fgets(line, 1024, f) != NULL)
+	{
+		if(line[0] == '#')
+			continue;
+		long time;
+		float pos[3], quat[4];
+		if(sscanf(line, "%ld %f %f %f %f %f %f %f", &time, &pos[0], &pos[1], &pos[2],
+		          &quat[0], &quat[1], &quat[2], &quat[3]) == 8)
+			samples_add(time, pos, quat);
+	}
+	fclose(f);
+}
+
+/** Creates a recording of someone standing in one place, swaying a
+ * little, and looking left/right and up/down. */
+static void samples_synthesize(int rate, int seconds)
+{
+	srand(1);
+	for(int i=0; i<rate*seconds; i++)
+	{
+		long time = 1000000L + (long)i*1000000L/rate;
+		double t = i/(double)rate;
+		float pos[3] = { .05*sin(t*1.3) + .0005*kuhl_gauss(),
+		                 1.55 + .02*sin(t*2.1) + .0005*kuhl_gauss(),
+		                 .04*sin(t*0.7) + .0005*kuhl_gauss() };
+		float yaw   = 60*sin(t*2.0) + 20*sin(t*5.3);
+		float pitch = 20*sin(t*1.1);
+		float rotMat[9];
+		mat3f_rotateEuler_new(rotMat, pitch + .05*kuhl_gauss(), yaw + .05*kuhl_gauss(), 0, "XYZ");
+		float quat[4];
+		quatf_from_mat3f(quat, rotMat);
+		samples_add(time, pos, quat);
+	}
+}
+
+/** Gets the recorded pose at 'time' by interpolating between the
+ * samples on either side of it. 'index' is used to speed up the
+ * search and should initially be 0.
+ *
+ * @return 1 if 'time' is within the recording, 0 otherwise.
+ */
+static int samples_interpolate(long time, int *index, float pos[3], float quat[4])
+{
+	while(*index+1 < samples_count && samples[*index+1].time < time)
+		(*index)++;
+	if(*index+1 >= samples_count || samples[*index].time > time)
+		return 0;
+	sample *a = &(samples[*index]);
+	sample *b = &(samples[*index+1]);
+	float t = (time - a->time) / (float)(b->time - a->time);
+	for(int i=0; i<3; i++)
+		pos[i] = a->pos[i] + t*(b->pos[i]-a->pos[i]);
+	quatf_slerp_new(quat, a->quat, b->quat, t);
+	return 1;
+}
+
+/** Angle in degrees between two orientations. */
+static float quat_angle(const float a[4], const float b[4])
+{
+	float dot = fabsf(vec4f_dot(a, b));
+	if(dot > 1)
+		dot = 1;
+	return 2*acosf(dot) * 180/M_PI;
+}
+
+static int compare_float(const void *a, const void *b)
+{
+	float x = *(const float*)a;
+	float y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+/** Sorts an array and returns a percentile from it. */
+static float percentile(float *values, int count, float pct)
+{
+	if(count == 0)
+		return 0;
+	qsort(values, count, sizeof(float), compare_float);
+	return values[(int)(pct*(count-1))];
+}
+
+static float mean(const float *values, int count)
+{
+	double sum = 0;
+	for(int i=0; i<count; i++)
+		sum += values[i];
+	return count > 0 ? sum/count : 0;
+}
+
+int main(int argc, char **argv)
+{
+	float sigma = 0.002;
+	float qScale = 5;
+	int opt;
+	while((opt = getopt(argc, argv, "s:q:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 's': sigma = atof(optarg); break;
+			case 'q': qScale = atof(optarg); break;
+			default:
+				printf("Usage: %s [-s sigma] [-q qScale] [recording]\n", argv[0]);
+				printf("  -s sigma   Standard deviation of position noise in meters (default %g)\n", sigma);
+				printf("  -q qScale  Kalman filter system noise scale (default %g)\n", qScale);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if(optind < argc)
+		samples_read(argv[optind]);
+	else
+	{
+		printf("No file provided, using a synthetic 120Hz recording.\n");
+		samples_synthesize(120, 30);
+	}
+	if(samples_count < 2)
+	{
+		msg(FATAL, "Need at least two samples.\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("%d samples over %.1f seconds (%.1f samples/sec)\n", samples_count,
+	       (samples[samples_count-1].time - samples[0].time)/1000000.0,
+	       (samples_count-1)*1000000.0/(samples[samples_count-1].time - samples[0].time));
+
+	int horizons[] = { 0, 8, 16, 25, 33, 50, 75, 100 }; // milliseconds
+	int numHorizons = sizeof(horizons)/sizeof(horizons[0]);
+
+	printf("\n%-8s | %-35s | %-35s\n", "", "position error (mm) mean / p95", "orientation error (deg) mean / p95");
+	printf("%-8s | %-17s %-17s | %-17s %-17s\n", "ahead", "newest sample", "predicted", "newest sample", "predicted");
+
+	float *posNone = malloc(sizeof(float)*samples_count);
+	float *posPred = malloc(sizeof(float)*samples_count);
+	float *angNone = malloc(sizeof(float)*samples_count);
+	float *angPred = malloc(sizeof(float)*samples_count);
+
+	for(int h=0; h<numHorizons; h++)
+	{
+		long ahead = horizons[h]*1000L;
+		predict_state state;
+		predict_init(&state, sigma, qScale);
+		int index = 0;
+		int count = 0;
+		for(int i=0; i<samples_count; i++)
+		{
+			sample *s = &(samples[i]);
+			predict_update(&state, s->pos, s->quat, s->time);
+			/* Let the filter settle before measuring error. */
+			if(i < 30)
+				continue;
+
+			float truePos[3], trueQuat[4];
+			if(!samples_interpolate(s->time + ahead, &index, truePos, trueQuat))
+				break;
+
+			float predPos[3], predQuat[4];
+			predict_get(&state, s->time + ahead, predPos, predQuat);
+
+			float diff[3];
+			vec3f_sub_new(diff, truePos, s->pos);
+			posNone[count] = vec3f_norm(diff)*1000;
+			vec3f_sub_new(diff, truePos, predPos);
+			posPred[count] = vec3f_norm(diff)*1000;
+			angNone[count] = quat_angle(trueQuat, s->quat);
+			angPred[count] = quat_angle(trueQuat, predQuat);
+			count++;
+		}
+
+		printf("%5d ms | %7.2f / %7.2f %7.2f / %7.2f | %7.2f / %7.2f %7.2f / %7.2f\n", horizons[h],
+		       mean(posNone, count), percentile(posNone, count, .95),
+		       mean(posPred, count), percentile(posPred, count, .95),
+		       mean(angNone, count), percentile(angNone, count, .95),
+		       mean(angPred, count), percentile(angPred, count, .95));
+	}
+
+	free(posNone);
+	free(posPred);
+	free(angNone);
+	free(angPred);
+	free(samples);
+	return 0;
+}
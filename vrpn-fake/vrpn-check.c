@@ -0,0 +1,202 @@
+/* Copyright (c) 2014 Scott Kuhl. All rights reserved.
+ * License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   vrpn-check makes sure that the tracker thread in vrpn-help.cpp
+   delivers poses to vrpn_get_handle() correctly. It starts fake
+   (which must be in the same directory as vrpn-check) with the -c
+   option on this computer and then acts like a program that renders
+   frames: it sleeps for a little while and then gets the newest pose
+   of Tracker0, over and over. It checks that:
+
+   - No pose is made of parts of two different records (fake -c
+     sends records where the position and orientation always agree).
+
+   - The records were received by the tracker thread while we were
+     sleeping instead of when vrpn_get_handle() was called.
+
+   - Each pose is newer than the previous one and is only about as
+     old as the time between two records.
+
+   The program prints a summary and exits with EXIT_SUCCESS if every
+   check passed. No display or OpenGL context is needed.
+
+   @author Scott Kuhl
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "kuhl-nodep.h"
+#include "vrpn-help.h"
+#include "msg.h"
+
+/** Checks if a pose from fake -c is made of parts of two different
+ * records. fake -c sets x, y and z to the same value and rotates
+ * around Y by 36 degrees per unit. The trace of a rotation matrix
+ * is 1+2cos(angle) regardless of the axis direction.
+ *
+ * @return 1 if the pose doesn't follow the pattern, 0 otherwise.
+ */
+static int pose_is_torn(const float pos[3], const float orient[16])
+{
+	if(pos[0] != pos[1] || pos[0] != pos[2])
+		return 1;
+	float expect = 1 + 2*cosf(pos[0]*36 * M_PI/180);
+	float trace = orient[0] + orient[5] + orient[10];
+	return fabsf(trace - expect) > 1e-3f;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-r rate] [-s seconds]\n", name);
+	printf("  -r rate      Records per second that fake sends (default 1000)\n");
+	printf("  -s seconds   How long to check for (default 5)\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	double rate = 1000;
+	int seconds = 5;
+	int opt;
+	while((opt = getopt(argc, argv, "r:s:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'r': rate = atof(optarg); break;
+			case 's': seconds = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if(rate <= 0 || seconds < 1)
+		usage(argv[0]);
+
+	char fakePath[1024];
+	char *progCopy = strdup(argv[0]);
+	snprintf(fakePath, 1024, "%s/fake", dirname(progCopy));
+	free(progCopy);
+	if(access(fakePath, X_OK) != 0)
+	{
+		msg(FATAL, "Unable to run %s. fake is needed to send records to check.\n", fakePath);
+		exit(EXIT_FAILURE);
+	}
+
+	pid_t fake = fork();
+	if(fake == 0)
+	{
+		char rateStr[32];
+		snprintf(rateStr, 32, "%f", rate);
+		char *fakeArgs[] = { fakePath, "-c", "-r", rateStr, NULL };
+		/* Keep fake quiet so it doesn't clutter our results. */
+		if(freopen("/dev/null", "w", stdout) == NULL)
+			msg(WARNING, "Unable to silence fake.\n");
+		execv(fakePath, fakeArgs);
+		/* stdout was discarded, so report the error on stderr. */
+		fprintf(stderr, "vrpn-check: Unable to run %s.\n", fakePath);
+		exit(EXIT_FAILURE);
+	}
+	/* Give fake time to start listening. */
+	usleep(500000);
+
+	int handle = vrpn_open("Tracker0", "localhost");
+	if(handle < 0)
+	{
+		kill(fake, SIGTERM);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Wait for the first record. */
+	float pos[3], orient[16];
+	long waitStart = kuhl_microseconds();
+	while(vrpn_get_handle(handle, pos, orient) == 0)
+	{
+		if(kuhl_microseconds() - waitStart > 2000000)
+		{
+			msg(FATAL, "Didn't receive any records from fake.\n");
+			kill(fake, SIGTERM);
+			exit(EXIT_FAILURE);
+		}
+		usleep(1000);
+	}
+
+	/* Sleep for two records between reads so that every read should
+	 * find a new record that the tracker thread received while we
+	 * were sleeping. */
+	long period = (long) (1000000 / rate);
+	long reads = 0, missing = 0, torn = 0, newer = 0, backwards = 0, fromThread = 0;
+	long ageSum = 0, ageMax = 0;
+	long lastTime = 0;
+	long end = kuhl_microseconds() + seconds*1000000L;
+	while(kuhl_microseconds() < end)
+	{
+		usleep(period*2);
+		long before = kuhl_microseconds();
+		int ok = vrpn_get_handle(handle, pos, orient);
+		long time, received;
+		vrpn_get_sample_time(handle, &time, &received);
+
+		reads++;
+		if(ok == 0)
+		{
+			missing++;
+			continue;
+		}
+		if(pose_is_torn(pos, orient))
+			torn++;
+		if(time > lastTime)
+			newer++;
+		else if(time < lastTime)
+			backwards++;
+		lastTime = time;
+		if(received < before)
+			fromThread++;
+
+		long age = before - time;
+		ageSum += age;
+		if(age > ageMax)
+			ageMax = age;
+	}
+	kill(fake, SIGTERM);
+	waitpid(fake, NULL, 0);
+
+	long good = reads - missing;
+	double ageMean = good > 0 ? ageSum / (double) good : 0;
+	printf("vrpn-check: %ld reads at %.1f records/sec for %d sec\n", reads, rate, seconds);
+	printf("  missing poses:          %ld\n", missing);
+	printf("  torn poses:             %ld\n", torn);
+	printf("  newer than last read:   %.1f%%\n", good > 0 ? 100.0*newer/good : 0);
+	printf("  older than last read:   %ld\n", backwards);
+	printf("  received by the thread: %.1f%%\n", good > 0 ? 100.0*fromThread/good : 0);
+	printf("  age (mean/max):         %.2f/%.2f ms\n", ageMean/1000, ageMax/1000.0);
+
+	/* The tracker thread polls every 500 microseconds, so a pose
+	 * should be about one record old. Allow for the scheduler waking
+	 * us up late now and then. */
+	int failed = 0;
+	if(missing > 0 || torn > 0 || backwards > 0)
+		failed = 1;
+	if(good == 0 || newer < good*.9 || fromThread < good*.9)
+		failed = 1;
+	if(ageMean > period + 5000)
+		failed = 1;
+
+	if(failed)
+	{
+		msg(ERROR, "vrpn-check failed.\n");
+		return EXIT_FAILURE;
+	}
+	printf("vrpn-check: passed\n");
+	return EXIT_SUCCESS;
+}